@@ -0,0 +1,244 @@
+#include "adaptive_threshold.h"
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NBIP_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NBIP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NBIP_TARGET(isa)
+#endif
+
+namespace {
+
+// Interleaved columns per task of the vertical accumulation
+const int kStripeColumns = 1024;
+
+// Rows per task of the threshold pass
+const int kBandRows = 16;
+
+// Sauvola's dynamic range of the standard deviation for 8-bit images
+const float kSauvolaRange = 128.0f;
+
+// Window geometry of one output row in table coordinates
+struct WindowRows {
+    const uint32_t* top;     // table row above the window
+    const uint32_t* bottom;  // table row at the bottom edge of the window
+    int left;                // table column left of the window for x = 0
+    int width;               // window width (table columns from left to right edge)
+};
+
+WindowRows MakeWindowRows(const cv::Mat& table, int pad, int radius, int y) {
+    WindowRows w;
+    w.top = reinterpret_cast<const uint32_t*>(table.ptr<int>(y + pad - radius));
+    w.bottom = reinterpret_cast<const uint32_t*>(table.ptr<int>(y + pad + radius + 1));
+    w.left = pad - radius;
+    w.width = 2 * radius + 1;
+    return w;
+}
+
+inline uint32_t WindowSum(const WindowRows& w, int x) {
+    int a = x + w.left, b = a + w.width;
+    return w.bottom[b] - w.top[b] - w.bottom[a] + w.top[a];
+}
+
+// cv::adaptiveThreshold rounds the mean to 8 bits and keeps pixels with
+// src - mean > -ceil(delta). For an integer t, t > round(s / area) holds exactly when
+// t * area > s + area / 2 (area is odd, so there are no ties), which needs no division.
+void MeanRowScalar(const WindowRows& w, const uchar* src, uchar* dst, int x, int width,
+                   int idelta, int area) {
+    const int half = area / 2;
+    for (; x < width; x++) {
+        int sum = (int)WindowSum(w, x);
+        dst[x] = (src[x] + idelta) * area > sum + half ? 255 : 0;
+    }
+}
+
+#ifdef NBIP_X86_SIMD
+
+NBIP_TARGET("avx2")
+int MeanRowAVX2(const WindowRows& w, const uchar* src, uchar* dst, int width, int idelta, int area) {
+    const __m256i vdelta = _mm256_set1_epi32(idelta);
+    const __m256i varea = _mm256_set1_epi32(area);
+    const __m256i vhalf = _mm256_set1_epi32(area / 2);
+    const uint32_t* tl = w.top + w.left;
+    const uint32_t* tr = tl + w.width;
+    const uint32_t* bl = w.bottom + w.left;
+    const uint32_t* br = bl + w.width;
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i result[2];
+        for (int h = 0; h < 2; h++) {
+            int i = x + 8 * h;
+            __m256i sum = _mm256_sub_epi32(
+                _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(br + i)), _mm256_loadu_si256((const __m256i*)(tl + i))),
+                _mm256_add_epi32(_mm256_loadu_si256((const __m256i*)(tr + i)), _mm256_loadu_si256((const __m256i*)(bl + i))));
+            __m256i pixels = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(src + i)));
+            __m256i lhs = _mm256_mullo_epi32(_mm256_add_epi32(pixels, vdelta), varea);
+            result[h] = _mm256_cmpgt_epi32(lhs, _mm256_add_epi32(sum, vhalf));
+        }
+        // All-ones lanes stay -1 through the signed packs, i.e. 255
+        __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(result[0], result[1]), 0xD8);
+        __m128i bytes = _mm_packs_epi16(_mm256_castsi256_si128(words), _mm256_extracti128_si256(words, 1));
+        _mm_storeu_si128((__m128i*)(dst + x), bytes);
+    }
+    return x;
+}
+
+#endif  // NBIP_X86_SIMD
+
+void StatisticRow(const WindowRows& w, const WindowRows& sq, const uchar* src, uchar* dst, int width,
+                  int constant, AdaptiveMode mode, float k) {
+    const int64_t area = (int64_t)w.width * w.width;
+    const float inv_area = 1.0f / (float)area;
+    const float inv_area2 = inv_area * inv_area;
+    for (int x = 0; x < width; x++) {
+        int64_t sum = WindowSum(w, x);
+        int64_t sqsum = WindowSum(sq, x);
+        // area^2 * variance, exact in 64 bits
+        int64_t scaled_var = std::max<int64_t>(0, area * sqsum - sum * sum);
+        float mean = sum * inv_area;
+        float sd = std::sqrt((float)scaled_var * inv_area2);
+        float t = mode == AdaptiveMode::Sauvola ? mean * (1.0f + k * (sd / kSauvolaRange - 1.0f))
+                                                : mean - k * sd;
+        dst[x] = src[x] > t - constant ? 255 : 0;
+    }
+}
+
+// Prefix sums along each padded row; table row i + 1 holds image row clamp(i - pad)
+void BuildRows(const cv::Mat& gray, cv::Mat& table, int pad, bool squared) {
+    const int width = gray.cols;
+    cv::parallel_for_(cv::Range(0, table.rows - 1), [&](const cv::Range& range) {
+        for (int i = range.start; i < range.end; i++) {
+            const uchar* src = gray.ptr<uchar>(std::min(std::max(i - pad, 0), gray.rows - 1));
+            uint32_t* row = reinterpret_cast<uint32_t*>(table.ptr<int>(i + 1));
+            uint32_t left = squared ? (uint32_t)src[0] * src[0] : src[0];
+            uint32_t right = squared ? (uint32_t)src[width - 1] * src[width - 1] : src[width - 1];
+            uint32_t acc = 0;
+            row[0] = 0;
+            int j = 1;
+            for (int x = 0; x < pad; x++)
+                row[j++] = acc += left;
+            if (squared) {
+                for (int x = 0; x < width; x++)
+                    row[j++] = acc += (uint32_t)src[x] * src[x];
+            } else {
+                for (int x = 0; x < width; x++)
+                    row[j++] = acc += src[x];
+            }
+            for (int x = 0; x < pad; x++)
+                row[j++] = acc += right;
+        }
+    });
+}
+
+// Adds every row to the one below, column stripes in parallel
+void AccumulateColumns(cv::Mat& table) {
+    const int stripes = (table.cols + kStripeColumns - 1) / kStripeColumns;
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+        for (int s = range.start; s < range.end; s++) {
+            int x0 = s * kStripeColumns;
+            int n = std::min(kStripeColumns, table.cols - x0);
+            for (int i = 2; i < table.rows; i++) {
+                const uint32_t* above = reinterpret_cast<const uint32_t*>(table.ptr<int>(i - 1)) + x0;
+                uint32_t* row = reinterpret_cast<uint32_t*>(table.ptr<int>(i)) + x0;
+                for (int j = 0; j < n; j++)
+                    row[j] += above[j];
+            }
+        }
+    });
+}
+
+void BuildTable(const cv::Mat& gray, cv::Mat& table, int pad, bool squared) {
+    table.create(gray.rows + 2 * pad + 1, gray.cols + 2 * pad + 1, CV_32S);
+    std::fill(table.ptr<int>(0), table.ptr<int>(0) + table.cols, 0);
+    BuildRows(gray, table, pad, squared);
+    AccumulateColumns(table);
+}
+
+}  // namespace
+
+const char* AdaptiveModeName(AdaptiveMode mode) {
+    switch (mode) {
+    case AdaptiveMode::Gaussian: return "gaussian";
+    case AdaptiveMode::Mean:     return "mean";
+    case AdaptiveMode::Sauvola:  return "sauvola";
+    case AdaptiveMode::Niblack:  return "niblack";
+    default:                     return "unknown";
+    }
+}
+
+bool IntegralImage::Update(const cv::Mat& gray, uint64_t version, int pad, bool squares) {
+    CV_Assert(gray.type() == CV_8UC1);
+    bool current = version != 0 && version == version_ && gray.rows == rows_ && gray.cols == cols_ &&
+                   pad <= pad_ && (!squares || !sqsum_.empty());
+    if (current)
+        return false;
+
+    BuildTable(gray, sum_, pad, false);
+    if (squares)
+        BuildTable(gray, sqsum_, pad, true);
+    else
+        sqsum_.release();
+    pad_ = pad;
+    rows_ = gray.rows;
+    cols_ = gray.cols;
+    version_ = version;
+    builds_++;
+    return true;
+}
+
+void IntegralImage::Clear() {
+    sum_.release();
+    sqsum_.release();
+    pad_ = rows_ = cols_ = 0;
+    version_ = 0;
+}
+
+void AdaptiveThresholdFromIntegral(const IntegralImage& tables, const cv::Mat& gray, cv::Mat& dst,
+                                   int block_size, int constant, AdaptiveMode mode, float k, SimdLevel level) {
+    CV_Assert(gray.type() == CV_8UC1 && mode != AdaptiveMode::Gaussian);
+    const int radius = block_size / 2;
+    CV_Assert(block_size % 2 == 1 && radius <= tables.Pad());
+    CV_Assert(mode == AdaptiveMode::Mean || !tables.SquaredSums().empty());
+
+    dst.create(gray.rows, gray.cols, CV_8UC1);
+    const int area = block_size * block_size;
+    const int pad = tables.Pad();
+    const int bands = (gray.rows + kBandRows - 1) / kBandRows;
+
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        int y_end = std::min(gray.rows, range.end * kBandRows);
+        for (int y = range.start * kBandRows; y < y_end; y++) {
+            WindowRows w = MakeWindowRows(tables.Sums(), pad, radius, y);
+            const uchar* src = gray.ptr<uchar>(y);
+            uchar* out = dst.ptr<uchar>(y);
+            if (mode != AdaptiveMode::Mean) {
+                WindowRows sq = MakeWindowRows(tables.SquaredSums(), pad, radius, y);
+                StatisticRow(w, sq, src, out, gray.cols, constant, mode, k);
+                continue;
+            }
+            int x = 0;
+#ifdef NBIP_X86_SIMD
+            if (level == SimdLevel::AVX2)
+                x = MeanRowAVX2(w, src, out, gray.cols, constant, area);
+#else
+            (void)level;
+#endif
+            MeanRowScalar(w, src, out, x, gray.cols, constant, area);
+        }
+    });
+}
+
+void AdaptiveThresholdIntegral(const cv::Mat& gray, cv::Mat& dst, int block_size, int constant,
+                               AdaptiveMode mode, float k, IntegralImage& tables, uint64_t version) {
+    // Padding for the largest block the GUI offers, so block changes reuse the tables
+    const int pad = std::max(block_size / 2, 49);
+    tables.Update(gray, version, pad, mode != AdaptiveMode::Mean);
+    AdaptiveThresholdFromIntegral(tables, gray, dst, block_size, constant, mode, k);
+}
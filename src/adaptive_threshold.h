@@ -0,0 +1,51 @@
+#pragma once
+
+#include "pointwise.h"
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+
+// Local statistic the adaptive threshold compares each pixel against
+enum class AdaptiveMode {
+    Gaussian,  // cv::adaptiveThreshold with ADAPTIVE_THRESH_GAUSSIAN_C
+    Mean,      // window mean, from a summed-area table
+    Sauvola,   // m * (1 + k * (sd / 128 - 1)), from summed-area tables
+    Niblack    // m - k * sd, from summed-area tables
+};
+
+const char* AdaptiveModeName(AdaptiveMode mode);
+
+// Summed-area tables of an 8-bit gray image with `pad` replicated pixels on every side,
+// so the sum over any window up to 2 * pad + 1 wide costs four lookups. Sums are kept
+// modulo 2^32: every window sum fits, so the wrap-around cancels out.
+class IntegralImage {
+public:
+    // Rebuilds the tables unless they already hold the image of `version` (0 never
+    // matches) with at least `pad` border and, if `squares`, the squared sums. Returns
+    // true if it rebuilt.
+    bool Update(const cv::Mat& gray, uint64_t version, int pad, bool squares);
+    void Clear();
+
+    int Pad() const { return pad_; }
+    const cv::Mat& Sums() const { return sum_; }          // CV_32S, read as uint32
+    const cv::Mat& SquaredSums() const { return sqsum_; }  // empty unless requested
+    uint64_t Builds() const { return builds_; }
+
+private:
+    cv::Mat sum_, sqsum_;
+    int pad_ = 0;
+    int rows_ = 0, cols_ = 0;
+    uint64_t version_ = 0;
+    uint64_t builds_ = 0;
+};
+
+// Threshold pass over tables built for `gray`: a pixel becomes 255 when it is above the
+// local threshold minus `constant`, otherwise 0. Mean matches cv::adaptiveThreshold with
+// ADAPTIVE_THRESH_MEAN_C and THRESH_BINARY bit for bit. Parallel over row bands.
+void AdaptiveThresholdFromIntegral(const IntegralImage& tables, const cv::Mat& gray, cv::Mat& dst,
+                                   int block_size, int constant, AdaptiveMode mode, float k = 0.2f,
+                                   SimdLevel level = BestSimdLevel());
+
+// Updates `tables` for `gray` (reusing them when `version` matches) and thresholds.
+// Mean, Sauvola and Niblack only.
+void AdaptiveThresholdIntegral(const cv::Mat& gray, cv::Mat& dst, int block_size, int constant,
+                               AdaptiveMode mode, float k, IntegralImage& tables, uint64_t version = 0);
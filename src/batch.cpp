@@ -0,0 +1,197 @@
+#include "batch.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <map>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct BatchItem {
+    size_t index = 0;
+    cv::Mat image;
+};
+
+bool WildcardMatch(const char* pattern, const char* text) {
+    if (*pattern == '\0') return *text == '\0';
+    if (*pattern == '*')
+        return WildcardMatch(pattern + 1, text) || (*text && WildcardMatch(pattern, text + 1));
+    if (*text && (*pattern == '?' || *pattern == *text))
+        return WildcardMatch(pattern + 1, text + 1);
+    return false;
+}
+
+std::string Lower(std::string text) {
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return text;
+}
+
+bool HasImageExtension(const fs::path& path) {
+    static const char* extensions[] = {
+        ".png", ".jpg", ".jpeg", ".bmp", ".tif", ".tiff", ".webp", ".pgm", ".ppm", ".pbm", ".jp2"
+    };
+    std::string ext = Lower(path.extension().string());
+    return std::find(std::begin(extensions), std::end(extensions), ext) != std::end(extensions);
+}
+
+int64_t ElapsedNs(Clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+}  // namespace
+
+std::vector<std::string> ExpandInputs(const std::string& pattern) {
+    std::vector<std::string> paths;
+    std::error_code ec;
+    fs::path input(pattern);
+
+    if (fs::is_directory(input, ec)) {
+        for (const fs::directory_entry& entry : fs::directory_iterator(input, ec)) {
+            if (entry.is_regular_file(ec) && HasImageExtension(entry.path()))
+                paths.push_back(entry.path().string());
+        }
+    } else if (pattern.find_first_of("*?") == std::string::npos) {
+        if (fs::is_regular_file(input, ec))
+            paths.push_back(pattern);
+    } else {
+        fs::path dir = input.has_parent_path() ? input.parent_path() : fs::path(".");
+        std::string name_pattern = input.filename().string();
+        for (const fs::directory_entry& entry : fs::directory_iterator(dir, ec)) {
+            if (entry.is_regular_file(ec) &&
+                WildcardMatch(name_pattern.c_str(), entry.path().filename().string().c_str()))
+                paths.push_back(entry.path().string());
+        }
+    }
+
+    std::sort(paths.begin(), paths.end());
+    return paths;
+}
+
+std::string BatchOutputPath(const BatchOptions& options, size_t index) {
+    fs::path input(options.inputs[index]);
+    std::string ext = options.output_ext.empty() ? input.extension().string() : options.output_ext;
+    return (fs::path(options.output_dir) / (input.stem().string() + ext)).string();
+}
+
+BatchReport RunBatch(const BatchOptions& options) {
+    BatchReport report;
+
+    // Results are written as they finish, so a shared name would silently keep one of them
+    std::map<std::string, size_t> outputs;
+    for (size_t i = 0; i < options.inputs.size(); i++) {
+        auto inserted = outputs.emplace(Lower(BatchOutputPath(options, i)), i);
+        if (!inserted.second) {
+            report.error = "'" + options.inputs[inserted.first->second] + "' and '" + options.inputs[i] +
+                           "' would both be written to '" + BatchOutputPath(options, i) + "'";
+            return report;
+        }
+    }
+    const int hardware_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    const int decoders = std::max(1, options.decode_threads);
+    const int processors = options.process_threads > 0 ? options.process_threads : hardware_threads;
+    const int encoders = std::max(1, options.encode_threads);
+
+    BoundedQueue<BatchItem> decoded(options.queue_capacity);
+    BoundedQueue<BatchItem> processed(options.queue_capacity);
+
+    std::atomic<size_t> next_input{0};
+    std::atomic<size_t> written{0};
+    std::atomic<size_t> failed{0};
+    std::atomic<int64_t> decode_ns{0}, process_ns{0}, encode_ns{0};
+    std::atomic<int> decoders_left{decoders};
+    std::atomic<int> processors_left{processors};
+
+    Clock::time_point start = Clock::now();
+    ThreadPool pool(decoders + processors + encoders);
+
+    for (int i = 0; i < decoders; i++) {
+        pool.Submit([&] {
+            for (;;) {
+                size_t index = next_input++;
+                if (index >= options.inputs.size()) break;
+
+                Clock::time_point t0 = Clock::now();
+                cv::Mat image;
+                try {
+                    NBIP_PROFILE_SCOPE("Decode");
+                    image = ReadNativeImage(options.inputs[index]);
+                } catch (const std::exception&) {
+                    image.release();
+                }
+                decode_ns += ElapsedNs(t0);
+
+                if (image.empty()) {
+                    failed++;
+                    continue;
+                }
+                if (!decoded.Push(BatchItem{index, image})) break;
+            }
+            if (--decoders_left == 0) decoded.Close();
+        });
+    }
+
+    for (int i = 0; i < processors; i++) {
+        pool.Submit([&] {
+            Pipeline pipeline;
+            pipeline.SetDiskCache(options.disk_cache);
+            BatchItem item;
+            while (decoded.Pop(item)) {
+                Clock::time_point t0 = Clock::now();
+                bool ok = true;
+                try {
+                    // Fresh output per image (it is queued); intermediates are reused
+                    cv::Mat result;
+                    ok = pipeline.Run(item.image, result, options.params);
+                    item.image = result;
+                } catch (const std::exception&) {
+                    ok = false;
+                }
+                process_ns += ElapsedNs(t0);
+
+                if (!ok) {
+                    failed++;
+                    continue;
+                }
+                processed.Push(std::move(item));
+            }
+            if (--processors_left == 0) processed.Close();
+        });
+    }
+
+    for (int i = 0; i < encoders; i++) {
+        pool.Submit([&] {
+            BatchItem item;
+            while (processed.Pop(item)) {
+                Clock::time_point t0 = Clock::now();
+                bool ok = false;
+                try {
+                    ok = WriteImage(BatchOutputPath(options, item.index), item.image, options.encoder);
+                } catch (const std::exception&) {
+                }
+                item.image.release();
+                encode_ns += ElapsedNs(t0);
+
+                if (ok) written++;
+                else failed++;
+            }
+        });
+    }
+
+    pool.Wait();
+
+    report.wall_seconds = ElapsedNs(start) * 1e-9;
+    report.processed = written;
+    report.failed = failed;
+    report.decode = { decoders, decode_ns * 1e-9 };
+    report.process = { processors, process_ns * 1e-9 };
+    report.encode = { encoders, encode_ns * 1e-9 };
+    return report;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "export_queue.h"
+#include "pipeline.h"
+#include <string>
+#include <vector>
+
+// Expands a directory (every readable image in it) or a file glob such as
+// "scans/*.png" into a sorted list of paths. '*' and '?' are allowed in the file name.
+std::vector<std::string> ExpandInputs(const std::string& pattern);
+
+struct BatchOptions {
+    std::vector<std::string> inputs;
+    std::string output_dir;
+    std::string output_ext;      // e.g. ".png"; empty keeps each input's extension
+    EncoderOptions encoder;
+    PipelineParams params;
+
+    int decode_threads = 2;
+    int process_threads = 0;     // 0: one per hardware thread
+    int encode_threads = 2;
+    size_t queue_capacity = 8;   // images allowed to wait between two stages
+    DiskCache* disk_cache = nullptr;  // stage results shared across runs (not owned)
+};
+
+// Time spent inside one overlapped stage, summed over its workers
+struct BatchStageReport {
+    int threads = 0;
+    double busy_seconds = 0.0;
+
+    // Fraction of the stage's worker time spent doing work rather than waiting
+    double Utilization(double wall_seconds) const {
+        return threads > 0 && wall_seconds > 0.0 ? busy_seconds / (threads * wall_seconds) : 0.0;
+    }
+};
+
+struct BatchReport {
+    std::string error;     // set if the batch could not start; nothing was written
+    size_t processed = 0;
+    size_t failed = 0;
+    double wall_seconds = 0.0;
+    BatchStageReport decode;
+    BatchStageReport process;
+    BatchStageReport encode;
+
+    double ImagesPerSecond() const { return wall_seconds > 0.0 ? processed / wall_seconds : 0.0; }
+};
+
+// Where RunBatch writes the result of options.inputs[index]: the input's file name in
+// output_dir, with output_ext if set
+std::string BatchOutputPath(const BatchOptions& options, size_t index);
+
+// Runs decode (cv::imread), the pipeline and encode (WriteImage) as overlapped stages
+// on a thread pool. Stages are connected by bounded queues, so at most
+// decode_threads + process_threads + encode_threads + 2 * queue_capacity images are
+// held in memory at any time. An image that fails at any stage (out of memory
+// included) is counted and the others go on. If two inputs would be written to the same
+// file (a.png and a.jpg with output_ext ".png", say; names compare case-insensitively),
+// nothing runs and `error` names them.
+BatchReport RunBatch(const BatchOptions& options);
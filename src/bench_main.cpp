@@ -0,0 +1,938 @@
+// Micro-benchmarks for the processing kernels
+#include "adaptive_threshold.h"
+#include "blur.h"
+#include "buffer_pool.h"
+#include "graph.h"
+#include "histogram.h"
+#include "history.h"
+#include "pipeline.h"
+#include "pipeline_spec.h"
+#include "pixel_kernels.h"
+#include "pointwise.h"
+#include "presenter.h"
+#include "sobel.h"
+#include "sweep.h"
+#include "tiled.h"
+#include "viewport.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct BenchSize {
+    const char* name;
+    int width;
+    int height;
+};
+
+const BenchSize kSizes[] = {
+    { "4K", 3840, 2160 },
+    { "50MP", 8192, 6144 },
+};
+
+// Median wall time of `runs` calls, in milliseconds (one untimed warm-up call first)
+double TimeMs(const std::function<void()>& fn, int runs = 7) {
+    fn();
+    std::vector<double> times;
+    for (int i = 0; i < runs; i++) {
+        int64 start = cv::getTickCount();
+        fn();
+        times.push_back((cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency());
+    }
+    std::sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+cv::Mat RandomImage(int width, int height, int type) {
+    cv::Mat image(height, width, type);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+    return image;
+}
+
+void PrintRow(const char* size, const char* variant, double ms, double megapixels, double baseline_ms) {
+    std::printf("  %-6s %-28s %9.2f ms %9.1f MP/s %7.2fx\n",
+        size, variant, ms, megapixels / (ms / 1000.0), baseline_ms / ms);
+}
+
+// Grayscale -> brightness/contrast -> binary threshold, as three OpenCV passes versus the
+// fused LUT kernel at every SIMD level this CPU supports
+void BenchPointwise() {
+    PipelineParams params;
+    params.grayscale = true;
+    params.brightness = true;
+    params.brightness_value = 15.0f;
+    params.contrast = true;
+    params.contrast_value = 1.3f;
+    params.threshold = true;
+    params.threshold_value = 127;
+
+    std::printf("Pointwise chain: %s\n", FormatPipelineSpec(params).c_str());
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height / 1e6;
+
+        // The original chain: every stage is its own pass into a fresh Mat
+        cv::Mat reference;
+        double three_pass = TimeMs([&] {
+            cv::Mat gray, adjusted, binary;
+            cv::cvtColor(source, gray, cv::COLOR_BGR2GRAY);
+            gray.convertTo(adjusted, -1, params.contrast_value, params.brightness_value);
+            cv::threshold(adjusted, binary, params.threshold_value, 255, cv::THRESH_BINARY);
+            reference = binary;
+        });
+        PrintRow(size.name, "three-pass (OpenCV)", three_pass, megapixels, three_pass);
+
+        std::vector<SimdLevel> levels = { SimdLevel::Scalar };
+        if (BestSimdLevel() != SimdLevel::Scalar) levels.push_back(SimdLevel::SSSE3);
+        if (BestSimdLevel() == SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
+
+        int first = static_cast<int>(Stage::Grayscale);
+        int last = FusedGroupEnd(first, params, source);
+        for (SimdLevel level : levels) {
+            PointwiseKernel kernel;
+            kernel.to_gray = true;
+            kernel.use_post_lut = true;
+            uchar lut[256];
+            BuildBrightnessContrastLut(params.contrast_value, params.brightness_value, kernel.post_lut);
+            BuildBinaryThresholdLut(params.threshold_value, lut);
+            ComposeLut(kernel.post_lut, lut);
+
+            cv::Mat fused;
+            double ms = TimeMs([&] { RunPointwiseKernel(source, fused, kernel, level); });
+            std::string variant = std::string("fused ") + SimdLevelName(level);
+            PrintRow(size.name, variant.c_str(), ms, megapixels, three_pass);
+
+            if (cv::norm(fused, reference, cv::NORM_INF) != 0)
+                std::printf("  warning: fused %s output differs from the three-pass result\n", SimdLevelName(level));
+        }
+
+        // Through the pipeline entry point (picks the group and the best SIMD level)
+        cv::Mat output;
+        double ms = TimeMs([&] { RunStageGroup(first, last, source, output, params); });
+        PrintRow(size.name, "pipeline group (auto)", ms, megapixels, three_pass);
+    }
+}
+
+// The GUI's original per-frame luma histogram (cvtColor + at<> loop) versus cv::calcHist
+// and ComputeHistogram, which also yields the three channel histograms
+void BenchHistogram() {
+    std::printf("Histogram (BGR source)\n");
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height / 1e6;
+
+        std::vector<float> reference(256);
+        double scalar = TimeMs([&] {
+            std::fill(reference.begin(), reference.end(), 0.0f);
+            cv::Mat gray;
+            cv::cvtColor(source, gray, cv::COLOR_BGR2GRAY);
+            for (int i = 0; i < gray.rows; i++)
+                for (int j = 0; j < gray.cols; j++)
+                    reference[gray.at<uchar>(i, j)]++;
+        }, 3);
+        PrintRow(size.name, "cvtColor + at<> loop", scalar, megapixels, scalar);
+
+        double calc_hist = TimeMs([&] {
+            cv::Mat gray, hist;
+            cv::cvtColor(source, gray, cv::COLOR_BGR2GRAY);
+            int channels[] = { 0 };
+            int bins[] = { 256 };
+            float range[] = { 0, 256 };
+            const float* ranges[] = { range };
+            cv::calcHist(&gray, 1, channels, cv::Mat(), hist, 1, bins, ranges);
+        });
+        PrintRow(size.name, "cvtColor + calcHist", calc_hist, megapixels, scalar);
+
+        Histogram histogram;
+        double ms = TimeMs([&] { ComputeHistogram(source, histogram); });
+        PrintRow(size.name, "ComputeHistogram (B,G,R,luma)", ms, megapixels, scalar);
+
+        for (int v = 0; v < 256; v++) {
+            if ((double)histogram.luma[v] != reference[v]) {
+                std::printf("  warning: luma histogram differs from the reference at bin %d\n", v);
+                break;
+            }
+        }
+    }
+}
+
+// Pixel buffer allocations per re-evaluation once the pipeline has warmed up. The blur
+// radius alternates so the blur stage and everything after it recompute every time.
+// Stages built on OpenCV calls that allocate internally (adaptive threshold, Canny)
+// show up here; the rest should report zero.
+// Returns false if a chain that should reach zero allocations per evaluation did not
+bool BenchAllocations() {
+    EnableAllocationTracking();
+    std::printf("Steady-state allocations (4K BGR, blur radius alternating 2/3)\n");
+
+    struct Chain {
+        const char* spec;
+        const char* exempt;  // why the chain still allocates per evaluation, or null
+    };
+    const Chain chains[] = {
+        { "brightness=20,blur=2,threshold=binary,value=120", nullptr },
+        { "blur=2,edges=sobel,low=40,overlay", nullptr },
+        { "grayscale,contrast=1.2,blur=2,threshold=binary", nullptr },
+        { "blur=2,adaptive=mean,block=15", nullptr },
+        { "blur=2,threshold=adaptive,block=15", "cv::adaptiveThreshold temporaries" },
+        { "grayscale,blur=2,edges=canny", "cv::Canny temporaries" },
+    };
+    const int warmup = 4, runs = 20;
+    bool ok = true;
+
+    cv::Mat source = RandomImage(3840, 2160, CV_8UC3);
+    for (const Chain& chain : chains) {
+        const char* spec = chain.spec;
+        PipelineParams params;
+        std::string error;
+        if (!ParsePipelineSpec(spec, params, &error)) {
+            std::printf("  %s: %s\n", spec, error.c_str());
+            ok = false;
+            continue;
+        }
+
+        // Cached path
+        Pipeline pipeline;
+        pipeline.SetSource(source);
+        for (int i = 0; i < warmup; i++) {
+            params.blur_radius = 2 + i % 2;
+            pipeline.Evaluate(params);
+        }
+        ResetAllocationPeak();
+        AllocationStats before = GetAllocationStats();
+        for (int i = 0; i < runs; i++) {
+            params.blur_radius = 2 + i % 2;
+            pipeline.Evaluate(params);
+        }
+        AllocationStats after = GetAllocationStats();
+        double evaluate_allocs = (after.allocations - before.allocations) / (double)runs;
+
+        // Uncached path into a fixed output buffer
+        cv::Mat output;
+        for (int i = 0; i < warmup; i++) {
+            params.blur_radius = 2 + i % 2;
+            pipeline.Run(source, output, params);
+        }
+        before = GetAllocationStats();
+        for (int i = 0; i < runs; i++) {
+            params.blur_radius = 2 + i % 2;
+            pipeline.Run(source, output, params);
+        }
+        double run_allocs = (GetAllocationStats().allocations - before.allocations) / (double)runs;
+
+        std::printf("  %-48s Evaluate %5.2f allocs  Run %5.2f allocs  peak %7.1f MB  pool %zu buffers\n",
+            spec, evaluate_allocs, run_allocs, after.peak_bytes / (1024.0 * 1024.0), pipeline.Pool().Size());
+        if (chain.exempt) {
+            std::printf("  %-48s exempt: %s\n", "", chain.exempt);
+        } else if (evaluate_allocs != 0.0 || run_allocs != 0.0) {
+            std::printf("  %-48s FAIL: expected no allocations in steady state\n", "");
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+// Two branches from one blurred image (Canny edges and an adaptive threshold) blended
+// together, run node by node on one thread versus branch-parallel on the pool
+void BenchGraph() {
+    NodeGraph graph;
+    std::string error;
+    ParseGraph(
+        "src = input\n"
+        "blurred = src | blur=2\n"
+        "edges = blurred | edges=canny,low=50,high=150\n"
+        "mask = blurred | threshold=adaptive,block=31\n"
+        "sobel = blurred | edges=sobel,low=40\n"
+        "mix = blend edges mask 0.5\n"
+        "out = blend mix sobel 0.7\n", graph, &error);
+    std::printf("Graph: blur -> {canny, adaptive threshold, sobel} -> blend\n");
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height / 1e6;
+        std::map<std::string, cv::Mat> sources = { { "src", source } };
+        std::vector<cv::Mat> outputs;
+
+        GraphExecutor serial(1);
+        double serial_ms = TimeMs([&] { serial.Run(graph, sources, outputs); }, 5);
+        PrintRow(size.name, "sequential nodes", serial_ms, megapixels, serial_ms);
+
+        GraphExecutor parallel;
+        GraphRunStats stats;
+        double parallel_ms = TimeMs([&] { parallel.Run(graph, sources, outputs, &stats); }, 5);
+        PrintRow(size.name, "parallel branches", parallel_ms, megapixels, serial_ms);
+        std::printf("  %-6s up to %d nodes at once, OpenCV threads %d, peak %zu intermediates\n",
+            size.name, stats.max_parallel, stats.opencv_threads, stats.peak_intermediates);
+    }
+}
+
+// Every blur method across radii 1-200 on a 4K BGR image, with the largest deviation
+// from the exact kernel and the method the blur stage picks
+void BenchBlur() {
+    const int radii[] = { 1, 2, 3, 4, 6, 8, 12, 16, 20, 32, 50, 100, 200 };
+    const BenchSize& size = kSizes[0];
+    cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+
+    std::printf("Blur on %s BGR, ms (max abs difference from exact)\n", size.name);
+    std::printf("  %6s %10s %18s %18s %-12s %10s %18s %-12s\n", "radius",
+        "gaussian", "stacked box", "recursive", "auto", "box", "running sum", "auto");
+
+    for (int radius : radii) {
+        cv::Mat exact, approx;
+        double sigma = BlurSigma(radius);
+        // The full kernels get slow at large radii; a couple of runs are enough there
+        int runs = radius > 20 ? 3 : 7;
+
+        double gaussian_ms = TimeMs([&] { BlurImage(source, exact, radius, true, BlurMethod::Exact); }, runs);
+        double stacked_ms = TimeMs([&] { StackedBoxBlur(source, approx, sigma); }, runs);
+        double stacked_error = cv::norm(exact, approx, cv::NORM_INF);
+        double recursive_ms = TimeMs([&] { RecursiveGaussianBlur(source, approx, sigma); }, runs);
+        double recursive_error = cv::norm(exact, approx, cv::NORM_INF);
+
+        double box_ms = TimeMs([&] { BlurImage(source, exact, radius, false, BlurMethod::Exact); }, runs);
+        double running_ms = TimeMs([&] { BoxBlur(source, approx, radius); }, runs);
+        double running_error = cv::norm(exact, approx, cv::NORM_INF);
+
+        std::printf("  %6d %10.2f %10.2f (%4.0f) %10.2f (%4.0f) %-12s %10.2f %10.2f (%4.0f) %-12s\n", radius,
+            gaussian_ms, stacked_ms, stacked_error, recursive_ms, recursive_error,
+            BlurMethodName(ResolveBlurMethod(radius, true)),
+            box_ms, running_ms, running_error,
+            BlurMethodName(ResolveBlurMethod(radius, false)));
+    }
+}
+
+// Mean mode against cv::adaptiveThreshold(ADAPTIVE_THRESH_MEAN_C) over odd sizes, block
+// sizes (including blocks wider than the image) and negative constants, at every SIMD
+// level. Returns false on any differing pixel.
+bool CheckAdaptiveMean() {
+    const cv::Size sizes[] = { { 1, 1 }, { 7, 5 }, { 33, 17 }, { 257, 131 }, { 1001, 9 } };
+    const int blocks[] = { 3, 5, 15, 31, 101 };
+    const int constants[] = { -10, -3, 0, 5, 10 };
+    int failures = 0;
+    for (const cv::Size& size : sizes) {
+        cv::Mat gray = RandomImage(size.width, size.height, CV_8UC1);
+        for (int block : blocks) {
+            IntegralImage tables;
+            tables.Update(gray, 1, block / 2, false);
+            for (int constant : constants) {
+                cv::Mat reference, result, mismatch;
+                cv::adaptiveThreshold(gray, reference, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, block, constant);
+                for (SimdLevel level : { SimdLevel::Scalar, BestSimdLevel() }) {
+                    AdaptiveThresholdFromIntegral(tables, gray, result, block, constant, AdaptiveMode::Mean, 0.2f, level);
+                    cv::compare(reference, result, mismatch, cv::CMP_NE);
+                    int mismatches = cv::countNonZero(mismatch);
+                    if (mismatches != 0) {
+                        std::printf("  FAIL: %dx%d block %d constant %d (%s): %d pixels differ\n", size.width,
+                            size.height, block, constant, SimdLevelName(level), mismatches);
+                        failures++;
+                    }
+                }
+            }
+        }
+    }
+    std::printf("  mean mode vs cv::adaptiveThreshold: %s\n", failures ? "MISMATCH" : "bit-exact");
+    return failures == 0;
+}
+
+// Adaptive threshold at block 31: OpenCV's Gaussian and mean versions against the
+// summed-area tables, once with a table build (new image) and once reusing the tables
+// (block size or constant changed), plus a bit-exactness check of the mean mode.
+// Returns false if the mean mode differs from OpenCV anywhere.
+bool BenchAdaptiveThreshold() {
+    const int block = 31;
+    const int constant = 5;
+    std::printf("Adaptive threshold, block %d, constant %d\n", block, constant);
+    bool ok = true;
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat gray = RandomImage(size.width, size.height, CV_8UC1);
+        cv::GaussianBlur(gray, gray, cv::Size(0, 0), 3.0);  // local structure for the threshold to follow
+        double megapixels = size.width * (double)size.height / 1e6;
+        cv::Mat reference, result;
+
+        double gaussian_ms = TimeMs([&] {
+            cv::adaptiveThreshold(gray, reference, 255, cv::ADAPTIVE_THRESH_GAUSSIAN_C, cv::THRESH_BINARY, block, constant);
+        });
+        PrintRow(size.name, "OpenCV gaussian", gaussian_ms, megapixels, gaussian_ms);
+
+        double mean_ms = TimeMs([&] {
+            cv::adaptiveThreshold(gray, reference, 255, cv::ADAPTIVE_THRESH_MEAN_C, cv::THRESH_BINARY, block, constant);
+        });
+        PrintRow(size.name, "OpenCV mean", mean_ms, megapixels, gaussian_ms);
+
+        IntegralImage tables;
+        double build_ms = TimeMs([&] {
+            AdaptiveThresholdIntegral(gray, result, block, constant, AdaptiveMode::Mean, 0.2f, tables, 0);
+        });
+        PrintRow(size.name, "integral mean (build)", build_ms, megapixels, gaussian_ms);
+
+        cv::Mat mismatch;
+        cv::compare(reference, result, mismatch, cv::CMP_NE);
+        int mismatches = cv::countNonZero(mismatch);
+
+        tables.Update(gray, 1, 49, true);
+        for (SimdLevel level : { SimdLevel::Scalar, BestSimdLevel() }) {
+            double compare_ms = TimeMs([&] {
+                AdaptiveThresholdFromIntegral(tables, gray, result, block, constant, AdaptiveMode::Mean, 0.2f, level);
+            });
+            std::string variant = std::string("integral mean (reuse, ") + SimdLevelName(level) + ")";
+            PrintRow(size.name, variant.c_str(), compare_ms, megapixels, gaussian_ms);
+        }
+
+        double sauvola_ms = TimeMs([&] {
+            AdaptiveThresholdFromIntegral(tables, gray, result, block, constant, AdaptiveMode::Sauvola, 0.2f);
+        });
+        PrintRow(size.name, "integral sauvola (reuse)", sauvola_ms, megapixels, gaussian_ms);
+
+        std::printf("  %-6s mean mode differs from cv::adaptiveThreshold at %d pixels\n", size.name, mismatches);
+        ok &= mismatches == 0;
+    }
+    return CheckAdaptiveMean() && ok;
+}
+
+// Sobel edge map: the old Sobel x2 -> convertScaleAbs x2 -> addWeighted -> threshold
+// chain against the fused kernel, and Canny on the image against Canny on fused gradients
+void BenchSobel() {
+    const int threshold = 40;
+    std::printf("Sobel edges, threshold %d\n", threshold);
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat gray = RandomImage(size.width, size.height, CV_8UC1);
+        double megapixels = size.width * (double)size.height / 1e6;
+
+        for (int ksize : { 3, 7 }) {
+            cv::Mat reference, fused;
+            double six_pass = TimeMs([&] {
+                cv::Mat gx, gy, ax, ay;
+                cv::Sobel(gray, gx, CV_16S, 1, 0, ksize);
+                cv::Sobel(gray, gy, CV_16S, 0, 1, ksize);
+                cv::convertScaleAbs(gx, ax);
+                cv::convertScaleAbs(gy, ay);
+                cv::addWeighted(ax, 0.5, ay, 0.5, 0, reference);
+                cv::threshold(reference, reference, threshold, 255, cv::THRESH_BINARY);
+            });
+            std::string label = "six-pass, ksize " + std::to_string(ksize);
+            PrintRow(size.name, label.c_str(), six_pass, megapixels, six_pass);
+
+            SobelOptions options;
+            options.ksize = ksize;
+            options.binary = true;
+            options.threshold = threshold;
+            for (SimdLevel level : { SimdLevel::Scalar, BestSimdLevel() }) {
+                double fused_ms = TimeMs([&] { SobelMagnitude(gray, &fused, nullptr, nullptr, options, level); });
+                label = std::string("fused L1, ksize ") + std::to_string(ksize) + " (" + SimdLevelName(level) + ")";
+                PrintRow(size.name, label.c_str(), fused_ms, megapixels, six_pass);
+            }
+            options.norm = GradientNorm::L2;
+            cv::Mat l2;
+            double l2_ms = TimeMs([&] { SobelMagnitude(gray, &l2, nullptr, nullptr, options); });
+            label = "fused L2, ksize " + std::to_string(ksize);
+            PrintRow(size.name, label.c_str(), l2_ms, megapixels, six_pass);
+
+            std::printf("  %-6s fused L1 differs from the six-pass chain at %d pixels\n", size.name,
+                (int)cv::norm(reference, fused, cv::NORM_L1) / 255);
+        }
+
+        cv::Mat canny_reference, canny_fused, dx, dy;
+        double canny_ms = TimeMs([&] { cv::Canny(gray, canny_reference, 50, 150); });
+        PrintRow(size.name, "Canny on image", canny_ms, megapixels, canny_ms);
+        SobelOptions gradients;
+        gradients.border = cv::BORDER_REPLICATE;
+        double canny_fused_ms = TimeMs([&] {
+            SobelMagnitude(gray, nullptr, &dx, &dy, gradients);
+            cv::Canny(dx, dy, canny_fused, 50, 150);
+        });
+        PrintRow(size.name, "Canny on fused gradients", canny_fused_ms, megapixels, canny_ms);
+        std::printf("  %-6s Canny outputs differ at %d pixels\n", size.name,
+            (int)cv::norm(canny_reference, canny_fused, cv::NORM_L1) / 255);
+    }
+}
+
+// Upload counts and bytes through the null backend when nothing, one pixel or every
+// pixel changed, and the texture contents afterwards. Returns false on any mismatch.
+bool CheckPresenterUploads() {
+    const cv::Size size(67, 45);
+    const uint64_t full_bytes = (uint64_t)size.area() * 4;
+    cv::Mat image = RandomImage(size.width, size.height, CV_8UC3);
+    cv::Mat same = image.clone();
+    cv::Mat pixel = image.clone();
+    uchar* changed = pixel.ptr<uchar>(20) + 30 * 3;
+    changed[0] = (uchar)~changed[0];
+    cv::Mat other = image.clone();
+    cv::bitwise_not(other, other);
+
+    struct Step {
+        const char* name;
+        const cv::Mat* frame;
+        uint64_t uploads;  // expected, for this step alone
+        uint64_t bytes;
+    };
+    const Step steps[] = {
+        { "first present", &image, 1, full_bytes },
+        { "same buffer", &image, 0, 0 },
+        { "equal pixels", &same, 0, 0 },
+        { "one pixel", &pixel, 1, 4 },
+        { "all changed", &other, 1, full_bytes },
+    };
+
+    NullDisplayBackend backend;
+    Presenter presenter(backend);
+    bool ok = true;
+    for (const Step& step : steps) {
+        const PresenterStats before = presenter.Stats();
+        presenter.Present(*step.frame);
+        const PresenterStats& after = presenter.Stats();
+        uint64_t uploads = after.uploads - before.uploads;
+        uint64_t bytes = after.bytes - before.bytes;
+        if (uploads != step.uploads || bytes != step.bytes) {
+            std::printf("  FAIL: %s: %llu uploads, %llu bytes (expected %llu, %llu)\n", step.name,
+                (unsigned long long)uploads, (unsigned long long)bytes, (unsigned long long)step.uploads,
+                (unsigned long long)step.bytes);
+            ok = false;
+        }
+    }
+
+    cv::Mat expected, mismatch;
+    cv::cvtColor(other, expected, cv::COLOR_BGR2RGBA);
+    cv::Mat texture(size, CV_8UC4, presenter.Texture());
+    cv::compare(expected.reshape(1), texture.reshape(1), mismatch, cv::CMP_NE);
+    if (cv::countNonZero(mismatch) != 0) {
+        std::printf("  FAIL: texture differs from the last image presented\n");
+        ok = false;
+    }
+    std::printf("  upload counts (none, one pixel, all changed): %s\n", ok ? "as expected" : "MISMATCH");
+    return ok;
+}
+
+// Display uploads: a fresh full-size texture and conversion per frame (what the GUI used
+// to do) against the presenter when nothing, a band, or everything changed. Returns
+// false if the presenter uploads more or less than expected.
+bool BenchPresent() {
+    std::printf("Display upload\n");
+    const bool ok = CheckPresenterUploads();
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat image = RandomImage(size.width, size.height, CV_8UC3);
+        cv::Mat band = image.clone();
+        cv::Mat changed = band.rowRange(size.height / 2, size.height / 2 + 64);
+        cv::bitwise_not(changed, changed);
+        cv::Mat other = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height / 1e6;
+
+        NullDisplayBackend backend;
+        double fresh_ms = TimeMs([&] {
+            std::unique_ptr<DisplayTexture> texture = backend.CreateTexture(image.size());
+            cv::Mat rgba;
+            cv::cvtColor(image, rgba, cv::COLOR_BGR2RGBA);
+            texture->Update(cv::Rect(0, 0, rgba.cols, rgba.rows), rgba);
+        });
+        PrintRow(size.name, "new texture per frame", fresh_ms, megapixels, fresh_ms);
+
+        struct Scenario {
+            const char* name;
+            const cv::Mat* frames[2];
+        };
+        const Scenario scenarios[] = {
+            { "presenter, unchanged", { &image, &image } },
+            { "presenter, 64-row band", { &image, &band } },
+            { "presenter, all changed", { &image, &other } },
+        };
+        for (const Scenario& scenario : scenarios) {
+            Presenter presenter(backend);
+            int frame = 0;
+            double ms = TimeMs([&] { presenter.Present(*scenario.frames[frame++ % 2]); });
+            PrintRow(size.name, scenario.name, ms, megapixels, fresh_ms);
+            const PresenterStats& stats = presenter.Stats();
+            std::printf("  %-6s %llu uploads, %.1f MB per present\n", size.name, (unsigned long long)stats.uploads,
+                stats.bytes / (1024.0 * 1024.0) / std::max<uint64_t>(1, stats.presents));
+        }
+    }
+    return ok;
+}
+
+// The pointwise chain and a blurred chain on 8-bit, 16-bit and float BGR: one OpenCV call
+// per stage against the typed fused kernel (and the 8-bit table kernel), then the
+// whole pipeline
+void BenchDepths() {
+    PipelineParams params;
+    params.grayscale = true;
+    params.brightness = true;
+    params.brightness_value = 15.0f;
+    params.contrast = true;
+    params.contrast_value = 1.3f;
+    params.threshold = true;
+    params.threshold_value = 127;
+    PipelineParams blurred = params;
+    blurred.blur = true;
+    blurred.blur_radius = 3;
+
+    std::printf("Pixel depths: %s\n", FormatPipelineSpec(params).c_str());
+
+    const struct {
+        const char* name;
+        int depth;
+    } depths[] = { { "U8", CV_8U }, { "U16", CV_16U }, { "F32", CV_32F } };
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source8 = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height / 1e6;
+
+        for (const auto& d : depths) {
+            cv::Mat source;
+            ConvertDepth(source8, source, d.depth);
+            const double scale = DepthScale(d.depth);
+
+            double per_stage = TimeMs([&] {
+                cv::Mat gray, adjusted, binary;
+                cv::cvtColor(source, gray, cv::COLOR_BGR2GRAY);
+                gray.convertTo(adjusted, -1, params.contrast_value, params.brightness_value * scale);
+                cv::threshold(adjusted, binary, params.threshold_value * scale, DepthMax(d.depth), cv::THRESH_BINARY);
+            });
+            std::string label = std::string(d.name) + " per stage (OpenCV)";
+            PrintRow(size.name, label.c_str(), per_stage, megapixels, per_stage);
+
+            TypedPointwiseOps ops;
+            ops.to_gray = true;
+            ops.post_affine = true;
+            ops.alpha = params.contrast_value;
+            ops.beta = (float)(params.brightness_value * scale);
+            ops.threshold = true;
+            ops.threshold_value = (float)(params.threshold_value * scale);
+            cv::Mat typed;
+            double typed_ms = TimeMs([&] { RunTypedPointwiseKernel(source, typed, ops); });
+            label = std::string(d.name) + " typed fused";
+            PrintRow(size.name, label.c_str(), typed_ms, megapixels, per_stage);
+
+            if (d.depth == CV_8U) {
+                int first = static_cast<int>(Stage::Grayscale);
+                cv::Mat lut;
+                double lut_ms = TimeMs([&] {
+                    RunStageGroup(first, FusedGroupEnd(first, params, source), source, lut, params);
+                });
+                PrintRow(size.name, "U8 table fused", lut_ms, megapixels, per_stage);
+            }
+
+            Pipeline pipeline;
+            cv::Mat output;
+            double chain_ms = TimeMs([&] { pipeline.Run(source, output, blurred); });
+            label = std::string(d.name) + " pipeline with blur";
+            PrintRow(size.name, label.c_str(), chain_ms, megapixels, per_stage);
+        }
+    }
+}
+
+// Inspecting a 1280x720 window: the whole image through the pipeline against the
+// viewport evaluator at 1:1 and 1:4, computing its tiles and panning over cached ones
+void BenchViewport() {
+    PipelineParams params;
+    params.grayscale = true;
+    params.blur = true;
+    params.blur_radius = 5;
+    params.threshold = true;
+    params.threshold_method = 1;
+    params.edge_detection = true;
+    params.use_canny = false;
+    params.kernel_size = 2;
+
+    std::printf("Viewport: %s\n", FormatPipelineSpec(params).c_str());
+    const cv::Size window(1280, 720);
+
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = window.area() / 1e6;
+
+        Pipeline pipeline;
+        cv::Mat output;
+        double whole_ms = TimeMs([&] { pipeline.Run(source, output, params); }, 3);
+        PrintRow(size.name, "whole image", whole_ms, megapixels, whole_ms);
+
+        for (double zoom : { 1.0, 0.25 }) {
+            cv::Rect region(size.width / 3, size.height / 3, (int)(window.width / zoom), (int)(window.height / zoom));
+            cv::Rect panned = region + cv::Point(region.width / 2, 0);
+            const char* label = zoom == 1.0 ? "1:1" : "1:4";
+
+            double cold_ms = TimeMs([&] {
+                ViewportEvaluator viewport;
+                viewport.SetSource(source);
+                viewport.Update(params, region, zoom, 1e9);
+            });
+            std::string variant = std::string("viewport ") + label + ", new tiles";
+            PrintRow(size.name, variant.c_str(), cold_ms, megapixels, whole_ms);
+
+            ViewportEvaluator viewport;
+            viewport.SetSource(source);
+            int step = 0;
+            double pan_ms = TimeMs([&] { viewport.Update(params, step++ % 2 ? panned : region, zoom, 1e9); });
+            variant = std::string("viewport ") + label + ", cached pan";
+            PrintRow(size.name, variant.c_str(), pan_ms, megapixels, whole_ms);
+        }
+    }
+}
+
+void BenchSweep() {
+    PipelineParams params;
+    params.grayscale = true;
+    params.blur = true;
+    params.blur_radius = 8;
+    params.threshold = true;
+    SweepAxis axis;
+    MakeSweepAxis("value", 40, 220, 20, axis);
+    const std::vector<SweepAxis> axes = { axis };
+
+    std::printf("Sweep: %s, value=40:220:20 (%zu variants)\n", FormatPipelineSpec(params).c_str(), axis.values.size());
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height * axis.values.size() / 1e6;
+
+        Pipeline pipeline;
+        cv::Mat output;
+        double separate_ms = TimeMs([&] {
+            for (double value : axis.values)
+                pipeline.Run(source, output, ApplySweepValue(params, axis.name, value));
+        }, 3);
+        PrintRow(size.name, "one run per variant", separate_ms, megapixels, separate_ms);
+
+        for (int threads : { 1, 0 }) {
+            SweepOptions options;
+            options.threads = threads;
+            options.thumbnail_width = 256;
+            double sweep_ms = TimeMs([&] { RunSweep(source, params, axes, options); }, 3);
+            PrintRow(size.name, threads == 1 ? "shared prefix, 1 thread" : "shared prefix, all threads",
+                sweep_ms, megapixels, separate_ms);
+        }
+    }
+}
+
+void BenchHistory() {
+    PipelineParams params;
+    params.grayscale = true;
+    params.blur = true;
+    params.blur_radius = 5;
+    params.threshold = true;
+    params.threshold_method = 2;
+
+    std::printf("Undo step: %s\n", FormatPipelineSpec(params).c_str());
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height / 1e6;
+
+        Pipeline pipeline;
+        cv::Mat result;
+        double recompute_ms = TimeMs([&] { pipeline.Run(source, result, params); }, 3);
+        PrintRow(size.name, "recompute", recompute_ms, megapixels, recompute_ms);
+
+        // keep_raw 0: the entry is compressed as soon as the background thread gets to it
+        for (size_t keep_raw : { 1, 0 }) {
+            ResultStore store(kDefaultResultStoreBytes, keep_raw);
+            store.Store(HashParams(params), result);
+            while (keep_raw == 0 && store.Stats().compressed == 0)
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            cv::Mat stored;
+            double load_ms = TimeMs([&] { store.Load(HashParams(params), stored); });
+            std::string variant = keep_raw ? "stored raw" : "stored PNG, " + std::to_string(store.Stats().bytes >> 10) + " KB";
+            PrintRow(size.name, variant.c_str(), load_ms, megapixels, recompute_ms);
+        }
+    }
+}
+
+// Threshold -> Sobel edges on BGR, with and without format negotiation, and blur on BGR
+// as interleaved versus planar data
+void BenchFormats() {
+    PipelineParams edges;
+    edges.threshold = true;
+    edges.edge_detection = true;
+    PipelineParams blur;
+    blur.blur = true;
+    blur.blur_radius = 8;
+
+    struct Scenario {
+        const char* name;
+        PipelineParams params;
+        FormatPlanOptions options;
+        bool baseline;  // the rows after it are compared with it
+    };
+    FormatPlanOptions unplanned;
+    unplanned.negotiate = false;
+    FormatPlanOptions planar;
+    planar.planar = true;
+    const Scenario scenarios[] = {
+        { "edges, unplanned", edges, unplanned, true },
+        { "edges, negotiated", edges, FormatPlanOptions(), false },
+        { "blur, interleaved", blur, FormatPlanOptions(), true },
+        { "blur, planar", blur, planar, false },
+    };
+
+    std::printf("Format plan: %s and %s\n", FormatPipelineSpec(edges).c_str(), FormatPipelineSpec(blur).c_str());
+    for (const BenchSize& size : kSizes) {
+        cv::Mat source = RandomImage(size.width, size.height, CV_8UC3);
+        double megapixels = size.width * (double)size.height / 1e6;
+
+        double baseline_ms = 0.0;
+        for (const Scenario& scenario : scenarios) {
+            Pipeline pipeline;
+            pipeline.SetFormatOptions(scenario.options);
+            cv::Mat output;
+            double ms = TimeMs([&] { pipeline.Run(source, output, scenario.params); });
+            if (scenario.baseline)
+                baseline_ms = ms;
+            const FormatSavings& savings = pipeline.LastFormatSavings();
+            std::string variant = std::string(scenario.name) + ", " + std::to_string(savings.conversions_avoided) + " conv";
+            PrintRow(size.name, variant.c_str(), ms, megapixels, baseline_ms);
+        }
+    }
+}
+
+// Tiled runs against whole-image runs of the same chain, 8- and 16-bit, gray and BGR,
+// with a memory limit that forces several strips. Otsu is the case to watch: its level
+// comes from an 8-bit histogram and must be applied in the strip's own depth. Returns
+// false on any differing pixel.
+bool BenchTiled() {
+    const char* specs[] = {
+        "grayscale,blur=2,threshold=otsu",
+        "threshold=otsu",
+        "grayscale,blur=3,threshold=otsu,edges=sobel",
+        "grayscale,blur=2,threshold=adaptive",
+    };
+    const int types[] = { CV_8UC1, CV_8UC3, CV_16UC1, CV_16UC3 };
+    const cv::Size size(301, 203);
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    const std::string input_path = (dir / "nbip-bench-tile-in.pnm").string();
+    const std::string output_path = (dir / "nbip-bench-tile-out.pnm").string();
+
+    std::printf("Tiled against whole-image runs\n");
+    bool ok = true;
+    for (int type : types) {
+        cv::Mat source(size, type);
+        cv::randu(source, cv::Scalar::all(0), cv::Scalar::all(DepthMax(CV_MAT_DEPTH(type)) + 1));
+        cv::GaussianBlur(source, source, cv::Size(0, 0), 3.0);  // mid-tones for Otsu to split
+
+        std::unique_ptr<TileWriter> writer = CreateTileWriter(input_path, size, type);
+        if (!writer || !writer->WriteRows(source) || !writer->Finish()) {
+            std::printf("  FAIL: cannot write %s\n", input_path.c_str());
+            return false;
+        }
+
+        for (const char* spec : specs) {
+            PipelineParams params;
+            std::string error;
+            if (!ParsePipelineSpec(spec, params, &error)) {
+                std::printf("  %s: %s\n", spec, error.c_str());
+                ok = false;
+                continue;
+            }
+
+            TiledOptions options;
+            options.memory_limit = size_t(1) << 20;
+            TiledReport report;
+            cv::Mat reference, tiled;
+            Pipeline().Run(source, reference, params);
+            std::unique_ptr<TileReader> reader;
+            bool same = RunTiled(input_path, output_path, params, options, &report, &error) &&
+                        (reader = OpenTileReader(output_path, &error)) && reader->ReadRows(0, size.height, tiled) &&
+                        tiled.type() == reference.type() && cv::norm(reference, tiled, cv::NORM_INF) == 0.0;
+            std::printf("  %-6s %-4s %-44s %2d strips: %s\n", CV_MAT_DEPTH(type) == CV_8U ? "8-bit" : "16-bit",
+                CV_MAT_CN(type) == 1 ? "gray" : "BGR", spec, report.strips,
+                same ? "identical" : ("MISMATCH " + error).c_str());
+            ok &= same;
+        }
+    }
+
+    std::error_code ec;
+    std::filesystem::remove(input_path, ec);
+    std::filesystem::remove(output_path, ec);
+    return ok;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    std::string suite = argc > 1 ? argv[1] : "all";
+    bool all = suite == "all";
+    bool ran = false;
+    bool failed = false;
+
+    if (all || suite == "pointwise") {
+        BenchPointwise();
+        ran = true;
+    }
+
+    if (all || suite == "histogram") {
+        BenchHistogram();
+        ran = true;
+    }
+
+    if (all || suite == "alloc") {
+        failed |= !BenchAllocations();
+        ran = true;
+    }
+
+    if (all || suite == "graph") {
+        BenchGraph();
+        ran = true;
+    }
+
+    if (all || suite == "blur") {
+        BenchBlur();
+        ran = true;
+    }
+
+    if (all || suite == "adaptive") {
+        failed |= !BenchAdaptiveThreshold();
+        ran = true;
+    }
+
+    if (all || suite == "sobel") {
+        BenchSobel();
+        ran = true;
+    }
+
+    if (all || suite == "present") {
+        failed |= !BenchPresent();
+        ran = true;
+    }
+
+    if (all || suite == "depth") {
+        BenchDepths();
+        ran = true;
+    }
+
+    if (all || suite == "viewport") {
+        BenchViewport();
+        ran = true;
+    }
+
+    if (all || suite == "sweep") {
+        BenchSweep();
+        ran = true;
+    }
+
+    if (all || suite == "history") {
+        BenchHistory();
+        ran = true;
+    }
+
+    if (all || suite == "formats") {
+        BenchFormats();
+        ran = true;
+    }
+
+    if (all || suite == "tile") {
+        failed |= !BenchTiled();
+        ran = true;
+    }
+
+    if (!ran) {
+        std::fprintf(stderr, "Usage: nbip-bench [all|pointwise|histogram|alloc|graph|blur|adaptive|sobel|present|depth|viewport|sweep|history|formats|tile]\n");
+        return 2;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,309 @@
+#include "blur.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace {
+
+// Up to these radii the full kernel is cheaper than the constant-time paths (see
+// `nbip-bench blur`)
+const int kExactGaussianMaxRadius = 6;
+const int kExactBoxMaxRadius = 4;
+
+// Interleaved samples per column stripe of the vertical passes
+const int kStripeSamples = 256;
+
+int Reflect101(int i, int n) {
+    if (n == 1) return 0;
+    while (i < 0 || i >= n) {
+        if (i < 0) i = -i;
+        if (i >= n) i = 2 * n - 2 - i;
+    }
+    return i;
+}
+
+// Source index of every position of a line of `n` samples padded by `radius` each side
+std::vector<int> PaddedIndex(int n, int radius) {
+    std::vector<int> index(n + 2 * radius);
+    for (int k = 0; k < (int)index.size(); k++)
+        index[k] = Reflect101(k - radius, n);
+    return index;
+}
+
+int ParallelStripes() {
+    return std::max(1, cv::getNumThreads()) * 4;
+}
+
+// Running-sum box along each row of `src`, rounded into `dst` (same size and type)
+void BoxRows(const cv::Mat& src, cv::Mat& dst, int radius) {
+    const int width = src.cols;
+    const int cn = src.channels();
+    const int window = 2 * radius + 1;
+    const float scale = 1.0f / window;
+    const std::vector<int> index = PaddedIndex(width, radius);
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        for (int y = range.start; y < range.end; y++) {
+            const uchar* in = src.ptr<uchar>(y);
+            uchar* out = dst.ptr<uchar>(y);
+            for (int c = 0; c < cn; c++) {
+                int sum = 0;
+                for (int k = 0; k < window; k++)
+                    sum += in[index[k] * cn + c];
+                out[c] = (uchar)(sum * scale + 0.5f);
+                for (int x = 1; x < width; x++) {
+                    sum += in[index[x + 2 * radius] * cn + c] - in[index[x - 1] * cn + c];
+                    out[x * cn + c] = (uchar)(sum * scale + 0.5f);
+                }
+            }
+        }
+    }, ParallelStripes());
+}
+
+// Running-sum box down each column; every task owns a stripe of columns and keeps one sum
+// per sample, so the inner loops run along rows
+void BoxColumns(const cv::Mat& src, cv::Mat& dst, int radius) {
+    const int height = src.rows;
+    const int samples = src.cols * src.channels();
+    const int window = 2 * radius + 1;
+    const float scale = 1.0f / window;
+    const std::vector<int> index = PaddedIndex(height, radius);
+    const int stripes = (samples + kStripeSamples - 1) / kStripeSamples;
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+        std::vector<int> sum(kStripeSamples);
+        for (int s = range.start; s < range.end; s++) {
+            const int x0 = s * kStripeSamples;
+            const int n = std::min(kStripeSamples, samples - x0);
+
+            std::fill(sum.begin(), sum.end(), 0);
+            for (int k = 0; k < window; k++) {
+                const uchar* in = src.ptr<uchar>(index[k]) + x0;
+                for (int j = 0; j < n; j++)
+                    sum[j] += in[j];
+            }
+            for (int y = 0; y < height; y++) {
+                if (y > 0) {
+                    const uchar* add = src.ptr<uchar>(index[y + 2 * radius]) + x0;
+                    const uchar* sub = src.ptr<uchar>(index[y - 1]) + x0;
+                    for (int j = 0; j < n; j++)
+                        sum[j] += add[j] - sub[j];
+                }
+                uchar* out = dst.ptr<uchar>(y) + x0;
+                for (int j = 0; j < n; j++)
+                    out[j] = (uchar)(sum[j] * scale + 0.5f);
+            }
+        }
+    });
+}
+
+// Young & van Vliet (1995): a third-order recursive filter run forwards and backwards
+struct RecursiveCoefficients {
+    float b;             // input weight
+    float a1, a2, a3;    // feedback weights (already divided by b0)
+};
+
+RecursiveCoefficients MakeRecursiveCoefficients(double sigma) {
+    sigma = std::max(sigma, 0.5);
+    double q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330
+                            : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * sigma);
+    double q2 = q * q, q3 = q2 * q;
+    double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+    double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+    double b2 = -(1.4281 * q2 + 1.26661 * q3);
+    double b3 = 0.422205 * q3;
+
+    RecursiveCoefficients c;
+    c.a1 = (float)(b1 / b0);
+    c.a2 = (float)(b2 / b0);
+    c.a3 = (float)(b3 / b0);
+    c.b = 1.0f - (c.a1 + c.a2 + c.a3);
+    return c;
+}
+
+// Filters `n` samples `stride` apart in place. Both passes start in the steady state of
+// the edge sample, which is what a replicated border would converge to.
+void RecursiveLine(float* line, int n, int stride, const RecursiveCoefficients& c) {
+    float w1 = line[0], w2 = w1, w3 = w1;
+    for (int i = 0; i < n; i++) {
+        float w = c.b * line[i * stride] + c.a1 * w1 + c.a2 * w2 + c.a3 * w3;
+        line[i * stride] = w;
+        w3 = w2; w2 = w1; w1 = w;
+    }
+    w1 = w2 = w3 = line[(n - 1) * stride];
+    for (int i = n - 1; i >= 0; i--) {
+        float w = c.b * line[i * stride] + c.a1 * w1 + c.a2 * w2 + c.a3 * w3;
+        line[i * stride] = w;
+        w3 = w2; w2 = w1; w1 = w;
+    }
+}
+
+void RecursiveRows(const cv::Mat& src, cv::Mat& dst, const RecursiveCoefficients& coefficients) {
+    const int cn = src.channels();
+    const int samples = src.cols * cn;
+
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& range) {
+        std::vector<float> line(samples);
+        for (int y = range.start; y < range.end; y++) {
+            const uchar* in = src.ptr<uchar>(y);
+            for (int j = 0; j < samples; j++)
+                line[j] = in[j];
+            for (int c = 0; c < cn; c++)
+                RecursiveLine(line.data() + c, src.cols, cn, coefficients);
+            uchar* out = dst.ptr<uchar>(y);
+            for (int j = 0; j < samples; j++)
+                out[j] = cv::saturate_cast<uchar>(line[j]);
+        }
+    }, ParallelStripes());
+}
+
+// Column stripes are copied to a float buffer so the recursion over rows runs along
+// contiguous samples
+void RecursiveColumns(const cv::Mat& src, cv::Mat& dst, const RecursiveCoefficients& c) {
+    const int height = src.rows;
+    const int samples = src.cols * src.channels();
+    const int stripes = (samples + kStripeSamples - 1) / kStripeSamples;
+
+    cv::parallel_for_(cv::Range(0, stripes), [&](const cv::Range& range) {
+        std::vector<float> buffer((size_t)height * kStripeSamples);
+        std::vector<float> w1(kStripeSamples), w2(kStripeSamples), w3(kStripeSamples);
+        for (int s = range.start; s < range.end; s++) {
+            const int x0 = s * kStripeSamples;
+            const int n = std::min(kStripeSamples, samples - x0);
+
+            for (int y = 0; y < height; y++) {
+                const uchar* in = src.ptr<uchar>(y) + x0;
+                float* row = &buffer[(size_t)y * kStripeSamples];
+                for (int j = 0; j < n; j++)
+                    row[j] = in[j];
+            }
+
+            std::copy(buffer.begin(), buffer.begin() + n, w1.begin());
+            std::copy(w1.begin(), w1.begin() + n, w2.begin());
+            std::copy(w1.begin(), w1.begin() + n, w3.begin());
+            for (int y = 0; y < height; y++) {
+                float* row = &buffer[(size_t)y * kStripeSamples];
+                for (int j = 0; j < n; j++) {
+                    float w = c.b * row[j] + c.a1 * w1[j] + c.a2 * w2[j] + c.a3 * w3[j];
+                    row[j] = w;
+                    w3[j] = w2[j]; w2[j] = w1[j]; w1[j] = w;
+                }
+            }
+
+            const float* last = &buffer[(size_t)(height - 1) * kStripeSamples];
+            std::copy(last, last + n, w1.begin());
+            std::copy(last, last + n, w2.begin());
+            std::copy(last, last + n, w3.begin());
+            for (int y = height - 1; y >= 0; y--) {
+                float* row = &buffer[(size_t)y * kStripeSamples];
+                uchar* out = dst.ptr<uchar>(y) + x0;
+                for (int j = 0; j < n; j++) {
+                    float w = c.b * row[j] + c.a1 * w1[j] + c.a2 * w2[j] + c.a3 * w3[j];
+                    out[j] = cv::saturate_cast<uchar>(w);
+                    w3[j] = w2[j]; w2[j] = w1[j]; w1[j] = w;
+                }
+            }
+        }
+    });
+}
+
+// Box radii whose stacked response best matches a Gaussian of `sigma` (Kovesi 2010)
+std::vector<int> StackedBoxRadii(double sigma, int passes) {
+    double variance = 12.0 * sigma * sigma;
+    int lower = (int)std::floor(std::sqrt(variance / passes + 1.0));
+    if (lower % 2 == 0) lower--;
+    int upper = lower + 2;
+    int lower_count = (int)std::lround((variance - passes * lower * lower - 4.0 * passes * lower - 3.0 * passes) /
+                                       (-4.0 * lower - 4.0));
+
+    std::vector<int> radii;
+    for (int i = 0; i < passes; i++)
+        radii.push_back(((i < lower_count ? lower : upper) - 1) / 2);
+    return radii;
+}
+
+}  // namespace
+
+const char* BlurMethodName(BlurMethod method) {
+    switch (method) {
+    case BlurMethod::Auto:       return "auto";
+    case BlurMethod::Exact:      return "exact";
+    case BlurMethod::RunningSum: return "running sum";
+    case BlurMethod::StackedBox: return "stacked box";
+    case BlurMethod::Recursive:  return "recursive";
+    default:                     return "unknown";
+    }
+}
+
+double BlurSigma(int radius) {
+    return 0.3 * (radius - 1) + 0.8;
+}
+
+BlurMethod ResolveBlurMethod(int radius, bool gaussian, int depth, BlurMethod method) {
+    if (depth != CV_8U)
+        return BlurMethod::Exact;
+    if (gaussian) {
+        if (method == BlurMethod::Auto)
+            return radius <= kExactGaussianMaxRadius ? BlurMethod::Exact : BlurMethod::Recursive;
+        return method == BlurMethod::RunningSum ? BlurMethod::Exact : method;
+    }
+    if (method == BlurMethod::Auto)
+        return radius <= kExactBoxMaxRadius ? BlurMethod::Exact : BlurMethod::RunningSum;
+    return method == BlurMethod::RunningSum ? method : BlurMethod::Exact;
+}
+
+int BlurHalo(int radius, bool gaussian) {
+    if (ResolveBlurMethod(radius, gaussian) == BlurMethod::Exact || !gaussian)
+        return radius;
+    return std::max(radius, (int)std::ceil(4.0 * BlurSigma(radius)));
+}
+
+void BoxBlur(const cv::Mat& src, cv::Mat& dst, int radius) {
+    CV_Assert(src.depth() == CV_8U);
+    if (radius <= 0) {
+        src.copyTo(dst);
+        return;
+    }
+    cv::Mat horizontal(src.rows, src.cols, src.type());
+    BoxRows(src, horizontal, radius);
+    dst.create(src.rows, src.cols, src.type());
+    BoxColumns(horizontal, dst, radius);
+}
+
+void StackedBoxBlur(const cv::Mat& src, cv::Mat& dst, double sigma, int passes) {
+    std::vector<int> radii = StackedBoxRadii(sigma, passes);
+    BoxBlur(src, dst, radii[0]);
+    for (size_t i = 1; i < radii.size(); i++)
+        BoxBlur(dst, dst, radii[i]);
+}
+
+void RecursiveGaussianBlur(const cv::Mat& src, cv::Mat& dst, double sigma) {
+    CV_Assert(src.depth() == CV_8U);
+    RecursiveCoefficients coefficients = MakeRecursiveCoefficients(sigma);
+    cv::Mat horizontal(src.rows, src.cols, src.type());
+    RecursiveRows(src, horizontal, coefficients);
+    dst.create(src.rows, src.cols, src.type());
+    RecursiveColumns(horizontal, dst, coefficients);
+}
+
+void BlurImage(const cv::Mat& src, cv::Mat& dst, int radius, bool gaussian, BlurMethod method) {
+    switch (ResolveBlurMethod(radius, gaussian, src.depth(), method)) {
+    case BlurMethod::RunningSum:
+        BoxBlur(src, dst, radius);
+        break;
+    case BlurMethod::StackedBox:
+        StackedBoxBlur(src, dst, BlurSigma(radius));
+        break;
+    case BlurMethod::Recursive:
+        RecursiveGaussianBlur(src, dst, BlurSigma(radius));
+        break;
+    default: {
+        cv::Size kernel_size(2 * radius + 1, 2 * radius + 1);
+        if (gaussian)
+            cv::GaussianBlur(src, dst, kernel_size, 0);
+        else
+            cv::blur(src, dst, kernel_size);
+        break;
+    }
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+
+// Largest radius the GUI slider and the spec parser accept
+const int kMaxBlurRadius = 200;
+
+enum class BlurMethod {
+    Auto,        // Exact for small radii, a constant-time method above the crossover
+    Exact,       // cv::GaussianBlur / cv::blur with the full (2r+1)-tap kernel
+    RunningSum,  // box: one running sum per row and column, O(1) per pixel
+    StackedBox,  // Gaussian: three running-sum box passes
+    Recursive    // Gaussian: Young-van Vliet recursive (IIR) filter, O(1) per pixel
+};
+
+const char* BlurMethodName(BlurMethod method);
+
+// Sigma cv::GaussianBlur derives for a (2r+1)-tap kernel; the approximations match it
+double BlurSigma(int radius);
+
+// What Auto resolves to for a radius; other methods are returned as is when they apply
+// to the filter type (8-bit images only, anything else runs Exact)
+BlurMethod ResolveBlurMethod(int radius, bool gaussian, int depth = CV_8U, BlurMethod method = BlurMethod::Auto);
+
+// Rows of context an output row depends on. The approximate Gaussians reach further than
+// the exact kernel; their response is cut at 4 sigma. For the recursive filter that cut
+// is not exact: its IIR response never ends, so a strip or tile run with this halo comes
+// out close to, but not bit-identical with, a whole-image run.
+int BlurHalo(int radius, bool gaussian);
+
+// 8-bit only, any channel count. `dst` may be `src`. Rows and column stripes run in
+// parallel. The box filters use reflect-101 borders like OpenCV; the recursive Gaussian
+// starts each line in the steady state of its edge sample, i.e. a replicated border.
+void BoxBlur(const cv::Mat& src, cv::Mat& dst, int radius);
+void StackedBoxBlur(const cv::Mat& src, cv::Mat& dst, double sigma, int passes = 3);
+void RecursiveGaussianBlur(const cv::Mat& src, cv::Mat& dst, double sigma);
+
+// The blur stage: a (2r+1)-tap Gaussian or box filter, by the chosen method
+void BlurImage(const cv::Mat& src, cv::Mat& dst, int radius, bool gaussian, BlurMethod method = BlurMethod::Auto);
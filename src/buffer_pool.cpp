@@ -0,0 +1,118 @@
+#include "buffer_pool.h"
+#include "pipeline.h"
+#include <atomic>
+
+namespace {
+
+std::atomic<uint64_t> g_allocations(0);
+std::atomic<uint64_t> g_deallocations(0);
+std::atomic<size_t> g_live_bytes(0);
+std::atomic<size_t> g_peak_bytes(0);
+std::atomic<bool> g_tracking(false);
+
+void RaisePeak(size_t live) {
+    size_t peak = g_peak_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !g_peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {
+    }
+}
+
+// Forwards to OpenCV's standard allocator and counts the buffers it owns. Buffers that
+// wrap user memory are passed through uncounted.
+class CountingAllocator : public cv::MatAllocator {
+public:
+    CountingAllocator() : base_(cv::Mat::getStdAllocator()) {}
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+                           cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        cv::UMatData* u = base_->allocate(dims, sizes, type, data, step, flags, usage);
+        if (u && !data) {
+            // Route the release back through unmap() below
+            u->currAllocator = this;
+            g_allocations.fetch_add(1, std::memory_order_relaxed);
+            RaisePeak(g_live_bytes.fetch_add(u->size, std::memory_order_relaxed) + u->size);
+        }
+        return u;
+    }
+
+    bool allocate(cv::UMatData* u, cv::AccessFlag flags, cv::UMatUsageFlags usage) const override {
+        return base_->allocate(u, flags, usage);
+    }
+
+    void unmap(cv::UMatData* u) const override {
+        if (u->urefcount == 0 && u->refcount == 0) {
+            g_deallocations.fetch_add(1, std::memory_order_relaxed);
+            g_live_bytes.fetch_sub(u->size, std::memory_order_relaxed);
+            base_->deallocate(u);
+        }
+    }
+
+    void deallocate(cv::UMatData* u) const override {
+        base_->deallocate(u);
+    }
+
+private:
+    cv::MatAllocator* base_;
+};
+
+}  // namespace
+
+void EnableAllocationTracking() {
+    static CountingAllocator allocator;
+    if (!g_tracking.exchange(true))
+        cv::Mat::setDefaultAllocator(&allocator);
+}
+
+bool AllocationTrackingEnabled() {
+    return g_tracking.load();
+}
+
+AllocationStats GetAllocationStats() {
+    AllocationStats stats;
+    stats.allocations = g_allocations.load(std::memory_order_relaxed);
+    stats.deallocations = g_deallocations.load(std::memory_order_relaxed);
+    stats.live_bytes = g_live_bytes.load(std::memory_order_relaxed);
+    stats.peak_bytes = g_peak_bytes.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void ResetAllocationPeak() {
+    g_peak_bytes.store(g_live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+}
+
+cv::Mat BufferPool::Acquire(int rows, int cols, int type) {
+    for (size_t i = 0; i < free_.size(); i++) {
+        cv::Mat& m = free_[i];
+        if (m.rows == rows && m.cols == cols && m.type() == type && OwnsExclusively(m)) {
+            cv::Mat buffer = m;
+            free_.erase(free_.begin() + i);
+            hits_++;
+            return buffer;
+        }
+    }
+    misses_++;
+    return cv::Mat(rows, cols, type);
+}
+
+void BufferPool::Recycle(cv::Mat& m) {
+    // Only whole buffers OpenCV allocated; views and wrapped user memory are just dropped
+    if (!m.empty() && m.u && m.isContinuous() && m.data == m.u->data &&
+        m.total() * m.elemSize() == m.u->size && !(m.u->flags & cv::UMatData::USER_ALLOCATED)) {
+        free_.push_back(m);
+        while (free_.size() > capacity_)
+            free_.erase(free_.begin());
+    }
+    m.release();
+}
+
+void BufferPool::SetCapacity(size_t buffers) {
+    capacity_ = buffers;
+    while (free_.size() > capacity_)
+        free_.erase(free_.begin());
+}
+
+size_t BufferPool::Bytes() const {
+    size_t bytes = 0;
+    for (const cv::Mat& m : free_)
+        bytes += m.total() * m.elemSize();
+    return bytes;
+}
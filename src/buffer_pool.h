@@ -0,0 +1,55 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <vector>
+
+// Process-wide counters of cv::Mat pixel buffer allocations
+struct AllocationStats {
+    uint64_t allocations = 0;    // buffers allocated since tracking started
+    uint64_t deallocations = 0;
+    size_t live_bytes = 0;
+    size_t peak_bytes = 0;       // highest live_bytes since the last ResetAllocationPeak()
+};
+
+// Routes every cv::Mat allocation made from now on through a counting allocator (which
+// forwards to OpenCV's standard one). Call once at startup; Mats allocated earlier are
+// not counted.
+void EnableAllocationTracking();
+bool AllocationTrackingEnabled();
+
+AllocationStats GetAllocationStats();
+
+// Restarts the peak gauge at the current live byte count
+void ResetAllocationPeak();
+
+// Free list of pixel buffers for one pipeline.
+//
+// Buffers come back through Recycle() even while other Mat headers still reference
+// them; Acquire() only hands out a buffer once the pool holds the last reference, so a
+// recycled result that is still on screen is never overwritten.
+class BufferPool {
+public:
+    // A buffer of exactly this shape, reused if one is free, otherwise newly allocated
+    cv::Mat Acquire(int rows, int cols, int type);
+
+    // Takes `m` (leaving it empty) for later reuse. The oldest buffers are dropped once
+    // more than Capacity() are held.
+    void Recycle(cv::Mat& m);
+
+    void SetCapacity(size_t buffers);
+    size_t Capacity() const { return capacity_; }
+
+    size_t Size() const { return free_.size(); }
+    size_t Bytes() const;
+    uint64_t Hits() const { return hits_; }
+    uint64_t Misses() const { return misses_; }
+
+    void Clear() { free_.clear(); }
+
+private:
+    std::vector<cv::Mat> free_;  // oldest first
+    size_t capacity_ = 16;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+};
@@ -0,0 +1,631 @@
+// Headless command line front end for the processing engine
+#include "batch.h"
+#include "disk_cache.h"
+#include "graph.h"
+#include "pipeline_proto.h"
+#include "pipeline_spec.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include "stream.h"
+#include "sweep.h"
+#include "tiled.h"
+#include <opencv2/opencv.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <string>
+
+namespace {
+
+void PrintUsage() {
+    std::fprintf(stderr,
+        "Usage:\n"
+        "  nbip-cli batch --input <dir|glob> --output <dir> (--pipeline <spec> | --pipeline-file <path>)\n"
+        "                 [--ext .png] [--decoders N] [--workers N] [--encoders N] [--queue N]\n"
+        "                 [--cv-threads N] [--cache-dir <dir> [--cache-size 4G]]\n"
+        "                 [--png-level 0-9] [--png-strategy default|filtered|huffman|rle|fixed]\n"
+        "                 [--jpeg-quality 0-100] [--jpeg-progressive] [--jpeg-optimize] [--webp-quality 1-101]\n"
+        "  nbip-cli stream --input <video|pattern> [--output <video|pattern>]\n"
+        "                 (--pipeline <spec> | --pipeline-file <path>) [--fourcc MJPG] [--fps N]\n"
+        "                 [--workers N] [--queue N] [--cv-threads N] [--realtime] [encoder options as for batch]\n"
+        "  nbip-cli tile  --input <image> --output <image> (--pipeline <spec> | --pipeline-file <path>)\n"
+        "                 [--memory 512M]\n"
+        "  nbip-cli graph --input <image> --output <image> --graph <path> [--threads N]\n"
+        "  nbip-cli sweep --input <image> (--pipeline <spec> | --pipeline-file <path>)\n"
+        "                 --sweep <name=first:last[:step]> [--sweep ...] [--sheet <image>] [--cell 256]\n"
+        "                 [--columns N] [--csv <file>] [--output-dir <dir> [--ext .png]] [--workers N]\n"
+        "                 [--cv-threads N]\n"
+        "  nbip-cli pipeline (--pipeline <spec> | --pipeline-file <path>) [--output <file.pb>]\n"
+        "\n"
+        "Pipeline spec example: \"grayscale,blur=2,threshold=otsu,edges=canny,low=50,high=150\"\n"
+        "Sweepable parameters: brightness, contrast, blur, value, block, constant, k, low, high, kernel.\n"
+        "Frame patterns are printf-style, e.g. frames/%%04d.png.\n"
+        "A --pipeline-file ending in .pb is read as a binary pipeline description.\n"
+        "Every command also takes --trace <out.json> to write a Chrome trace of each stage, decode\n"
+        "and encode (open it in chrome://tracing or Perfetto).\n");
+}
+
+// Minimal "--name value" argument reader
+struct Args {
+    int argc;
+    char** argv;
+    int pos;
+
+    bool Next(std::string& name) {
+        if (pos >= argc) return false;
+        name = argv[pos++];
+        return true;
+    }
+
+    bool Value(std::string& value) {
+        if (pos >= argc) return false;
+        value = argv[pos++];
+        return true;
+    }
+
+    bool DoubleValue(double& value) {
+        std::string text;
+        if (!Value(text)) return false;
+        char* end = nullptr;
+        value = std::strtod(text.c_str(), &end);
+        return end != text.c_str() && *end == '\0';
+    }
+
+    bool IntValue(int& value) {
+        std::string text;
+        if (!Value(text)) return false;
+        char* end = nullptr;
+        long parsed = std::strtol(text.c_str(), &end, 10);
+        if (*end != '\0') return false;
+        value = (int)parsed;
+        return true;
+    }
+};
+
+// Byte count with an optional K/M/G suffix
+bool ParseBytes(const std::string& text, size_t& bytes) {
+    char* end = nullptr;
+    double value = std::strtod(text.c_str(), &end);
+    if (end == text.c_str() || value <= 0) return false;
+    double scale = 1.0;
+    if (*end == 'K' || *end == 'k') scale = 1024.0, end++;
+    else if (*end == 'M' || *end == 'm') scale = 1024.0 * 1024.0, end++;
+    else if (*end == 'G' || *end == 'g') scale = 1024.0 * 1024.0 * 1024.0, end++;
+    if (*end == 'B' || *end == 'b') end++;
+    if (*end != '\0') return false;
+    bytes = (size_t)(value * scale);
+    return true;
+}
+
+bool ParsePngStrategy(const std::string& text, int& strategy) {
+    static const char* names[] = { "default", "filtered", "huffman", "rle", "fixed" };
+    static const int values[] = { cv::IMWRITE_PNG_STRATEGY_DEFAULT, cv::IMWRITE_PNG_STRATEGY_FILTERED,
+                                  cv::IMWRITE_PNG_STRATEGY_HUFFMAN_ONLY, cv::IMWRITE_PNG_STRATEGY_RLE,
+                                  cv::IMWRITE_PNG_STRATEGY_FIXED };
+    for (int i = 0; i < 5; i++) {
+        if (text == names[i]) {
+            strategy = values[i];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Sets OpenCV's process-wide thread count for one command and restores it on return
+class ScopedCvThreads {
+public:
+    explicit ScopedCvThreads(int threads) : saved_(cv::getNumThreads()) { cv::setNumThreads(threads); }
+    ~ScopedCvThreads() { cv::setNumThreads(saved_); }
+
+    ScopedCvThreads(const ScopedCvThreads&) = delete;
+    ScopedCvThreads& operator=(const ScopedCvThreads&) = delete;
+
+private:
+    int saved_;
+};
+
+// Encoder flags shared by the commands that write images. Returns false if `name` is not
+// one of them; otherwise `ok` tells whether its value parsed.
+bool EncoderFlag(const std::string& name, Args& args, EncoderOptions& encoder, bool& ok) {
+    if (name == "--png-level") ok = args.IntValue(encoder.png_compression);
+    else if (name == "--png-strategy") {
+        std::string strategy;
+        ok = args.Value(strategy) && ParsePngStrategy(strategy, encoder.png_strategy);
+    }
+    else if (name == "--jpeg-quality") ok = args.IntValue(encoder.jpeg_quality);
+    else if (name == "--jpeg-progressive") encoder.jpeg_progressive = true;
+    else if (name == "--jpeg-optimize") encoder.jpeg_optimize = true;
+    else if (name == "--webp-quality") ok = args.IntValue(encoder.webp_quality);
+    else return false;
+    return true;
+}
+
+bool LoadParams(const std::string& spec, const std::string& spec_file, PipelineParams& params) {
+    std::string error;
+    bool parsed;
+    if (spec_file.empty())
+        parsed = ParsePipelineSpec(spec, params, &error);
+    else if (std::filesystem::path(spec_file).extension() == ".pb")
+        parsed = LoadPipelineProtoFile(spec_file, params, &error);
+    else
+        parsed = LoadPipelineSpecFile(spec_file, params, &error);
+    if (!parsed)
+        std::fprintf(stderr, "Pipeline error: %s\n", error.c_str());
+    return parsed;
+}
+
+int RunBatchCommand(Args args) {
+    BatchOptions options;
+    std::string input, spec, spec_file, cache_dir, name;
+    size_t cache_bytes = (size_t)4 << 30;
+    int queue = (int)options.queue_capacity;
+    int cv_threads = 1;  // parallelism comes from the worker pool by default
+
+    while (args.Next(name)) {
+        bool ok = true;
+        if (name == "--input") ok = args.Value(input);
+        else if (name == "--output") ok = args.Value(options.output_dir);
+        else if (name == "--pipeline") ok = args.Value(spec);
+        else if (name == "--pipeline-file") ok = args.Value(spec_file);
+        else if (name == "--ext") ok = args.Value(options.output_ext);
+        else if (name == "--decoders") ok = args.IntValue(options.decode_threads);
+        else if (name == "--workers") ok = args.IntValue(options.process_threads);
+        else if (name == "--encoders") ok = args.IntValue(options.encode_threads);
+        else if (name == "--queue") ok = args.IntValue(queue) && queue > 0;
+        else if (name == "--cv-threads") ok = args.IntValue(cv_threads);
+        else if (name == "--cache-dir") ok = args.Value(cache_dir);
+        else if (name == "--cache-size") {
+            std::string size;
+            ok = args.Value(size) && ParseBytes(size, cache_bytes);
+        }
+        else if (EncoderFlag(name, args, options.encoder, ok)) {}
+        else ok = false;
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n", name.c_str());
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (input.empty() || options.output_dir.empty()) {
+        PrintUsage();
+        return 2;
+    }
+
+    if (!LoadParams(spec, spec_file, options.params))
+        return 2;
+
+    options.inputs = ExpandInputs(input);
+    if (options.inputs.empty()) {
+        std::fprintf(stderr, "No input images match '%s'\n", input.c_str());
+        return 1;
+    }
+
+    std::error_code ec;
+    std::filesystem::create_directories(options.output_dir, ec);
+    options.queue_capacity = (size_t)queue;
+    // Only for the run: the workers share OpenCV's threads, and the count is restored
+    // on every return
+    ScopedCvThreads scoped_threads(cv_threads);
+
+    std::unique_ptr<DiskCache> cache;
+    if (!cache_dir.empty()) {
+        cache.reset(new DiskCache(cache_dir, cache_bytes));
+        options.disk_cache = cache.get();
+        std::printf("Result cache: %s (%zu entries, %.1f MB of %.1f MB)\n", cache_dir.c_str(),
+            cache->Entries(), cache->Bytes() / (1024.0 * 1024.0), cache_bytes / (1024.0 * 1024.0));
+    }
+
+    std::printf("Pipeline: %s\n", FormatPipelineSpec(options.params).c_str());
+    std::printf("Processing %zu images...\n", options.inputs.size());
+
+    BatchReport report = RunBatch(options);
+    if (!report.error.empty()) {
+        std::fprintf(stderr, "Error: %s\n", report.error.c_str());
+        return 1;
+    }
+
+    std::printf("Processed %zu images (%zu failed) in %.2f s: %.2f images/sec\n",
+        report.processed, report.failed, report.wall_seconds, report.ImagesPerSecond());
+    std::printf("  %-8s %2d threads  busy %8.2f s  utilization %5.1f%%\n", "decode",
+        report.decode.threads, report.decode.busy_seconds, 100.0 * report.decode.Utilization(report.wall_seconds));
+    std::printf("  %-8s %2d threads  busy %8.2f s  utilization %5.1f%%\n", "process",
+        report.process.threads, report.process.busy_seconds, 100.0 * report.process.Utilization(report.wall_seconds));
+    std::printf("  %-8s %2d threads  busy %8.2f s  utilization %5.1f%%\n", "encode",
+        report.encode.threads, report.encode.busy_seconds, 100.0 * report.encode.Utilization(report.wall_seconds));
+
+    if (cache) {
+        DiskCacheStats stats = cache->Stats();
+        std::printf("Result cache: %llu hits, %llu misses (%.1f%% hit rate), %llu written, %llu evicted, "
+            "%.1f MB read, %.1f MB written\n",
+            (unsigned long long)stats.hits, (unsigned long long)stats.misses, 100.0 * stats.HitRate(),
+            (unsigned long long)stats.writes, (unsigned long long)stats.evictions,
+            stats.bytes_read / (1024.0 * 1024.0), stats.bytes_written / (1024.0 * 1024.0));
+    }
+
+    return report.failed == 0 ? 0 : 1;
+}
+
+int RunStreamCommand(Args args) {
+    StreamOptions options;
+    std::string spec, spec_file, name, error;
+    int queue = (int)options.queue_capacity;
+    int cv_threads = 1;  // parallelism comes from the frame workers by default
+
+    while (args.Next(name)) {
+        bool ok = true;
+        if (name == "--input") ok = args.Value(options.input);
+        else if (name == "--output") ok = args.Value(options.output);
+        else if (name == "--pipeline") ok = args.Value(spec);
+        else if (name == "--pipeline-file") ok = args.Value(spec_file);
+        else if (name == "--fourcc") ok = args.Value(options.fourcc);
+        else if (name == "--fps") ok = args.DoubleValue(options.fps) && options.fps > 0.0;
+        else if (name == "--workers") ok = args.IntValue(options.process_threads);
+        else if (name == "--queue") ok = args.IntValue(queue) && queue > 0;
+        else if (name == "--cv-threads") ok = args.IntValue(cv_threads);
+        else if (name == "--realtime") options.realtime = true;
+        else if (EncoderFlag(name, args, options.encoder, ok)) {}
+        else ok = false;
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n", name.c_str());
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (options.input.empty()) {
+        PrintUsage();
+        return 2;
+    }
+    if (!LoadParams(spec, spec_file, options.params))
+        return 2;
+
+    options.queue_capacity = (size_t)queue;
+    // Only for the stream: frame workers share OpenCV's threads, and the count is
+    // restored on every return
+    ScopedCvThreads scoped_threads(cv_threads);
+
+    std::printf("Pipeline: %s\n", FormatPipelineSpec(options.params).c_str());
+
+    StreamReport report;
+    if (!RunStream(options, &report, &error)) {
+        std::fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+
+    std::printf("%zu frames read, %zu written, %zu dropped, %zu failed in %.2f s\n",
+        report.read, report.written, report.dropped, report.failed, report.wall_seconds);
+    std::printf("  %.2f fps sustained (slowest second %.0f fps), source %.2f fps\n",
+        report.FramesPerSecond(), report.slowest_second_fps, report.source_fps);
+    std::printf("  %-8s %2d threads  busy %8.2f s  utilization %5.1f%%\n", "decode",
+        report.decode.threads, report.decode.busy_seconds, 100.0 * report.decode.Utilization(report.wall_seconds));
+    std::printf("  %-8s %2d threads  busy %8.2f s  utilization %5.1f%%\n", "process",
+        report.process.threads, report.process.busy_seconds, 100.0 * report.process.Utilization(report.wall_seconds));
+    std::printf("  %-8s %2d threads  busy %8.2f s  utilization %5.1f%%\n", "encode",
+        report.encode.threads, report.encode.busy_seconds, 100.0 * report.encode.Utilization(report.wall_seconds));
+    return report.failed == 0 ? 0 : 1;
+}
+
+int RunTileCommand(Args args) {
+    TiledOptions options;
+    PipelineParams params;
+    std::string input, output, spec, spec_file, memory, name, error;
+
+    while (args.Next(name)) {
+        bool ok = true;
+        if (name == "--input") ok = args.Value(input);
+        else if (name == "--output") ok = args.Value(output);
+        else if (name == "--pipeline") ok = args.Value(spec);
+        else if (name == "--pipeline-file") ok = args.Value(spec_file);
+        else if (name == "--memory") ok = args.Value(memory) && ParseBytes(memory, options.memory_limit);
+        else ok = false;
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n", name.c_str());
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (input.empty() || output.empty()) {
+        PrintUsage();
+        return 2;
+    }
+    if (!LoadParams(spec, spec_file, params))
+        return 2;
+
+    std::printf("Pipeline: %s\n", FormatPipelineSpec(params).c_str());
+
+    TiledReport report;
+    int64 start = cv::getTickCount();
+    if (!RunTiled(input, output, params, options, &report, &error)) {
+        std::fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    double seconds = (cv::getTickCount() - start) / cv::getTickFrequency();
+
+    std::printf("%dx%d in %d strips of %d rows (halo %d) in %.2f s\n",
+        report.image_size.width, report.image_size.height, report.strips, report.strip_rows, report.halo, seconds);
+    std::printf("  estimated peak pixel memory %.1f MB%s\n", report.estimated_peak_bytes / (1024.0 * 1024.0),
+        report.streaming ? "" : " (plus the whole image: format is not streamable, use .pgm/.ppm)");
+    if (report.otsu_prepass)
+        std::printf("  Otsu pre-pass threshold: %d\n", report.otsu_threshold);
+    return 0;
+}
+
+int RunGraphCommand(Args args) {
+    std::string input, output, graph_file, name, error;
+    int threads = 0;
+
+    while (args.Next(name)) {
+        bool ok = true;
+        if (name == "--input") ok = args.Value(input);
+        else if (name == "--output") ok = args.Value(output);
+        else if (name == "--graph") ok = args.Value(graph_file);
+        else if (name == "--threads") ok = args.IntValue(threads);
+        else ok = false;
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n", name.c_str());
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (input.empty() || output.empty() || graph_file.empty()) {
+        PrintUsage();
+        return 2;
+    }
+
+    NodeGraph graph;
+    if (!LoadGraphFile(graph_file, graph, &error)) {
+        std::fprintf(stderr, "Graph error: %s\n", error.c_str());
+        return 2;
+    }
+
+    cv::Mat image;
+    {
+        NBIP_PROFILE_SCOPE("Decode");
+        image = ReadNativeImage(input);
+    }
+    if (image.empty()) {
+        std::fprintf(stderr, "Cannot read '%s'\n", input.c_str());
+        return 1;
+    }
+
+    // Every source node reads the input image
+    std::map<std::string, cv::Mat> sources;
+    for (const GraphNode& node : graph.Nodes()) {
+        if (node.kind == NodeKind::Source)
+            sources[node.name] = image;
+    }
+
+    GraphExecutor executor(threads);
+    std::vector<cv::Mat> results;
+    GraphRunStats stats;
+    if (!executor.Run(graph, sources, results, &stats, &error)) {
+        std::fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    if (!cv::imwrite(output, results[0])) {
+        std::fprintf(stderr, "Cannot write '%s'\n", output.c_str());
+        return 1;
+    }
+
+    std::printf("%d nodes in %.1f ms: up to %d in parallel (graph width %d), OpenCV threads %d, "
+        "peak %zu intermediates, %llu steals\n",
+        stats.nodes_run, stats.wall_ms, stats.max_parallel, stats.width, stats.opencv_threads,
+        stats.peak_intermediates, (unsigned long long)stats.steals);
+    return 0;
+}
+
+// Every combination of one or two swept parameters, as a contact sheet and a CSV of timings
+int RunSweepCommand(Args args) {
+    PipelineParams params;
+    SweepOptions options;
+    std::vector<SweepAxis> axes;
+    std::string input, spec, spec_file, sheet, csv, output_dir, ext = ".png", name, error;
+    int cell = 256, columns = 0;
+    int cv_threads = 1;  // parallelism comes from the variants by default
+
+    while (args.Next(name)) {
+        bool ok = true;
+        if (name == "--input") ok = args.Value(input);
+        else if (name == "--pipeline") ok = args.Value(spec);
+        else if (name == "--pipeline-file") ok = args.Value(spec_file);
+        else if (name == "--sweep") {
+            std::string text;
+            SweepAxis axis;
+            ok = args.Value(text) && ParseSweepAxis(text, axis, &error);
+            if (ok) axes.push_back(axis);
+            else if (!error.empty()) std::fprintf(stderr, "Sweep error: %s\n", error.c_str());
+        }
+        else if (name == "--sheet") ok = args.Value(sheet);
+        else if (name == "--cell") ok = args.IntValue(cell) && cell > 0;
+        else if (name == "--columns") ok = args.IntValue(columns);
+        else if (name == "--csv") ok = args.Value(csv);
+        else if (name == "--output-dir") ok = args.Value(output_dir);
+        else if (name == "--ext") ok = args.Value(ext);
+        else if (name == "--workers") ok = args.IntValue(options.threads);
+        else if (name == "--cv-threads") ok = args.IntValue(cv_threads);
+        else ok = false;
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n", name.c_str());
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (input.empty() || axes.empty() || axes.size() > 2) {
+        PrintUsage();
+        return 2;
+    }
+    if (!LoadParams(spec, spec_file, params))
+        return 2;
+    size_t combinations = 1;
+    for (const SweepAxis& axis : axes)
+        combinations *= axis.values.size();
+    if (combinations > kMaxSweepVariants) {
+        std::fprintf(stderr, "%zu combinations; at most %zu are swept at once\n", combinations, kMaxSweepVariants);
+        return 2;
+    }
+
+    cv::Mat image;
+    {
+        NBIP_PROFILE_SCOPE("Decode");
+        image = ReadNativeImage(input);
+    }
+    if (image.empty()) {
+        std::fprintf(stderr, "Cannot read '%s'\n", input.c_str());
+        return 1;
+    }
+    // Only for the sweep: variants share OpenCV's threads, and the count is restored on
+    // every return
+    ScopedCvThreads scoped_threads(cv_threads);
+
+    // Full-size results are written as they finish; only thumbnails are kept
+    std::atomic<size_t> write_failures{ 0 };
+    if (!output_dir.empty()) {
+        std::error_code ec;
+        std::filesystem::create_directories(output_dir, ec);
+        options.consume = [&](size_t index, const cv::Mat& result) {
+            char file[32];
+            std::snprintf(file, sizeof(file), "sweep_%03zu", index);
+            std::string path = (std::filesystem::path(output_dir) / (file + ext)).string();
+            std::string write_error;
+            if (!WriteImage(path, result, EncoderOptions(), nullptr, &write_error)) {
+                std::fprintf(stderr, "%s\n", write_error.c_str());
+                write_failures++;
+            }
+        };
+    }
+    options.thumbnail_width = cell;
+
+    std::printf("Pipeline: %s\n", FormatPipelineSpec(params).c_str());
+    SweepResult result = RunSweep(image, params, axes, options);
+
+    std::printf("%zu variants in %.2f s; %d shared stages in %.1f ms (%.1f ms if run separately)\n",
+        result.variants.size(), result.wall_seconds, result.shared_stages, result.prefix_ms, result.UnsharedMs());
+    size_t variant_failures = 0;
+    for (size_t i = 0; i < result.variants.size(); i++) {
+        const SweepVariant& variant = result.variants[i];
+        if (!variant.error.empty()) {
+            std::printf("  %3zu  %-28s failed: %s\n", i, SweepLabel(axes, variant).c_str(), variant.error.c_str());
+            variant_failures++;
+            continue;
+        }
+        std::printf("  %3zu  %-28s %8.2f ms  (+%.2f ms shared)\n", i, SweepLabel(axes, variant).c_str(),
+            variant.ms, variant.shared_ms);
+    }
+
+    if (!sheet.empty() && !cv::imwrite(sheet, ContactSheet(result, axes, cell, columns))) {
+        std::fprintf(stderr, "Cannot write '%s'\n", sheet.c_str());
+        return 1;
+    }
+    if (!csv.empty() && !WriteSweepCsv(csv, result, axes, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    return write_failures == 0 && variant_failures == 0 ? 0 : 1;
+}
+
+// Converts between the text spec and the binary description
+int RunPipelineCommand(Args args) {
+    PipelineParams params;
+    std::string spec, spec_file, output, name, error;
+
+    while (args.Next(name)) {
+        bool ok = true;
+        if (name == "--pipeline") ok = args.Value(spec);
+        else if (name == "--pipeline-file") ok = args.Value(spec_file);
+        else if (name == "--output") ok = args.Value(output);
+        else ok = false;
+
+        if (!ok) {
+            std::fprintf(stderr, "Invalid argument: %s\n", name.c_str());
+            PrintUsage();
+            return 2;
+        }
+    }
+
+    if (!LoadParams(spec, spec_file, params))
+        return 2;
+
+    std::printf("%s\n", FormatPipelineSpec(params).c_str());
+    if (!output.empty() && !SavePipelineProtoFile(output, params, &error)) {
+        std::fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
+
+int RunCommand(const std::string& command, Args args) {
+    if (command == "batch")
+        return RunBatchCommand(args);
+    if (command == "stream")
+        return RunStreamCommand(args);
+    if (command == "tile")
+        return RunTileCommand(args);
+    if (command == "graph")
+        return RunGraphCommand(args);
+    if (command == "sweep")
+        return RunSweepCommand(args);
+    if (command == "pipeline")
+        return RunPipelineCommand(args);
+
+    PrintUsage();
+    return 2;
+}
+
+// Per-scope totals of a traced run, slowest first
+void PrintProfile() {
+    std::vector<ProfileStat> stats = GetProfileStats();
+    std::sort(stats.begin(), stats.end(),
+        [](const ProfileStat& a, const ProfileStat& b) { return a.total_ms > b.total_ms; });
+    for (const ProfileStat& stat : stats) {
+        std::printf("  %-18s %8llu calls  %10.1f ms total  %8.2f ms mean  %8.2f ms max\n", stat.name,
+            (unsigned long long)stat.calls, stat.total_ms, stat.total_ms / stat.calls, stat.max_ms);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    // --trace is accepted by every command, so it is taken out before the command parses
+    std::string trace;
+    std::vector<char*> rest;
+    for (int i = 0; i < argc; i++) {
+        if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+            trace = argv[++i];
+        else
+            rest.push_back(argv[i]);
+    }
+
+    if (rest.size() < 2) {
+        PrintUsage();
+        return 2;
+    }
+
+    if (!trace.empty())
+        EnableProfiling(true, true);
+
+    int result = RunCommand(rest[1], Args{ (int)rest.size(), rest.data(), 2 });
+
+    if (!trace.empty()) {
+        std::string error;
+        if (!WriteChromeTrace(trace, &error)) {
+            std::fprintf(stderr, "%s\n", error.c_str());
+            return result != 0 ? result : 1;
+        }
+        std::printf("Trace: %zu events written to %s\n", CapturedEventCount(), trace.c_str());
+        PrintProfile();
+    }
+    return result;
+}
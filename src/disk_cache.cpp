@@ -0,0 +1,331 @@
+#include "disk_cache.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+const uint64_t kPrime1 = 11400714785074694791ULL;
+const uint64_t kPrime2 = 14029467366897019727ULL;
+const uint64_t kPrime3 = 1609587929392839161ULL;
+const uint64_t kPrime4 = 9650029242287828579ULL;
+const uint64_t kPrime5 = 2870177450012600261ULL;
+
+const char kMagic[4] = {'N', 'B', 'C', '1'};
+const char* kExtension = ".nbc";
+
+uint64_t Rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t Read64(const unsigned char* p) {
+    uint64_t v;
+    std::memcpy(&v, p, 8);
+    return v;
+}
+
+uint32_t Read32(const unsigned char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+uint64_t Round(uint64_t acc, uint64_t input) {
+    acc += input * kPrime2;
+    acc = Rotl(acc, 31);
+    return acc * kPrime1;
+}
+
+uint64_t MergeRound(uint64_t acc, uint64_t value) {
+    acc ^= Round(0, value);
+    return acc * kPrime1 + kPrime4;
+}
+
+struct EntryHeader {
+    char magic[4];
+    int32_t rows;
+    int32_t cols;
+    int32_t type;
+};
+
+// Everything in the header comes from disk: the type must be one OpenCV knows and the
+// pixels must fill the rest of the file exactly, before anything is allocated
+bool ValidHeader(const EntryHeader& header, uint64_t file_bytes) {
+    if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || header.rows <= 0 || header.cols <= 0)
+        return false;
+    if (header.type != CV_MAT_TYPE(header.type) || CV_MAT_DEPTH(header.type) > CV_64F || CV_MAT_CN(header.type) > 4)
+        return false;
+    const uint64_t pixels = (uint64_t)header.rows * (uint64_t)header.cols;
+    if (file_bytes < sizeof(header) || pixels > file_bytes)
+        return false;
+    return sizeof(header) + pixels * CV_ELEM_SIZE(header.type) == file_bytes;
+}
+
+bool ParseEntryName(const std::string& name, uint64_t& key) {
+    if (name.size() != 16 + std::strlen(kExtension) || name.compare(16, std::string::npos, kExtension) != 0)
+        return false;
+    key = 0;
+    for (int i = 0; i < 16; i++) {
+        char c = name[i];
+        int digit;
+        if (c >= '0' && c <= '9') digit = c - '0';
+        else if (c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else return false;
+        key = (key << 4) | (uint64_t)digit;
+    }
+    return true;
+}
+
+}  // namespace
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + size;
+    uint64_t h;
+
+    if (size >= 32) {
+        uint64_t v1 = seed + kPrime1 + kPrime2;
+        uint64_t v2 = seed + kPrime2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - kPrime1;
+        do {
+            v1 = Round(v1, Read64(p));
+            v2 = Round(v2, Read64(p + 8));
+            v3 = Round(v3, Read64(p + 16));
+            v4 = Round(v4, Read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+        h = Rotl(v1, 1) + Rotl(v2, 7) + Rotl(v3, 12) + Rotl(v4, 18);
+        h = MergeRound(h, v1);
+        h = MergeRound(h, v2);
+        h = MergeRound(h, v3);
+        h = MergeRound(h, v4);
+    } else {
+        h = seed + kPrime5;
+    }
+    h += size;
+
+    for (; p + 8 <= end; p += 8)
+        h = Rotl(h ^ Round(0, Read64(p)), 27) * kPrime1 + kPrime4;
+    if (p + 4 <= end) {
+        h = Rotl(h ^ (Read32(p) * kPrime1), 23) * kPrime2 + kPrime3;
+        p += 4;
+    }
+    for (; p < end; p++)
+        h = Rotl(h ^ (*p * kPrime5), 11) * kPrime1;
+
+    h ^= h >> 33;
+    h *= kPrime2;
+    h ^= h >> 29;
+    h *= kPrime3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t HashImage(const cv::Mat& image) {
+    int32_t shape[3] = {image.rows, image.cols, image.type()};
+    uint64_t h = HashBytes(shape, sizeof(shape));
+    if (image.empty())
+        return h;
+    if (image.isContinuous())
+        return HashBytes(image.data, image.total() * image.elemSize(), h);
+
+    // Chain the rows so padding never enters the hash
+    size_t row_bytes = (size_t)image.cols * image.elemSize();
+    for (int y = 0; y < image.rows; y++)
+        h = HashBytes(image.ptr(y), row_bytes, h);
+    return h;
+}
+
+DiskCache::DiskCache(const std::string& directory, size_t max_bytes)
+    : directory_(directory), max_bytes_(max_bytes) {
+    std::error_code ec;
+    fs::create_directories(directory_, ec);
+
+    // Index what earlier runs left behind, most recently used first
+    struct Found {
+        fs::file_time_type time;
+        uint64_t key;
+        size_t bytes;
+    };
+    std::vector<Found> found;
+    for (fs::directory_iterator it(directory_, ec), end; !ec && it != end; it.increment(ec)) {
+        uint64_t key;
+        if (!it->is_regular_file(ec) || !ParseEntryName(it->path().filename().string(), key))
+            continue;
+        Found entry;
+        entry.time = it->last_write_time(ec);
+        entry.key = key;
+        entry.bytes = (size_t)it->file_size(ec);
+        found.push_back(entry);
+    }
+    std::sort(found.begin(), found.end(), [](const Found& a, const Found& b) { return a.time > b.time; });
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const Found& entry : found) {
+        lru_.push_back({entry.key, entry.bytes});
+        index_[entry.key] = std::prev(lru_.end());
+        bytes_ += entry.bytes;
+    }
+    Evict();
+}
+
+std::string DiskCache::EntryPath(uint64_t key) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)key, kExtension);
+    return (fs::path(directory_) / name).string();
+}
+
+bool DiskCache::Load(uint64_t key, cv::Mat& image) {
+    NBIP_PROFILE_SCOPE("Disk cache load");
+    std::string path = EntryPath(key);
+    std::ifstream file(path, std::ios::binary);
+
+    if (!file) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stats_.misses++;
+        return false;
+    }
+
+    std::error_code ec;
+    const uint64_t file_bytes = fs::file_size(path, ec);
+    EntryHeader header;
+    bool ok = !ec && file.read(reinterpret_cast<char*>(&header), sizeof(header)) && ValidHeader(header, file_bytes);
+    cv::Mat loaded;
+    if (ok) {
+        loaded.create(header.rows, header.cols, header.type);
+        file.read(reinterpret_cast<char*>(loaded.data), (std::streamsize)(loaded.total() * loaded.elemSize()));
+        ok = file.gcount() == (std::streamsize)(loaded.total() * loaded.elemSize());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!ok) {
+        // Truncated or corrupt: a miss, and the entry goes
+        file.close();
+        Remove(key);
+        stats_.misses++;
+        return false;
+    }
+
+    size_t bytes = sizeof(header) + loaded.total() * loaded.elemSize();
+    auto found = index_.find(key);
+    if (found != index_.end())
+        lru_.splice(lru_.begin(), lru_, found->second);
+    else
+        Insert(key, bytes);  // written by another process since we started
+
+    // Keep the on-disk order in step for the next process that indexes the directory
+    fs::last_write_time(path, fs::file_time_type::clock::now(), ec);
+
+    stats_.hits++;
+    stats_.bytes_read += bytes;
+    image = loaded;
+    return true;
+}
+
+bool DiskCache::Store(uint64_t key, const cv::Mat& image) {
+    if (image.empty() || image.dims != 2)
+        return false;
+    NBIP_PROFILE_SCOPE("Disk cache store");
+
+    std::string temp;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(key);
+        if (found != index_.end()) {
+            lru_.splice(lru_.begin(), lru_, found->second);
+            return true;
+        }
+        // Unique among the processes sharing the directory as well as our own threads
+        temp = EntryPath(key) + ".tmp" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) +
+               "-" + std::to_string(next_temp_++);
+    }
+
+    EntryHeader header;
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.rows = image.rows;
+    header.cols = image.cols;
+    header.type = image.type();
+
+    size_t row_bytes = (size_t)image.cols * image.elemSize();
+    {
+        std::ofstream file(temp, std::ios::binary | std::ios::trunc);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        for (int y = 0; y < image.rows && file; y++)
+            file.write(reinterpret_cast<const char*>(image.ptr(y)), (std::streamsize)row_bytes);
+        file.close();
+        if (!file) {
+            std::error_code ec;
+            fs::remove(temp, ec);
+            return false;
+        }
+    }
+
+    std::error_code ec;
+    fs::rename(temp, EntryPath(key), ec);
+    if (ec) {
+        fs::remove(temp, ec);
+        return false;
+    }
+
+    size_t bytes = sizeof(header) + row_bytes * image.rows;
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (index_.find(key) == index_.end())
+        Insert(key, bytes);
+    stats_.writes++;
+    stats_.bytes_written += bytes;
+    Evict();
+    return true;
+}
+
+void DiskCache::Insert(uint64_t key, size_t bytes) {
+    lru_.push_front({key, bytes});
+    index_[key] = lru_.begin();
+    bytes_ += bytes;
+}
+
+void DiskCache::Remove(uint64_t key) {
+    std::error_code ec;
+    fs::remove(EntryPath(key), ec);
+    auto found = index_.find(key);
+    if (found == index_.end())
+        return;
+    bytes_ -= found->second->bytes;
+    lru_.erase(found->second);
+    index_.erase(found);
+}
+
+void DiskCache::Evict() {
+    // Always keep the newest entry, even if it alone exceeds the limit
+    while (bytes_ > max_bytes_ && lru_.size() > 1) {
+        const Entry& victim = lru_.back();
+        std::error_code ec;
+        fs::remove(EntryPath(victim.key), ec);
+        bytes_ -= victim.bytes;
+        index_.erase(victim.key);
+        lru_.pop_back();
+        stats_.evictions++;
+    }
+}
+
+size_t DiskCache::Bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+size_t DiskCache::Entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+DiskCacheStats DiskCache::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
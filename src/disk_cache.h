@@ -0,0 +1,71 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// 64-bit non-cryptographic hash (XXH64 construction)
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0);
+
+// Hash of an image's shape, type and pixels (padding between rows is ignored)
+uint64_t HashImage(const cv::Mat& image);
+
+struct DiskCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t writes = 0;
+    uint64_t evictions = 0;
+    uint64_t bytes_read = 0;
+    uint64_t bytes_written = 0;
+
+    double HitRate() const {
+        uint64_t lookups = hits + misses;
+        return lookups > 0 ? double(hits) / lookups : 0.0;
+    }
+};
+
+// Content-addressed store of stage results on disk, shared between runs and between
+// processes. Entries are named by their key (see Pipeline::SetDiskCache) and are never
+// modified, so a lookup either finds a complete result or none: entries are written to
+// a temporary file and renamed into place. Once the directory grows past its size limit,
+// the least recently used entries are deleted.
+//
+// Thread-safe; several pipelines may share one cache.
+class DiskCache {
+public:
+    // Creates `directory` if needed and indexes the entries already in it
+    DiskCache(const std::string& directory, size_t max_bytes);
+
+    bool Load(uint64_t key, cv::Mat& image);
+    bool Store(uint64_t key, const cv::Mat& image);
+
+    const std::string& Directory() const { return directory_; }
+    size_t MaxBytes() const { return max_bytes_; }
+    size_t Bytes() const;
+    size_t Entries() const;
+    DiskCacheStats Stats() const;
+
+private:
+    struct Entry {
+        uint64_t key;
+        size_t bytes;
+    };
+
+    std::string directory_;
+    size_t max_bytes_;
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_;  // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    size_t bytes_ = 0;
+    uint64_t next_temp_ = 0;
+    DiskCacheStats stats_;
+
+    std::string EntryPath(uint64_t key) const;
+    void Insert(uint64_t key, size_t bytes);  // mutex held
+    void Remove(uint64_t key);                // mutex held; deletes the file too
+    void Evict();                             // mutex held
+};
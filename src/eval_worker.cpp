@@ -0,0 +1,170 @@
+#include "eval_worker.h"
+
+EvaluationWorker::EvaluationWorker() : thread_([this] { WorkerLoop(); }) {}
+
+EvaluationWorker::~EvaluationWorker() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        cancel_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+void EvaluationWorker::SetSource(const cv::Mat& image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    source_ = image;
+    source_changed_ = true;
+    has_pending_ = false;
+    has_result_ = false;
+    result_taken_ = true;
+    result_.release();
+    result_stage_.fill(StageResult());
+    resolved_ = cv::Mat();
+    resolved_version_ = 0;
+    if (running_)
+        cancel_ = true;
+    wake_.notify_one();
+}
+
+void EvaluationWorker::Post(const PipelineParams& params) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Already being computed (and not on its way out)
+    if (running_ && !cancel_ && EquivalentParams(running_params_, params)) {
+        has_pending_ = false;
+        return;
+    }
+    // Already computed
+    if (!running_ && !source_changed_ && ResultMatches(params)) {
+        has_pending_ = false;
+        return;
+    }
+    if (has_pending_ && EquivalentParams(pending_, params))
+        return;
+
+    pending_ = params;
+    has_pending_ = true;
+    if (running_)
+        cancel_ = true;
+    wake_.notify_one();
+}
+
+void EvaluationWorker::Cancel() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    has_pending_ = false;
+    if (running_)
+        cancel_ = true;
+}
+
+bool EvaluationWorker::TakeResult(cv::Mat& image, PipelineParams& params) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!has_result_ || result_taken_)
+        return false;
+    image = result_;
+    params = result_params_;
+    result_taken_ = true;
+    return true;
+}
+
+bool EvaluationWorker::Result(const PipelineParams& params, cv::Mat& image) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (source_changed_ || !ResultMatches(params))
+        return false;
+    image = result_;
+    return true;
+}
+
+bool EvaluationWorker::StageOutput(Stage stage, const PipelineParams& requested, cv::Mat& image,
+                                   uint64_t& version) const {
+    StageResult record;
+    PipelineParams params;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        record = result_stage_[static_cast<int>(stage)];
+        if (!ResultMatches(requested) || record.version == 0)
+            return false;
+        // A fused stage is replayed once per version, not once per call
+        if (record.version == resolved_version_) {
+            image = resolved_;
+            version = resolved_version_;
+            return true;
+        }
+        params = result_params_;
+    }
+
+    if (!ResolveStageOutput(stage, record, params, image))
+        return false;
+    version = record.version;
+    if (!record.group_input.empty()) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        resolved_ = image;
+        resolved_version_ = record.version;
+    }
+    return true;
+}
+
+bool EvaluationWorker::Busy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return has_pending_ || running_;
+}
+
+StageCacheStats EvaluationWorker::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+FormatSavings EvaluationWorker::LastFormatSavings() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return savings_;
+}
+
+bool EvaluationWorker::ResultMatches(const PipelineParams& params) const {
+    return has_result_ && EquivalentParams(result_params_, params);
+}
+
+void EvaluationWorker::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    for (;;) {
+        wake_.wait(lock, [&] { return stopping_ || has_pending_ || source_changed_; });
+        if (stopping_)
+            return;
+
+        if (source_changed_) {
+            pipeline_.SetSource(source_);
+            source_.release();
+            source_changed_ = false;
+        }
+        if (!has_pending_)
+            continue;
+
+        PipelineParams params = pending_;
+        has_pending_ = false;
+        running_ = true;
+        running_params_ = params;
+        cancel_ = false;
+        lock.unlock();
+
+        bool finished = pipeline_.Evaluate(params, cancel_);
+        cv::Mat result = pipeline_.Result();
+        StageCacheStats stats = pipeline_.TotalStats();
+        FormatSavings savings = pipeline_.LastFormatSavings();
+        std::array<StageResult, kStageCount> stage_result;
+        for (int i = 0; i < kStageCount; i++)
+            stage_result[i] = pipeline_.StageRecord(static_cast<Stage>(i));
+
+        lock.lock();
+        running_ = false;
+        stats_ = stats;
+        // A source change while running makes the result stale
+        if (finished && !source_changed_) {
+            result_ = result;
+            result_params_ = params;
+            result_stage_ = stage_result;
+            savings_ = savings;
+            has_result_ = true;
+            result_taken_ = false;
+        }
+    }
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "pipeline.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+// Runs Pipeline::Evaluate on a dedicated thread.
+//
+// Requests coalesce: Post() replaces any request that hasn't started yet, and cancels
+// the one in flight if it is for different parameters, so only the newest snapshot is
+// ever computed to completion. Cancellation takes effect between stages and between row
+// bands of the slow ones. The last completed result stays available until a newer one
+// replaces it.
+class EvaluationWorker {
+public:
+    EvaluationWorker();
+    ~EvaluationWorker();
+
+    EvaluationWorker(const EvaluationWorker&) = delete;
+    EvaluationWorker& operator=(const EvaluationWorker&) = delete;
+
+    // Drops pending work and the last result; later requests run on `image`
+    void SetSource(const cv::Mat& image);
+
+    // Requests an evaluation of `params` (a no-op if it's already pending or running)
+    void Post(const PipelineParams& params);
+
+    // Drops the pending request and cancels the one in flight
+    void Cancel();
+
+    // Hands out a result completed since the last call, if any
+    bool TakeResult(cv::Mat& image, PipelineParams& params);
+
+    // The last completed result, without waiting; false unless it is for `params`
+    bool Result(const PipelineParams& params, cv::Mat& image) const;
+
+    // Output of `stage` in the last completed result (see Pipeline::StageOutput), false
+    // unless that result is for `params`. A fused stage is replayed on the calling thread
+    // the first time it is asked for.
+    bool StageOutput(Stage stage, const PipelineParams& params, cv::Mat& image, uint64_t& version) const;
+
+    // True while a request is pending or running
+    bool Busy() const;
+
+    // Cache counters of the worker's pipeline, as of the last finished evaluation
+    StageCacheStats Stats() const;
+
+    // What the format plan saved in the last completed evaluation
+    FormatSavings LastFormatSavings() const;
+
+private:
+    void WorkerLoop();
+    bool ResultMatches(const PipelineParams& params) const;
+
+    Pipeline pipeline_;  // only touched by the worker thread
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::atomic<bool> cancel_{ false };
+
+    // Guarded by mutex_
+    bool source_changed_ = false;
+    cv::Mat source_;
+    bool has_pending_ = false;
+    PipelineParams pending_;
+    bool running_ = false;
+    PipelineParams running_params_;
+    bool has_result_ = false;
+    bool result_taken_ = true;
+    PipelineParams result_params_;
+    cv::Mat result_;
+    std::array<StageResult, kStageCount> result_stage_;
+    mutable cv::Mat resolved_;          // the last fused stage replayed
+    mutable uint64_t resolved_version_ = 0;
+    StageCacheStats stats_;
+    FormatSavings savings_;
+    bool stopping_ = false;
+
+    std::thread thread_;
+};
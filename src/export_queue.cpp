@@ -0,0 +1,204 @@
+#include "export_queue.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <filesystem>
+
+#if defined(_WIN32)
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace {
+
+std::atomic<uint64_t> g_next_temp{ 0 };
+
+long CurrentProcessId() {
+#if defined(_WIN32)
+    return (long)_getpid();
+#else
+    return (long)getpid();
+#endif
+}
+
+std::string LowerExtension(const std::string& path) {
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return ext;
+}
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+// Nearest depth the format stores: 16-bit PNG and PNM, anything in TIFF, float in
+// OpenEXR and Radiance, 8-bit elsewhere
+int EncodableDepth(const std::string& ext, int depth) {
+    if (ext == ".tif" || ext == ".tiff")
+        return depth;
+    if (ext == ".exr" || ext == ".hdr")
+        return CV_32F;
+    if (ext == ".png" || ext == ".ppm" || ext == ".pgm" || ext == ".pnm")
+        return depth == CV_8U ? CV_8U : CV_16U;
+    return CV_8U;
+}
+
+}  // namespace
+
+std::vector<int> EncoderParams(const std::string& path, const EncoderOptions& options) {
+    std::string ext = LowerExtension(path);
+    if (ext == ".png") {
+        return { cv::IMWRITE_PNG_COMPRESSION, std::min(std::max(options.png_compression, 0), 9),
+                 cv::IMWRITE_PNG_STRATEGY, options.png_strategy };
+    }
+    if (ext == ".jpg" || ext == ".jpeg") {
+        return { cv::IMWRITE_JPEG_QUALITY, std::min(std::max(options.jpeg_quality, 0), 100),
+                 cv::IMWRITE_JPEG_PROGRESSIVE, options.jpeg_progressive ? 1 : 0,
+                 cv::IMWRITE_JPEG_OPTIMIZE, options.jpeg_optimize ? 1 : 0 };
+    }
+    if (ext == ".webp")
+        return { cv::IMWRITE_WEBP_QUALITY, std::max(options.webp_quality, 1) };
+    return {};
+}
+
+bool WriteImage(const std::string& path, const cv::Mat& image, const EncoderOptions& options,
+                size_t* bytes_written, std::string* error) {
+    if (image.empty()) return Fail(error, "Nothing to write");
+
+    // Conversions and encoding may fail or run out of memory; only this file fails then
+    std::string temp;
+    try {
+        // Only RGBA and depths the format can't hold need a converted copy
+        cv::Mat pixels = image;
+        if (image.channels() == 4)
+            cv::cvtColor(image, pixels, cv::COLOR_RGBA2BGR);
+        ConvertDepth(pixels, pixels, EncodableDepth(LowerExtension(path), pixels.depth()));
+
+        // Unique among our own threads and other processes writing the same name; it
+        // keeps the extension, which picks the encoder
+        const fs::path target(path);
+        temp = (target.parent_path() / (target.stem().string() + ".tmp" + std::to_string(CurrentProcessId()) +
+                "-" + std::to_string(g_next_temp++) + target.extension().string())).string();
+
+        NBIP_PROFILE_SCOPE("Encode");
+        if (!cv::imwrite(temp, pixels, EncoderParams(path, options))) {
+            std::error_code ec;
+            fs::remove(temp, ec);
+            return Fail(error, "Cannot encode " + path);
+        }
+    } catch (const std::exception& e) {
+        std::error_code ec;
+        if (!temp.empty())
+            fs::remove(temp, ec);
+        return Fail(error, "Cannot encode " + path + ": " + e.what());
+    }
+
+    std::error_code ec;
+    const uintmax_t size = fs::file_size(temp, ec);
+    if (!ec)
+        fs::rename(temp, path, ec);
+    if (ec) {
+        std::string reason = ec.message();
+        fs::remove(temp, ec);
+        return Fail(error, "Cannot replace " + path + ": " + reason);
+    }
+
+    if (bytes_written) *bytes_written = (size_t)size;
+    return true;
+}
+
+ExportQueue::ExportQueue(int threads) : pool_(std::max(1, threads)) {}
+
+ExportQueue::~ExportQueue() {
+    pool_.Wait();
+}
+
+void ExportQueue::Submit(const cv::Mat& image, const std::vector<std::string>& paths, const EncoderOptions& options) {
+    Begin(paths.size());
+    for (const std::string& path : paths)
+        pool_.Submit([this, image, path, options] { Write(image, path, options); });
+}
+
+void ExportQueue::Submit(std::function<cv::Mat()> resolve, const std::vector<std::string>& paths,
+                         const EncoderOptions& options) {
+    Begin(paths.size());
+    pool_.Submit([this, resolve, paths, options] {
+        cv::Mat image;
+        std::string error = "Nothing to write";
+        size_t handed_off = 0;  // paths[1..handed_off] have tasks of their own
+        try {
+            image = resolve();
+            // The other formats go back to the pool; this thread writes the first
+            while (!image.empty() && handed_off + 1 < paths.size()) {
+                const std::string& path = paths[handed_off + 1];
+                pool_.Submit([this, image, path, options] { Write(image, path, options); });
+                handed_off++;
+            }
+        } catch (const std::exception& e) {
+            error = e.what();
+            image.release();
+        }
+        if (image.empty()) {
+            // The first file and every one no task took fail, so each is counted once
+            for (size_t i = handed_off; i < paths.size(); i++)
+                Finish(false, 0, 0, error);
+            return;
+        }
+        if (!paths.empty())
+            Write(image, paths[0], options);
+    });
+}
+
+void ExportQueue::Begin(size_t files) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (progress_.Pending() == 0) {
+        progress_ = ExportProgress();
+        busy_since_ = Clock::now();
+    }
+    progress_.queued += files;
+}
+
+void ExportQueue::Write(const cv::Mat& image, const std::string& path, const EncoderOptions& options) {
+    size_t bytes = 0;
+    std::string error;
+    bool ok = false;
+    try {
+        ok = WriteImage(path, image, options, &bytes, &error);
+    } catch (const std::exception& e) {
+        error = "Cannot write " + path + ": " + e.what();
+    }
+    Finish(ok, bytes, image.total(), error);
+}
+
+void ExportQueue::Finish(bool ok, size_t bytes, uint64_t pixels, const std::string& error) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (ok) {
+        progress_.written++;
+        progress_.bytes += bytes;
+        progress_.pixels += pixels;
+    } else {
+        progress_.failed++;
+        progress_.last_error = error;
+    }
+    if (progress_.Pending() == 0)
+        progress_.wall_seconds = std::chrono::duration<double>(Clock::now() - busy_since_).count();
+}
+
+ExportProgress ExportQueue::Progress() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ExportProgress progress = progress_;
+    if (progress.Pending() > 0)
+        progress.wall_seconds = std::chrono::duration<double>(Clock::now() - busy_since_).count();
+    return progress;
+}
+
+bool ExportQueue::Busy() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return progress_.Pending() > 0;
+}
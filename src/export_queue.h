@@ -0,0 +1,89 @@
+#pragma once
+
+#include "thread_pool.h"
+#include <opencv2/opencv.hpp>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Encoder settings; each format reads only its own fields. The defaults match
+// cv::imwrite's.
+struct EncoderOptions {
+    int png_compression = 1;                            // zlib level 0-9
+    int png_strategy = cv::IMWRITE_PNG_STRATEGY_RLE;    // cv::IMWRITE_PNG_STRATEGY_*
+    int jpeg_quality = 95;                              // 0-100
+    bool jpeg_progressive = false;
+    bool jpeg_optimize = false;                         // optimized Huffman tables
+    int webp_quality = 101;                             // 1-100, above 100 is lossless
+};
+
+// cv::imwrite parameters for the format `path`'s extension selects
+std::vector<int> EncoderParams(const std::string& path, const EncoderOptions& options);
+
+// Encodes `image` straight into a temporary file next to `path` (the encoder writes as it
+// goes; the encoded file is never held in memory) and renames it into place, so `path`
+// never holds a partial file. 8-bit BGR and grayscale are encoded straight from the
+// caller's buffer; four channels are taken as RGBA and converted. Never throws: any
+// failure, running out of memory included, is returned in `error`.
+bool WriteImage(const std::string& path, const cv::Mat& image, const EncoderOptions& options,
+                size_t* bytes_written = nullptr, std::string* error = nullptr);
+
+// Counters since the queue last went from idle to busy
+struct ExportProgress {
+    size_t queued = 0;         // files submitted
+    size_t written = 0;
+    size_t failed = 0;
+    uint64_t bytes = 0;        // encoded bytes written
+    uint64_t pixels = 0;
+    double wall_seconds = 0.0;
+    std::string last_error;
+
+    size_t Pending() const { return queued - written - failed; }
+    double MegabytesPerSecond() const { return wall_seconds > 0.0 ? bytes / (1024.0 * 1024.0) / wall_seconds : 0.0; }
+    double MegapixelsPerSecond() const { return wall_seconds > 0.0 ? pixels * 1e-6 / wall_seconds : 0.0; }
+};
+
+// Writes images on background threads.
+//
+// Each Submit() may name several files (say a PNG and a JPEG of the same result); every
+// file is encoded as its own task, so the formats are written in parallel. The image is
+// shared with the tasks, not copied, and must not be modified until they finish
+// (pipeline results never are). The destructor waits for queued files.
+class ExportQueue {
+public:
+    explicit ExportQueue(int threads = 2);
+    ~ExportQueue();
+
+    ExportQueue(const ExportQueue&) = delete;
+    ExportQueue& operator=(const ExportQueue&) = delete;
+
+    void Submit(const cv::Mat& image, const std::vector<std::string>& paths, const EncoderOptions& options);
+
+    // Same, but `resolve` produces the image on a pool thread first (a result that may
+    // still need evaluating, say), so the caller never waits for it. Every file fails if
+    // it returns an empty image or throws.
+    void Submit(std::function<cv::Mat()> resolve, const std::vector<std::string>& paths,
+                const EncoderOptions& options);
+
+    ExportProgress Progress() const;
+    bool Busy() const;
+
+    // Blocks until every submitted file has been written or has failed
+    void Wait() { pool_.Wait(); }
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    void Begin(size_t files);
+    void Write(const cv::Mat& image, const std::string& path, const EncoderOptions& options);
+    void Finish(bool ok, size_t bytes, uint64_t pixels, const std::string& error);
+
+    mutable std::mutex mutex_;
+    ExportProgress progress_;
+    Clock::time_point busy_since_;
+
+    ThreadPool pool_;  // last: its workers use the members above until it is destroyed
+};
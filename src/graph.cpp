@@ -0,0 +1,393 @@
+#include "graph.h"
+#include "pipeline_spec.h"
+#include "profiler.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+namespace {
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+std::string Trim(const std::string& s) {
+    size_t begin = s.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos) return "";
+    size_t end = s.find_last_not_of(" \t\r\n");
+    return s.substr(begin, end - begin + 1);
+}
+
+int InputCount(NodeKind kind) {
+    switch (kind) {
+    case NodeKind::Source: return 0;
+    case NodeKind::Stage:  return 1;
+    case NodeKind::Blend:  return 2;
+    }
+    return 0;
+}
+
+void Blend(const cv::Mat& a, const cv::Mat& b, double alpha, cv::Mat& output) {
+    // Edge maps and thresholds of a BGR source may be gray or BGR; blend in BGR then
+    cv::Mat a_bgr = a, b_bgr = b;
+    if (a.channels() == 1 && b.channels() == 3) cv::cvtColor(a, a_bgr, cv::COLOR_GRAY2BGR);
+    if (b.channels() == 1 && a.channels() == 3) cv::cvtColor(b, b_bgr, cv::COLOR_GRAY2BGR);
+    cv::addWeighted(a_bgr, alpha, b_bgr, 1.0 - alpha, 0, output);
+}
+
+void RunNode(const GraphNode& node, const std::vector<cv::Mat>& results, cv::Mat& output) {
+    switch (node.kind) {
+    case NodeKind::Stage: {
+        NBIP_PROFILE_SCOPE(StageName(node.stage));
+        RunStage(node.stage, results[node.inputs[0]], output, node.params);
+        break;
+    }
+    case NodeKind::Blend: {
+        NBIP_PROFILE_SCOPE("Blend");
+        Blend(results[node.inputs[0]], results[node.inputs[1]], node.alpha, output);
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+}  // namespace
+
+int NodeGraph::AddSource(const std::string& name) {
+    GraphNode node;
+    node.name = name;
+    node.kind = NodeKind::Source;
+    return AddNode(node);
+}
+
+int NodeGraph::AddStage(const std::string& name, Stage stage, const PipelineParams& params, int input) {
+    GraphNode node;
+    node.name = name;
+    node.kind = NodeKind::Stage;
+    node.stage = stage;
+    node.params = params;
+    node.inputs = { input };
+    return AddNode(node);
+}
+
+int NodeGraph::AddBlend(const std::string& name, int a, int b, double alpha) {
+    GraphNode node;
+    node.name = name;
+    node.kind = NodeKind::Blend;
+    node.alpha = alpha;
+    node.inputs = { a, b };
+    return AddNode(node);
+}
+
+int NodeGraph::AddNode(const GraphNode& node) {
+    nodes_.push_back(node);
+    return (int)nodes_.size() - 1;
+}
+
+int NodeGraph::Find(const std::string& name) const {
+    for (size_t i = 0; i < nodes_.size(); i++) {
+        if (nodes_[i].name == name)
+            return (int)i;
+    }
+    return -1;
+}
+
+std::vector<int> NodeGraph::Outputs() const {
+    if (!outputs_.empty() || nodes_.empty())
+        return outputs_;
+    return { (int)nodes_.size() - 1 };
+}
+
+bool NodeGraph::TopologicalOrder(std::vector<int>& order, std::string* error) const {
+    const int n = (int)nodes_.size();
+    std::vector<int> pending(n, 0);
+    std::vector<std::vector<int>> consumers(n);
+
+    for (int i = 0; i < n; i++) {
+        const GraphNode& node = nodes_[i];
+        if ((int)node.inputs.size() != InputCount(node.kind))
+            return Fail(error, "node '" + node.name + "' has the wrong number of inputs");
+        for (int input : node.inputs) {
+            if (input < 0 || input >= n)
+                return Fail(error, "node '" + node.name + "' has an invalid input");
+            consumers[input].push_back(i);
+            pending[i]++;
+        }
+    }
+    for (int output : Outputs()) {
+        if (output < 0 || output >= n)
+            return Fail(error, "invalid output node");
+    }
+
+    // Kahn's algorithm
+    order.clear();
+    for (int i = 0; i < n; i++) {
+        if (pending[i] == 0)
+            order.push_back(i);
+    }
+    for (size_t k = 0; k < order.size(); k++) {
+        for (int consumer : consumers[order[k]]) {
+            if (--pending[consumer] == 0)
+                order.push_back(consumer);
+        }
+    }
+    if ((int)order.size() != n)
+        return Fail(error, "the graph has a cycle");
+    return true;
+}
+
+bool ParseGraph(const std::string& text, NodeGraph& graph, std::string* error) {
+    NodeGraph g;
+    std::istringstream lines(text);
+    std::string line;
+    int line_number = 0;
+
+    while (std::getline(lines, line)) {
+        line_number++;
+        line = Trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+        std::string where = "line " + std::to_string(line_number) + ": ";
+
+        std::istringstream words(line);
+        std::string first;
+        words >> first;
+        if (first == "output") {
+            std::vector<int> outputs;
+            std::string name;
+            while (words >> name) {
+                int id = g.Find(name);
+                if (id < 0)
+                    return Fail(error, where + "unknown node '" + name + "'");
+                outputs.push_back(id);
+            }
+            g.SetOutputs(outputs);
+            continue;
+        }
+
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+            return Fail(error, where + "expected '<name> = ...'");
+        std::string name = Trim(line.substr(0, eq));
+        std::string rhs = Trim(line.substr(eq + 1));
+        if (name.empty() || name.find_first_of(" \t|") != std::string::npos)
+            return Fail(error, where + "invalid node name");
+        if (g.Find(name) >= 0)
+            return Fail(error, where + "node '" + name + "' is defined twice");
+
+        if (rhs == "input") {
+            g.AddSource(name);
+            continue;
+        }
+
+        if (rhs.compare(0, 6, "blend ") == 0) {
+            std::istringstream args(rhs.substr(6));
+            std::string a, b;
+            double alpha = 0.5;
+            args >> a >> b;
+            if (!(args >> alpha)) alpha = 0.5;
+            int ia = g.Find(a), ib = g.Find(b);
+            if (ia < 0 || ib < 0)
+                return Fail(error, where + "blend needs two existing nodes");
+            g.AddBlend(name, ia, ib, alpha);
+            continue;
+        }
+
+        size_t bar = rhs.find('|');
+        if (bar == std::string::npos)
+            return Fail(error, where + "expected 'input', 'blend <a> <b> [alpha]' or '<node> | <spec>'");
+        std::string input_name = Trim(rhs.substr(0, bar));
+        int input = g.Find(input_name);
+        if (input < 0)
+            return Fail(error, where + "unknown node '" + input_name + "'");
+
+        PipelineParams params;
+        std::string spec_error;
+        if (!ParsePipelineSpec(rhs.substr(bar + 1), params, &spec_error))
+            return Fail(error, where + spec_error);
+
+        // One node per enabled stage; the last one carries the name
+        std::vector<Stage> stages;
+        for (int i = 0; i < kStageCount; i++) {
+            if (MakeStageKey(static_cast<Stage>(i), params)[0] != 0.0)
+                stages.push_back(static_cast<Stage>(i));
+        }
+        if (stages.empty())
+            return Fail(error, where + "the spec enables no stage");
+        for (size_t k = 0; k < stages.size(); k++) {
+            std::string node_name = k + 1 == stages.size() ? name : name + "." + std::to_string(k + 1);
+            input = g.AddStage(node_name, stages[k], params, input);
+        }
+    }
+
+    std::vector<int> order;
+    if (!g.TopologicalOrder(order, error))
+        return false;
+    graph = g;
+    return true;
+}
+
+bool LoadGraphFile(const std::string& path, NodeGraph& graph, std::string* error) {
+    std::ifstream file(path);
+    if (!file)
+        return Fail(error, "cannot open '" + path + "'");
+    std::stringstream text;
+    text << file.rdbuf();
+    return ParseGraph(text.str(), graph, error);
+}
+
+GraphExecutor::GraphExecutor(int threads)
+    : threads_(threads > 0 ? threads : std::max(1, cv::getNumThreads())) {}
+
+bool GraphExecutor::Run(const NodeGraph& graph, const std::map<std::string, cv::Mat>& sources,
+                        std::vector<cv::Mat>& outputs, GraphRunStats* stats, std::string* error) {
+    int64 start = cv::getTickCount();
+    std::vector<int> order;
+    if (!graph.TopologicalOrder(order, error))
+        return false;
+
+    const std::vector<GraphNode>& nodes = graph.Nodes();
+    const int n = (int)nodes.size();
+    const std::vector<int> requested = graph.Outputs();
+
+    // Only the nodes the outputs depend on
+    std::vector<char> needed(n, 0), is_output(n, 0);
+    for (int output : requested)
+        needed[output] = is_output[output] = 1;
+    for (auto it = order.rbegin(); it != order.rend(); ++it) {
+        if (!needed[*it]) continue;
+        for (int input : nodes[*it].inputs)
+            needed[input] = 1;
+    }
+
+    std::vector<cv::Mat> results(n);
+    std::vector<std::vector<int>> consumers(n);
+    std::vector<std::atomic<int>> deps(n), uses(n);
+    std::vector<int> level(n, 0), level_width(n + 1, 0);
+    std::vector<int> ready;
+    int to_run = 0;
+
+    for (int i : order) {
+        if (!needed[i]) continue;
+        const GraphNode& node = nodes[i];
+        if (node.kind == NodeKind::Source) {
+            auto bound = sources.find(node.name);
+            if (bound == sources.end() || bound->second.empty())
+                return Fail(error, "no image bound to source '" + node.name + "'");
+            results[i] = bound->second;
+        }
+        deps[i] = 0;
+        uses[i] = 0;
+        for (int input : node.inputs) {
+            consumers[input].push_back(i);
+            level[i] = std::max(level[i], level[input] + 1);
+            if (nodes[input].kind != NodeKind::Source)
+                deps[i]++;
+        }
+        if (node.kind != NodeKind::Source) {
+            level_width[level[i]]++;
+            to_run++;
+            if (deps[i] == 0)
+                ready.push_back(i);
+        }
+    }
+    for (int i = 0; i < n; i++)
+        uses[i] = (int)consumers[i].size();
+
+    GraphRunStats s;
+    s.width = *std::max_element(level_width.begin(), level_width.end());
+    const bool parallel = s.width > 1 && threads_ > 1;
+
+    std::atomic<int> running(0), max_running(0);
+    std::atomic<int> live(0), peak_live(0);
+    std::mutex error_mutex;
+    std::string first_error;
+    std::atomic<bool> failed(false);
+
+    auto raise = [](std::atomic<int>& peak, int value) {
+        int current = peak.load();
+        while (value > current && !peak.compare_exchange_weak(current, value)) {
+        }
+    };
+
+    // Computes node i and releases the inputs nobody else needs
+    auto execute = [&](int i) {
+        const GraphNode& node = nodes[i];
+        raise(max_running, ++running);
+        if (!failed) {
+            try {
+                cv::Mat output;
+                RunNode(node, results, output);
+                results[i] = output;
+                raise(peak_live, ++live);
+            } catch (const std::exception& e) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!failed.exchange(true))
+                    first_error = "node '" + node.name + "': " + e.what();
+            }
+        }
+        running--;
+
+        // After a failure nothing is released (and `live` left alone) until the error
+        // has been reported
+        if (failed)
+            return;
+        for (int input : node.inputs) {
+            if (uses[input].fetch_sub(1) == 1 && !is_output[input] && nodes[input].kind != NodeKind::Source) {
+                results[input].release();
+                live--;
+            }
+        }
+    };
+
+    int cv_threads = cv::getNumThreads();
+    if (parallel) {
+        // Split OpenCV's threads between the branches that can run at once
+        int branches = std::min(s.width, threads_);
+        s.opencv_threads = std::max(1, cv_threads / branches);
+        cv::setNumThreads(s.opencv_threads);
+
+        if (!pool_ || pool_->Size() != threads_)
+            pool_ = std::make_unique<ThreadPool>(threads_);
+        uint64_t steals_before = pool_->Steals();
+
+        std::function<void(int)> submit = [&](int i) {
+            pool_->Submit([&, i] {
+                execute(i);
+                for (int consumer : consumers[i]) {
+                    if (deps[consumer].fetch_sub(1) == 1)
+                        submit(consumer);
+                }
+            });
+        };
+        for (int i : ready)
+            submit(i);
+        pool_->Wait();
+
+        s.steals = pool_->Steals() - steals_before;
+        cv::setNumThreads(cv_threads);
+    } else {
+        s.opencv_threads = cv_threads;
+        for (int i : order) {
+            if (needed[i] && nodes[i].kind != NodeKind::Source)
+                execute(i);
+        }
+    }
+
+    if (failed)
+        return Fail(error, first_error);
+
+    outputs.clear();
+    for (int output : requested)
+        outputs.push_back(results[output]);
+
+    s.nodes_run = to_run;
+    s.max_parallel = max_running;
+    s.peak_intermediates = (size_t)peak_live.load();
+    s.wall_ms = (cv::getTickCount() - start) * 1000.0 / cv::getTickFrequency();
+    if (stats) *stats = s;
+    return true;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "pipeline.h"
+#include "thread_pool.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+enum class NodeKind {
+    Source,  // image bound at run time by name
+    Stage,   // one chain stage (RunStage) on a single input
+    Blend    // inputs[0] * alpha + inputs[1] * (1 - alpha)
+};
+
+struct GraphNode {
+    std::string name;
+    NodeKind kind = NodeKind::Source;
+    Stage stage = Stage::Grayscale;  // Stage nodes
+    PipelineParams params;           // Stage nodes: only the stage's own fields matter
+    double alpha = 0.5;              // Blend nodes
+    std::vector<int> inputs;         // node indices
+};
+
+// Directed acyclic graph of processing nodes. Every node produces one image; nodes name
+// their inputs by index.
+class NodeGraph {
+public:
+    int AddSource(const std::string& name);
+    int AddStage(const std::string& name, Stage stage, const PipelineParams& params, int input);
+    int AddBlend(const std::string& name, int a, int b, double alpha);
+
+    // Adds a node as is; Validate() checks its inputs
+    int AddNode(const GraphNode& node);
+
+    const std::vector<GraphNode>& Nodes() const { return nodes_; }
+    int Find(const std::string& name) const;  // -1 if absent
+
+    // Nodes whose result the caller wants; defaults to the last node added
+    void SetOutputs(const std::vector<int>& outputs) { outputs_ = outputs; }
+    std::vector<int> Outputs() const;
+
+    // Checks input arity and indices and orders the nodes so every node comes after its
+    // inputs. Fails on cycles.
+    bool TopologicalOrder(std::vector<int>& order, std::string* error = nullptr) const;
+
+private:
+    std::vector<GraphNode> nodes_;
+    std::vector<int> outputs_;
+};
+
+// Text form of a graph, one node per line ('#' starts a comment):
+//
+//   src     = input
+//   blurred = src | blur=2
+//   edges   = blurred | edges=canny,low=50,high=150
+//   mask    = blurred | threshold=adaptive,block=15
+//   out     = blend edges mask 0.5
+//   output out
+//
+// `<input> | <spec>` takes a pipeline spec (see pipeline_spec.h); a spec that enables
+// several stages becomes a chain of nodes in the usual stage order.
+bool ParseGraph(const std::string& text, NodeGraph& graph, std::string* error = nullptr);
+bool LoadGraphFile(const std::string& path, NodeGraph& graph, std::string* error = nullptr);
+
+struct GraphRunStats {
+    int nodes_run = 0;
+    int max_parallel = 0;         // most nodes that were running at the same time
+    int width = 0;                // widest topological level of the nodes that ran
+    int opencv_threads = 0;       // cv::getNumThreads() while the graph ran
+    size_t peak_intermediates = 0;  // most node results alive at once
+    uint64_t steals = 0;
+    double wall_ms = 0.0;
+};
+
+// Runs a NodeGraph on a work-stealing pool.
+//
+// A node is submitted as soon as its last input is ready, so independent branches run
+// concurrently. Each node's result is released as soon as its last consumer finishes
+// (requested outputs are kept). While several branches can run at once, OpenCV's own
+// thread count is divided between them so branch and kernel parallelism don't
+// oversubscribe the cores; a graph with no parallel branches runs inline on the calling
+// thread and leaves OpenCV all of them.
+class GraphExecutor {
+public:
+    // threads <= 0 uses cv::getNumThreads()
+    explicit GraphExecutor(int threads = 0);
+
+    // Evaluates the nodes the graph's outputs depend on. `sources` binds Source nodes by
+    // name; `outputs` receives the results in NodeGraph::Outputs() order.
+    bool Run(const NodeGraph& graph, const std::map<std::string, cv::Mat>& sources,
+             std::vector<cv::Mat>& outputs, GraphRunStats* stats = nullptr, std::string* error = nullptr);
+
+private:
+    int threads_;
+    std::unique_ptr<ThreadPool> pool_;  // created on the first parallel run
+};
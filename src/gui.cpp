@@ -13,6 +13,21 @@
 #include <string>
 #include <vector>
 #include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include "blur.h"
+#include "buffer_pool.h"
+#include "export_queue.h"
+#include "histogram.h"
+#include "history.h"
+#include "image_loader.h"
+#include "pipeline.h"
+#include "presenter.h"
+#include "preview.h"
+#include "profiler.h"
+#include "sweep.h"
+#include "viewport.h"
 
 #pragma comment(lib, "d3d11.lib")
 
@@ -25,8 +40,6 @@ HWND g_hWnd = nullptr;
 
 // Image Buffers
 cv::Mat original_image;
-ID3D11ShaderResourceView* g_texture = nullptr;
-ID3D11ShaderResourceView* g_processedTexture = nullptr;
 int g_imageWidth = 0, g_imageHeight = 0;
 
 // Node State
@@ -44,6 +57,7 @@ int lower_threshold = 100;
 int upper_threshold = 200;
 int kernel_size = 1;
 bool overlay_edges = false;
+bool l2_gradient = false;
 
 // Threshold Node State
 bool show_threshold = false;
@@ -51,16 +65,157 @@ int threshold_value = 127;
 int threshold_method = 0;  // 0: Binary, 1: Adaptive, 2: Otsu
 int block_size = 11;  // For adaptive threshold
 int constant = 2;     // For adaptive threshold
+int adaptive_mode = 0;  // Gaussian, Mean, Sauvola, Niblack
+float adaptive_k = 0.2f;
 bool show_histogram = false;
+int histogram_source = 0;   // 0: source image, i: output of stage i - 1
+int histogram_channel = 0;  // 0: Luma, 1: Blue, 2: Green, 3: Red
 std::vector<float> histogram_data(256, 0.0f);  // Store histogram as float
+HistogramCache g_source_histogram;
+HistogramCache g_stage_histogram;
+uint64_t g_source_version = 0;  // bumped on every load
+
+// Undo/redo of the node state. Full-resolution results of recent states are kept (under
+// a memory budget), so stepping back shows them without recomputing. Declared before
+// g_preview, which uses g_results until it is destroyed.
+ParamsHistory g_history;
+ResultStore g_results;
+
+// Processing chain: proxy evaluation while dragging, full resolution once idle
+ProgressivePreview g_preview;
+
+// Decodes off the UI thread; neighbours of the open file are prefetched
+ImageLoader g_loader;
+std::string g_image_path;
+bool g_image_is_preview = false;  // original_image is a reduced decode
+bool g_load_failed = false;
+
+// Saving encodes on background threads; the chosen file plus any extra formats
+ExportQueue g_exports;
+EncoderOptions g_encoder;
+bool export_png = false;
+bool export_jpeg = false;
+bool export_webp = false;
+
+// Profiler overlay: per-scope timings and a rolling frame-time graph
+bool show_profiler = false;
+const int kFrameHistory = 240;
+float g_frame_ms[kFrameHistory] = {};
+int g_frame_index = 0;
 
 // Function declarations
-bool LoadImageToTexture(const cv::Mat& image, ID3D11ShaderResourceView** out_texture, int& width, int& height);
 void CreateRenderTarget();
 void CleanupRenderTarget();
 void CleanupDeviceD3D();
 bool CreateDeviceD3D(HWND hWnd);
 
+// Persistent DEFAULT-usage texture; regions are written with UpdateSubresource
+class D3DDisplayTexture : public DisplayTexture {
+public:
+    D3DDisplayTexture(ID3D11Texture2D* texture, ID3D11ShaderResourceView* view) : texture_(texture), view_(view) {}
+    ~D3DDisplayTexture() override {
+        view_->Release();
+        texture_->Release();
+    }
+
+    bool Update(const cv::Rect& region, const cv::Mat& rgba) override {
+        D3D11_BOX box = { (UINT)region.x, (UINT)region.y, 0,
+                          (UINT)(region.x + region.width), (UINT)(region.y + region.height), 1 };
+        g_pd3dDeviceContext->UpdateSubresource(texture_, 0, &box, rgba.data, (UINT)rgba.step, 0);
+        return true;
+    }
+
+    void* Handle() const override { return view_; }
+
+private:
+    ID3D11Texture2D* texture_;
+    ID3D11ShaderResourceView* view_;
+};
+
+class D3DDisplayBackend : public DisplayBackend {
+public:
+    std::unique_ptr<DisplayTexture> CreateTexture(cv::Size size) override {
+        D3D11_TEXTURE2D_DESC desc = {};
+        desc.Width = size.width;
+        desc.Height = size.height;
+        desc.MipLevels = 1;
+        desc.ArraySize = 1;
+        desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        desc.SampleDesc.Count = 1;
+        desc.Usage = D3D11_USAGE_DEFAULT;
+        desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+
+        ID3D11Texture2D* texture = nullptr;
+        if (FAILED(g_pd3dDevice->CreateTexture2D(&desc, nullptr, &texture)))
+            return nullptr;
+        ID3D11ShaderResourceView* view = nullptr;
+        if (FAILED(g_pd3dDevice->CreateShaderResourceView(texture, nullptr, &view))) {
+            texture->Release();
+            return nullptr;
+        }
+        return std::unique_ptr<DisplayTexture>(new D3DDisplayTexture(texture, view));
+    }
+};
+
+// Source image and processed result on screen: persistent textures, changed regions only
+D3DDisplayBackend g_display;
+Presenter g_source_view(g_display);
+Presenter g_result_view(g_display);
+
+// Snapshot of the GUI node state for the pipeline
+PipelineParams CurrentParams() {
+    PipelineParams params;
+    params.grayscale = show_grayscale;
+    params.brightness = show_brightness;
+    params.brightness_value = brightness_value;
+    params.contrast = show_contrast;
+    params.contrast_value = contrast_value;
+    params.blur = show_blur;
+    params.blur_radius = blur_radius;
+    params.use_gaussian = use_gaussian;
+    params.threshold = show_threshold;
+    params.threshold_method = threshold_method;
+    params.threshold_value = threshold_value;
+    params.block_size = block_size;
+    params.constant = constant;
+    params.adaptive_mode = adaptive_mode;
+    params.adaptive_k = adaptive_k;
+    params.edge_detection = show_edge_detection;
+    params.use_canny = use_canny;
+    params.lower_threshold = lower_threshold;
+    params.upper_threshold = upper_threshold;
+    params.kernel_size = kernel_size;
+    params.overlay_edges = overlay_edges;
+    params.edge_norm = l2_gradient ? 1 : 0;
+    return params;
+}
+
+// Inverse of CurrentParams: loads a parameter set into the GUI node state
+void ApplyParams(const PipelineParams& params) {
+    show_grayscale = params.grayscale;
+    show_brightness = params.brightness;
+    brightness_value = params.brightness_value;
+    show_contrast = params.contrast;
+    contrast_value = params.contrast_value;
+    show_blur = params.blur;
+    blur_radius = params.blur_radius;
+    use_gaussian = params.use_gaussian;
+    show_threshold = params.threshold;
+    threshold_method = params.threshold_method;
+    threshold_value = params.threshold_value;
+    block_size = params.block_size;
+    constant = params.constant;
+    adaptive_mode = params.adaptive_mode;
+    adaptive_k = params.adaptive_k;
+    show_edge_detection = params.edge_detection;
+    use_canny = params.use_canny;
+    lower_threshold = params.lower_threshold;
+    upper_threshold = params.upper_threshold;
+    kernel_size = params.kernel_size;
+    overlay_edges = params.overlay_edges;
+    l2_gradient = params.edge_norm == 1;
+}
+
 // Helper function to calculate display size
 ImVec2 CalculateDisplaySize(int imgWidth, int imgHeight, float maxWidth, float maxHeight) {
     float scale = 1.0f;
@@ -75,6 +230,179 @@ ImVec2 CalculateDisplaySize(int imgWidth, int imgHeight, float maxWidth, float m
     return ImVec2(imgWidth * scale, imgHeight * scale);
 }
 
+// Zoom and pan of the image panel. Fit shows the whole image through the progressive
+// preview; zoomed in, only the visible region is evaluated, tile by tile
+ViewportEvaluator g_viewport;
+Presenter g_zoom_view(g_display);
+bool g_zoom_fit = true;
+float g_zoom = 1.0f;               // screen pixels per full-resolution pixel
+ImVec2 g_view_center(0.5f, 0.5f);  // centre of the view, as a fraction of the image
+const float kMaxZoom = 16.0f;
+
+// Changes the zoom keeping the image point under `anchor` (panel coordinates) in place
+void ZoomAt(float zoom, ImVec2 anchor, ImVec2 panel, float fit_zoom) {
+    float x = g_view_center.x * g_imageWidth + (anchor.x - panel.x / 2) / g_zoom;
+    float y = g_view_center.y * g_imageHeight + (anchor.y - panel.y / 2) / g_zoom;
+    g_zoom = std::min(kMaxZoom, std::max(fit_zoom, zoom));
+    g_view_center.x = (x - (anchor.x - panel.x / 2) / g_zoom) / g_imageWidth;
+    g_view_center.y = (y - (anchor.y - panel.y / 2) / g_zoom) / g_imageHeight;
+    g_zoom_fit = g_zoom <= fit_zoom;
+}
+
+// Start of a `view`-wide window onto `extent` around `center`, kept inside the image (or
+// centred on it when the image is smaller than the view)
+float ClampView(float center, float view, float extent) {
+    if (view >= extent)
+        return (extent - view) / 2;
+    return std::min(extent - view, std::max(0.0f, center - view / 2));
+}
+
+// Zoomed view of the processed image (the source when no stage is on): drag to pan,
+// mouse wheel to zoom around the cursor
+void ShowZoomedImage(const PipelineParams& params, ImVec2 panel, float fit_zoom) {
+    ImGuiIO& io = ImGui::GetIO();
+    ImVec2 origin = ImGui::GetCursorScreenPos();
+    ImGui::InvisibleButton("##ImageView", panel);
+    if (ImGui::IsItemActive() && ImGui::IsMouseDragging(ImGuiMouseButton_Left, 0.0f)) {
+        g_view_center.x -= io.MouseDelta.x / g_zoom / g_imageWidth;
+        g_view_center.y -= io.MouseDelta.y / g_zoom / g_imageHeight;
+    }
+    if (ImGui::IsItemHovered() && io.MouseWheel != 0.0f) {
+        ImVec2 anchor(io.MousePos.x - origin.x, io.MousePos.y - origin.y);
+        ZoomAt(g_zoom * std::pow(1.25f, io.MouseWheel), anchor, panel, fit_zoom);
+    }
+    if (g_zoom_fit)
+        return;
+
+    // Visible region in full-resolution pixels
+    float view_w = panel.x / g_zoom, view_h = panel.y / g_zoom;
+    float x0 = ClampView(g_view_center.x * g_imageWidth, view_w, (float)g_imageWidth);
+    float y0 = ClampView(g_view_center.y * g_imageHeight, view_h, (float)g_imageHeight);
+    g_view_center = ImVec2((x0 + view_w / 2) / g_imageWidth, (y0 + view_h / 2) / g_imageHeight);
+
+    // original_image may still be the reduced preview; the evaluator works in its pixels
+    const float image_scale = (float)original_image.cols / g_imageWidth;
+    cv::Rect region(cv::Point((int)std::floor(x0 * image_scale), (int)std::floor(y0 * image_scale)),
+                    cv::Point((int)std::ceil((x0 + view_w) * image_scale), (int)std::ceil((y0 + view_h) * image_scale)));
+    if (g_viewport.Update(params, region, g_zoom / image_scale))
+        g_zoom_view.Present(g_viewport.Display());
+    if (!g_zoom_view.Texture())
+        return;
+
+    // Screen position of the level pixels that were evaluated
+    const cv::Rect level = g_viewport.LevelRegion();
+    const float to_full = 1.0f / ((float)g_viewport.LevelScale() * image_scale);
+    ImVec2 p0(origin.x + (level.x * to_full - x0) * g_zoom, origin.y + (level.y * to_full - y0) * g_zoom);
+    ImVec2 p1(origin.x + (level.br().x * to_full - x0) * g_zoom, origin.y + (level.br().y * to_full - y0) * g_zoom);
+
+    ImDrawList* draw = ImGui::GetWindowDrawList();
+    draw->PushClipRect(origin, ImVec2(origin.x + panel.x, origin.y + panel.y), true);
+    draw->AddImage((ImTextureID)g_zoom_view.Texture(), p0, p1);
+    draw->PopClipRect();
+}
+
+// Parameter sweep: every combination of one or two parameters, run in the background on
+// a reduced copy of the image and shown as a contact sheet. Clicking a cell applies it.
+bool show_sweep = false;
+int sweep_parameter[2] = { 3, 2 };  // indices into SweepParameterNames(): value, blur
+bool sweep_two_axes = false;
+float sweep_range[2][3] = { { 60.0f, 200.0f, 20.0f }, { 1.0f, 9.0f, 2.0f } };  // first, last, step
+std::future<SweepResult> g_sweep_job;
+std::vector<SweepAxis> g_sweep_axes;
+SweepResult g_sweep;
+cv::Mat g_sweep_sheet;
+std::string g_sweep_error;
+Presenter g_sweep_view(g_display);
+const int kSweepCellWidth = 192;
+const int kSweepSourceSize = 768;  // longest side of the copy the variants run on
+
+void StartSweep() {
+    static const std::vector<std::string> names = SweepParameterNames();
+    std::vector<SweepAxis> axes(sweep_two_axes ? 2 : 1);
+    for (size_t a = 0; a < axes.size(); a++) {
+        if (!MakeSweepAxis(names[sweep_parameter[a]], sweep_range[a][0], sweep_range[a][1], sweep_range[a][2],
+                           axes[a], &g_sweep_error))
+            return;
+    }
+    if (axes.size() == 2 && axes[0].values.size() * axes[1].values.size() > kMaxSweepVariants) {
+        g_sweep_error = "More than " + std::to_string(kMaxSweepVariants) + " combinations";
+        return;
+    }
+    g_sweep_error.clear();
+    g_sweep_axes = axes;
+
+    // Neighbourhood sizes are scaled to the copy, like the preview's proxies
+    cv::Mat source = original_image;
+    const double reduce = std::min(1.0, (double)kSweepSourceSize / std::max(source.cols, source.rows));
+    if (reduce < 1.0)
+        cv::resize(original_image, source, cv::Size(), reduce, reduce, cv::INTER_AREA);
+    SweepOptions options;
+    options.scale = (double)source.cols / g_imageWidth;
+    options.thumbnail_width = kSweepCellWidth;
+    const PipelineParams base = CurrentParams();
+    g_sweep_job = std::async(std::launch::async, [source, base, axes, options] {
+        return RunSweep(source, base, axes, options);
+    });
+}
+
+void ShowSweepWindow() {
+    if (g_sweep_job.valid() && g_sweep_job.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        g_sweep = g_sweep_job.get();
+        g_sweep_sheet = ContactSheet(g_sweep, g_sweep_axes, kSweepCellWidth);
+        g_sweep_view.Present(g_sweep_sheet);
+    }
+    if (!show_sweep)
+        return;
+
+    ImGui::Begin("Sweep", &show_sweep);
+    static std::string items;
+    if (items.empty()) {
+        for (const std::string& name : SweepParameterNames())
+            items += name + '\0';
+    }
+    for (int a = 0; a < 2; a++) {
+        if (a == 1) {
+            ImGui::Checkbox("Second Parameter", &sweep_two_axes);
+            if (!sweep_two_axes) break;
+        }
+        ImGui::PushID(a);
+        ImGui::Combo("Parameter", &sweep_parameter[a], items.c_str());
+        ImGui::InputFloat3("First / Last / Step", sweep_range[a]);
+        ImGui::PopID();
+    }
+
+    if (g_sweep_job.valid()) {
+        ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "Running...");
+    } else if (ImGui::Button("Run Sweep") && !original_image.empty()) {
+        StartSweep();
+    }
+    if (!g_sweep_error.empty())
+        ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%s", g_sweep_error.c_str());
+
+    if (g_sweep_view.Texture() && !g_sweep_sheet.empty()) {
+        ImGui::Text("%zu variants in %.2f s: shared stages %.1f ms, %.1f ms if run separately",
+            g_sweep.variants.size(), g_sweep.wall_seconds, g_sweep.prefix_ms, g_sweep.UnsharedMs());
+        ImGui::TextDisabled("Click a cell to use its values");
+        ImGui::Image((ImTextureID)g_sweep_view.Texture(), ImVec2((float)g_sweep_sheet.cols, (float)g_sweep_sheet.rows));
+        if (ImGui::IsItemHovered()) {
+            ImVec2 mouse = ImGui::GetIO().MousePos, origin = ImGui::GetItemRectMin();
+            int cell = ContactSheetCell(g_sweep, g_sweep_axes, kSweepCellWidth,
+                cv::Point((int)(mouse.x - origin.x), (int)(mouse.y - origin.y)));
+            if (cell >= 0) {
+                const SweepVariant& variant = g_sweep.variants[cell];
+                if (!variant.error.empty())
+                    ImGui::SetTooltip("%s\nfailed: %s", SweepLabel(g_sweep_axes, variant).c_str(), variant.error.c_str());
+                else
+                    ImGui::SetTooltip("%s\n%.2f ms (+%.2f ms shared)", SweepLabel(g_sweep_axes, variant).c_str(),
+                        variant.ms, variant.shared_ms);
+                if (ImGui::IsMouseClicked(ImGuiMouseButton_Left))
+                    ApplyParams(variant.params);
+            }
+        }
+    }
+    ImGui::End();
+}
+
 // Helper Functions
 std::wstring OpenFileDialog() {
     HRESULT hr = CoInitializeEx(NULL, COINIT_APARTMENTTHREADED | COINIT_DISABLE_OLE1DDE);
@@ -130,9 +458,10 @@ std::wstring SaveFileDialog() {
         COMDLG_FILTERSPEC fileTypes[] = {
             {L"PNG Image", L"*.png"},
             {L"JPEG Image", L"*.jpg"},
-            {L"BMP Image", L"*.bmp"}
+            {L"BMP Image", L"*.bmp"},
+            {L"WebP Image", L"*.webp"}
         };
-        pFileSave->SetFileTypes(3, fileTypes);
+        pFileSave->SetFileTypes(4, fileTypes);
         pFileSave->SetDefaultExtension(L"png");
 
         hr = pFileSave->Show(NULL);
@@ -160,40 +489,48 @@ std::wstring SaveFileDialog() {
     return L"";
 }
 
-bool SaveImage(const cv::Mat& image, const std::wstring& path) {
-    if (image.empty() || path.empty()) return false;
-    
+// The chosen file plus the same name in each extra format ticked in the export settings
+std::vector<std::string> ExportPaths(const std::wstring& path) {
     std::string pathStr(path.begin(), path.end());
-    cv::Mat saveImage;
-    
-    // Convert to BGR format for saving
-    if (image.channels() == 1)
-        cv::cvtColor(image, saveImage, cv::COLOR_GRAY2BGR);
-    else if (image.channels() == 4)
-        cv::cvtColor(image, saveImage, cv::COLOR_RGBA2BGR);
-    else
-        saveImage = image.clone();
-
-    return cv::imwrite(pathStr, saveImage);
+    std::vector<std::string> paths = { pathStr };
+    std::string ext = pathStr.substr(std::min(pathStr.size(), pathStr.find_last_of('.')));
+    std::string stem = pathStr.substr(0, pathStr.size() - ext.size());
+    const std::pair<bool, const char*> extra[] = { { export_png, ".png" }, { export_jpeg, ".jpg" }, { export_webp, ".webp" } };
+    for (const auto& format : extra) {
+        if (format.first && _stricmp(ext.c_str(), format.second) != 0)
+            paths.push_back(stem + format.second);
+    }
+    return paths;
 }
 
 bool LoadNewImage(const std::wstring& path) {
     if (path.empty()) return false;
     std::string pathStr(path.begin(), path.end());
-    cv::Mat new_image = cv::imread(pathStr);
-    if (new_image.empty()) return false;
+    g_loader.Request(pathStr);
+    g_image_path = pathStr;
+    g_load_failed = false;
+    return true;
+}
 
-    if (g_texture) {
-        g_texture->Release();
-        g_texture = nullptr;
-    }
-    if (g_processedTexture) {
-        g_processedTexture->Release();
-        g_processedTexture = nullptr;
+// Shows an image handed out by the loader: the reduced preview first, then the full decode
+bool ShowLoadedImage(const LoadedImage& loaded) {
+    if (loaded.Failed()) {
+        g_load_failed = true;
+        return false;
     }
 
-    original_image = new_image;
-    return LoadImageToTexture(original_image, &g_texture, g_imageWidth, g_imageHeight);
+    original_image = loaded.image;
+    g_image_is_preview = loaded.scale > 1;
+    g_source_version++;
+    g_preview.SetSource(original_image);
+    g_viewport.SetSource(original_image);
+    g_zoom_view.Hide();
+    g_result_view.Hide();
+    g_source_view.Present(original_image);
+    // Lay the preview out at the full image's size so the view doesn't jump
+    g_imageWidth = original_image.cols * loaded.scale;
+    g_imageHeight = original_image.rows * loaded.scale;
+    return g_source_view.Texture() != nullptr;
 }
 
 void CreateRenderTarget() {
@@ -242,43 +579,6 @@ bool CreateDeviceD3D(HWND hWnd) {
     return true;
 }
 
-bool LoadImageToTexture(const cv::Mat& image, ID3D11ShaderResourceView** out_texture, int& width, int& height) {
-    if (image.empty()) return false;
-
-    width = image.cols;
-    height = image.rows;
-
-    cv::Mat rgba_image;
-    if (image.channels() == 3)
-        cv::cvtColor(image, rgba_image, cv::COLOR_BGR2RGBA);
-    else if (image.channels() == 1)
-        cv::cvtColor(image, rgba_image, cv::COLOR_GRAY2RGBA);
-    else
-        rgba_image = image;
-
-    D3D11_TEXTURE2D_DESC desc = {};
-    desc.Width = width;
-    desc.Height = height;
-    desc.MipLevels = 1;
-    desc.ArraySize = 1;
-    desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-    desc.SampleDesc.Count = 1;
-    desc.Usage = D3D11_USAGE_DEFAULT;
-    desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
-
-    D3D11_SUBRESOURCE_DATA initData = {};
-    initData.pSysMem = rgba_image.data;
-    initData.SysMemPitch = rgba_image.cols * 4;
-
-    ID3D11Texture2D* tex = nullptr;
-    HRESULT hr = g_pd3dDevice->CreateTexture2D(&desc, &initData, &tex);
-    if (FAILED(hr)) return false;
-
-    hr = g_pd3dDevice->CreateShaderResourceView(tex, nullptr, out_texture);
-    tex->Release();
-
-    return SUCCEEDED(hr);
-}
 
 // Win32 Message Handler
 LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
@@ -307,6 +607,10 @@ LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam) {
 
 // Application Entry
 int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
+    // Before any image is loaded, so every pixel buffer shows up in the gauge
+    EnableAllocationTracking();
+    g_preview.SetResultStore(&g_results);
+
     WNDCLASSEX wc = { sizeof(WNDCLASSEX), CS_CLASSDC, WndProc, 0L, 0L,
                       GetModuleHandle(NULL), NULL, NULL, NULL, NULL,
                       _T("ImGuiWindow"), NULL };
@@ -344,6 +648,10 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
         ImGui_ImplWin32_NewFrame();
         ImGui::NewFrame();
 
+        LoadedImage loaded;
+        if (g_loader.Take(loaded))
+            ShowLoadedImage(loaded);
+
         ImGui::Begin("Welcome to Node-Based Image Editor!");
         
         if (ImGui::Button("Load Image")) {
@@ -353,111 +661,103 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
             }
         }
 
+        // Step through the open file's directory (usually served by the prefetch)
+        if (!g_image_path.empty()) {
+            for (int offset : { -1, 1 }) {
+                ImGui::SameLine();
+                if (ImGui::Button(offset < 0 ? "< Prev" : "Next >")) {
+                    std::string neighbor = g_loader.Neighbor(g_image_path, offset);
+                    if (!neighbor.empty())
+                        LoadNewImage(std::wstring(neighbor.begin(), neighbor.end()));
+                }
+            }
+        }
+
         ImGui::SameLine();
 if (ImGui::Button("Save Image")) {
-    if (!original_image.empty()) {
+    // Not the reduced preview; the full decode is only moments away
+    if (!original_image.empty() && !g_image_is_preview) {
         std::wstring savePath = SaveFileDialog();
         if (!savePath.empty()) {
-            cv::Mat imageToSave;
-            
-            // Save the processed image if any processing is active
-            if (g_processedTexture && (show_grayscale || show_brightness || show_contrast || 
-                show_blur || show_threshold || show_edge_detection)) {
-                
-                imageToSave = original_image.clone();
-                
-                // Apply all active processing steps
-                if (show_grayscale) {
-                    cv::cvtColor(imageToSave, imageToSave, cv::COLOR_BGR2GRAY);
-                }
-                
-                if (show_brightness || show_contrast) {
-                    imageToSave.convertTo(imageToSave, -1, contrast_value, brightness_value);
-                }
-                
-                if (show_blur) {
-                    cv::Size kernel_size(2 * blur_radius + 1, 2 * blur_radius + 1);
-                    if (use_gaussian) {
-                        cv::GaussianBlur(imageToSave, imageToSave, kernel_size, 0);
-                    } else {
-                        cv::blur(imageToSave, imageToSave, kernel_size);
-                    }
-                }
-                
-                if (show_threshold) {
-                    cv::Mat gray;
-                    if (imageToSave.channels() == 3)
-                        cv::cvtColor(imageToSave, gray, cv::COLOR_BGR2GRAY);
-                    else
-                        gray = imageToSave.clone();
-
-                    cv::Mat binary;
-                    if (threshold_method == 0) {
-                        cv::threshold(gray, binary, threshold_value, 255, cv::THRESH_BINARY);
-                    }
-                    else if (threshold_method == 1) {
-                        cv::adaptiveThreshold(gray, binary, 255,
-                            cv::ADAPTIVE_THRESH_GAUSSIAN_C,
-                            cv::THRESH_BINARY,
-                            block_size,
-                            constant);
-                    }
-                    else if (threshold_method == 2) {
-                        cv::threshold(gray, binary, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
-                    }
-                    imageToSave = binary;
-                }
-                
-                if (show_edge_detection) {
-                    cv::Mat edges;
-                    cv::Mat gray;
-                    if (imageToSave.channels() == 3) {
-                        cv::cvtColor(imageToSave, gray, cv::COLOR_BGR2GRAY);
-                    } else {
-                        gray = imageToSave.clone();
-                    }
-                    
-                    int adjusted_kernel_size = kernel_size * 2 - 1;
-                    
-                    if (use_canny) {
-                        cv::GaussianBlur(gray, gray, cv::Size(adjusted_kernel_size, adjusted_kernel_size), 0);
-                        cv::Canny(gray, edges, lower_threshold, upper_threshold);
-                    } else {
-                        cv::Mat grad_x, grad_y;
-                        cv::Sobel(gray, grad_x, CV_16S, 1, 0, adjusted_kernel_size);
-                        cv::Sobel(gray, grad_y, CV_16S, 0, 1, adjusted_kernel_size);
-                        cv::convertScaleAbs(grad_x, grad_x);
-                        cv::convertScaleAbs(grad_y, grad_y);
-                        cv::addWeighted(grad_x, 0.5, grad_y, 0.5, 0, edges);
-                    }
-                    
-                    if (overlay_edges) {
-                        cv::Mat edges_bgr;
-                        cv::cvtColor(edges, edges_bgr, cv::COLOR_GRAY2BGR);
-                        cv::addWeighted(imageToSave, 0.7, edges_bgr, 0.3, 0, imageToSave);
-                    } else {
-                        imageToSave = edges;
-                    }
-                }
-            } else {
-                // Save the original image if no processing is active
-                imageToSave = original_image;
-            }
-            
-            if (SaveImage(imageToSave, savePath)) {
-                MessageBoxW(NULL, L"Image saved successfully!", L"Success", MB_OK | MB_ICONINFORMATION);
-            } else {
-                MessageBoxW(NULL, L"Failed to save image!", L"Error", MB_OK | MB_ICONERROR);
-            }
+            // Write the full-resolution buffer the preview already computed; if the
+            // worker hasn't caught up with the last change, the export thread computes it
+            PipelineParams save_params = CurrentParams();
+            if (save_params.AnyEnabled())
+                g_exports.Submit(g_preview.FullResolutionTask(save_params), ExportPaths(savePath), g_encoder);
+            else
+                g_exports.Submit(original_image, ExportPaths(savePath), g_encoder);
         }
     }
 }
 
-        if (original_image.empty()) {
-            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "No image loaded!");
+        ImGui::SameLine();
+        bool undo = ImGui::Button("Undo") || (io.KeyCtrl && !io.KeyShift && ImGui::IsKeyPressed(ImGuiKey_Z));
+        ImGui::SameLine();
+        bool redo = ImGui::Button("Redo") ||
+            (io.KeyCtrl && (ImGui::IsKeyPressed(ImGuiKey_Y) || (io.KeyShift && ImGui::IsKeyPressed(ImGuiKey_Z))));
+        PipelineParams restored;
+        if ((undo && g_history.Undo(restored)) || (redo && g_history.Redo(restored)))
+            ApplyParams(restored);
+
+        ImGui::SameLine();
+        if (ImGui::Checkbox("Profiler", &show_profiler))
+            EnableProfiling(show_profiler);
+        ImGui::SameLine();
+        ImGui::Checkbox("Sweep", &show_sweep);
+
+        ExportProgress export_progress = g_exports.Progress();
+        if (export_progress.Pending() > 0) {
+            ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "Saving %zu/%zu files... %.1f MB/s",
+                export_progress.written + export_progress.failed, export_progress.queued,
+                export_progress.MegabytesPerSecond());
+        } else if (export_progress.failed > 0) {
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "%s", export_progress.last_error.c_str());
+        } else if (export_progress.written > 0) {
+            ImGui::TextColored(ImVec4(0.0f, 1.0f, 0.0f, 1.0f), "Saved %zu files (%.1f MB) in %.2f s, %.1f MP/s",
+                export_progress.written, export_progress.bytes / (1024.0 * 1024.0),
+                export_progress.wall_seconds, export_progress.MegapixelsPerSecond());
+        }
+
+        if (ImGui::CollapsingHeader("Export Settings")) {
+            ImGui::SliderInt("PNG Compression", &g_encoder.png_compression, 0, 9);
+            ImGui::Combo("PNG Strategy", &g_encoder.png_strategy, "Default\0Filtered\0Huffman Only\0RLE\0Fixed\0");
+            ImGui::SliderInt("JPEG Quality", &g_encoder.jpeg_quality, 0, 100);
+            ImGui::Checkbox("Progressive JPEG", &g_encoder.jpeg_progressive);
+            ImGui::SameLine();
+            ImGui::Checkbox("Optimize Huffman Tables", &g_encoder.jpeg_optimize);
+            ImGui::SliderInt("WebP Quality", &g_encoder.webp_quality, 1, 101, g_encoder.webp_quality > 100 ? "Lossless" : "%d");
+            ImGui::Text("Also Save As:");
+            ImGui::SameLine();
+            ImGui::Checkbox("PNG", &export_png);
+            ImGui::SameLine();
+            ImGui::Checkbox("JPEG", &export_jpeg);
+            ImGui::SameLine();
+            ImGui::Checkbox("WebP", &export_webp);
+        }
+
+        if (g_load_failed) {
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f), "Failed to load %s", g_image_path.c_str());
+        } else if (original_image.empty()) {
+            ImGui::TextColored(ImVec4(1.0f, 0.0f, 0.0f, 1.0f),
+                g_loader.Loading() ? "Loading..." : "No image loaded!");
+        } else if (g_image_is_preview) {
+            ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f),
+                "Image loaded: %dx%d (preview, decoding...)", g_imageWidth, g_imageHeight);
         } else {
             ImGui::TextColored(ImVec4(0.0f, 1.0f, 0.0f, 1.0f), 
-                "Image loaded: %dx%d", original_image.cols, original_image.rows);
+                "Image loaded: %dx%d, %s", original_image.cols, original_image.rows,
+                original_image.depth() == CV_16U ? "16-bit" : original_image.depth() == CV_32F ? "float" : "8-bit");
+            if (g_loader.Loading()) {
+                ImGui::SameLine();
+                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "(loading next...)");
+            }
+        }
+        if (!g_image_path.empty()) {
+            const DecodedImageCache& decoded = g_loader.Cache();
+            DecodeCacheStats decode_stats = decoded.Stats();
+            ImGui::Text("Decoded images: %zu cached, %.1f MB, %llu hits / %llu misses",
+                decoded.Entries(), decoded.Bytes() / (1024.0 * 1024.0),
+                (unsigned long long)decode_stats.hits, (unsigned long long)decode_stats.misses);
         }
 
         ImGui::Separator();
@@ -477,7 +777,7 @@ if (ImGui::Button("Save Image")) {
         }
 
         if (show_blur) {
-            ImGui::SliderInt("Blur Radius", &blur_radius, 1, 20);
+            ImGui::SliderInt("Blur Radius", &blur_radius, 1, kMaxBlurRadius, "%d", ImGuiSliderFlags_Logarithmic);
             ImGui::Checkbox("Use Gaussian Blur", &use_gaussian);
         }
 
@@ -489,36 +789,49 @@ if (ImGui::Button("Save Image")) {
                 ImGui::SliderInt("Threshold Value", &threshold_value, 0, 255);
             }
             else if (threshold_method == 1) {  // Adaptive
+                ImGui::Combo("Local Statistic", &adaptive_mode, "Gaussian\0Mean\0Sauvola\0Niblack\0");
                 ImGui::SliderInt("Block Size", &block_size, 3, 99, "%d");
                 if (block_size % 2 == 0) block_size++;  // Ensure odd number
                 ImGui::SliderInt("Constant", &constant, -10, 10);
+                if (adaptive_mode >= 2)
+                    ImGui::SliderFloat("k", &adaptive_k, 0.0f, 1.0f);
             }
             
             ImGui::Checkbox("Show Histogram", &show_histogram);
             
             if (show_histogram && !original_image.empty()) {
-                // Calculate histogram
-                std::fill(histogram_data.begin(), histogram_data.end(), 0.0f);
-                cv::Mat gray;
-                if (original_image.channels() == 3)
-                    cv::cvtColor(original_image, gray, cv::COLOR_BGR2GRAY);
-                else
-                    gray = original_image.clone();
-
-                for (int i = 0; i < gray.rows; i++) {
-                    for (int j = 0; j < gray.cols; j++) {
-                        histogram_data[gray.at<uchar>(i, j)]++;
-                    }
+                const char* histogram_sources[kStageCount + 1] = { "Source" };
+                for (int i = 0; i < kStageCount; i++)
+                    histogram_sources[i + 1] = StageName(static_cast<Stage>(i));
+                ImGui::Combo("Histogram Of", &histogram_source, histogram_sources, kStageCount + 1);
+                ImGui::Combo("Channel", &histogram_channel, "Luma\0Blue\0Green\0Red\0");
+
+                // Counted once per image version rather than every frame
+                const Histogram* histogram = nullptr;
+                cv::Mat stage_image;
+                uint64_t stage_version = 0;
+                if (histogram_source == 0) {
+                    histogram = &g_source_histogram.Get(original_image, g_source_version);
+                } else if (g_preview.StageOutput(static_cast<Stage>(histogram_source - 1), CurrentParams(), stage_image, stage_version)) {
+                    histogram = &g_stage_histogram.Get(stage_image, stage_version);
                 }
 
-                ImGui::PlotHistogram("##Histogram", 
-                    histogram_data.data(), 
-                    256, 
-                    0,
-                    "Image Histogram", 
-                    0.0f, 
-                    *std::max_element(histogram_data.begin(), histogram_data.end()), 
-                    ImVec2(300, 100));
+                if (histogram) {
+                    const HistogramBins& bins = histogram->Bins(histogram_channel - 1);
+                    for (int v = 0; v < 256; v++)
+                        histogram_data[v] = (float)bins[v];
+
+                    ImGui::PlotHistogram("##Histogram", 
+                        histogram_data.data(), 
+                        256, 
+                        0,
+                        "Image Histogram", 
+                        0.0f, 
+                        *std::max_element(histogram_data.begin(), histogram_data.end()), 
+                        ImVec2(300, 100));
+                } else {
+                    ImGui::TextDisabled("Stage output not computed yet");
+                }
             }
         }
 
@@ -529,133 +842,148 @@ if (ImGui::Button("Save Image")) {
             ImGui::SliderInt("Kernel Size", &kernel_size, 1, 4, "%d");
             ImGui::Text("Actual Kernel Size: %dx%d", kernel_size * 2 - 1, kernel_size * 2 - 1);
             ImGui::Checkbox("Overlay on Original", &overlay_edges);
+            ImGui::Checkbox("L2 Gradient Magnitude", &l2_gradient);
         }
 
-        // Chain processing
-        if (!original_image.empty() && (show_grayscale || show_brightness || show_contrast || show_blur || show_threshold || show_edge_detection)) {
-            cv::Mat current = original_image.clone();
+        // Calculate available space for image display
+        ImVec2 contentRegion = ImGui::GetContentRegionAvail();
+        float maxWidth = contentRegion.x - 20;  // Subtract some padding
+        float maxHeight = 600;  // Maximum height for display
 
-            if (show_grayscale) {
-                cv::cvtColor(current, current, cv::COLOR_BGR2GRAY);
+        // A slider drag becomes one undo step when it is released
+        g_history.Record(CurrentParams(), ImGui::IsAnyItemActive());
+
+        // Chain processing: only stages whose input or parameters changed are recomputed,
+        // on a downscaled proxy while a slider is held
+        PipelineParams params = CurrentParams();
+        if (!original_image.empty() && params.AnyEnabled() && g_zoom_fit) {
+            ImVec2 targetSize = CalculateDisplaySize(g_imageWidth, g_imageHeight, maxWidth, maxHeight);
+            cv::Size display_size((int)std::ceil(targetSize.x), (int)std::ceil(targetSize.y));
+
+            // Re-upload only when the displayed result actually changed, and then only
+            // the region that differs from what the texture already holds
+            if (g_preview.Update(params, display_size, ImGui::IsAnyItemActive()))
+                g_result_view.Present(g_preview.Display());
+
+            StageCacheStats cache_stats = g_preview.Stats();
+            ImGui::Text("Stage cache: %llu hits / %llu misses",
+                (unsigned long long)cache_stats.hits, (unsigned long long)cache_stats.misses);
+            FormatSavings format_savings = g_preview.LastFormatSavings();
+            ImGui::Text("Format plan: %lld conversions, %.1f MB avoided in the last evaluation",
+                (long long)format_savings.conversions_avoided, format_savings.bytes_saved / (1024.0 * 1024.0));
+            AllocationStats alloc_stats = GetAllocationStats();
+            ImGui::Text("Buffers: %llu allocated, %.1f MB live (peak %.1f MB)",
+                (unsigned long long)alloc_stats.allocations,
+                alloc_stats.live_bytes / (1024.0 * 1024.0), alloc_stats.peak_bytes / (1024.0 * 1024.0));
+            ResultStoreStats result_stats = g_results.Stats();
+            ImGui::Text("History: step %zu of %zu, %zu results kept (%zu compressed), %.1f of %.0f MB",
+                g_history.Position() + 1, g_history.Size(), result_stats.entries, result_stats.compressed,
+                result_stats.bytes / (1024.0 * 1024.0), g_results.MaxBytes() / (1024.0 * 1024.0));
+            const PresenterStats& present_stats = g_result_view.Stats();
+            ImGui::Text("Uploads: %llu (%llu partial, %llu skipped), %.1f MB",
+                (unsigned long long)present_stats.uploads, (unsigned long long)present_stats.partial_uploads,
+                (unsigned long long)present_stats.skipped, present_stats.bytes / (1024.0 * 1024.0));
+            // The last completed result stays on screen while the worker catches up
+            if (g_preview.Refining()) {
+                ImGui::SameLine();
+                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f),
+                    g_preview.DisplayIsFullResolution() ? "(updating...)" : "(preview, refining...)");
+            } else if (!g_preview.DisplayIsFullResolution()) {
+                ImGui::SameLine();
+                ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "(preview)");
             }
+        }
 
-            if (show_brightness || show_contrast) {
-                current.convertTo(current, -1, contrast_value, brightness_value);
+        // Show image
+        bool show_processed = show_grayscale || show_brightness || show_contrast || show_blur || show_threshold || show_edge_detection;
+        void* fit_texture = show_processed && g_result_view.Texture() ? g_result_view.Texture() : g_source_view.Texture();
+        if (g_source_view.Texture()) {
+            ImGui::Separator();
+            ImGui::Text(show_processed ? "Processed Image:" : "Original Image:");
+            ImVec2 displaySize = CalculateDisplaySize(g_imageWidth, g_imageHeight, maxWidth, maxHeight);
+            const float fit_zoom = displaySize.x / g_imageWidth;
+
+            ImGui::SameLine();
+            if (ImGui::SmallButton("Fit"))
+                g_zoom_fit = true;
+            ImGui::SameLine();
+            if (ImGui::SmallButton("1:1")) {
+                g_zoom_fit = false;
+                g_zoom = std::max(1.0f, fit_zoom);
             }
-
-            if (show_blur) {
-                cv::Size kernel_size(2 * blur_radius + 1, 2 * blur_radius + 1);
-                if (use_gaussian) {
-                    cv::GaussianBlur(current, current, kernel_size, 0);
-                } else {
-                    cv::blur(current, current, kernel_size);
+            ImGui::SameLine();
+            ImGui::Text("%.0f%%", (g_zoom_fit ? fit_zoom : g_zoom) * 100.0f);
+            if (!g_zoom_fit) {
+                ViewportStats view_stats = g_viewport.Stats();
+                ImGui::SameLine();
+                ImGui::TextDisabled("level %d, %llu tiles computed, %llu reused", g_viewport.Level(),
+                    (unsigned long long)view_stats.tiles_computed, (unsigned long long)view_stats.tiles_reused);
+                if (g_viewport.Pending() > 0) {
+                    ImGui::SameLine();
+                    ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.0f, 1.0f), "(%d tiles to go)", g_viewport.Pending());
                 }
             }
 
-            if (show_threshold) {
-                cv::Mat gray;
-                if (current.channels() == 3)
-                    cv::cvtColor(current, gray, cv::COLOR_BGR2GRAY);
-                else
-                    gray = current.clone();
-
-                cv::Mat binary;
-                if (threshold_method == 0) {  // Binary
-                    cv::threshold(gray, binary, threshold_value, 255, cv::THRESH_BINARY);
+            if (g_zoom_fit) {
+                ImVec2 origin = ImGui::GetCursorScreenPos();
+                ImGui::Image((ImTextureID)fit_texture, displaySize);
+                // Zooming in from the fitted view starts from the whole image
+                if (ImGui::IsItemHovered() && io.MouseWheel > 0.0f) {
+                    g_zoom = fit_zoom;
+                    g_view_center = ImVec2(0.5f, 0.5f);
+                    ImVec2 anchor(io.MousePos.x - origin.x, io.MousePos.y - origin.y);
+                    ZoomAt(fit_zoom * std::pow(1.25f, io.MouseWheel), anchor, displaySize, fit_zoom);
                 }
-                else if (threshold_method == 1) {  // Adaptive
-                    cv::adaptiveThreshold(gray, binary,
-                        255,
-                        cv::ADAPTIVE_THRESH_GAUSSIAN_C,
-                        cv::THRESH_BINARY,
-                        block_size,
-                        constant);
-                }
-                else if (threshold_method == 2) {  // Otsu
-                    cv::threshold(gray, binary, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
-                }
-
-                if (current.channels() == 3)
-                    cv::cvtColor(binary, current, cv::COLOR_GRAY2BGR);
-                else
-                    current = binary;
+            } else {
+                ShowZoomedImage(params, ImVec2(maxWidth, maxHeight), fit_zoom);
             }
+        }
 
-            if (show_edge_detection) {
-                cv::Mat edges;
-                cv::Mat gray;
-                
-                int adjusted_kernel_size = kernel_size * 2 - 1;
-                
-                if (current.channels() == 3) {
-                    cv::cvtColor(current, gray, cv::COLOR_BGR2GRAY);
-                } else {
-                    gray = current.clone();
-                }
-
-                if (use_canny) {
-                    cv::GaussianBlur(gray, gray, cv::Size(adjusted_kernel_size, adjusted_kernel_size), 0);
-                    cv::Canny(gray, edges, lower_threshold, upper_threshold);
-                } else {
-                    cv::Mat grad_x, grad_y;
-                    cv::Mat abs_grad_x, abs_grad_y;
-                    
-                    cv::Sobel(gray, grad_x, CV_16S, 1, 0, adjusted_kernel_size);
-                    cv::Sobel(gray, grad_y, CV_16S, 0, 1, adjusted_kernel_size);
-                    
-                    cv::convertScaleAbs(grad_x, abs_grad_x);
-                    cv::convertScaleAbs(grad_y, abs_grad_y);
-                    
-                    cv::addWeighted(abs_grad_x, 0.5, abs_grad_y, 0.5, 0, edges);
-                    cv::threshold(edges, edges, lower_threshold, 255, cv::THRESH_BINARY);
-                }
-
-                if (overlay_edges) {
-                    cv::Mat edges_bgr;
-                    cv::cvtColor(edges, edges_bgr, cv::COLOR_GRAY2BGR);
-                    cv::Mat overlay = current.clone();
-                    overlay.setTo(cv::Scalar(0, 0, 255), edges);
-                    cv::addWeighted(current, 0.7, overlay, 0.3, 0, current);
-                } else {
-                    cv::cvtColor(edges, current, cv::COLOR_GRAY2BGR);
-                }
-            }
+        ImGui::End();
 
-            LoadImageToTexture(current, &g_processedTexture, g_imageWidth, g_imageHeight);
-        }
+        ShowSweepWindow();
 
-        // Calculate available space for image display
-        ImVec2 contentRegion = ImGui::GetContentRegionAvail();
-        float maxWidth = contentRegion.x - 20;  // Subtract some padding
-        float maxHeight = 600;  // Maximum height for display
+        g_frame_ms[g_frame_index] = io.DeltaTime * 1000.0f;
+        g_frame_index = (g_frame_index + 1) % kFrameHistory;
+        if (show_profiler) {
+            ImGui::Begin("Profiler", &show_profiler);
+            float frame_ms = g_frame_ms[(g_frame_index + kFrameHistory - 1) % kFrameHistory];
+            char overlay[32];
+            snprintf(overlay, sizeof(overlay), "%.1f ms (%.0f fps)", frame_ms, frame_ms > 0.0f ? 1000.0f / frame_ms : 0.0f);
+            ImGui::PlotLines("Frame", g_frame_ms, kFrameHistory, g_frame_index, overlay, 0.0f, 50.0f, ImVec2(0, 80));
 
-        // Show image
-        if ((g_processedTexture && (show_grayscale || show_brightness || show_contrast || show_blur || show_threshold || show_edge_detection))) {
+            ImGui::Text("%-18s %8s %8s %8s %8s", "Scope", "last ms", "avg ms", "max ms", "calls");
             ImGui::Separator();
-            ImGui::Text("Processed Image:");
-            ImVec2 displaySize = CalculateDisplaySize(g_imageWidth, g_imageHeight, maxWidth, maxHeight);
-            ImGui::Image((ImTextureID)g_processedTexture, displaySize);
-        } else if (g_texture) {
-            ImGui::Separator();
-            ImGui::Text("Original Image:");
-            ImVec2 displaySize = CalculateDisplaySize(g_imageWidth, g_imageHeight, maxWidth, maxHeight);
-            ImGui::Image((ImTextureID)g_texture, displaySize);
+            for (const ProfileStat& stat : GetProfileStats()) {
+                ImGui::Text("%-18s %8.2f %8.2f %8.2f %8llu", stat.name, stat.last_ms, stat.average_ms,
+                    stat.max_ms, (unsigned long long)stat.calls);
+            }
+            if (ImGui::Button("Reset"))
+                ResetProfileStats();
+            ImGui::End();
+            if (!show_profiler)
+                EnableProfiling(false);
         }
 
-        ImGui::End();
-
         ImGui::Render();
         g_pd3dDeviceContext->OMSetRenderTargets(1, &g_mainRenderTargetView, NULL);
         const float clear_color[4] = { 0.1f, 0.1f, 0.1f, 1.0f };
         g_pd3dDeviceContext->ClearRenderTargetView(g_mainRenderTargetView, clear_color);
         ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
 
-        g_pSwapChain->Present(1, 0);
+        {
+            NBIP_PROFILE_SCOPE("Present");
+            g_pSwapChain->Present(1, 0);
+        }
     }
 
     ImGui_ImplDX11_Shutdown();
     ImGui_ImplWin32_Shutdown();
     ImGui::DestroyContext();
+    g_source_view.Clear();
+    g_result_view.Clear();
+    g_zoom_view.Clear();
+    g_sweep_view.Clear();
     CleanupDeviceD3D();
     UnregisterClass(wc.lpszClassName, wc.hInstance);
     return 0;
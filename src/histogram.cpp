@@ -0,0 +1,116 @@
+#include "histogram.h"
+#include "pixel_kernels.h"
+#include "pointwise.h"
+#include "profiler.h"
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+// Pixels per parallel task
+const int kBandPixels = 1 << 18;
+
+// Counters of one band; 32 bits are plenty for kBandPixels
+struct BandCounts {
+    uint32_t gray[4][256];  // gray image, or the luma of a BGR image
+    uint32_t bgr[3][256];
+};
+
+void CountGrayRow(const uchar* p, int width, uint32_t (*h)[256]) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        h[0][p[x]]++;
+        h[1][p[x + 1]]++;
+        h[2][p[x + 2]]++;
+        h[3][p[x + 3]]++;
+    }
+    for (; x < width; x++)
+        h[0][p[x]]++;
+}
+
+void CountBgrRow(const uchar* p, int width, uint32_t (*h)[256]) {
+    for (int x = 0; x < width; x++, p += 3) {
+        h[0][p[0]]++;
+        h[1][p[1]]++;
+        h[2][p[2]]++;
+    }
+}
+
+}  // namespace
+
+void ComputeHistogram(const cv::Mat& image, Histogram& histogram) {
+    CV_Assert(image.channels() == 1 || image.channels() == 3);
+    if (image.depth() != CV_8U) {
+        // 256 bins over the depth's range
+        cv::Mat narrow;
+        ConvertDepth(image, narrow, CV_8U);
+        ComputeHistogram(narrow, histogram);
+        return;
+    }
+    NBIP_PROFILE_SCOPE("Histogram");
+
+    histogram = Histogram();
+    histogram.channels = image.channels();
+    histogram.total = (uint64_t)image.rows * image.cols;
+    if (image.empty())
+        return;
+
+    const bool bgr = image.channels() == 3;
+    PointwiseKernel to_gray;
+    to_gray.to_gray = true;
+    const SimdLevel level = BestSimdLevel();
+
+    const int rows_per_band = std::max(1, kBandPixels / image.cols);
+    const int bands = (image.rows + rows_per_band - 1) / rows_per_band;
+    std::mutex merge_mutex;
+
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        BandCounts band;
+        HistogramBins gray{};
+        std::array<HistogramBins, 3> channel{};
+        std::vector<uchar> gray_row(bgr ? image.cols : 0);
+
+        for (int b = range.start; b < range.end; b++) {
+            std::fill(&band.gray[0][0], &band.gray[0][0] + 4 * 256, 0u);
+            std::fill(&band.bgr[0][0], &band.bgr[0][0] + 3 * 256, 0u);
+
+            int y1 = std::min(image.rows, (b + 1) * rows_per_band);
+            for (int y = b * rows_per_band; y < y1; y++) {
+                const uchar* row = image.ptr(y);
+                if (bgr) {
+                    CountBgrRow(row, image.cols, band.bgr);
+                    PointwiseRow(row, gray_row.data(), image.cols, to_gray, level);
+                    CountGrayRow(gray_row.data(), image.cols, band.gray);
+                } else {
+                    CountGrayRow(row, image.cols, band.gray);
+                }
+            }
+
+            for (int v = 0; v < 256; v++) {
+                gray[v] += (uint64_t)band.gray[0][v] + band.gray[1][v] + band.gray[2][v] + band.gray[3][v];
+                for (int c = 0; c < 3; c++)
+                    channel[c][v] += band.bgr[c][v];
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(merge_mutex);
+        for (int v = 0; v < 256; v++) {
+            histogram.luma[v] += gray[v];
+            for (int c = 0; c < 3; c++)
+                histogram.channel[c][v] += channel[c][v];
+        }
+    });
+
+    if (!bgr)
+        histogram.channel[0] = histogram.luma;
+}
+
+const Histogram& HistogramCache::Get(const cv::Mat& image, uint64_t version) {
+    if (!valid_ || version != version_) {
+        ComputeHistogram(image, histogram_);
+        version_ = version;
+        valid_ = true;
+    }
+    return histogram_;
+}
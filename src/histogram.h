@@ -0,0 +1,39 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <cstdint>
+
+using HistogramBins = std::array<uint64_t, 256>;
+
+// Per-channel and luma histograms of an 8-bit image
+struct Histogram {
+    int channels = 0;                        // 1, or 3 for BGR
+    std::array<HistogramBins, 3> channel{};  // B, G, R (only [0] for gray images)
+    HistogramBins luma{};                    // gray value as cv::cvtColor computes it
+    uint64_t total = 0;                      // pixel count
+
+    // 0..2 select B/G/R, anything else the luma histogram
+    const HistogramBins& Bins(int index) const {
+        return index >= 0 && index < channels ? channel[index] : luma;
+    }
+};
+
+// Counts every pixel of `image` (1 or 3 channels; 16-bit and float images are binned
+// over their value range as if converted to 8-bit). Row bands are counted in parallel
+// into private sub-histograms that are merged at the end; gray images use four
+// interleaved sub-histograms so consecutive equal values don't serialize on one counter,
+// and the BGR luma comes from the vectorized gray row kernel.
+void ComputeHistogram(const cv::Mat& image, Histogram& histogram);
+
+// Histogram of one image version: recomputed only when the version changes
+class HistogramCache {
+public:
+    const Histogram& Get(const cv::Mat& image, uint64_t version);
+    void Invalidate() { valid_ = false; }
+
+private:
+    Histogram histogram_;
+    uint64_t version_ = 0;
+    bool valid_ = false;
+};
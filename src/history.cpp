@@ -0,0 +1,270 @@
+#include "history.h"
+#include "disk_cache.h"
+#include "profiler.h"
+#include <algorithm>
+
+namespace {
+
+// PNG keeps 8- and 16-bit images exactly; float has no lossless encoder that is always built
+bool Compressible(const cv::Mat& image) {
+    return image.depth() == CV_8U || image.depth() == CV_16U;
+}
+
+}  // namespace
+
+ParamsHistory::ParamsHistory(size_t max_states)
+    : max_states_(std::max<size_t>(2, max_states)), states_(1) {}
+
+bool ParamsHistory::Record(const PipelineParams& params, bool editing) {
+    PipelineParams& current = states_[position_];
+    if (EquivalentParams(current, params)) {
+        current = params;
+        return false;
+    }
+    if (editing)
+        return false;
+
+    states_.resize(position_ + 1);
+    states_.push_back(params);
+    if (states_.size() > max_states_)
+        states_.erase(states_.begin());
+    position_ = states_.size() - 1;
+    return true;
+}
+
+bool ParamsHistory::Undo(PipelineParams& params) {
+    if (!CanUndo()) return false;
+    params = states_[--position_];
+    return true;
+}
+
+bool ParamsHistory::Redo(PipelineParams& params) {
+    if (!CanRedo()) return false;
+    params = states_[++position_];
+    return true;
+}
+
+ResultStore::ResultStore(size_t max_bytes, size_t keep_raw)
+    : max_bytes_(max_bytes), keep_raw_(keep_raw), thread_(&ResultStore::WorkerLoop, this) {}
+
+ResultStore::~ResultStore() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+void ResultStore::Clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    lru_.clear();
+    index_.clear();
+    buffers_.clear();
+    compress_queue_.clear();
+    bytes_ = 0;
+}
+
+void ResultStore::Store(uint64_t key, const cv::Mat& image) {
+    const size_t raw_bytes = image.total() * image.elemSize();
+    if (image.empty() || raw_bytes > max_bytes_)
+        return;
+    const uint64_t content = HashImage(image);
+    std::shared_ptr<Buffer> identical = FindIdentical(content, image);
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(key);
+    if (found != index_.end()) {
+        Release(found->second->buffer);
+        lru_.erase(found->second);
+        index_.erase(found);
+    }
+
+    // The match may have been evicted or cleared since it was compared
+    std::shared_ptr<Buffer> buffer = identical && Indexed(identical) ? identical : nullptr;
+    if (!buffer) {
+        buffer = std::make_shared<Buffer>();
+        buffer->content = content;
+        buffer->image = image;
+        buffer->bytes = raw_bytes;
+        bytes_ += raw_bytes;
+        buffers_.emplace(content, buffer);
+    }
+    buffer->entries++;
+    lru_.push_front(Entry{ key, buffer });
+    index_[key] = lru_.begin();
+
+    QueueCompression();
+    // Otherwise the worker evicts once the queued buffers have shrunk
+    if (compress_queue_.empty() && !compressing_)
+        Evict();
+}
+
+std::shared_ptr<ResultStore::Buffer> ResultStore::FindIdentical(uint64_t content, const cv::Mat& image) {
+    struct Candidate {
+        std::shared_ptr<Buffer> buffer;
+        cv::Mat image;
+    };
+    std::vector<Candidate> candidates;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto range = buffers_.equal_range(content);
+        for (auto it = range.first; it != range.second; ++it)
+            candidates.push_back(Candidate{ it->second, it->second->image });
+    }
+
+    // Outside the lock: a compressed buffer's PNG is never modified again, and a raw
+    // buffer's pixels are held by `candidate.image`
+    for (Candidate& candidate : candidates) {
+        cv::Mat pixels = candidate.image;
+        if (pixels.empty()) {
+            NBIP_PROFILE_SCOPE("Decompress result");
+            pixels = cv::imdecode(candidate.buffer->png, cv::IMREAD_UNCHANGED);
+        }
+        if (pixels.size() != image.size() || pixels.type() != image.type())
+            continue;
+        cv::Mat difference;
+        cv::compare(pixels.reshape(1), image.reshape(1), difference, cv::CMP_NE);
+        if (cv::countNonZero(difference) == 0)
+            return candidate.buffer;
+    }
+    return nullptr;
+}
+
+bool ResultStore::Indexed(const std::shared_ptr<Buffer>& buffer) const {
+    auto range = buffers_.equal_range(buffer->content);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == buffer)
+            return true;
+    }
+    return false;
+}
+
+bool ResultStore::Load(uint64_t key, cv::Mat& image) {
+    std::shared_ptr<Buffer> buffer;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto found = index_.find(key);
+        if (found == index_.end()) {
+            stats_.misses++;
+            return false;
+        }
+        stats_.hits++;
+        lru_.splice(lru_.begin(), lru_, found->second);
+        if (!found->second->buffer->image.empty()) {
+            image = found->second->buffer->image;
+            return true;
+        }
+        buffer = found->second->buffer;
+    }
+
+    // A compressed buffer's PNG is never modified again
+    NBIP_PROFILE_SCOPE("Decompress result");
+    image = cv::imdecode(buffer->png, cv::IMREAD_UNCHANGED);
+    return !image.empty();
+}
+
+bool ResultStore::LoadRaw(uint64_t key, cv::Mat& image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(key);
+    if (found == index_.end() || found->second->buffer->image.empty())
+        return false;
+    stats_.hits++;
+    lru_.splice(lru_.begin(), lru_, found->second);
+    image = found->second->buffer->image;
+    return true;
+}
+
+bool ResultStore::Contains(uint64_t key) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return index_.count(key) != 0;
+}
+
+ResultStoreStats ResultStore::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ResultStoreStats stats = stats_;
+    stats.entries = lru_.size();
+    stats.buffers = buffers_.size();
+    for (const auto& item : buffers_)
+        stats.compressed += item.second->image.empty() ? 1 : 0;
+    stats.bytes = bytes_;
+    return stats;
+}
+
+void ResultStore::Release(const std::shared_ptr<Buffer>& buffer) {
+    if (--buffer->entries > 0)
+        return;
+    bytes_ -= buffer->bytes;
+    auto range = buffers_.equal_range(buffer->content);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second == buffer) {
+            buffers_.erase(it);
+            break;
+        }
+    }
+}
+
+void ResultStore::Evict() {
+    while (bytes_ > max_bytes_ && !lru_.empty()) {
+        Entry& oldest = lru_.back();
+        index_.erase(oldest.key);
+        Release(oldest.buffer);
+        lru_.pop_back();
+        stats_.evictions++;
+    }
+}
+
+void ResultStore::QueueCompression() {
+    // Buffers in order of their most recent use; the first keep_raw_ stay raw
+    std::vector<Buffer*> seen;
+    for (const Entry& entry : lru_) {
+        Buffer* buffer = entry.buffer.get();
+        if (std::find(seen.begin(), seen.end(), buffer) != seen.end())
+            continue;
+        seen.push_back(buffer);
+        if (seen.size() > keep_raw_ && !buffer->queued && !buffer->image.empty() && Compressible(buffer->image)) {
+            buffer->queued = true;
+            compress_queue_.push_back(entry.buffer);
+        }
+    }
+    if (!compress_queue_.empty())
+        wake_.notify_one();
+}
+
+void ResultStore::WorkerLoop() {
+    for (;;) {
+        std::shared_ptr<Buffer> buffer;
+        cv::Mat image;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stopping_ || !compress_queue_.empty(); });
+            if (stopping_) return;
+            buffer = compress_queue_.front();
+            compress_queue_.pop_front();
+            image = buffer->image;
+            compressing_ = true;
+        }
+
+        std::vector<uchar> png;
+        bool encoded;
+        {
+            NBIP_PROFILE_SCOPE("Compress result");
+            encoded = cv::imencode(".png", image, png, { cv::IMWRITE_PNG_COMPRESSION, 1 });
+        }
+        image.release();
+
+        // The buffer may have been evicted or cleared meanwhile
+        std::lock_guard<std::mutex> lock(mutex_);
+        compressing_ = false;
+        if (encoded && Indexed(buffer) && png.size() < buffer->bytes) {
+            bytes_ -= buffer->bytes;
+            buffer->bytes = png.size();
+            bytes_ += buffer->bytes;
+            buffer->png.swap(png);
+            buffer->image.release();
+        }
+        // Stores deferred eviction to here, so it sees the compressed sizes
+        if (compress_queue_.empty())
+            Evict();
+    }
+}
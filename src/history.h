@@ -0,0 +1,130 @@
+#pragma once
+
+#include "pipeline.h"
+#include <condition_variable>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+const size_t kDefaultHistoryStates = 1000;
+const size_t kDefaultResultStoreBytes = size_t(512) << 20;
+
+// Undo/redo of parameter states. Only parameters are kept here, so a step costs a few
+// hundred bytes; results live in a ResultStore.
+class ParamsHistory {
+public:
+    // Starts with the default parameters as the only state
+    explicit ParamsHistory(size_t max_states = kDefaultHistoryStates);
+
+    // Call once per frame with the current parameters. A change becomes a new state once
+    // `editing` is false, so a whole slider drag is one step, and clears the redo states.
+    // Changes that don't affect the result (values of a disabled stage) are folded into
+    // the current state. Returns true if a state was added.
+    bool Record(const PipelineParams& params, bool editing);
+
+    bool CanUndo() const { return position_ > 0; }
+    bool CanRedo() const { return position_ + 1 < states_.size(); }
+
+    // Moves one state back or forward and returns its parameters
+    bool Undo(PipelineParams& params);
+    bool Redo(PipelineParams& params);
+
+    size_t Position() const { return position_; }
+    size_t Size() const { return states_.size(); }
+
+private:
+    size_t max_states_;
+    std::vector<PipelineParams> states_;  // oldest first
+    size_t position_ = 0;
+};
+
+struct ResultStoreStats {
+    size_t entries = 0;
+    size_t buffers = 0;        // distinct pixel buffers; identical results share one
+    size_t compressed = 0;     // buffers held as PNG
+    size_t bytes = 0;          // raw and compressed bytes held
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+// Full-resolution results of recent parameter states, under a hard byte budget.
+//
+// Results are held by reference, not copied: the pipeline never writes into a buffer
+// someone else still references (see OwnsExclusively), so a stored result stays intact
+// while the pipeline moves on. Results with identical pixels share one buffer (a
+// matching hash is confirmed by comparing the pixels). Apart from the `keep_raw` most
+// recently used, buffers are compressed losslessly to PNG on a background thread (8- and
+// 16-bit only; float stays raw). Past the budget, the least recently used entries are
+// evicted first, once the compressions already queued have finished, so the budget is
+// checked against what the buffers will actually hold.
+//
+// Thread-safe.
+class ResultStore {
+public:
+    explicit ResultStore(size_t max_bytes = kDefaultResultStoreBytes, size_t keep_raw = 4);
+    ~ResultStore();
+
+    ResultStore(const ResultStore&) = delete;
+    ResultStore& operator=(const ResultStore&) = delete;
+
+    // Drops every entry (the source changed)
+    void Clear();
+
+    // `key` is usually HashParams() of the parameters that produced `image`
+    void Store(uint64_t key, const cv::Mat& image);
+
+    // Decodes compressed entries; raw ones are shared, not copied
+    bool Load(uint64_t key, cv::Mat& image);
+
+    // Like Load, but never decodes: false for compressed entries as well (and not
+    // counted as a miss), so it is cheap enough for the UI thread
+    bool LoadRaw(uint64_t key, cv::Mat& image);
+    bool Contains(uint64_t key) const;
+
+    size_t MaxBytes() const { return max_bytes_; }
+    ResultStoreStats Stats() const;
+
+private:
+    struct Buffer {
+        uint64_t content;          // HashImage of the pixels
+        cv::Mat image;             // empty once compressed
+        std::vector<uchar> png;
+        size_t bytes = 0;
+        int entries = 0;           // entries sharing it
+        bool queued = false;       // handed to the compression thread (once only)
+    };
+
+    struct Entry {
+        uint64_t key;
+        std::shared_ptr<Buffer> buffer;
+    };
+
+    void WorkerLoop();
+    // A buffer holding exactly `image`'s pixels, if one hashed to `content` (mutex not held)
+    std::shared_ptr<Buffer> FindIdentical(uint64_t content, const cv::Mat& image);
+    bool Indexed(const std::shared_ptr<Buffer>& buffer) const;  // mutex held
+    void Release(const std::shared_ptr<Buffer>& buffer);  // mutex held
+    void Evict();                                          // mutex held
+    void QueueCompression();                               // mutex held
+
+    size_t max_bytes_;
+    size_t keep_raw_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::list<Entry> lru_;  // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+    std::unordered_multimap<uint64_t, std::shared_ptr<Buffer>> buffers_;  // by content
+    std::list<std::shared_ptr<Buffer>> compress_queue_;
+    bool compressing_ = false;  // the worker holds a buffer taken from the queue
+    size_t bytes_ = 0;
+    ResultStoreStats stats_;
+    bool stopping_ = false;
+
+    std::thread thread_;
+};
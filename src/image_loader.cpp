@@ -0,0 +1,301 @@
+#include "image_loader.h"
+#include "batch.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cctype>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+// Smaller files decode fully in about the time a preview would take
+const uintmax_t kPreviewMinFileBytes = uintmax_t(1) << 20;
+
+int ReducedReadFlag(int scale) {
+    switch (scale) {
+    case 2: return cv::IMREAD_REDUCED_COLOR_2;
+    case 4: return cv::IMREAD_REDUCED_COLOR_4;
+    default: return cv::IMREAD_REDUCED_COLOR_8;
+    }
+}
+
+// Only libjpeg scales while decoding; other codecs decode fully and then resize
+bool PreviewWorthwhile(const std::string& path) {
+    fs::path file(path);
+    std::string ext = file.extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (ext != ".jpg" && ext != ".jpeg") return false;
+    std::error_code ec;
+    uintmax_t size = fs::file_size(file, ec);
+    return !ec && size >= kPreviewMinFileBytes;
+}
+
+int IndexOf(const std::vector<std::string>& files, const std::string& path) {
+    auto it = std::find(files.begin(), files.end(), path);
+    return it != files.end() ? (int)(it - files.begin()) : -1;
+}
+
+}  // namespace
+
+DecodedImageCache::DecodedImageCache(size_t max_bytes) : max_bytes_(max_bytes) {}
+
+bool DecodedImageCache::Fresh(const Entry& entry) const {
+    std::error_code ec;
+    fs::file_time_type modified = fs::last_write_time(entry.path, ec);
+    return !ec && modified == entry.modified;
+}
+
+void DecodedImageCache::Erase(std::list<Entry>::iterator it) {
+    bytes_ -= it->bytes;
+    index_.erase(it->path);
+    lru_.erase(it);
+}
+
+bool DecodedImageCache::Get(const std::string& path, cv::Mat& image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    if (found == index_.end()) {
+        stats_.misses++;
+        return false;
+    }
+    if (!Fresh(*found->second)) {
+        Erase(found->second);
+        stats_.misses++;
+        return false;
+    }
+    lru_.splice(lru_.begin(), lru_, found->second);
+    image = found->second->image;
+    stats_.hits++;
+    return true;
+}
+
+bool DecodedImageCache::Contains(const std::string& path) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    return found != index_.end() && Fresh(*found->second);
+}
+
+void DecodedImageCache::Put(const std::string& path, const cv::Mat& image) {
+    std::error_code ec;
+    fs::file_time_type modified = fs::last_write_time(path, ec);
+    size_t bytes = image.total() * image.elemSize();
+    if (ec || image.empty() || bytes > max_bytes_) return;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto found = index_.find(path);
+    if (found != index_.end())
+        Erase(found->second);
+    lru_.push_front(Entry{ path, modified, image, bytes });
+    index_[path] = lru_.begin();
+    bytes_ += bytes;
+
+    while (bytes_ > max_bytes_) {
+        Erase(std::prev(lru_.end()));
+        stats_.evictions++;
+    }
+}
+
+size_t DecodedImageCache::Bytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return bytes_;
+}
+
+size_t DecodedImageCache::Entries() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+DecodeCacheStats DecodedImageCache::Stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+ImageLoader::ImageLoader(size_t cache_bytes, int threads, int prefetch_radius)
+    : cache_(cache_bytes), prefetch_radius_(std::max(0, prefetch_radius)) {
+    for (int i = 0; i < std::max(1, threads); i++)
+        workers_.emplace_back(&ImageLoader::WorkerLoop, this);
+}
+
+ImageLoader::~ImageLoader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+}
+
+void ImageLoader::Request(const std::string& path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (path == current_ && !current_done_) return;
+
+    current_ = path;
+    generation_++;
+    has_preview_ = false;
+    has_full_ = false;
+    preview_ = LoadedImage();
+    full_ = LoadedImage();
+
+    cv::Mat image;
+    if (cache_.Get(path, image)) {
+        full_ = LoadedImage{ path, image, 1 };
+        has_full_ = true;
+        current_done_ = true;
+        jobs_.push_front(Job{ JobKind::Neighbors, path, generation_ });
+        wake_.notify_one();
+        return;
+    }
+
+    // A prefetch of this file already in flight delivers it when it finishes
+    current_done_ = false;
+    if (!decoding_.count(path))
+        jobs_.push_front(Job{ JobKind::Full, path, generation_ });
+    // Ahead of the full decode: it takes a fraction of the time
+    jobs_.push_front(Job{ JobKind::Preview, path, generation_ });
+    wake_.notify_all();
+}
+
+bool ImageLoader::Take(LoadedImage& image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (has_full_) {
+        image = std::move(full_);
+        full_ = LoadedImage();
+        has_full_ = false;
+        return true;
+    }
+    if (has_preview_) {
+        image = std::move(preview_);
+        preview_ = LoadedImage();
+        has_preview_ = false;
+        return true;
+    }
+    return false;
+}
+
+bool ImageLoader::Loading() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !current_done_;
+}
+
+std::string ImageLoader::Neighbor(const std::string& path, int offset) {
+    std::vector<std::string> files = Listing(path);
+    int index = IndexOf(files, path);
+    if (index < 0 || index + offset < 0 || index + offset >= (int)files.size())
+        return std::string();
+    return files[index + offset];
+}
+
+std::vector<std::string> ImageLoader::Listing(const std::string& path) {
+    fs::path parent = fs::path(path).parent_path();
+    std::string dir = parent.empty() ? std::string(".") : parent.string();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (dir == listing_dir_ && IndexOf(listing_, path) >= 0)
+            return listing_;
+    }
+
+    // Spelled like `path` (same separators), so neighbours and the files the user opens
+    // directly share cache entries
+    std::vector<std::string> files = ExpandInputs(dir);
+    for (std::string& file : files)
+        file = (parent / fs::path(file).filename()).string();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    listing_dir_ = dir;
+    listing_ = files;
+    return files;
+}
+
+void ImageLoader::QueueNeighbors(const std::string& path) {
+    std::vector<std::string> files = Listing(path);
+    int index = IndexOf(files, path);
+    if (index < 0) return;
+
+    // Forward first: that is the usual direction of travel
+    std::vector<std::string> neighbors;
+    for (int d = 1; d <= prefetch_radius_; d++) {
+        if (index + d < (int)files.size()) neighbors.push_back(files[index + d]);
+        if (index - d >= 0) neighbors.push_back(files[index - d]);
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (path != current_) return;
+    nearby_ = std::unordered_set<std::string>(neighbors.begin(), neighbors.end());
+    for (const std::string& neighbor : neighbors) {
+        if (!decoding_.count(neighbor) && !cache_.Contains(neighbor))
+            jobs_.push_back(Job{ JobKind::Prefetch, neighbor, generation_ });
+    }
+    wake_.notify_all();
+}
+
+bool ImageLoader::Wanted(const Job& job) const {
+    switch (job.kind) {
+    case JobKind::Preview:
+        return job.generation == generation_ && !current_done_;
+    case JobKind::Neighbors:
+        return job.generation == generation_;
+    default:
+        return job.path == current_ || nearby_.count(job.path) > 0;
+    }
+}
+
+void ImageLoader::WorkerLoop() {
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [&] { return stopping_ || !jobs_.empty(); });
+            if (stopping_) return;
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            if (!Wanted(job)) continue;
+            if (job.kind == JobKind::Full || job.kind == JobKind::Prefetch) {
+                if (decoding_.count(job.path) || cache_.Contains(job.path)) continue;
+                decoding_.insert(job.path);
+            }
+        }
+
+        if (job.kind == JobKind::Neighbors) {
+            QueueNeighbors(job.path);
+            continue;
+        }
+
+        cv::Mat image;
+        if (job.kind == JobKind::Preview) {
+            if (PreviewWorthwhile(job.path)) {
+                NBIP_PROFILE_SCOPE("Decode preview");
+                image = cv::imread(job.path, ReducedReadFlag(kPreviewScale));
+            }
+        } else {
+            NBIP_PROFILE_SCOPE("Decode");
+            image = ReadNativeImage(job.path);
+        }
+        Finish(job, image);
+    }
+}
+
+void ImageLoader::Finish(const Job& job, const cv::Mat& image) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (job.kind == JobKind::Preview) {
+        if (job.generation == generation_ && !current_done_ && !image.empty()) {
+            preview_ = LoadedImage{ job.path, image, kPreviewScale };
+            has_preview_ = true;
+        }
+        return;
+    }
+
+    decoding_.erase(job.path);
+    cache_.Put(job.path, image);
+    if (job.path == current_ && !current_done_) {
+        // An unreadable file is delivered as an empty image
+        full_ = LoadedImage{ job.path, image, 1 };
+        has_full_ = true;
+        has_preview_ = false;
+        preview_ = LoadedImage();
+        current_done_ = true;
+        jobs_.push_front(Job{ JobKind::Neighbors, job.path, generation_ });
+        wake_.notify_one();
+    }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+const size_t kDefaultDecodeCacheBytes = size_t(1) << 30;
+
+struct DecodeCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    double HitRate() const {
+        uint64_t lookups = hits + misses;
+        return lookups > 0 ? double(hits) / lookups : 0.0;
+    }
+};
+
+// Fully decoded images keyed by path. An entry is dropped if the file's modification
+// time no longer matches, and the least recently used ones go once the pixels exceed
+// the byte budget. Images are shared with the caller, not copied, so they must not be
+// written to. Thread-safe.
+class DecodedImageCache {
+public:
+    explicit DecodedImageCache(size_t max_bytes);
+
+    bool Get(const std::string& path, cv::Mat& image);
+    // Like Get, but neither counts a lookup nor refreshes the entry
+    bool Contains(const std::string& path) const;
+    void Put(const std::string& path, const cv::Mat& image);
+
+    size_t MaxBytes() const { return max_bytes_; }
+    size_t Bytes() const;
+    size_t Entries() const;
+    DecodeCacheStats Stats() const;
+
+private:
+    struct Entry {
+        std::string path;
+        std::filesystem::file_time_type modified;
+        cv::Mat image;
+        size_t bytes;
+    };
+
+    bool Fresh(const Entry& entry) const;
+    void Erase(std::list<Entry>::iterator it);  // mutex held
+
+    size_t max_bytes_;
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_;  // most recently used first
+    std::unordered_map<std::string, std::list<Entry>::iterator> index_;
+    size_t bytes_ = 0;
+    DecodeCacheStats stats_;
+};
+
+// A decoded image handed out by ImageLoader
+struct LoadedImage {
+    std::string path;
+    cv::Mat image;     // empty if the file could not be read
+    int scale = 1;     // 1 for the full decode, otherwise the preview's downscale factor
+    bool Failed() const { return image.empty(); }
+};
+
+// Decodes images on background threads.
+//
+// Request() returns immediately. A JPEG large enough to be worth it is also decoded at
+// 1/kPreviewScale size (IMREAD_REDUCED_COLOR_*, which libjpeg does by dropping DCT
+// coefficients rather than resampling), so there is something to show while the full
+// decode runs. Full decodes go into a DecodedImageCache, and once the requested image is
+// in, its neighbours in the directory are decoded in the background so stepping through
+// a folder mostly hits the cache.
+//
+// Only the newest request is delivered. Queued work that no longer concerns the current
+// file or its neighbours is dropped when it reaches the front of the queue.
+class ImageLoader {
+public:
+    static const int kPreviewScale = 4;
+
+    explicit ImageLoader(size_t cache_bytes = kDefaultDecodeCacheBytes, int threads = 2,
+                         int prefetch_radius = 2);
+    ~ImageLoader();
+
+    ImageLoader(const ImageLoader&) = delete;
+    ImageLoader& operator=(const ImageLoader&) = delete;
+
+    // Starts loading `path` (a cache hit is ready by the next Take)
+    void Request(const std::string& path);
+
+    // Hands out the newest image for the current request delivered since the last call:
+    // first the preview, if one was decoded in time, then the full image
+    bool Take(LoadedImage& image);
+
+    // True until the full image for the current request has been decoded
+    bool Loading() const;
+
+    // The file `offset` places away from `path` in its directory (sorted by name), or an
+    // empty string past either end. Uses the listing made when `path` was prefetched
+    // around, falling back to listing the directory.
+    std::string Neighbor(const std::string& path, int offset);
+
+    const DecodedImageCache& Cache() const { return cache_; }
+
+private:
+    enum class JobKind { Preview, Full, Prefetch, Neighbors };
+
+    struct Job {
+        JobKind kind;
+        std::string path;
+        uint64_t generation;
+    };
+
+    void WorkerLoop();
+    bool Wanted(const Job& job) const;  // mutex held
+    void Finish(const Job& job, const cv::Mat& image);
+    void QueueNeighbors(const std::string& path);
+    std::vector<std::string> Listing(const std::string& path);
+
+    DecodedImageCache cache_;
+    int prefetch_radius_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<Job> jobs_;  // requests at the front, prefetches at the back
+    std::unordered_set<std::string> decoding_;  // full decodes in flight
+    std::unordered_set<std::string> nearby_;    // neighbours worth prefetching
+    std::string current_;
+    uint64_t generation_ = 0;
+    bool current_done_ = true;
+    bool has_preview_ = false;
+    bool has_full_ = false;
+    LoadedImage preview_;
+    LoadedImage full_;
+    std::string listing_dir_;
+    std::vector<std::string> listing_;
+    bool stopping_ = false;
+
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,73 @@
+/* C ABI for embedding the processing chain in other programs.
+ *
+ * Pixel memory always belongs to the caller: inputs are read in place and the final
+ * stage writes straight into the caller's output buffer. A pipeline object is created
+ * once from a text spec (see pipeline_spec.h) and reused for any number of calls; it
+ * keeps its intermediate buffers between calls, so repeated calls at a fixed image size
+ * do no setup work. A pipeline must not be used from two threads at once.
+ *
+ * Pixels are 8-bit, interleaved BGR (3 channels) or gray (1 channel).
+ */
+#ifndef NBIP_H
+#define NBIP_H
+
+#include <stddef.h>
+
+#if defined(_WIN32)
+#  if defined(NBIP_BUILDING_LIBRARY)
+#    define NBIP_API __declspec(dllexport)
+#  else
+#    define NBIP_API __declspec(dllimport)
+#  endif
+#else
+#  define NBIP_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct nbip_pipeline nbip_pipeline;
+
+typedef struct nbip_image {
+    void* data;        /* first pixel of the first row */
+    int width;
+    int height;
+    size_t stride;     /* bytes between rows; 0 means width * channels */
+    int channels;      /* 1 (gray) or 3 (BGR) */
+} nbip_image;
+
+typedef enum nbip_status {
+    NBIP_OK = 0,
+    NBIP_ERROR_INVALID_ARGUMENT = 1,
+    NBIP_ERROR_INVALID_SPEC = 2,
+    NBIP_ERROR_FORMAT_MISMATCH = 3,
+    NBIP_ERROR_PROCESSING = 4
+} nbip_status;
+
+/* Parses `spec` (e.g. "grayscale,blur=2,edges=canny") into a reusable pipeline */
+NBIP_API nbip_status nbip_pipeline_create(const char* spec, nbip_pipeline** out_pipeline);
+
+/* Same, from a binary pipeline description (proto/pipeline.proto) of `size` bytes */
+NBIP_API nbip_status nbip_pipeline_create_from_proto(const void* data, size_t size,
+                                                     nbip_pipeline** out_pipeline);
+
+NBIP_API void nbip_pipeline_destroy(nbip_pipeline* pipeline);
+
+/* Channel count the output buffer must have for an input with `input_channels` */
+NBIP_API int nbip_pipeline_output_channels(const nbip_pipeline* pipeline, int input_channels);
+
+/* Runs the pipeline on `input` and writes the result into `output`, which must have the
+ * same width and height and nbip_pipeline_output_channels() channels. The two buffers
+ * must not overlap. */
+NBIP_API nbip_status nbip_pipeline_run(nbip_pipeline* pipeline, const nbip_image* input,
+                                       const nbip_image* output);
+
+/* Message describing the last error on the calling thread ("" if none) */
+NBIP_API const char* nbip_last_error(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NBIP_H */
@@ -0,0 +1,112 @@
+#include "nbip.h"
+#include "pipeline.h"
+#include "pipeline_proto.h"
+#include "pipeline_spec.h"
+#include <new>
+#include <string>
+
+struct nbip_pipeline {
+    PipelineParams params;
+    Pipeline pipeline;
+};
+
+namespace {
+
+thread_local std::string g_last_error;
+
+nbip_status Fail(nbip_status status, const std::string& message) {
+    g_last_error = message;
+    return status;
+}
+
+bool ValidImage(const nbip_image* image) {
+    return image && image->data && image->width > 0 && image->height > 0 &&
+           (image->channels == 1 || image->channels == 3) &&
+           (image->stride == 0 || image->stride >= (size_t)image->width * image->channels);
+}
+
+// Header over caller memory: no allocation, no copy
+cv::Mat WrapImage(const nbip_image& image) {
+    size_t stride = image.stride ? image.stride : (size_t)image.width * image.channels;
+    return cv::Mat(image.height, image.width, CV_8UC(image.channels), image.data, stride);
+}
+
+nbip_status CreatePipeline(const PipelineParams& params, nbip_pipeline** out_pipeline) {
+    nbip_pipeline* pipeline = new (std::nothrow) nbip_pipeline;
+    if (!pipeline)
+        return Fail(NBIP_ERROR_PROCESSING, "out of memory");
+
+    pipeline->params = params;
+    *out_pipeline = pipeline;
+    g_last_error.clear();
+    return NBIP_OK;
+}
+
+}  // namespace
+
+nbip_status nbip_pipeline_create(const char* spec, nbip_pipeline** out_pipeline) {
+    if (!spec || !out_pipeline)
+        return Fail(NBIP_ERROR_INVALID_ARGUMENT, "spec and out_pipeline must not be null");
+
+    PipelineParams params;
+    std::string error;
+    if (!ParsePipelineSpec(spec, params, &error))
+        return Fail(NBIP_ERROR_INVALID_SPEC, error);
+
+    return CreatePipeline(params, out_pipeline);
+}
+
+nbip_status nbip_pipeline_create_from_proto(const void* data, size_t size, nbip_pipeline** out_pipeline) {
+    if ((!data && size > 0) || !out_pipeline)
+        return Fail(NBIP_ERROR_INVALID_ARGUMENT, "data and out_pipeline must not be null");
+
+    PipelineParams params;
+    std::string error;
+    if (!ParsePipelineProto(std::string(static_cast<const char*>(data), size), params, &error))
+        return Fail(NBIP_ERROR_INVALID_SPEC, error);
+
+    return CreatePipeline(params, out_pipeline);
+}
+
+void nbip_pipeline_destroy(nbip_pipeline* pipeline) {
+    delete pipeline;
+}
+
+int nbip_pipeline_output_channels(const nbip_pipeline* pipeline, int input_channels) {
+    if (!pipeline || (input_channels != 1 && input_channels != 3))
+        return 0;
+    return PipelineOutputChannels(pipeline->params, input_channels);
+}
+
+nbip_status nbip_pipeline_run(nbip_pipeline* pipeline, const nbip_image* input, const nbip_image* output) {
+    if (!pipeline || !ValidImage(input) || !ValidImage(output))
+        return Fail(NBIP_ERROR_INVALID_ARGUMENT, "null pipeline or malformed image descriptor");
+
+    if (output->width != input->width || output->height != input->height ||
+        output->channels != PipelineOutputChannels(pipeline->params, input->channels))
+        return Fail(NBIP_ERROR_FORMAT_MISMATCH, "output must match the input size and the pipeline's output channels");
+
+    try {
+        cv::Mat source = WrapImage(*input);
+        cv::Mat destination = WrapImage(*output);
+        uchar* target = destination.data;
+
+        if (!pipeline->pipeline.Run(source, destination, pipeline->params))
+            return Fail(NBIP_ERROR_PROCESSING, "pipeline failed");
+
+        // Would only happen if a stage changed the output format behind our back
+        if (destination.data != target)
+            return Fail(NBIP_ERROR_PROCESSING, "pipeline produced an unexpected output format");
+    } catch (const cv::Exception& e) {
+        return Fail(NBIP_ERROR_PROCESSING, e.what());
+    } catch (const std::exception& e) {
+        return Fail(NBIP_ERROR_PROCESSING, e.what());
+    }
+
+    g_last_error.clear();
+    return NBIP_OK;
+}
+
+const char* nbip_last_error(void) {
+    return g_last_error.c_str();
+}
@@ -0,0 +1,865 @@
+#include "pipeline.h"
+#include "blur.h"
+#include "disk_cache.h"
+#include "pixel_kernels.h"
+#include "pointwise.h"
+#include "profiler.h"
+#include "sobel.h"
+#include <algorithm>
+
+const char* StageName(Stage stage) {
+    switch (stage) {
+    case Stage::Grayscale:          return "Grayscale";
+    case Stage::BrightnessContrast: return "Brightness/Contrast";
+    case Stage::Blur:               return "Blur";
+    case Stage::Threshold:          return "Threshold";
+    case Stage::EdgeDetection:      return "Edge Detection";
+    default:                        return "Unknown";
+    }
+}
+
+StageKey MakeStageKey(Stage stage, const PipelineParams& p) {
+    StageKey key{};
+    switch (stage) {
+    case Stage::Grayscale:
+        key[0] = p.grayscale;
+        break;
+    case Stage::BrightnessContrast:
+        // Either checkbox applies both values, exactly like the original chain
+        key[0] = p.brightness || p.contrast;
+        key[1] = p.contrast_value;
+        key[2] = p.brightness_value;
+        break;
+    case Stage::Blur:
+        key[0] = p.blur;
+        key[1] = p.blur_radius;
+        key[2] = p.use_gaussian;
+        // Recursive results differ from the exact kernel's, and by where the image is cut
+        key[3] = ResolveBlurMethod(p.blur_radius, p.use_gaussian) == BlurMethod::Recursive;
+        break;
+    case Stage::Threshold:
+        key[0] = p.threshold;
+        key[1] = p.threshold_method;
+        // Only the values the selected method reads, so unrelated sliders don't invalidate
+        if (p.threshold_method == 0) {
+            key[2] = p.threshold_value;
+        } else if (p.threshold_method == 1) {
+            key[2] = p.block_size;
+            key[3] = p.constant;
+            key[4] = p.adaptive_mode;
+            if (p.adaptive_mode >= static_cast<int>(AdaptiveMode::Sauvola))
+                key[5] = p.adaptive_k;
+        }
+        break;
+    case Stage::EdgeDetection:
+        key[0] = p.edge_detection;
+        key[1] = p.use_canny;
+        key[2] = p.lower_threshold;
+        key[3] = p.use_canny ? p.upper_threshold : 0;
+        key[4] = p.kernel_size;
+        key[5] = p.overlay_edges;
+        key[6] = p.edge_norm;
+        break;
+    default:
+        break;
+    }
+    return key;
+}
+
+bool EquivalentParams(const PipelineParams& a, const PipelineParams& b) {
+    for (int i = 0; i < kStageCount; i++) {
+        StageKey key_a = MakeStageKey(static_cast<Stage>(i), a);
+        StageKey key_b = MakeStageKey(static_cast<Stage>(i), b);
+        // A disabled stage's other values don't matter
+        if (key_a[0] != key_b[0] || (key_a[0] != 0.0 && key_a != key_b))
+            return false;
+    }
+    return true;
+}
+
+uint64_t HashParams(const PipelineParams& params) {
+    uint64_t h = 0;
+    for (int i = 0; i < kStageCount; i++) {
+        StageKey key = MakeStageKey(static_cast<Stage>(i), params);
+        if (key[0] == 0.0) key = StageKey{};
+        h = HashBytes(key.data(), sizeof(key), h);
+    }
+    return h;
+}
+
+void RunStage(Stage stage, const cv::Mat& input, cv::Mat& output, const PipelineParams& p,
+              StageWorkspace* workspace, int output_channels) {
+    StageWorkspace local;
+    StageWorkspace& ws = workspace ? *workspace : local;
+
+    switch (stage) {
+    case Stage::Grayscale:
+        if (input.channels() == 3)
+            cv::cvtColor(input, output, cv::COLOR_BGR2GRAY);
+        else
+            output = input;
+        break;
+
+    case Stage::BrightnessContrast:
+        input.convertTo(output, -1, p.contrast_value, p.brightness_value * DepthScale(input.depth()));
+        break;
+
+    case Stage::Blur:
+        // Full kernel for small radii, constant time per pixel for large ones
+        BlurImage(input, output, p.blur_radius, p.use_gaussian);
+        break;
+
+    case Stage::Threshold: {
+        // Workspace buffers are only ever written, never aliased to the input
+        cv::Mat gray;
+        if (input.channels() == 3) {
+            // Kept while the input stays the same, so a settings change skips the
+            // conversion. The Gaussian mode may run in row bands sharing this workspace.
+            const bool banded = p.threshold_method == 1 && p.adaptive_mode == static_cast<int>(AdaptiveMode::Gaussian);
+            if (banded || ws.input_version == 0 || ws.gray_version != ws.input_version ||
+                ws.gray.size() != input.size()) {
+                cv::cvtColor(input, ws.gray, cv::COLOR_BGR2GRAY);
+                ws.gray_version = banded ? 0 : ws.input_version;
+            }
+            gray = ws.gray;
+        } else {
+            gray = input;
+        }
+
+        // Single-channel results go straight into `output`
+        const bool widen = input.channels() == 3 && output_channels != 1;
+        cv::Mat& binary = widen ? ws.binary : output;
+        const int depth = gray.depth();
+        if (p.threshold_method == 0) {  // Binary
+            cv::threshold(gray, binary, p.threshold_value * DepthScale(depth), DepthMax(depth), cv::THRESH_BINARY);
+            if (widen)
+                cv::cvtColor(binary, output, cv::COLOR_GRAY2BGR);
+            break;
+        }
+
+        // Adaptive and Otsu only run on 8-bit data: wider inputs go through an 8-bit copy
+        // and the mask is widened back
+        cv::Mat& mask = depth == CV_8U ? binary : ws.narrow_mask;
+        if (depth != CV_8U) {
+            ConvertDepth(gray, ws.narrow, CV_8U);
+            gray = ws.narrow;
+        }
+        if (p.threshold_method == 1) {  // Adaptive
+            AdaptiveMode mode = static_cast<AdaptiveMode>(p.adaptive_mode);
+            if (mode == AdaptiveMode::Gaussian) {
+                cv::adaptiveThreshold(gray, mask,
+                    255,
+                    cv::ADAPTIVE_THRESH_GAUSSIAN_C,
+                    cv::THRESH_BINARY,
+                    p.block_size,
+                    p.constant);
+            } else {
+                // Only a compare pass while block size, constant or k change
+                AdaptiveThresholdIntegral(gray, mask, p.block_size, p.constant, mode, p.adaptive_k,
+                                          ws.integral, ws.input_version);
+            }
+        }
+        else if (p.threshold_method == 2) {  // Otsu
+            cv::threshold(gray, mask, 0, 255, cv::THRESH_BINARY | cv::THRESH_OTSU);
+        }
+
+        if (depth != CV_8U)
+            ConvertDepth(mask, binary, depth);
+        if (widen)
+            cv::cvtColor(binary, output, cv::COLOR_GRAY2BGR);
+        break;
+    }
+
+    case Stage::EdgeDetection: {
+        // A single-channel 8-bit edge map is written straight into `output`
+        const bool gray_output = !p.overlay_edges && output_channels == 1;
+        cv::Mat& edges = gray_output && input.depth() == CV_8U ? output : ws.edges;
+        cv::Mat gray;
+
+        int adjusted_kernel_size = p.kernel_size * 2 - 1;
+
+        if (input.channels() == 3) {
+            cv::cvtColor(input, ws.gray, cv::COLOR_BGR2GRAY);
+            gray = ws.gray;
+        } else {
+            gray = input;
+        }
+        // Canny and the fused Sobel kernel work on 8-bit gray
+        if (gray.depth() != CV_8U) {
+            ConvertDepth(gray, ws.narrow, CV_8U);
+            gray = ws.narrow;
+        }
+
+        SobelOptions sobel;
+        sobel.norm = static_cast<GradientNorm>(p.edge_norm);
+        if (p.use_canny) {
+            cv::GaussianBlur(gray, ws.smoothed, cv::Size(adjusted_kernel_size, adjusted_kernel_size), 0);
+            // Both gradients in one pass, with the border Canny would use for its own
+            sobel.border = cv::BORDER_REPLICATE;
+            SobelMagnitude(ws.smoothed, nullptr, &ws.grad_x, &ws.grad_y, sobel);
+            cv::Canny(ws.grad_x, ws.grad_y, edges, p.lower_threshold, p.upper_threshold,
+                      sobel.norm == GradientNorm::L2);
+        } else {
+            // Gradients, magnitude and threshold in one pass
+            sobel.ksize = adjusted_kernel_size;
+            sobel.binary = true;
+            sobel.threshold = p.lower_threshold;
+            SobelMagnitude(gray, &edges, nullptr, nullptr, sobel);
+        }
+
+        if (p.overlay_edges) {
+            // Gray content that was BGR before the plan kept it single-channel
+            cv::Mat color = input;
+            if (output_channels == 3 && input.channels() == 1) {
+                cv::cvtColor(input, ws.expanded, cv::COLOR_GRAY2BGR);
+                color = ws.expanded;
+            }
+            color.copyTo(ws.overlay);
+            ws.overlay.setTo(cv::Scalar(0, 0, DepthMax(input.depth())), edges);
+            cv::addWeighted(color, 0.7, ws.overlay, 0.3, 0, output);
+        } else if (gray_output) {
+            if (input.depth() != CV_8U)
+                ConvertDepth(edges, output, input.depth());
+        } else if (input.depth() != CV_8U) {
+            ConvertDepth(edges, ws.binary, input.depth());
+            cv::cvtColor(ws.binary, output, cv::COLOR_GRAY2BGR);
+        } else {
+            cv::cvtColor(edges, output, cv::COLOR_GRAY2BGR);
+        }
+        break;
+    }
+
+    default:
+        output = input;
+        break;
+    }
+}
+
+// Canny's hysteresis follows connected edges beyond its aperture; this many extra rows
+// make a seam artefact very unlikely without making strips much taller
+const int kCannyHysteresisMargin = 16;
+
+int StageHalo(Stage stage, const PipelineParams& p) {
+    switch (stage) {
+    case Stage::Blur:
+        return p.blur ? BlurHalo(p.blur_radius, p.use_gaussian) : 0;
+    case Stage::Threshold:
+        return p.threshold && p.threshold_method == 1 ? p.block_size / 2 : 0;
+    case Stage::EdgeDetection:
+        if (!p.edge_detection)
+            return 0;
+        if (p.use_canny) {
+            // Pre-blur, 3x3 Sobel, non-maximum suppression, hysteresis
+            return (p.kernel_size - 1) + 1 + 1 + kCannyHysteresisMargin;
+        }
+        return std::max(1, p.kernel_size - 1);
+    default:
+        return 0;
+    }
+}
+
+int PipelineHalo(const PipelineParams& params) {
+    int halo = 0;
+    for (int i = 0; i < kStageCount; i++)
+        halo += StageHalo(static_cast<Stage>(i), params);
+    return halo;
+}
+
+int PipelineOutputChannels(const PipelineParams& p, int input_channels) {
+    int channels = input_channels;
+    if (p.grayscale && channels == 3) channels = 1;
+    if (p.edge_detection && !p.overlay_edges) channels = 3;
+    return channels;
+}
+
+bool OwnsExclusively(const cv::Mat& m) {
+    return m.u != nullptr && m.u->refcount == 1;
+}
+
+namespace {
+
+// Part of every disk cache key; bump when a stage's output changes for the same parameters
+const uint64_t kDiskCacheFormat = 3;
+
+bool StageEnabled(int stage, const PipelineParams& p) {
+    return MakeStageKey(static_cast<Stage>(stage), p)[0] != 0.0;
+}
+
+bool IsPointwiseStage(int stage, const PipelineParams& p) {
+    switch (static_cast<Stage>(stage)) {
+    case Stage::Grayscale:
+    case Stage::BrightnessContrast:
+        return true;
+    case Stage::Threshold:
+        return p.threshold_method == 0;  // Binary only; adaptive and Otsu look beyond the pixel
+    default:
+        return false;
+    }
+}
+
+// A lone stage is only worth the fused kernel when it saves passes: a binary threshold
+// on BGR otherwise converts to gray, thresholds and converts back
+// Whether first..last run as one fused pass on an input of `depth` and `channels`
+bool UseFusedKernel(int first, int last, const PipelineParams& p, int depth, int channels) {
+    if (!IsNativeDepth(depth) || (channels != 1 && channels != 3))
+        return false;
+    if (!IsPointwiseStage(first, p))
+        return false;
+    return first != last || (first == static_cast<int>(Stage::Threshold) && channels == 3);
+}
+
+int FusedGroupEnd(int first, const PipelineParams& p, int depth, int channels) {
+    if (!IsPointwiseStage(first, p))
+        return first;
+
+    int last = first;
+    for (int i = first + 1; i < kStageCount; i++) {
+        if (!StageEnabled(i, p)) continue;
+        if (!IsPointwiseStage(i, p)) break;
+        last = i;
+    }
+    return UseFusedKernel(first, last, p, depth, channels) ? last : first;
+}
+
+void AppendLut(bool& used, uchar lut[256], const uchar next[256]) {
+    if (used) {
+        ComposeLut(lut, next);
+    } else {
+        std::copy(next, next + 256, lut);
+        used = true;
+    }
+}
+
+// Neighbourhood stages that give identical results when run in independent row bands
+// (each read with its halo) of an image of `depth`. Otsu and Canny need the whole image
+// at once, and the recursive Gaussian's response runs past any halo.
+bool RunsInBands(int stage, const PipelineParams& p, int depth) {
+    if (StageHalo(static_cast<Stage>(stage), p) == 0)
+        return false;
+    if (static_cast<Stage>(stage) == Stage::Blur)
+        return ResolveBlurMethod(p.blur_radius, p.use_gaussian, depth) != BlurMethod::Recursive;
+    if (static_cast<Stage>(stage) == Stage::EdgeDetection)
+        return !p.use_canny;
+    // The summed-area tables are built for the whole input and reused across calls
+    if (static_cast<Stage>(stage) == Stage::Threshold)
+        return p.adaptive_mode == static_cast<int>(AdaptiveMode::Gaussian);
+    return true;
+}
+
+// Pixels per band of a cancellable stage: small enough that a cancel takes effect within
+// a few milliseconds, large enough that the halo rows cost little
+const int64 kCancelBandPixels = 1 << 21;
+
+bool RunStageInBands(Stage stage, const cv::Mat& input, cv::Mat& output, const PipelineParams& p,
+                     const std::atomic<bool>& cancel, StageWorkspace& ws, int output_channels) {
+    const int halo = StageHalo(stage, p);
+    const int band_rows = (int)std::max<int64>(1, kCancelBandPixels / std::max(1, input.cols));
+
+    cv::Mat& band = ws.band;
+    for (int y0 = 0; y0 < input.rows; y0 += band_rows) {
+        if (cancel.load(std::memory_order_relaxed))
+            return false;
+
+        int y1 = std::min(input.rows, y0 + band_rows);
+        int r0 = std::max(0, y0 - halo);
+        int r1 = std::min(input.rows, y1 + halo);
+        RunStage(stage, input.rowRange(r0, r1), band, p, &ws, output_channels);
+
+        if (y0 == 0)
+            output.create(input.rows, input.cols, band.type());
+        cv::Mat target = output.rowRange(y0, y1);
+        band.rowRange(y0 - r0, y1 - r0).copyTo(target);
+    }
+    return true;
+}
+
+// `replicate`: a threshold of BGR data writes its mask to all three channels
+PointwiseKernel BuildPointwiseKernel(int first, int last, const PipelineParams& p, int channels, bool replicate) {
+    PointwiseKernel k;
+    uchar lut[256];
+    for (int i = first; i <= last; i++) {
+        if (!StageEnabled(i, p)) continue;
+
+        switch (static_cast<Stage>(i)) {
+        case Stage::Grayscale:
+            if (channels == 3) {
+                k.to_gray = true;
+                channels = 1;
+            }
+            break;
+        case Stage::BrightnessContrast:
+            BuildBrightnessContrastLut(p.contrast_value, p.brightness_value, lut);
+            // Still BGR: the table applies per channel, before any gray conversion
+            if (channels == 3 && !k.to_gray)
+                AppendLut(k.use_pre_lut, k.pre_lut, lut);
+            else
+                AppendLut(k.use_post_lut, k.post_lut, lut);
+            break;
+        case Stage::Threshold:
+            BuildBinaryThresholdLut(p.threshold_value, lut);
+            if (channels == 3) {
+                k.to_gray = true;
+                k.replicate = replicate;
+            }
+            AppendLut(k.use_post_lut, k.post_lut, lut);
+            break;
+        default:
+            break;
+        }
+    }
+    return k;
+}
+
+// The same chain for 16-bit and float inputs, with parameters scaled to the depth's range
+TypedPointwiseOps BuildTypedPointwiseOps(int first, int last, const PipelineParams& p, int channels, int depth,
+                                         bool replicate) {
+    TypedPointwiseOps ops;
+    for (int i = first; i <= last; i++) {
+        if (!StageEnabled(i, p)) continue;
+
+        switch (static_cast<Stage>(i)) {
+        case Stage::Grayscale:
+            if (channels == 3) {
+                ops.to_gray = true;
+                channels = 1;
+            }
+            break;
+        case Stage::BrightnessContrast:
+            if (channels == 3 && !ops.to_gray)
+                ops.pre_affine = true;
+            else
+                ops.post_affine = true;
+            ops.alpha = p.contrast_value;
+            ops.beta = (float)(p.brightness_value * DepthScale(depth));
+            break;
+        case Stage::Threshold:
+            if (channels == 3) {
+                ops.to_gray = true;
+                ops.replicate = replicate;
+            }
+            ops.threshold = true;
+            ops.threshold_value = (float)(p.threshold_value * DepthScale(depth));
+            break;
+        default:
+            break;
+        }
+    }
+    return ops;
+}
+
+// Runs a per-channel stage on each plane of a BGR image in turn. Each plane is
+// contiguous single-channel data, which the row-parallel kernels handle at full width.
+// A cancel takes effect between planes. Returns false if cancelled.
+bool RunStagePlanar(Stage stage, const cv::Mat& input, cv::Mat& output, const PipelineParams& p,
+                    const std::atomic<bool>* cancel, StageWorkspace& ws) {
+    cv::split(input, ws.planes);
+    ws.plane_results.resize(ws.planes.size());
+    for (size_t c = 0; c < ws.planes.size(); c++) {
+        if (cancel && cancel->load(std::memory_order_relaxed))
+            return false;
+        RunStage(stage, ws.planes[c], ws.plane_results[c], p, &ws);
+    }
+    cv::merge(ws.plane_results, output);
+    return true;
+}
+
+// Channel values read plus written per pixel by one GRAY <-> BGR conversion, and by the
+// split and merge around a planar stage
+const int kConversionChannels = 4;
+const int kSplitMergeChannels = 12;
+
+}  // namespace
+
+FormatPlan PlanFormats(const PipelineParams& p, int input_channels, const FormatPlanOptions& options) {
+    FormatPlan plan;
+    const bool negotiate = options.negotiate && (input_channels == 1 || input_channels == 3);
+    int plain = input_channels;    // what the unplanned chain carries
+    int carried = input_channels;  // what the planned one does
+
+    auto save = [&](int stage, int conversions, int channels) {
+        plan.conversions_avoided[stage] += conversions;
+        plan.channels_saved[stage] += channels;
+    };
+
+    for (int i = 0; i < kStageCount; i++) {
+        if (!StageEnabled(i, p)) {
+            plan.channels[i] = carried;
+            continue;
+        }
+
+        switch (static_cast<Stage>(i)) {
+        case Stage::Grayscale:
+            if (plain == 3) plain = 1;
+            if (carried == 3) carried = 1;
+            break;
+        case Stage::Blur:
+            // Not free: the split and merge cost two passes
+            if (options.planar && carried == 3) {
+                plan.planar[i] = true;
+                save(i, -2, -kSplitMergeChannels);
+            }
+            break;
+        case Stage::Threshold:
+            // The mask is not widened back to BGR
+            if (negotiate && carried == 3) {
+                carried = 1;
+                save(i, 1, kConversionChannels);
+            }
+            break;
+        case Stage::EdgeDetection:
+            // Gray content needs no BGR -> GRAY before the gradients
+            if (carried == 1 && plain == 3)
+                save(i, 1, kConversionChannels);
+            if (p.overlay_edges) {
+                // Red edges need BGR wherever the unplanned chain still had it
+                if (carried == 1 && plain == 3) {
+                    carried = 3;
+                    save(i, -1, -kConversionChannels);
+                }
+            } else {
+                plain = 3;
+                if (negotiate) {
+                    carried = 1;
+                    save(i, 1, kConversionChannels);
+                } else {
+                    carried = 3;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+        plan.channels[i] = carried;
+    }
+
+    plan.output_channels = plain;
+    plan.expand_output = carried != plain;
+    return plan;
+}
+
+int FusedGroupEnd(int first, const PipelineParams& p, const cv::Mat& input) {
+    return FusedGroupEnd(first, p, input.depth(), input.channels());
+}
+
+bool RunStageGroup(int first, int last, const cv::Mat& input, cv::Mat& output, const PipelineParams& p,
+                   const std::atomic<bool>* cancel, StageWorkspace* workspace, int output_channels) {
+    if (UseFusedKernel(first, last, p, input.depth(), input.channels())) {
+        NBIP_PROFILE_SCOPE("Fused pointwise");
+        const bool replicate = output_channels != 1;
+        // 8-bit chains collapse into lookup tables; wider depths run the typed kernels
+        if (input.depth() != CV_8U) {
+            return RunTypedPointwiseKernel(
+                input, output, BuildTypedPointwiseOps(first, last, p, input.channels(), input.depth(), replicate),
+                cancel);
+        }
+        return RunPointwiseKernel(input, output, BuildPointwiseKernel(first, last, p, input.channels(), replicate),
+                                  BestSimdLevel(), cancel);
+    }
+
+    NBIP_PROFILE_SCOPE(StageName(static_cast<Stage>(first)));
+    if (cancel && RunsInBands(first, p, input.depth()) && (int64)input.rows * input.cols > kCancelBandPixels) {
+        StageWorkspace local;
+        return RunStageInBands(static_cast<Stage>(first), input, output, p, *cancel, workspace ? *workspace : local,
+                               output_channels);
+    }
+
+    RunStage(static_cast<Stage>(first), input, output, p, workspace, output_channels);
+    return true;
+}
+
+int Pipeline::GroupEnd(int first, const PipelineParams& params, const cv::Mat& input) const {
+    return GroupEnd(first, params, input.depth(), input.channels());
+}
+
+int Pipeline::GroupEnd(int first, const PipelineParams& params, int depth, int channels) const {
+    return fuse_pointwise_ ? FusedGroupEnd(first, params, depth, channels) : first;
+}
+
+bool Pipeline::RunGroup(int first, int last, const FormatPlan& plan, const cv::Mat& input, cv::Mat& output,
+                        const PipelineParams& params, const std::atomic<bool>* cancel) {
+    if (plan.planar[first] && input.channels() == 3) {
+        NBIP_PROFILE_SCOPE(StageName(static_cast<Stage>(first)));
+        if (!RunStagePlanar(static_cast<Stage>(first), input, output, params, cancel, workspace_[first]))
+            return false;
+    } else if (!RunStageGroup(first, last, input, output, params, cancel, &workspace_[first], plan.channels[last])) {
+        return false;
+    }
+
+    for (int i = first; i <= last; i++)
+        AddSavings(plan.conversions_avoided[i], plan.channels_saved[i], input);
+    return true;
+}
+
+void Pipeline::ExpandOutput(const cv::Mat& gray, cv::Mat& output) {
+    // The one conversion the plan keeps, straight into the caller's buffer
+    cv::cvtColor(gray, output, cv::COLOR_GRAY2BGR);
+    AddSavings(-1, -kConversionChannels, gray);
+}
+
+void Pipeline::AddSavings(int conversions, int channels, const cv::Mat& image) {
+    const int64_t bytes = (int64_t)channels * (int64_t)image.total() * (int64_t)image.elemSize1();
+    last_savings_.conversions_avoided += conversions;
+    last_savings_.bytes_saved += bytes;
+    total_savings_.conversions_avoided += conversions;
+    total_savings_.bytes_saved += bytes;
+}
+
+void Pipeline::SetFormatOptions(const FormatPlanOptions& options) {
+    if (options.negotiate != format_options_.negotiate) {
+        for (StageCache& entry : cache_) {
+            pool_.Recycle(entry.output);
+            entry = StageCache();
+        }
+    }
+    format_options_ = options;
+}
+
+std::array<uint64_t, kStageCount> Pipeline::DiskCacheKeys(const cv::Mat& input, const PipelineParams& params) const {
+    // Each key covers the source pixels and every stage up to and including its own, so
+    // changing one stage leaves the keys of the stages before it intact. Negotiation
+    // changes the layout of what is stored.
+    std::array<uint64_t, kStageCount> keys{};
+    const uint64_t format[2] = { kDiskCacheFormat, format_options_.negotiate ? 1u : 0u };
+    uint64_t h = HashBytes(format, sizeof(format), HashImage(input));
+    for (int i = 0; i < kStageCount; i++) {
+        StageKey key{};
+        if (StageEnabled(i, params))
+            key = MakeStageKey(static_cast<Stage>(i), params);
+        h = HashBytes(key.data(), sizeof(key), h);
+        keys[i] = h;
+    }
+    return keys;
+}
+
+bool Pipeline::Run(const cv::Mat& input, cv::Mat& output, const PipelineParams& params) {
+    if (input.empty()) return false;
+    last_savings_ = FormatSavings();
+    const FormatPlan plan = PlanFormats(params, input.channels(), format_options_);
+
+    int last_enabled = -1;
+    for (int i = 0; i < kStageCount; i++) {
+        if (StageEnabled(i, params))
+            last_enabled = i;
+    }
+
+    const cv::Mat* current = &input;
+    int resume = 0;
+    std::array<uint64_t, kStageCount> disk_keys{};
+    cv::Mat cached;
+    if (disk_cache_ && last_enabled >= 0) {
+        disk_keys = DiskCacheKeys(input, params);
+        // Only group ends are stored. Stages keep the depth, and the plan gives the
+        // channels each group hands on to the next.
+        std::array<bool, kStageCount> stored{};
+        int channels = input.channels();
+        for (int first = 0; first <= last_enabled; first++) {
+            if (!StageEnabled(first, params))
+                continue;
+            const int last = GroupEnd(first, params, input.depth(), channels);
+            stored[last] = true;
+            channels = plan.channels[last];
+            first = last;
+        }
+        // The deepest stage already on disk; everything up to it is skipped
+        for (int stage = last_enabled; stage >= 0; stage--) {
+            if (stored[stage] && disk_cache_->Load(disk_keys[stage], cached)) {
+                if (stage == last_enabled) {
+                    // Not ExpandOutput: nothing was saved in stages that did not run, so
+                    // the conversion costs nothing against them either
+                    if (plan.expand_output)
+                        cv::cvtColor(cached, output, cv::COLOR_GRAY2BGR);
+                    else
+                        cached.copyTo(output);
+                    return true;
+                }
+                current = &cached;
+                resume = stage + 1;
+                break;
+            }
+        }
+    }
+
+    for (int first = resume; first <= last_enabled; first++) {
+        if (!StageEnabled(first, params))
+            continue;
+        int last = GroupEnd(first, params, *current);
+        workspace_[first].input_version = 0;  // inputs of Run() carry no version
+
+        if (last == last_enabled && !plan.expand_output) {
+            // Stages that pass their input through only swap headers; keep writing into
+            // the caller's buffer in that case
+            cv::Mat target = output;
+            RunGroup(first, last, plan, *current, output, params, nullptr);
+            if (!target.empty() && output.data != target.data) {
+                output.copyTo(target);
+                output = target;
+            }
+            if (disk_cache_)
+                disk_cache_->Store(disk_keys[last], output);
+            return true;
+        }
+
+        // Reuse last call's buffer unless someone else still references it
+        cv::Mat& scratch = scratch_[last];
+        if (!OwnsExclusively(scratch)) {
+            pool_.Recycle(scratch);
+            scratch = pool_.Acquire(current->rows, current->cols, CV_MAKETYPE(current->depth(), plan.channels[last]));
+        }
+        RunGroup(first, last, plan, *current, scratch, params, nullptr);
+        if (disk_cache_)
+            disk_cache_->Store(disk_keys[last], scratch);
+        if (last == last_enabled) {
+            ExpandOutput(scratch, output);
+            return true;
+        }
+        current = &scratch;
+        first = last;
+    }
+
+    // Nothing enabled: the result is the input itself
+    if (output.data != input.data)
+        input.copyTo(output);
+    return true;
+}
+
+void Pipeline::SetSource(const cv::Mat& image) {
+    source_ = image;
+    source_version_ = next_version_++;
+    stage_result_.fill(StageResult());
+    for (StageCache& entry : cache_) {
+        pool_.Recycle(entry.output);
+        entry = StageCache();
+    }
+    result_ = source_;
+    result_version_ = source_version_;
+}
+
+const cv::Mat& Pipeline::Evaluate(const PipelineParams& params) {
+    EvaluateUntil(params, nullptr);
+    return result_;
+}
+
+bool Pipeline::Evaluate(const PipelineParams& params, const std::atomic<bool>& cancel) {
+    return EvaluateUntil(params, &cancel);
+}
+
+bool Pipeline::EvaluateUntil(const PipelineParams& params, const std::atomic<bool>* cancel) {
+    last_savings_ = FormatSavings();
+    const FormatPlan plan = PlanFormats(params, source_.channels(), format_options_);
+    const cv::Mat* current = &source_;
+    uint64_t current_version = source_version_;
+    std::array<StageResult, kStageCount> stage_result;
+
+    for (int first = 0; first < kStageCount && !source_.empty(); first++) {
+        if (cancel && cancel->load(std::memory_order_relaxed))
+            return false;
+        if (!StageEnabled(first, params)) {
+            // Disabled stages pass their input through untouched
+            stage_result[first].image = *current;
+            stage_result[first].version = current_version;
+            continue;
+        }
+
+        int last = GroupEnd(first, params, *current);
+        GroupKey key{};
+        for (int i = first; i <= last; i++) {
+            if (StageEnabled(i, params))
+                key[i] = MakeStageKey(static_cast<Stage>(i), params);
+        }
+
+        StageCache& entry = cache_[last];
+        bool hit = entry.valid && entry.first_stage == first &&
+                   entry.input_version == current_version && entry.key == key;
+
+        for (int i = first; i <= last; i++) {
+            if (!StageEnabled(i, params)) continue;
+            if (hit) stats_[i].hits++;
+            else stats_[i].misses++;
+        }
+
+        if (!hit) {
+            // Never write into a buffer someone may still read: the old output goes back to
+            // the pool, which only hands out buffers nobody else references
+            pool_.Recycle(entry.output);
+            entry.valid = false;
+            cv::Mat buffer = pool_.Acquire(current->rows, current->cols, CV_MAKETYPE(current->depth(), plan.channels[last]));
+            cv::Mat output = buffer;
+            workspace_[first].input_version = current_version;
+            bool finished = RunGroup(first, last, plan, *current, output, params, cancel);
+            // Pass-through stages only swap headers
+            if (output.data != buffer.data)
+                pool_.Recycle(buffer);
+            if (!finished)
+                return false;
+            entry.output = output;
+            entry.first_stage = first;
+            entry.key = key;
+            entry.input_version = current_version;
+            entry.output_version = next_version_++;
+            for (int i = first; i < last; i++)
+                entry.fused_version[i] = next_version_++;
+            entry.valid = true;
+        }
+
+        // Stages fused into this group have no output of their own: they are replayed
+        // from the group's input when asked for
+        for (int i = first; i < last; i++) {
+            stage_result[i].group_input = *current;
+            stage_result[i].group_first = first;
+            stage_result[i].version = entry.fused_version[i];
+        }
+        current = &entry.output;
+        current_version = entry.output_version;
+        stage_result[last].image = *current;
+        stage_result[last].version = current_version;
+        first = last;
+    }
+
+    result_ = *current;
+    result_version_ = current_version;
+    result_params_ = params;
+    stage_result_ = stage_result;
+    return true;
+}
+
+bool ResolveStageOutput(Stage stage, const StageResult& result, const PipelineParams& params, cv::Mat& image) {
+    if (result.version == 0)
+        return false;
+    if (result.group_input.empty()) {
+        image = result.image;
+        return true;
+    }
+
+    NBIP_PROFILE_SCOPE("Replay fused stage");
+    cv::Mat current = result.group_input;
+    for (int i = result.group_first; i <= static_cast<int>(stage); i++) {
+        if (!StageEnabled(i, params)) continue;
+        cv::Mat output;
+        RunStage(static_cast<Stage>(i), current, output, params);
+        current = output;
+    }
+    image = current;
+    return true;
+}
+
+bool Pipeline::StageOutput(Stage stage, cv::Mat& image, uint64_t& version) const {
+    const StageResult& result = stage_result_[static_cast<int>(stage)];
+    if (!ResolveStageOutput(stage, result, result_params_, image))
+        return false;
+    version = result.version;
+    return true;
+}
+
+StageCacheStats Pipeline::TotalStats() const {
+    StageCacheStats total;
+    for (const StageCacheStats& s : stats_) {
+        total.hits += s.hits;
+        total.misses += s.misses;
+    }
+    return total;
+}
+
+void Pipeline::ResetStats() {
+    stats_.fill(StageCacheStats());
+    total_savings_ = FormatSavings();
+}
@@ -0,0 +1,299 @@
+#pragma once
+
+#include "adaptive_threshold.h"
+#include "buffer_pool.h"
+#include <opencv2/opencv.hpp>
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+class DiskCache;
+
+// Parameters of every node in the processing chain (mirrors the GUI state)
+struct PipelineParams {
+    bool grayscale = false;
+
+    bool brightness = false;
+    float brightness_value = 0.0f;
+    bool contrast = false;
+    float contrast_value = 1.0f;
+
+    bool blur = false;
+    int blur_radius = 1;
+    bool use_gaussian = true;
+
+    bool threshold = false;
+    int threshold_method = 0;  // 0: Binary, 1: Adaptive, 2: Otsu
+    int threshold_value = 127;
+    int block_size = 11;       // For adaptive threshold
+    int constant = 2;          // For adaptive threshold
+    int adaptive_mode = 0;     // AdaptiveMode: 0 Gaussian, 1 Mean, 2 Sauvola, 3 Niblack
+    float adaptive_k = 0.2f;   // For Sauvola and Niblack
+
+    bool edge_detection = false;
+    bool use_canny = true;
+    int lower_threshold = 100;
+    int upper_threshold = 200;
+    int kernel_size = 1;
+    bool overlay_edges = false;
+    int edge_norm = 0;         // GradientNorm: 0 L1, 1 L2
+
+    bool AnyEnabled() const {
+        return grayscale || brightness || contrast || blur || threshold || edge_detection;
+    }
+};
+
+// Stages of the chain, in execution order
+enum class Stage {
+    Grayscale,
+    BrightnessContrast,
+    Blur,
+    Threshold,
+    EdgeDetection,
+    Count
+};
+
+constexpr int kStageCount = static_cast<int>(Stage::Count);
+
+const char* StageName(Stage stage);
+
+// The parameters a single stage depends on, packed so they can be compared cheaply.
+// Slot 0 is always the enabled flag.
+using StageKey = std::array<double, 8>;
+
+StageKey MakeStageKey(Stage stage, const PipelineParams& params);
+
+// True if both parameter sets produce the same image (unused fields are ignored)
+bool EquivalentParams(const PipelineParams& a, const PipelineParams& b);
+
+// Hash that is the same for parameter sets EquivalentParams considers equal
+uint64_t HashParams(const PipelineParams& params);
+
+// Keys of a run of stages evaluated as one step (slots outside the run are zero)
+using GroupKey = std::array<StageKey, kStageCount>;
+
+// Temporaries of one stage (gray conversions, gradients, masks), kept between calls so a
+// repeated evaluation at the same size allocates nothing
+struct StageWorkspace {
+    cv::Mat gray;
+    cv::Mat binary;
+    cv::Mat smoothed;
+    cv::Mat grad_x, grad_y;  // CV_16S gradients fed to Canny
+    cv::Mat edges;
+    cv::Mat overlay;
+    cv::Mat band;  // one row band of a cancellable stage
+    // 16-bit and float inputs of the steps that only run on 8-bit data (adaptive and
+    // Otsu thresholds, edge detection): the 8-bit gray copy and its 8-bit result
+    cv::Mat narrow;
+    cv::Mat narrow_mask;
+    // A gray input widened to BGR for the edge overlay, and the planes of a planar stage
+    cv::Mat expanded;
+    std::vector<cv::Mat> planes;
+    std::vector<cv::Mat> plane_results;
+
+    // Summed-area tables of the adaptive threshold's gray input, reused while
+    // `input_version` stays the same (0: the input is unversioned, always rebuild).
+    // `gray` is reused the same way when it was converted from `gray_version`.
+    IntegralImage integral;
+    uint64_t input_version = 0;
+    uint64_t gray_version = 0;
+};
+
+// Runs one stage on `input` and writes the result to `output`, reusing its buffer when
+// the size and type already match. Stages that leave the image unchanged may instead
+// make `output` share `input`. Without a workspace, temporaries are allocated per call.
+//
+// `output_channels` overrides the layout of results that are gray in content (see
+// FormatPlan): 1 leaves a threshold or edge map of a BGR input single-channel, 3 widens a
+// gray input before edges are overlaid on it. 0 keeps the stage's usual layout.
+void RunStage(Stage stage, const cv::Mat& input, cv::Mat& output, const PipelineParams& params,
+              StageWorkspace* workspace = nullptr, int output_channels = 0);
+
+// Rows of context a stage needs above and below every output row
+int StageHalo(Stage stage, const PipelineParams& params);
+
+// Sum of the halos of every enabled stage
+int PipelineHalo(const PipelineParams& params);
+
+// Channel count of the final image for a given source channel count (1 or 3)
+int PipelineOutputChannels(const PipelineParams& params, int input_channels);
+
+struct FormatPlanOptions {
+    bool negotiate = true;  // keep gray content single-channel (off: the unplanned layouts)
+    bool planar = false;    // run blur on BGR data as three separate planes
+};
+
+// Layout of every edge of the chain for one set of parameters.
+//
+// Unplanned, a threshold of a BGR image converts to gray and widens the mask back to BGR,
+// edge detection converts that to gray again, and an edge map is widened to BGR once
+// more. Planned, gray content (a grayscale, threshold or edge result) stays
+// single-channel as long as every stage downstream reads it that way: only an edge
+// overlay on what was a color image needs it widened first. Run() widens once at the end
+// where PipelineOutputChannels asks for BGR; Evaluate() hands the gray result on as is.
+struct FormatPlan {
+    std::array<int, kStageCount> channels{};  // written by each stage (disabled: passed on)
+    std::array<bool, kStageCount> planar{};   // the stage runs on separate planes
+    int output_channels = 0;                  // PipelineOutputChannels
+    bool expand_output = false;               // Run() ends with one GRAY -> BGR
+
+    // Compared with the unplanned chain, in the slot of the stage that saves them:
+    // conversion passes, and channel values read plus written per pixel
+    std::array<int, kStageCount> conversions_avoided{};
+    std::array<int, kStageCount> channels_saved{};
+};
+
+FormatPlan PlanFormats(const PipelineParams& params, int input_channels,
+                       const FormatPlanOptions& options = FormatPlanOptions());
+
+// What the format plan saved compared with the unplanned chain
+struct FormatSavings {
+    int64_t conversions_avoided = 0;
+    int64_t bytes_saved = 0;  // pixel bytes read and written
+};
+
+// Last stage of the fused pointwise run starting at `first` (see pointwise.h), or
+// `first` itself if the stage runs on its own
+int FusedGroupEnd(int first, const PipelineParams& params, const cv::Mat& input);
+
+// Runs stages first..last (as returned by FusedGroupEnd) as one step. With `cancel`,
+// the fused kernel and large neighbourhood stages run in row bands and stop between
+// bands once it is set; returns false in that case and `output` is incomplete.
+// `output_channels` is passed on as for RunStage.
+bool RunStageGroup(int first, int last, const cv::Mat& input, cv::Mat& output, const PipelineParams& params,
+                   const std::atomic<bool>* cancel = nullptr, StageWorkspace* workspace = nullptr,
+                   int output_channels = 0);
+
+// True if `m` owns its pixel buffer and no other Mat header references it
+bool OwnsExclusively(const cv::Mat& m);
+
+struct StageCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
+// Output of one stage in an evaluation. A stage fused into a later one has no buffer of
+// its own: it keeps the group's input and first stage and is replayed unfused on demand.
+struct StageResult {
+    cv::Mat image;
+    cv::Mat group_input;  // fused stages only
+    int group_first = 0;
+    uint64_t version = 0; // 0: not computed
+};
+
+// The image of `result`, running stages group_first..stage of `params` one by one for a
+// fused stage (a pointwise pass over the group input)
+bool ResolveStageOutput(Stage stage, const StageResult& result, const PipelineParams& params, cv::Mat& image);
+
+// Linear processing chain with a per-stage result cache.
+//
+// Every buffer carries a version number. A stage is only recomputed when its input
+// version or its own parameters changed, so a parameter change re-runs that stage and
+// everything downstream of it, and an unchanged frame does no pixel work at all.
+class Pipeline {
+public:
+    // Shares `image` (no copy) and invalidates every cached stage
+    void SetSource(const cv::Mat& image);
+    const cv::Mat& Source() const { return source_; }
+
+    // Brings every stage up to date with `params` and returns the final image. With
+    // format negotiation on, gray content stays single-channel here even where Run()
+    // would widen it to BGR (see FormatPlan).
+    const cv::Mat& Evaluate(const PipelineParams& params);
+
+    // Same, but gives up as soon as `cancel` is set (checked between stages and between
+    // row bands). Returns false if cancelled: the stages that finished stay cached and
+    // Result() still holds the previous complete result.
+    bool Evaluate(const PipelineParams& params, const std::atomic<bool>& cancel);
+
+    const cv::Mat& Result() const { return result_; }
+    uint64_t ResultVersion() const { return result_version_; }
+    uint64_t SourceVersion() const { return source_version_; }
+
+    // Image after `stage` in the last completed Evaluate (a disabled stage passes its
+    // input on), with its version. False before the first evaluation. Stages that ran
+    // fused into a group ending at a later stage are replayed unfused (see StageResult).
+    bool StageOutput(Stage stage, cv::Mat& image, uint64_t& version) const;
+
+    // The record behind StageOutput, for callers that resolve it later or elsewhere
+    const StageResult& StageRecord(Stage stage) const { return stage_result_[static_cast<int>(stage)]; }
+    const PipelineParams& ResultParams() const { return result_params_; }
+
+    // One-shot evaluation for callers that bring their own buffers. Nothing is cached in
+    // memory (see SetDiskCache for the on-disk cache): the last enabled stage writes
+    // directly into `output` (which may wrap external memory of the right size and
+    // type), and intermediates live in scratch buffers that are reused by the next call.
+    bool Run(const cv::Mat& input, cv::Mat& output, const PipelineParams& params);
+
+    // Run() looks up and stores the result of every stage group in `cache` (not owned;
+    // null disables it). A run resumes after the deepest stage found on disk, so a change
+    // to the last stage only recomputes that stage.
+    void SetDiskCache(DiskCache* cache) { disk_cache_ = cache; }
+    DiskCache* GetDiskCache() const { return disk_cache_; }
+
+    // Consecutive grayscale, brightness/contrast and binary threshold stages run as one
+    // fused pass (on by default). Fused stages share one cache entry.
+    void SetFusePointwise(bool enabled) { fuse_pointwise_ = enabled; }
+    bool FusePointwise() const { return fuse_pointwise_; }
+
+    // Layout planning (see FormatPlan; negotiation on by default). Switching negotiation
+    // drops the cached stages, whose layouts no longer match.
+    void SetFormatOptions(const FormatPlanOptions& options);
+    const FormatPlanOptions& FormatOptions() const { return format_options_; }
+
+    // Conversions and pixel traffic the plan saved in the stages the last Run() or
+    // Evaluate() computed (cached stages save nothing), and since ResetStats()
+    const FormatSavings& LastFormatSavings() const { return last_savings_; }
+    const FormatSavings& TotalFormatSavings() const { return total_savings_; }
+
+    const StageCacheStats& Stats(Stage stage) const { return stats_[static_cast<int>(stage)]; }
+    StageCacheStats TotalStats() const;
+    void ResetStats();
+
+    // Stage outputs and scratch buffers are recycled through this pool, so repeated
+    // evaluations at a fixed size reach a steady state without new allocations
+    BufferPool& Pool() { return pool_; }
+    const BufferPool& Pool() const { return pool_; }
+
+private:
+    // Lives in the slot of the last stage of its group
+    struct StageCache {
+        bool valid = false;
+        int first_stage = 0;
+        GroupKey key{};
+        uint64_t input_version = 0;
+        uint64_t output_version = 0;
+        std::array<uint64_t, kStageCount> fused_version{};  // of the group's inner stages
+        cv::Mat output;
+    };
+
+    cv::Mat source_;
+    uint64_t source_version_ = 0;
+    uint64_t next_version_ = 1;
+
+    std::array<StageCache, kStageCount> cache_;
+    std::array<StageCacheStats, kStageCount> stats_;
+
+    cv::Mat result_;
+    uint64_t result_version_ = 0;
+    PipelineParams result_params_;
+    std::array<StageResult, kStageCount> stage_result_;
+
+    std::array<cv::Mat, kStageCount> scratch_;
+    std::array<StageWorkspace, kStageCount> workspace_;
+    BufferPool pool_;
+    bool fuse_pointwise_ = true;
+    DiskCache* disk_cache_ = nullptr;
+    FormatPlanOptions format_options_;
+    FormatSavings last_savings_;
+    FormatSavings total_savings_;
+
+    int GroupEnd(int first, const PipelineParams& params, const cv::Mat& input) const;
+    int GroupEnd(int first, const PipelineParams& params, int depth, int channels) const;
+    bool EvaluateUntil(const PipelineParams& params, const std::atomic<bool>* cancel);
+    bool RunGroup(int first, int last, const FormatPlan& plan, const cv::Mat& input, cv::Mat& output,
+                  const PipelineParams& params, const std::atomic<bool>* cancel);
+    void ExpandOutput(const cv::Mat& gray, cv::Mat& output);
+    void AddSavings(int conversions, int channels, const cv::Mat& image);
+    std::array<uint64_t, kStageCount> DiskCacheKeys(const cv::Mat& input, const PipelineParams& params) const;
+};
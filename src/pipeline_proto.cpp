@@ -0,0 +1,133 @@
+#include "pipeline_proto.h"
+#include "blur.h"
+#include "pipeline.pb.h"
+#include <fstream>
+#include <sstream>
+
+namespace {
+
+// Bumped when the meaning of a field changes
+const uint32_t kFormatVersion = 1;
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+}  // namespace
+
+std::string SerializePipeline(const PipelineParams& p) {
+    nbip::proto::Pipeline message;
+    message.set_format_version(kFormatVersion);
+    message.set_grayscale(p.grayscale);
+
+    if (p.brightness || p.contrast) {
+        nbip::proto::BrightnessContrast* bc = message.mutable_brightness_contrast();
+        bc->set_brightness(p.brightness);
+        bc->set_offset(p.brightness_value);
+        bc->set_contrast(p.contrast);
+        bc->set_gain(p.contrast_value);
+    }
+    if (p.blur) {
+        nbip::proto::Blur* blur = message.mutable_blur();
+        blur->set_radius(p.blur_radius);
+        blur->set_box(!p.use_gaussian);
+    }
+    if (p.threshold) {
+        nbip::proto::Threshold* threshold = message.mutable_threshold();
+        threshold->set_method(static_cast<nbip::proto::Threshold::Method>(p.threshold_method));
+        threshold->set_value(p.threshold_value);
+        threshold->set_block_size(p.block_size);
+        threshold->set_constant(p.constant);
+        threshold->set_adaptive_mode(static_cast<nbip::proto::Threshold::AdaptiveMode>(p.adaptive_mode));
+        threshold->set_k(p.adaptive_k);
+    }
+    if (p.edge_detection) {
+        nbip::proto::EdgeDetection* edges = message.mutable_edges();
+        edges->set_sobel(!p.use_canny);
+        edges->set_low(p.lower_threshold);
+        edges->set_high(p.upper_threshold);
+        edges->set_kernel_size(p.kernel_size);
+        edges->set_overlay(p.overlay_edges);
+        edges->set_l2(p.edge_norm == 1);
+    }
+
+    return message.SerializeAsString();
+}
+
+bool ParsePipelineProto(const std::string& bytes, PipelineParams& params, std::string* error) {
+    nbip::proto::Pipeline message;
+    if (!message.ParseFromString(bytes))
+        return Fail(error, "not a serialized pipeline");
+    if (message.format_version() > kFormatVersion)
+        return Fail(error, "pipeline format version " + std::to_string(message.format_version()) + " is newer than this build");
+
+    PipelineParams p;
+    p.grayscale = message.grayscale();
+
+    if (message.has_brightness_contrast()) {
+        const nbip::proto::BrightnessContrast& bc = message.brightness_contrast();
+        p.brightness = bc.brightness();
+        p.brightness_value = bc.offset();
+        p.contrast = bc.contrast();
+        p.contrast_value = bc.gain();
+    }
+    if (message.has_blur()) {
+        p.blur = true;
+        p.blur_radius = message.blur().radius();
+        p.use_gaussian = !message.blur().box();
+        if (p.blur_radius < 1 || p.blur_radius > kMaxBlurRadius)
+            return Fail(error, "blur radius must be between 1 and " + std::to_string(kMaxBlurRadius));
+    }
+    if (message.has_threshold()) {
+        const nbip::proto::Threshold& threshold = message.threshold();
+        p.threshold = true;
+        p.threshold_method = threshold.method();
+        p.threshold_value = threshold.value();
+        p.block_size = threshold.block_size();
+        p.constant = threshold.constant();
+        p.adaptive_mode = threshold.adaptive_mode();
+        p.adaptive_k = threshold.k();
+        if (p.threshold_method < 0 || p.threshold_method > 2)
+            return Fail(error, "unknown threshold method");
+        if (p.adaptive_mode < 0 || p.adaptive_mode > 3)
+            return Fail(error, "unknown adaptive threshold mode");
+        if (p.threshold_method == 1 && (p.block_size < 3 || p.block_size % 2 == 0))
+            return Fail(error, "adaptive threshold block size must be odd and at least 3");
+    }
+    if (message.has_edges()) {
+        const nbip::proto::EdgeDetection& edges = message.edges();
+        p.edge_detection = true;
+        p.use_canny = !edges.sobel();
+        p.lower_threshold = edges.low();
+        p.upper_threshold = edges.high();
+        p.kernel_size = edges.kernel_size();
+        p.overlay_edges = edges.overlay();
+        p.edge_norm = edges.l2() ? 1 : 0;
+        if (p.kernel_size < 1 || p.kernel_size > 4)
+            return Fail(error, "edge kernel size must be between 1 and 4");
+    }
+
+    params = p;
+    return true;
+}
+
+bool SavePipelineProtoFile(const std::string& path, const PipelineParams& params, std::string* error) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file)
+        return Fail(error, "cannot create '" + path + "'");
+    std::string bytes = SerializePipeline(params);
+    file.write(bytes.data(), (std::streamsize)bytes.size());
+    if (!file)
+        return Fail(error, "cannot write '" + path + "'");
+    return true;
+}
+
+bool LoadPipelineProtoFile(const std::string& path, PipelineParams& params, std::string* error) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return Fail(error, "cannot open '" + path + "'");
+    std::stringstream bytes;
+    bytes << file.rdbuf();
+    return ParsePipelineProto(bytes.str(), params, error);
+}
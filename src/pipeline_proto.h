@@ -0,0 +1,12 @@
+#pragma once
+
+#include "pipeline.h"
+#include <string>
+
+// Binary protobuf form of a pipeline (proto/pipeline.proto). Unlike the text spec it is
+// versioned and stable across releases, so it is the format to store alongside results.
+std::string SerializePipeline(const PipelineParams& params);
+bool ParsePipelineProto(const std::string& bytes, PipelineParams& params, std::string* error = nullptr);
+
+bool SavePipelineProtoFile(const std::string& path, const PipelineParams& params, std::string* error = nullptr);
+bool LoadPipelineProtoFile(const std::string& path, PipelineParams& params, std::string* error = nullptr);
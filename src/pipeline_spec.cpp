@@ -0,0 +1,179 @@
+#include "pipeline_spec.h"
+#include "blur.h"
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+bool ParseInt(const std::string& text, int& out) {
+    try {
+        size_t used = 0;
+        out = std::stoi(text, &used);
+        return used == text.size();
+    } catch (...) {
+        return false;
+    }
+}
+
+bool ParseFloat(const std::string& text, float& out) {
+    try {
+        size_t used = 0;
+        out = std::stof(text, &used);
+        return used == text.size();
+    } catch (...) {
+        return false;
+    }
+}
+
+std::string FormatFloat(float value) {
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+
+std::vector<std::string> Tokenize(const std::string& spec) {
+    std::vector<std::string> tokens;
+    std::string token;
+    for (char c : spec) {
+        if (c == ',' || c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+            if (!token.empty()) tokens.push_back(token);
+            token.clear();
+        } else {
+            token += c;
+        }
+    }
+    if (!token.empty()) tokens.push_back(token);
+    return tokens;
+}
+
+}  // namespace
+
+bool ParsePipelineSpec(const std::string& spec, PipelineParams& params, std::string* error) {
+    PipelineParams p;
+
+    for (const std::string& token : Tokenize(spec)) {
+        size_t eq = token.find('=');
+        std::string name = token.substr(0, eq);
+        std::string value = eq == std::string::npos ? "" : token.substr(eq + 1);
+        bool ok = true;
+
+        if (name == "grayscale") {
+            p.grayscale = true;
+        } else if (name == "brightness") {
+            p.brightness = true;
+            ok = ParseFloat(value, p.brightness_value);
+        } else if (name == "contrast") {
+            p.contrast = true;
+            ok = ParseFloat(value, p.contrast_value);
+        } else if (name == "blur") {
+            p.blur = true;
+            ok = value.empty() || (ParseInt(value, p.blur_radius) && p.blur_radius >= 1 && p.blur_radius <= kMaxBlurRadius);
+        } else if (name == "box") {
+            p.use_gaussian = false;
+        } else if (name == "threshold") {
+            p.threshold = true;
+            if (value.empty() || value == "binary") p.threshold_method = 0;
+            else if (value == "adaptive") p.threshold_method = 1;
+            else if (value == "otsu") p.threshold_method = 2;
+            else ok = false;
+        } else if (name == "value") {
+            ok = ParseInt(value, p.threshold_value);
+        } else if (name == "block") {
+            ok = ParseInt(value, p.block_size) && p.block_size >= 3 && p.block_size % 2 == 1;
+        } else if (name == "constant") {
+            ok = ParseInt(value, p.constant);
+        } else if (name == "adaptive") {
+            p.threshold = true;
+            p.threshold_method = 1;
+            if (value.empty() || value == "gaussian") p.adaptive_mode = 0;
+            else if (value == "mean") p.adaptive_mode = 1;
+            else if (value == "sauvola") p.adaptive_mode = 2;
+            else if (value == "niblack") p.adaptive_mode = 3;
+            else ok = false;
+        } else if (name == "k") {
+            ok = ParseFloat(value, p.adaptive_k);
+        } else if (name == "edges") {
+            p.edge_detection = true;
+            if (value.empty() || value == "canny") p.use_canny = true;
+            else if (value == "sobel") p.use_canny = false;
+            else ok = false;
+        } else if (name == "low") {
+            ok = ParseInt(value, p.lower_threshold);
+        } else if (name == "high") {
+            ok = ParseInt(value, p.upper_threshold);
+        } else if (name == "kernel") {
+            ok = ParseInt(value, p.kernel_size) && p.kernel_size >= 1 && p.kernel_size <= 4;
+        } else if (name == "overlay") {
+            p.overlay_edges = true;
+        } else if (name == "norm") {
+            if (value == "l1") p.edge_norm = 0;
+            else if (value == "l2") p.edge_norm = 1;
+            else ok = false;
+        } else {
+            return Fail(error, "unknown pipeline token '" + token + "'");
+        }
+
+        if (!ok)
+            return Fail(error, "invalid value in pipeline token '" + token + "'");
+    }
+
+    params = p;
+    return true;
+}
+
+std::string FormatPipelineSpec(const PipelineParams& p) {
+    std::ostringstream out;
+    const char* sep = "";
+    auto add = [&](const std::string& token) {
+        out << sep << token;
+        sep = ",";
+    };
+
+    if (p.grayscale) add("grayscale");
+    if (p.brightness) add("brightness=" + FormatFloat(p.brightness_value));
+    if (p.contrast) add("contrast=" + FormatFloat(p.contrast_value));
+    if (p.blur) {
+        add("blur=" + std::to_string(p.blur_radius));
+        if (!p.use_gaussian) add("box");
+    }
+    if (p.threshold) {
+        const char* methods[] = { "binary", "adaptive", "otsu" };
+        add(std::string("threshold=") + methods[p.threshold_method]);
+        if (p.threshold_method == 0) add("value=" + std::to_string(p.threshold_value));
+        if (p.threshold_method == 1) {
+            if (p.adaptive_mode != 0) add(std::string("adaptive=") + AdaptiveModeName(static_cast<AdaptiveMode>(p.adaptive_mode)));
+            add("block=" + std::to_string(p.block_size));
+            add("constant=" + std::to_string(p.constant));
+            if (p.adaptive_mode >= 2) add("k=" + FormatFloat(p.adaptive_k));
+        }
+    }
+    if (p.edge_detection) {
+        add(p.use_canny ? "edges=canny" : "edges=sobel");
+        add("low=" + std::to_string(p.lower_threshold));
+        if (p.use_canny) add("high=" + std::to_string(p.upper_threshold));
+        add("kernel=" + std::to_string(p.kernel_size));
+        if (p.overlay_edges) add("overlay");
+        if (p.edge_norm == 1) add("norm=l2");
+    }
+    return out.str();
+}
+
+bool LoadPipelineSpecFile(const std::string& path, PipelineParams& params, std::string* error) {
+    std::ifstream file(path);
+    if (!file)
+        return Fail(error, "cannot open pipeline file '" + path + "'");
+
+    std::string spec, line;
+    while (std::getline(file, line)) {
+        size_t hash = line.find('#');
+        if (hash != std::string::npos) line.erase(hash);
+        spec += line + "\n";
+    }
+    return ParsePipelineSpec(spec, params, error);
+}
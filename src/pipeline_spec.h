@@ -0,0 +1,27 @@
+#pragma once
+
+#include "pipeline.h"
+#include <string>
+
+// Text form of a pipeline, used by the headless tools. Stages are comma or space
+// separated `name[=value]` tokens, for example:
+//
+//   grayscale, brightness=20, blur=3, threshold=adaptive, block=15, edges=canny, low=50
+//
+// Recognised tokens:
+//   grayscale                      convert to gray
+//   brightness=<float>             enable brightness with the given offset
+//   contrast=<float>               enable contrast with the given gain
+//   blur=<1..200>, box             enable blur (Gaussian unless `box` is given)
+//   threshold=binary|adaptive|otsu enable threshold
+//   value=<int>, block=<odd>, constant=<int>
+//   adaptive=gaussian|mean|sauvola|niblack, k=<float>
+//   edges=canny|sobel              enable edge detection
+//   low=<int>, high=<int>, kernel=<1..4>, overlay, norm=l1|l2
+bool ParsePipelineSpec(const std::string& spec, PipelineParams& params, std::string* error = nullptr);
+
+// Inverse of ParsePipelineSpec: only enabled stages are written
+std::string FormatPipelineSpec(const PipelineParams& params);
+
+// Reads a spec from a file; '#' starts a comment that runs to the end of the line
+bool LoadPipelineSpecFile(const std::string& path, PipelineParams& params, std::string* error = nullptr);
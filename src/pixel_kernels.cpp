@@ -0,0 +1,175 @@
+#include "pixel_kernels.h"
+#include <algorithm>
+#include <array>
+#include <utility>
+
+namespace {
+
+// cv::cvtColor's BGR -> gray weights
+const float kGrayB = 0.114f;
+const float kGrayG = 0.587f;
+const float kGrayR = 0.299f;
+
+// Bits of the step mask a row kernel is instantiated for
+const unsigned kPreAffine = 1;
+const unsigned kToGray = 2;
+const unsigned kPostAffine = 4;
+const unsigned kThreshold = 8;
+const unsigned kReplicate = 16;
+constexpr size_t kStepCombinations = 32;
+
+// Like cv::saturate_cast, except that float is left unclipped
+template <typename T>
+inline T Store(float v) { return cv::saturate_cast<T>(v); }
+
+template <>
+inline float Store<float>(float v) { return v; }
+
+template <typename T, int Cn, unsigned Steps>
+void TypedPointwiseRow(const T* src, T* dst, int width, const TypedPointwiseOps& ops) {
+    constexpr bool gray = Cn == 3 && (Steps & kToGray);
+    constexpr int dst_cn = gray ? ((Steps & kReplicate) ? 3 : 1) : Cn;
+    const float alpha = ops.alpha;
+    const float beta = ops.beta;
+    const float threshold = ops.threshold_value;
+    const T high = (T)PixelTraits<T>::kMax;
+
+    for (int x = 0; x < width; x++) {
+        const T* s = src + Cn * x;
+        T* d = dst + dst_cn * x;
+        if constexpr (gray) {
+            T b = s[0], g = s[1], r = s[2];
+            if constexpr ((Steps & kPreAffine) != 0) {
+                b = Store<T>(alpha * b + beta);
+                g = Store<T>(alpha * g + beta);
+                r = Store<T>(alpha * r + beta);
+            }
+            T v = Store<T>(b * kGrayB + g * kGrayG + r * kGrayR);
+            if constexpr ((Steps & kPostAffine) != 0) v = Store<T>(alpha * v + beta);
+            if constexpr ((Steps & kThreshold) != 0) v = v > threshold ? high : T(0);
+            for (int c = 0; c < dst_cn; c++)
+                d[c] = v;
+        } else {
+            // Without a gray conversion pre and post are the same step
+            for (int c = 0; c < Cn; c++) {
+                T v = s[c];
+                if constexpr ((Steps & (kPreAffine | kPostAffine)) != 0) v = Store<T>(alpha * v + beta);
+                if constexpr ((Steps & kThreshold) != 0) v = v > threshold ? high : T(0);
+                d[c] = v;
+            }
+        }
+    }
+}
+
+template <typename T>
+using TypedRowFn = void (*)(const T*, T*, int, const TypedPointwiseOps&);
+
+template <typename T, int Cn, size_t... Steps>
+std::array<TypedRowFn<T>, kStepCombinations> MakeRowTable(std::index_sequence<Steps...>) {
+    return {{ &TypedPointwiseRow<T, Cn, (unsigned)Steps>... }};
+}
+
+template <typename T>
+TypedRowFn<T> SelectRow(int channels, unsigned steps) {
+    static const std::array<TypedRowFn<T>, kStepCombinations> gray_rows =
+        MakeRowTable<T, 1>(std::make_index_sequence<kStepCombinations>());
+    static const std::array<TypedRowFn<T>, kStepCombinations> bgr_rows =
+        MakeRowTable<T, 3>(std::make_index_sequence<kStepCombinations>());
+    return channels == 3 ? bgr_rows[steps] : gray_rows[steps];
+}
+
+template <typename T>
+bool RunTyped(const cv::Mat& src, cv::Mat& dst, const TypedPointwiseOps& ops, const std::atomic<bool>* cancel) {
+    const int channels = src.channels();
+    const bool gray = channels == 3 && ops.to_gray;
+    unsigned steps = (ops.pre_affine ? kPreAffine : 0) | (ops.post_affine ? kPostAffine : 0) |
+                     (ops.threshold ? kThreshold : 0);
+    if (gray) steps |= kToGray | (ops.replicate ? kReplicate : 0);
+    const TypedRowFn<T> row = SelectRow<T>(channels, steps);
+
+    const int dst_channels = gray ? (ops.replicate ? 3 : 1) : channels;
+    dst.create(src.rows, src.cols, CV_MAKETYPE(PixelTraits<T>::kDepth, dst_channels));
+
+    // Continuous images are one long row split into equal spans; otherwise whole rows
+    // are grouped into bands, ~64K pixels per task
+    const bool continuous = src.isContinuous() && dst.isContinuous();
+    const int64 total_pixels = continuous ? (int64)src.cols * src.rows : src.cols;
+    const int rows_per_band = std::max(1, (1 << 16) / std::max(1, src.cols));
+    const int tasks = continuous
+        ? (int)std::max<int64>(1, total_pixels >> 16)
+        : (src.rows + rows_per_band - 1) / rows_per_band;
+
+    std::atomic<bool> cancelled(false);
+    cv::parallel_for_(cv::Range(0, tasks), [&](const cv::Range& range) {
+        for (int t = range.start; t < range.end; t++) {
+            if (cancel && cancel->load(std::memory_order_relaxed)) {
+                cancelled = true;
+                return;
+            }
+            if (continuous) {
+                int64 p0 = total_pixels * t / tasks;
+                int64 p1 = total_pixels * (t + 1) / tasks;
+                row(src.ptr<T>() + p0 * channels, dst.ptr<T>() + p0 * dst_channels, (int)(p1 - p0), ops);
+            } else {
+                int y1 = std::min(src.rows, (t + 1) * rows_per_band);
+                for (int y = t * rows_per_band; y < y1; y++)
+                    row(src.ptr<T>(y), dst.ptr<T>(y), src.cols, ops);
+            }
+        }
+    });
+    return !cancelled;
+}
+
+// Full-scale value of the depths only ever converted from
+double SourceDepthMax(int depth) {
+    switch (depth) {
+    case CV_8S:  return 127.0;
+    case CV_16S: return 32767.0;
+    case CV_32S: return 2147483647.0;
+    case CV_64F: return 1.0;
+    default:     return DepthMax(depth);
+    }
+}
+
+}  // namespace
+
+bool IsNativeDepth(int depth) {
+    return depth == CV_8U || depth == CV_16U || depth == CV_32F;
+}
+
+double DepthMax(int depth) {
+    switch (depth) {
+    case CV_16U: return PixelTraits<ushort>::kMax;
+    case CV_32F: return PixelTraits<float>::kMax;
+    default:     return PixelTraits<uchar>::kMax;
+    }
+}
+
+double DepthScale(int depth) {
+    return DepthMax(depth) / PixelTraits<uchar>::kMax;
+}
+
+cv::Mat ReadNativeImage(const std::string& path) {
+    cv::Mat image = cv::imread(path, cv::IMREAD_COLOR | cv::IMREAD_ANYDEPTH);
+    if (!image.empty() && !IsNativeDepth(image.depth()))
+        image.convertTo(image, CV_32F, 1.0 / SourceDepthMax(image.depth()));
+    return image;
+}
+
+void ConvertDepth(const cv::Mat& src, cv::Mat& dst, int depth) {
+    if (src.depth() == depth) {
+        dst = src;
+        return;
+    }
+    src.convertTo(dst, depth, DepthMax(depth) / SourceDepthMax(src.depth()));
+}
+
+bool RunTypedPointwiseKernel(const cv::Mat& src, cv::Mat& dst, const TypedPointwiseOps& ops,
+                             const std::atomic<bool>* cancel) {
+    CV_Assert(IsNativeDepth(src.depth()) && (src.channels() == 1 || src.channels() == 3));
+    switch (src.depth()) {
+    case CV_8U:  return RunTyped<uchar>(src, dst, ops, cancel);
+    case CV_16U: return RunTyped<ushort>(src, dst, ops, cancel);
+    default:     return RunTyped<float>(src, dst, ops, cancel);
+    }
+}
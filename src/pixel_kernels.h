@@ -0,0 +1,65 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+#include <string>
+
+// Value range of each pixel depth the chain runs in. Stage parameters are given in 8-bit
+// units (brightness, thresholds 0..255) and scaled to the native range, so a
+// 16-bit threshold of 127 means 127 * 257. Float images are taken to be 0..1.
+template <typename T> struct PixelTraits;
+
+template <> struct PixelTraits<uchar> {
+    static constexpr int kDepth = CV_8U;
+    static constexpr float kMax = 255.0f;
+};
+
+template <> struct PixelTraits<ushort> {
+    static constexpr int kDepth = CV_16U;
+    static constexpr float kMax = 65535.0f;
+};
+
+template <> struct PixelTraits<float> {
+    static constexpr int kDepth = CV_32F;
+    static constexpr float kMax = 1.0f;
+};
+
+// CV_8U, CV_16U and CV_32F; other depths are converted to float when read
+bool IsNativeDepth(int depth);
+
+// Largest value of a depth (255, 65535, 1) and that value over 255
+double DepthMax(int depth);
+double DepthScale(int depth);
+
+// Reads an image as 3-channel BGR in its own depth (8-bit, 16-bit or float) instead of
+// cv::imread's default 8-bit. Empty if the file cannot be decoded.
+cv::Mat ReadNativeImage(const std::string& path);
+
+// Converts `src` to `depth`, rescaling between the two value ranges; `dst` shares `src`
+// if it already has that depth
+void ConvertDepth(const cv::Mat& src, cv::Mat& dst, int depth);
+
+// Pointwise chain in native units, for any depth:
+//
+//   dst = threshold( post( gray( pre(src) ) ) )
+//
+// pre and post are `alpha * v + beta` (per channel before the gray conversion, on the
+// gray value after it), saturated to the depth's range for integer types only: float
+// keeps values outside 0..1 between steps instead of clipping them.
+struct TypedPointwiseOps {
+    bool pre_affine = false;
+    bool to_gray = false;      // BGR -> gray with cvtColor's weights
+    bool post_affine = false;
+    bool threshold = false;    // v > threshold_value ? max : 0
+    bool replicate = false;    // write the gray result back out as BGR
+    float alpha = 1.0f;        // of whichever affine step is enabled
+    float beta = 0.0f;
+    float threshold_value = 0.0f;
+};
+
+// Every combination of depth (CV_8U, CV_16U, CV_32F), channel count (1 or 3) and enabled
+// step is a separate instantiation chosen once per call, so rows run without per-pixel
+// branches. Parallel over row bands; bands not yet started are skipped once `cancel` is
+// set, and false is returned.
+bool RunTypedPointwiseKernel(const cv::Mat& src, cv::Mat& dst, const TypedPointwiseOps& ops,
+                             const std::atomic<bool>* cancel = nullptr);
@@ -0,0 +1,389 @@
+#include "pointwise.h"
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NBIP_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NBIP_TARGET(isa) __attribute__((target(isa)))
+#else
+#define NBIP_TARGET(isa)
+#endif
+
+namespace {
+
+// Fixed-point BGR -> gray weights used by cv::cvtColor for 8-bit images (Q14)
+const int kGrayB = 1868;
+const int kGrayG = 9617;
+const int kGrayR = 4899;
+const int kGrayShift = 14;
+
+inline uchar GrayPixel(int b, int g, int r) {
+    return (uchar)((b * kGrayB + g * kGrayG + r * kGrayR + (1 << (kGrayShift - 1))) >> kGrayShift);
+}
+
+void PointwiseRowScalar(const uchar* src, uchar* dst, int x, int width, const PointwiseKernel& k) {
+    if (!k.to_gray) {
+        const uchar* lut = k.post_lut;
+        for (; x < width; x++)
+            dst[x] = lut[src[x]];
+        return;
+    }
+
+    for (; x < width; x++) {
+        int b = src[3 * x], g = src[3 * x + 1], r = src[3 * x + 2];
+        if (k.use_pre_lut) {
+            b = k.pre_lut[b];
+            g = k.pre_lut[g];
+            r = k.pre_lut[r];
+        }
+        uchar v = GrayPixel(b, g, r);
+        if (k.use_post_lut) v = k.post_lut[v];
+
+        if (k.replicate) {
+            dst[3 * x] = dst[3 * x + 1] = dst[3 * x + 2] = v;
+        } else {
+            dst[x] = v;
+        }
+    }
+}
+
+#ifdef NBIP_X86_SIMD
+
+// Shuffle masks shared by the SSSE3 and AVX2 paths (AVX2 broadcasts them to both lanes)
+struct ShuffleMasks {
+    alignas(16) signed char deinterleave[3][3][16];  // [channel][source register][byte]
+    alignas(16) signed char replicate[3][16];        // [destination register][byte]
+
+    ShuffleMasks() {
+        for (int c = 0; c < 3; c++) {
+            for (int part = 0; part < 3; part++) {
+                for (int i = 0; i < 16; i++) {
+                    int byte = 3 * i + c - 16 * part;
+                    deinterleave[c][part][i] = (signed char)(byte >= 0 && byte < 16 ? byte : -128);
+                }
+            }
+        }
+        for (int part = 0; part < 3; part++) {
+            for (int i = 0; i < 16; i++)
+                replicate[part][i] = (signed char)((16 * part + i) / 3);
+        }
+    }
+};
+
+const ShuffleMasks& Masks() {
+    static const ShuffleMasks masks;
+    return masks;
+}
+
+// 256-entry table lookup on 16 bytes: each 16-entry slice of the table is selected with
+// pshufb. XOR-ing the high nibble with the slice number and adding 0x70 with saturation
+// leaves indices of the wanted slice below 0x80 and pushes every other index to >= 0x80,
+// which pshufb turns into zero, so the 16 partial results can simply be OR-ed.
+NBIP_TARGET("ssse3")
+inline __m128i Lut16(__m128i idx, const __m128i* slices) {
+    const __m128i bias = _mm_set1_epi8(0x70);
+    __m128i result = _mm_setzero_si128();
+    for (int i = 0; i < 16; i++) {
+        __m128i t = _mm_adds_epu8(_mm_xor_si128(idx, _mm_set1_epi8((char)(i << 4))), bias);
+        result = _mm_or_si128(result, _mm_shuffle_epi8(slices[i], t));
+    }
+    return result;
+}
+
+// Gray value of 4 pixels from their 16-bit B/G/R lanes
+NBIP_TARGET("ssse3")
+inline __m128i Gray4(__m128i bg, __m128i r1) {
+    const __m128i coef_bg = _mm_set1_epi32((kGrayG << 16) | kGrayB);
+    const __m128i coef_r1 = _mm_set1_epi32(((1 << (kGrayShift - 1)) << 16) | kGrayR);
+    __m128i sum = _mm_add_epi32(_mm_madd_epi16(bg, coef_bg), _mm_madd_epi16(r1, coef_r1));
+    return _mm_srai_epi32(sum, kGrayShift);
+}
+
+// Gray values of 16 interleaved BGR pixels held in three registers
+NBIP_TARGET("ssse3")
+inline __m128i Gray16(__m128i s0, __m128i s1, __m128i s2) {
+    const ShuffleMasks& m = Masks();
+    __m128i ch[3];
+    for (int c = 0; c < 3; c++) {
+        ch[c] = _mm_or_si128(
+            _mm_or_si128(_mm_shuffle_epi8(s0, _mm_load_si128((const __m128i*)m.deinterleave[c][0])),
+                         _mm_shuffle_epi8(s1, _mm_load_si128((const __m128i*)m.deinterleave[c][1]))),
+            _mm_shuffle_epi8(s2, _mm_load_si128((const __m128i*)m.deinterleave[c][2])));
+    }
+
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i b_lo = _mm_unpacklo_epi8(ch[0], zero), b_hi = _mm_unpackhi_epi8(ch[0], zero);
+    __m128i g_lo = _mm_unpacklo_epi8(ch[1], zero), g_hi = _mm_unpackhi_epi8(ch[1], zero);
+    __m128i r_lo = _mm_unpacklo_epi8(ch[2], zero), r_hi = _mm_unpackhi_epi8(ch[2], zero);
+
+    __m128i y0 = Gray4(_mm_unpacklo_epi16(b_lo, g_lo), _mm_unpacklo_epi16(r_lo, one));
+    __m128i y1 = Gray4(_mm_unpackhi_epi16(b_lo, g_lo), _mm_unpackhi_epi16(r_lo, one));
+    __m128i y2 = Gray4(_mm_unpacklo_epi16(b_hi, g_hi), _mm_unpacklo_epi16(r_hi, one));
+    __m128i y3 = Gray4(_mm_unpackhi_epi16(b_hi, g_hi), _mm_unpackhi_epi16(r_hi, one));
+    return _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+}
+
+NBIP_TARGET("ssse3")
+int PointwiseRowSSSE3(const uchar* src, uchar* dst, int width, const PointwiseKernel& k) {
+    __m128i pre[16], post[16];
+    for (int i = 0; i < 16; i++) {
+        pre[i] = _mm_loadu_si128((const __m128i*)(k.pre_lut + 16 * i));
+        post[i] = _mm_loadu_si128((const __m128i*)(k.post_lut + 16 * i));
+    }
+
+    int x = 0;
+    if (!k.to_gray) {
+        for (; x + 16 <= width; x += 16) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(src + x));
+            _mm_storeu_si128((__m128i*)(dst + x), Lut16(v, post));
+        }
+        return x;
+    }
+
+    const ShuffleMasks& m = Masks();
+    for (; x + 16 <= width; x += 16) {
+        const uchar* s = src + 3 * x;
+        __m128i s0 = _mm_loadu_si128((const __m128i*)s);
+        __m128i s1 = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i s2 = _mm_loadu_si128((const __m128i*)(s + 32));
+        if (k.use_pre_lut) {
+            s0 = Lut16(s0, pre);
+            s1 = Lut16(s1, pre);
+            s2 = Lut16(s2, pre);
+        }
+
+        __m128i gray = Gray16(s0, s1, s2);
+        if (k.use_post_lut) gray = Lut16(gray, post);
+
+        if (k.replicate) {
+            uchar* d = dst + 3 * x;
+            for (int part = 0; part < 3; part++) {
+                __m128i mask = _mm_load_si128((const __m128i*)m.replicate[part]);
+                _mm_storeu_si128((__m128i*)(d + 16 * part), _mm_shuffle_epi8(gray, mask));
+            }
+        } else {
+            _mm_storeu_si128((__m128i*)(dst + x), gray);
+        }
+    }
+    return x;
+}
+
+// AVX2 versions work on two independent 16-pixel groups, one per 128-bit lane, so the
+// in-lane shuffles and packs are exactly the SSSE3 ones
+NBIP_TARGET("avx2")
+inline __m256i Lut32(__m256i idx, const __m256i* slices) {
+    const __m256i bias = _mm256_set1_epi8(0x70);
+    __m256i result = _mm256_setzero_si256();
+    for (int i = 0; i < 16; i++) {
+        __m256i t = _mm256_adds_epu8(_mm256_xor_si256(idx, _mm256_set1_epi8((char)(i << 4))), bias);
+        result = _mm256_or_si256(result, _mm256_shuffle_epi8(slices[i], t));
+    }
+    return result;
+}
+
+NBIP_TARGET("avx2")
+inline __m256i Gray8x2(__m256i bg, __m256i r1) {
+    const __m256i coef_bg = _mm256_set1_epi32((kGrayG << 16) | kGrayB);
+    const __m256i coef_r1 = _mm256_set1_epi32(((1 << (kGrayShift - 1)) << 16) | kGrayR);
+    __m256i sum = _mm256_add_epi32(_mm256_madd_epi16(bg, coef_bg), _mm256_madd_epi16(r1, coef_r1));
+    return _mm256_srai_epi32(sum, kGrayShift);
+}
+
+NBIP_TARGET("avx2")
+inline __m256i LoadLanes(const uchar* lane0, const uchar* lane1) {
+    return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i*)lane0)),
+                                   _mm_loadu_si128((const __m128i*)lane1), 1);
+}
+
+NBIP_TARGET("avx2")
+inline __m256i BroadcastMask(const signed char* mask) {
+    return _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i*)mask));
+}
+
+NBIP_TARGET("avx2")
+int PointwiseRowAVX2(const uchar* src, uchar* dst, int width, const PointwiseKernel& k) {
+    __m256i pre[16], post[16];
+    for (int i = 0; i < 16; i++) {
+        pre[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(k.pre_lut + 16 * i)));
+        post[i] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(k.post_lut + 16 * i)));
+    }
+
+    int x = 0;
+    if (!k.to_gray) {
+        for (; x + 32 <= width; x += 32) {
+            __m256i v = _mm256_loadu_si256((const __m256i*)(src + x));
+            _mm256_storeu_si256((__m256i*)(dst + x), Lut32(v, post));
+        }
+        return x;
+    }
+
+    const ShuffleMasks& m = Masks();
+    __m256i deinterleave[3][3], replicate[3];
+    for (int c = 0; c < 3; c++) {
+        for (int part = 0; part < 3; part++)
+            deinterleave[c][part] = BroadcastMask(m.deinterleave[c][part]);
+        replicate[c] = BroadcastMask(m.replicate[c]);
+    }
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi16(1);
+
+    for (; x + 32 <= width; x += 32) {
+        // Lane 0 holds pixels x..x+15, lane 1 holds x+16..x+31
+        const uchar* s = src + 3 * x;
+        __m256i s0 = LoadLanes(s, s + 48);
+        __m256i s1 = LoadLanes(s + 16, s + 64);
+        __m256i s2 = LoadLanes(s + 32, s + 80);
+        if (k.use_pre_lut) {
+            s0 = Lut32(s0, pre);
+            s1 = Lut32(s1, pre);
+            s2 = Lut32(s2, pre);
+        }
+
+        __m256i ch[3];
+        for (int c = 0; c < 3; c++) {
+            ch[c] = _mm256_or_si256(
+                _mm256_or_si256(_mm256_shuffle_epi8(s0, deinterleave[c][0]),
+                                _mm256_shuffle_epi8(s1, deinterleave[c][1])),
+                _mm256_shuffle_epi8(s2, deinterleave[c][2]));
+        }
+
+        __m256i b_lo = _mm256_unpacklo_epi8(ch[0], zero), b_hi = _mm256_unpackhi_epi8(ch[0], zero);
+        __m256i g_lo = _mm256_unpacklo_epi8(ch[1], zero), g_hi = _mm256_unpackhi_epi8(ch[1], zero);
+        __m256i r_lo = _mm256_unpacklo_epi8(ch[2], zero), r_hi = _mm256_unpackhi_epi8(ch[2], zero);
+
+        __m256i y0 = Gray8x2(_mm256_unpacklo_epi16(b_lo, g_lo), _mm256_unpacklo_epi16(r_lo, one));
+        __m256i y1 = Gray8x2(_mm256_unpackhi_epi16(b_lo, g_lo), _mm256_unpackhi_epi16(r_lo, one));
+        __m256i y2 = Gray8x2(_mm256_unpacklo_epi16(b_hi, g_hi), _mm256_unpacklo_epi16(r_hi, one));
+        __m256i y3 = Gray8x2(_mm256_unpackhi_epi16(b_hi, g_hi), _mm256_unpackhi_epi16(r_hi, one));
+        __m256i gray = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+
+        if (k.use_post_lut) gray = Lut32(gray, post);
+
+        if (k.replicate) {
+            uchar* d = dst + 3 * x;
+            for (int part = 0; part < 3; part++) {
+                __m256i out = _mm256_shuffle_epi8(gray, replicate[part]);
+                _mm_storeu_si128((__m128i*)(d + 16 * part), _mm256_castsi256_si128(out));
+                _mm_storeu_si128((__m128i*)(d + 48 + 16 * part), _mm256_extracti128_si256(out, 1));
+            }
+        } else {
+            _mm256_storeu_si256((__m256i*)(dst + x), gray);
+        }
+    }
+    return x;
+}
+
+#endif  // NBIP_X86_SIMD
+
+}  // namespace
+
+SimdLevel BestSimdLevel() {
+#ifdef NBIP_X86_SIMD
+    static const SimdLevel level =
+        cv::checkHardwareSupport(CV_CPU_AVX2) ? SimdLevel::AVX2 :
+        cv::checkHardwareSupport(CV_CPU_SSSE3) ? SimdLevel::SSSE3 : SimdLevel::Scalar;
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+const char* SimdLevelName(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX2:  return "AVX2";
+    case SimdLevel::SSSE3: return "SSSE3";
+    default:               return "Scalar";
+    }
+}
+
+void BuildBrightnessContrastLut(float contrast, float brightness, uchar lut[256]) {
+    for (int v = 0; v < 256; v++)
+        lut[v] = cv::saturate_cast<uchar>(v * contrast + brightness);
+}
+
+void BuildBinaryThresholdLut(int threshold, uchar lut[256]) {
+    for (int v = 0; v < 256; v++)
+        lut[v] = v > threshold ? 255 : 0;
+}
+
+void ComposeLut(uchar lut[256], const uchar next[256]) {
+    for (int v = 0; v < 256; v++)
+        lut[v] = next[lut[v]];
+}
+
+void PointwiseRow(const uchar* src, uchar* dst, int width, const PointwiseKernel& kernel, SimdLevel level) {
+    int x = 0;
+#ifdef NBIP_X86_SIMD
+    if (level == SimdLevel::AVX2)
+        x = PointwiseRowAVX2(src, dst, width, kernel);
+    else if (level == SimdLevel::SSSE3)
+        x = PointwiseRowSSSE3(src, dst, width, kernel);
+#else
+    (void)level;
+#endif
+    PointwiseRowScalar(src, dst, x, width, kernel);
+}
+
+bool RunPointwiseKernel(const cv::Mat& src, cv::Mat& dst, const PointwiseKernel& kernel, SimdLevel level,
+                        const std::atomic<bool>* cancel) {
+    CV_Assert(src.depth() == CV_8U && (src.channels() == 1 || src.channels() == 3));
+    CV_Assert(!kernel.to_gray || src.channels() == 3);
+
+    PointwiseKernel k = kernel;
+    if (!k.to_gray) {
+        // Without a gray conversion both tables act on every byte: fold them together
+        if (!k.use_post_lut)
+            for (int v = 0; v < 256; v++) k.post_lut[v] = (uchar)v;
+        if (k.use_pre_lut) {
+            uchar lut[256];
+            std::copy(k.pre_lut, k.pre_lut + 256, lut);
+            ComposeLut(lut, k.post_lut);
+            std::copy(lut, lut + 256, k.post_lut);
+        }
+        k.use_pre_lut = false;
+        k.use_post_lut = true;
+        k.replicate = false;
+    }
+
+    int dst_channels = k.to_gray ? (k.replicate ? 3 : 1) : src.channels();
+    dst.create(src.rows, src.cols, CV_8UC(dst_channels));
+
+    // PointwiseRow counts pixels when converting to gray and bytes otherwise
+    const int src_step = k.to_gray ? 3 : 1;
+    const int dst_step = k.to_gray ? dst_channels : 1;
+    const int row_units = k.to_gray ? src.cols : src.cols * src.channels();
+
+    // Continuous images are one long row split into equal spans; otherwise whole rows
+    // are grouped into bands. ~64K units per task keeps scheduling overhead small.
+    const bool continuous = src.isContinuous() && dst.isContinuous();
+    const int64 total_units = continuous ? (int64)row_units * src.rows : row_units;
+    const int rows_per_band = std::max(1, (1 << 16) / std::max(1, row_units));
+    const int tasks = continuous
+        ? (int)std::max<int64>(1, total_units >> 16)
+        : (src.rows + rows_per_band - 1) / rows_per_band;
+
+    std::atomic<bool> cancelled(false);
+    cv::parallel_for_(cv::Range(0, tasks), [&](const cv::Range& range) {
+        for (int t = range.start; t < range.end; t++) {
+            if (cancel && cancel->load(std::memory_order_relaxed)) {
+                cancelled = true;
+                return;
+            }
+            if (continuous) {
+                int64 u0 = total_units * t / tasks;
+                int64 u1 = total_units * (t + 1) / tasks;
+                PointwiseRow(src.data + u0 * src_step, dst.data + u0 * dst_step, (int)(u1 - u0), k, level);
+            } else {
+                int y1 = std::min(src.rows, (t + 1) * rows_per_band);
+                for (int y = t * rows_per_band; y < y1; y++)
+                    PointwiseRow(src.ptr(y), dst.ptr(y), row_units, k, level);
+            }
+        }
+    });
+    return !cancelled;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <atomic>
+
+// Fused single-pass kernel for runs of consecutive 8-bit pointwise stages (grayscale,
+// brightness/contrast, binary threshold). Every source pixel is read once and the
+// result is written once:
+//
+//   dst = post_lut[ gray( pre_lut[src] ) ]
+//
+// where the gray conversion and both lookup tables are optional. Brightness/contrast
+// and binary threshold are both 256-entry tables on 8-bit data, so any chain of them
+// composes into a single table.
+struct PointwiseKernel {
+    bool to_gray = false;       // BGR -> gray with cvtColor's fixed-point weights
+    bool replicate = false;     // write the gray result back out as BGR
+    bool use_pre_lut = false;   // per-channel table applied before the gray conversion
+    bool use_post_lut = false;  // table applied to the gray value (or every channel)
+    uchar pre_lut[256];
+    uchar post_lut[256];
+};
+
+enum class SimdLevel {
+    Scalar,
+    SSSE3,
+    AVX2
+};
+
+// Best instruction set available on this CPU (Scalar on non-x86 builds)
+SimdLevel BestSimdLevel();
+const char* SimdLevelName(SimdLevel level);
+
+// lut[v] = saturate(v * contrast + brightness), rounded like Mat::convertTo
+void BuildBrightnessContrastLut(float contrast, float brightness, uchar lut[256]);
+
+// lut[v] = v > threshold ? 255 : 0, like cv::threshold with THRESH_BINARY
+void BuildBinaryThresholdLut(int threshold, uchar lut[256]);
+
+// lut = next(lut): appends `next` after the table already in `lut`
+void ComposeLut(uchar lut[256], const uchar next[256]);
+
+// Processes one row of `width` pixels. `src` has 3 channels when the kernel converts
+// to gray; otherwise src and dst have the same channel count and `width` counts bytes.
+void PointwiseRow(const uchar* src, uchar* dst, int width, const PointwiseKernel& kernel, SimdLevel level);
+
+// Whole-image entry point, parallel over row bands. `src` must be CV_8UC1 or CV_8UC3.
+// Bands not yet started are skipped once `cancel` is set; returns false in that case.
+bool RunPointwiseKernel(const cv::Mat& src, cv::Mat& dst, const PointwiseKernel& kernel,
+                        SimdLevel level = BestSimdLevel(), const std::atomic<bool>* cancel = nullptr);
@@ -0,0 +1,147 @@
+#include "presenter.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cstring>
+
+bool NullDisplayTexture::Update(const cv::Rect& region, const cv::Mat& rgba) {
+    if ((region & cv::Rect(0, 0, pixels_.cols, pixels_.rows)) != region || rgba.size() != region.size())
+        return false;
+    rgba.copyTo(pixels_(region));
+    return true;
+}
+
+std::unique_ptr<DisplayTexture> NullDisplayBackend::CreateTexture(cv::Size size) {
+    return std::unique_ptr<DisplayTexture>(new NullDisplayTexture(size));
+}
+
+cv::Rect DifferingRegion(const cv::Mat& a, const cv::Mat& b) {
+    CV_Assert(a.size() == b.size() && a.type() == b.type());
+    const size_t pixel_bytes = a.elemSize();
+    const size_t row_bytes = a.cols * pixel_bytes;
+
+    // Byte columns [left, right) and rows [top, bottom] that differ so far
+    int top = -1, bottom = -1;
+    size_t left = row_bytes, right = 0;
+    for (int y = 0; y < a.rows; y++) {
+        const uchar* pa = a.ptr(y);
+        const uchar* pb = b.ptr(y);
+        if (pa == pb || std::memcmp(pa, pb, row_bytes) == 0) continue;
+        if (top < 0) top = y;
+        bottom = y;
+        // Only the part outside the columns already known to differ needs scanning
+        size_t l = 0;
+        while (l < left && pa[l] == pb[l]) l++;
+        left = l;
+        size_t r = row_bytes;
+        while (r > right && pa[r - 1] == pb[r - 1]) r--;
+        right = r;
+    }
+
+    if (top < 0) return cv::Rect();
+    int x0 = (int)(left / pixel_bytes);
+    int x1 = (int)((right + pixel_bytes - 1) / pixel_bytes);
+    return cv::Rect(x0, top, x1 - x0, bottom - top + 1);
+}
+
+Presenter::Presenter(DisplayBackend& backend, size_t max_textures)
+    : backend_(backend), max_textures_(std::max<size_t>(1, max_textures)) {}
+
+int Presenter::SlotFor(cv::Size size) {
+    for (size_t i = 0; i < slots_.size(); i++) {
+        if (slots_[i].size == size) return (int)i;
+    }
+
+    size_t index = slots_.size();
+    if (slots_.size() < max_textures_) {
+        slots_.emplace_back();
+    } else {
+        index = 0;
+        for (size_t i = 1; i < slots_.size(); i++) {
+            if (slots_[i].last_used < slots_[index].last_used) index = i;
+        }
+    }
+
+    Slot& slot = slots_[index];
+    slot.texture.reset();  // before creating its replacement
+    slot.texture = backend_.CreateTexture(size);
+    slot.size = size;
+    slot.shown.release();
+    if (!slot.texture) {
+        slots_.erase(slots_.begin() + index);
+        return -1;
+    }
+    stats_.textures_created++;
+    return (int)index;
+}
+
+bool Presenter::Present(const cv::Mat& image, cv::Rect dirty) {
+    stats_.presents++;
+    if (image.empty()) {
+        Hide();
+        return false;
+    }
+    CV_Assert(IsNativeDepth(image.depth()) && (image.channels() == 1 || image.channels() == 3 || image.channels() == 4));
+
+    current_ = SlotFor(image.size());
+    if (current_ < 0) return false;
+    Slot& slot = slots_[current_];
+    slot.last_used = ++clock_;
+
+    const cv::Rect full(0, 0, image.cols, image.rows);
+    cv::Rect region = full;
+    if (!slot.shown.empty() && slot.shown.type() == image.type()) {
+        if (slot.shown.data == image.data && slot.shown.step == image.step) {
+            stats_.skipped++;
+            return false;
+        }
+        region = dirty.area() > 0 ? (dirty & full) : DifferingRegion(slot.shown, image);
+        if (region.area() == 0) {
+            slot.shown = image;
+            stats_.skipped++;
+            return false;
+        }
+    }
+
+    NBIP_PROFILE_SCOPE("Texture upload");
+    if (staging_.rows < region.height || staging_.cols < region.width)
+        staging_.create(std::max(staging_.rows, region.height), std::max(staging_.cols, region.width), CV_8UC4);
+    cv::Mat rgba = staging_(cv::Rect(0, 0, region.width, region.height));
+    cv::Mat source = image(region);
+    if (source.depth() != CV_8U) {
+        ConvertDepth(source, narrow_, CV_8U);
+        source = narrow_;
+    }
+    if (image.channels() == 3)
+        cv::cvtColor(source, rgba, cv::COLOR_BGR2RGBA);
+    else if (image.channels() == 1)
+        cv::cvtColor(source, rgba, cv::COLOR_GRAY2RGBA);
+    else
+        source.copyTo(rgba);
+
+    if (!slot.texture->Update(region, rgba)) {
+        slot.shown.release();  // contents unknown now
+        return false;
+    }
+
+    stats_.uploads++;
+    if (region != full) stats_.partial_uploads++;
+    stats_.bytes += (uint64_t)region.area() * 4;
+    slot.shown = image;
+    return true;
+}
+
+void* Presenter::Texture() const {
+    return current_ >= 0 ? slots_[current_].texture->Handle() : nullptr;
+}
+
+cv::Size Presenter::ImageSize() const {
+    return current_ >= 0 ? slots_[current_].size : cv::Size();
+}
+
+void Presenter::Clear() {
+    slots_.clear();
+    current_ = -1;
+    staging_.release();
+    narrow_.release();
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <opencv2/opencv.hpp>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// An RGBA8 texture of fixed size owned by a DisplayBackend
+class DisplayTexture {
+public:
+    virtual ~DisplayTexture() = default;
+
+    // Copies `rgba` (CV_8UC4, region.size()) into `region` of the texture
+    virtual bool Update(const cv::Rect& region, const cv::Mat& rgba) = 0;
+
+    // What the UI draws with (an ImTextureID)
+    virtual void* Handle() const = 0;
+};
+
+// Creates the textures a Presenter uploads to: Direct3D in the GUI, memory elsewhere
+class DisplayBackend {
+public:
+    virtual ~DisplayBackend() = default;
+    virtual std::unique_ptr<DisplayTexture> CreateTexture(cv::Size size) = 0;
+};
+
+// Texture kept in system memory, for headless runs and benchmarks
+class NullDisplayTexture : public DisplayTexture {
+public:
+    explicit NullDisplayTexture(cv::Size size) : pixels_(size, CV_8UC4, cv::Scalar::all(0)) {}
+
+    bool Update(const cv::Rect& region, const cv::Mat& rgba) override;
+    void* Handle() const override { return const_cast<uchar*>(pixels_.data); }
+
+    const cv::Mat& Pixels() const { return pixels_; }
+
+private:
+    cv::Mat pixels_;
+};
+
+class NullDisplayBackend : public DisplayBackend {
+public:
+    std::unique_ptr<DisplayTexture> CreateTexture(cv::Size size) override;
+};
+
+struct PresenterStats {
+    uint64_t presents = 0;          // Present() calls
+    uint64_t skipped = 0;           // nothing had changed
+    uint64_t uploads = 0;
+    uint64_t partial_uploads = 0;   // uploads of less than the whole image
+    uint64_t bytes = 0;             // RGBA bytes uploaded
+    uint64_t textures_created = 0;
+};
+
+// Smallest rectangle covering every pixel where `a` and `b` (same size and type) differ;
+// empty if they are equal
+cv::Rect DifferingRegion(const cv::Mat& a, const cv::Mat& b);
+
+// Shows images through persistent textures.
+//
+// Keeps one texture for each image size shown recently (the proxy and full-resolution
+// results usually alternate), converts into one reused RGBA staging buffer, and uploads
+// only what changed since that texture was last written: nothing if the image is the
+// very buffer shown last (pipeline results are never written in place while another
+// reference is held), otherwise the region where its pixels differ, or the region
+// the caller says changed.
+class Presenter {
+public:
+    explicit Presenter(DisplayBackend& backend, size_t max_textures = 2);
+
+    // Shows `image` (gray, BGR or RGBA; 8-bit, 16-bit or float, displayed as 8-bit). A non-empty `dirty` limits the upload to
+    // that region instead of comparing. Returns true if anything was uploaded.
+    bool Present(const cv::Mat& image, cv::Rect dirty = cv::Rect());
+
+    // Texture of the last presented image; nullptr before the first Present and after Hide
+    void* Texture() const;
+    cv::Size ImageSize() const;
+
+    // Shows nothing until the next Present; textures are kept for reuse
+    void Hide() { current_ = -1; }
+    // Releases every texture (before the device goes away)
+    void Clear();
+
+    const PresenterStats& Stats() const { return stats_; }
+    void ResetStats() { stats_ = PresenterStats(); }
+
+private:
+    struct Slot {
+        std::unique_ptr<DisplayTexture> texture;
+        cv::Size size;
+        cv::Mat shown;       // source image whose pixels the texture holds
+        uint64_t last_used = 0;
+    };
+
+    int SlotFor(cv::Size size);
+
+    DisplayBackend& backend_;
+    size_t max_textures_;
+    std::vector<Slot> slots_;
+    int current_ = -1;
+    uint64_t clock_ = 0;
+    cv::Mat staging_;        // RGBA, grown as needed and reused
+    cv::Mat narrow_;         // 8-bit copy of a 16-bit or float region
+    PresenterStats stats_;
+};
@@ -0,0 +1,210 @@
+#include "preview.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+void ImagePyramid::SetSource(const cv::Mat& image) {
+    levels_.clear();
+    if (!image.empty())
+        levels_.push_back(image);
+}
+
+const cv::Mat& ImagePyramid::Level(int level) {
+    while ((int)levels_.size() <= level) {
+        const cv::Mat& previous = levels_.back();
+        cv::Mat half;
+        cv::resize(previous, half, cv::Size((previous.cols + 1) / 2, (previous.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+        levels_.push_back(half);
+    }
+    return levels_[level];
+}
+
+int ImagePyramid::LevelFor(cv::Size display) {
+    if (levels_.empty() || display.width <= 0 || display.height <= 0)
+        return 0;
+
+    int level = 0;
+    for (;;) {
+        const cv::Mat& current = Level(level);
+        int next_width = (current.cols + 1) / 2;
+        int next_height = (current.rows + 1) / 2;
+        if (next_width < display.width || next_height < display.height || current.cols <= 1 || current.rows <= 1)
+            return level;
+        level++;
+    }
+}
+
+PipelineParams ScaleParamsForLevel(const PipelineParams& params, double scale) {
+    PipelineParams p = params;
+    if (scale >= 1.0)
+        return p;
+
+    // Radius 0 is a 1x1 kernel, i.e. no blur, which is what a sub-pixel radius looks like
+    p.blur_radius = std::max(0, (int)std::lround(params.blur_radius * scale));
+
+    int block = (int)std::lround(params.block_size * scale);
+    if (block % 2 == 0) block++;
+    p.block_size = std::max(3, block);
+
+    // kernel_size maps to an aperture of 2k-1 pixels. Only Canny's pre-blur scales; the
+    // Sobel aperture sets the gradient magnitude its fixed threshold is compared with.
+    if (params.use_canny) {
+        double aperture = (params.kernel_size * 2 - 1) * scale;
+        p.kernel_size = std::min(4, std::max(1, (int)std::lround((aperture + 1.0) / 2.0)));
+    }
+    return p;
+}
+
+void ProgressivePreview::SetSource(const cv::Mat& image) {
+    pyramid_.SetSource(image);
+    proxies_.clear();
+    full_.SetSource(image);
+    // A decode still running is for the old image; dropping it waits for it to end
+    loading_ = std::future<cv::Mat>();
+    if (store_)
+        store_->Clear();
+    display_ = image;
+    display_full_ = false;
+    has_display_ = false;
+}
+
+bool ProgressivePreview::Update(const PipelineParams& params, cv::Size display_size, bool interacting) {
+    if (pyramid_.LevelCount() == 0)
+        return false;
+
+    bool changed = false;
+    interacting_ = interacting;
+
+    // Pick up a stored result decoded in the background
+    if (loading_.valid() && loading_.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        cv::Mat loaded = loading_.get();
+        if (!loaded.empty() && EquivalentParams(loading_params_, params)) {
+            display_ = loaded;
+            display_params_ = params;
+            display_full_ = true;
+            has_display_ = true;
+            changed = true;
+        }
+    }
+
+    // Pick up a finished background evaluation
+    cv::Mat full;
+    PipelineParams full_params;
+    if (full_.TakeResult(full, full_params)) {
+        if (store_)
+            store_->Store(HashParams(full_params), full);
+        if (EquivalentParams(full_params, params)) {
+            display_ = full;
+            display_params_ = params;
+            display_full_ = true;
+            has_display_ = true;
+            changed = true;
+        }
+    }
+
+    bool up_to_date = has_display_ && EquivalentParams(display_params_, params);
+    const uint64_t key = HashParams(params);
+    cv::Mat stored;
+    if (!up_to_date && store_ && store_->LoadRaw(key, stored)) {
+        // Seen before: no proxy, and nothing for the worker to do
+        full_.Cancel();
+        display_ = stored;
+        display_params_ = params;
+        display_full_ = true;
+        has_display_ = true;
+        changed = true;
+    } else if (!up_to_date && store_ && store_->Contains(key)) {
+        // Compressed: decoded off the UI thread, one at a time. A decode for parameters
+        // that went stale meanwhile is dropped when it ends and the next one starts.
+        full_.Cancel();
+        if (!loading_.valid()) {
+            ResultStore* store = store_;
+            loading_params_ = params;
+            loading_ = std::async(std::launch::async, [store, key] {
+                cv::Mat image;
+                store->Load(key, image);
+                return image;
+            });
+        }
+    } else if (!up_to_date) {
+        int level = pyramid_.LevelFor(display_size);
+        if (level == 0) {
+            // The display needs every pixel anyway: no proxy. The last result stays up
+            // until the worker delivers this one.
+            full_.Post(params);
+        } else {
+            if ((int)proxies_.size() <= level)
+                proxies_.resize(level + 1);
+            Pipeline& proxy = proxies_[level];
+            if (proxy.Source().empty())
+                proxy.SetSource(pyramid_.Level(level));
+
+            double scale = (double)pyramid_.Level(level).cols / pyramid_.Level(0).cols;
+            display_ = proxy.Evaluate(ScaleParamsForLevel(params, scale));
+            display_params_ = params;
+            display_full_ = false;
+            has_display_ = true;
+            changed = true;
+
+            // Full-resolution work for older parameters is useless while dragging
+            if (interacting)
+                full_.Cancel();
+        }
+    }
+
+    // Refine once input goes idle (repeated posts of the same parameters are free)
+    if (!interacting && has_display_ && !display_full_)
+        full_.Post(params);
+
+    return changed;
+}
+
+bool ProgressivePreview::StageOutput(Stage stage, const PipelineParams& params, cv::Mat& image, uint64_t& version) {
+    if (full_.StageOutput(stage, params, image, version))
+        return true;
+    if (!interacting_)
+        full_.Post(params);
+    return false;
+}
+
+std::function<cv::Mat()> ProgressivePreview::FullResolutionTask(const PipelineParams& params) {
+    cv::Mat ready;
+    if (has_display_ && display_full_ && EquivalentParams(display_params_, params))
+        ready = display_;
+    else if (!full_.Result(params, ready) && store_)
+        store_->LoadRaw(HashParams(params), ready);
+
+    ResultStore* store = store_;
+    cv::Mat source = pyramid_.LevelCount() > 0 ? pyramid_.Level(0) : cv::Mat();
+    return [ready, store, source, params]() -> cv::Mat {
+        // Evaluate() may keep gray content single-channel; files get what Run() writes
+        const int channels = PipelineOutputChannels(params, source.channels());
+        auto widen = [channels](const cv::Mat& image) {
+            if (image.channels() != 1 || channels != 3)
+                return image;
+            cv::Mat bgr;
+            cv::cvtColor(image, bgr, cv::COLOR_GRAY2BGR);
+            return bgr;
+        };
+        if (!ready.empty())
+            return widen(ready);
+        cv::Mat image;
+        if (store && store->Load(HashParams(params), image))
+            return widen(image);
+        // Not on the worker: the next change the UI posts would cancel it
+        Pipeline pipeline;
+        if (!pipeline.Run(source, image, params))
+            return cv::Mat();
+        return image;
+    };
+}
+
+StageCacheStats ProgressivePreview::Stats() const {
+    StageCacheStats total = full_.Stats();
+    for (const Pipeline& proxy : proxies_) {
+        StageCacheStats s = proxy.TotalStats();
+        total.hits += s.hits;
+        total.misses += s.misses;
+    }
+    return total;
+}
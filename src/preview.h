@@ -0,0 +1,91 @@
+#pragma once
+
+#include "eval_worker.h"
+#include "history.h"
+#include "pipeline.h"
+#include <functional>
+#include <future>
+#include <vector>
+
+// Successive halvings of an image (level 0 is the image itself), built on demand
+class ImagePyramid {
+public:
+    void SetSource(const cv::Mat& image);
+
+    // Smallest level that still covers `display` in both dimensions
+    int LevelFor(cv::Size display);
+
+    const cv::Mat& Level(int level);
+    int LevelCount() const { return (int)levels_.size(); }
+
+private:
+    std::vector<cv::Mat> levels_;
+};
+
+// Scales the neighbourhood sizes in `params` (blur radius, adaptive block size, Canny's
+// pre-blur kernel) by `scale` so a proxy evaluated on a downscaled image looks like the
+// full-resolution result shrunk to the same size. The Sobel aperture is kept: its
+// threshold only means the same thing at the same aperture.
+PipelineParams ScaleParamsForLevel(const PipelineParams& params, double scale);
+
+// Interactive preview on top of Pipeline.
+//
+// While the user drags a slider the chain runs on the smallest pyramid level that covers
+// the display. Once input goes idle the full-resolution chain runs on an
+// EvaluationWorker and replaces the proxy when it completes. When the display needs the
+// full resolution anyway, every change goes straight to the worker and the last
+// completed result stays on screen meanwhile. Each level keeps its own Pipeline, so
+// switching back and forth reuses cached stage results.
+class ProgressivePreview {
+public:
+    void SetSource(const cv::Mat& image);
+
+    // Completed full-resolution results are kept in `store` (not owned; null disables
+    // it, and it must outlive the preview), and parameters found there are shown without
+    // any evaluation, so stepping back through undo history recomputes nothing. Raw
+    // entries are shown at once; compressed ones are decoded on a background thread while
+    // the current image stays up. SetSource clears the store.
+    void SetResultStore(ResultStore* store) { store_ = store; }
+
+    // Call once per frame. Returns true if Display() changed.
+    bool Update(const PipelineParams& params, cv::Size display_size, bool interacting);
+
+    // Latest image to show: a proxy or the full-resolution result
+    const cv::Mat& Display() const { return display_; }
+    bool DisplayIsFullResolution() const { return display_full_; }
+    // True while the full-resolution worker has work pending or running
+    bool Refining() const { return full_.Busy(); }
+
+    // Work that produces the full-resolution result for `params` on another thread (an
+    // export, say), so the UI thread never waits for it: the result already on screen,
+    // in the worker or in the store if there is one, otherwise the chain run on that
+    // thread. Gray results are widened to BGR where Run() would widen them. The task
+    // reads the result store, which must outlive it.
+    std::function<cv::Mat()> FullResolutionTask(const PipelineParams& params);
+
+    // Full-resolution output of `stage` for `params`, if the last completed background
+    // evaluation was for them. Results shown from the store carry no stage outputs: the
+    // evaluation is then posted, once input is idle, and the outputs follow when it ends.
+    bool StageOutput(Stage stage, const PipelineParams& params, cv::Mat& image, uint64_t& version);
+
+    // Cache counters summed over the proxy levels and the full-resolution pipeline
+    StageCacheStats Stats() const;
+
+    // What the format plan saved in the last completed full-resolution evaluation
+    FormatSavings LastFormatSavings() const { return full_.LastFormatSavings(); }
+
+private:
+    ImagePyramid pyramid_;
+    std::vector<Pipeline> proxies_;  // indexed by pyramid level; [0] unused
+    EvaluationWorker full_;
+
+    ResultStore* store_ = nullptr;
+    std::future<cv::Mat> loading_;  // a compressed stored result being decoded
+    PipelineParams loading_params_;
+    bool interacting_ = false;
+
+    PipelineParams display_params_;
+    cv::Mat display_;
+    bool display_full_ = false;
+    bool has_display_ = false;
+};
@@ -0,0 +1,137 @@
+#include "profiler.h"
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+std::atomic<bool> g_profiling_enabled{ false };
+
+namespace {
+
+struct ProfileEvent {
+    const char* name;
+    int64_t start_ns;
+    int64_t duration_ns;
+    uint32_t thread;
+};
+
+const double kAverageWeight = 0.05;
+
+std::mutex g_mutex;
+std::vector<ProfileStat> g_stats;
+std::unordered_map<const char*, size_t> g_stat_index;
+bool g_capture = false;
+int64_t g_capture_start = 0;
+std::vector<ProfileEvent> g_events;
+std::atomic<uint32_t> g_next_thread{ 0 };
+
+uint32_t ThreadIndex() {
+    thread_local uint32_t index = g_next_thread++;
+    return index;
+}
+
+// mutex held. The same text may sit at different addresses in different files.
+ProfileStat& StatFor(const char* name) {
+    auto found = g_stat_index.find(name);
+    if (found != g_stat_index.end())
+        return g_stats[found->second];
+    size_t index = 0;
+    while (index < g_stats.size() && std::strcmp(g_stats[index].name, name) != 0)
+        index++;
+    if (index == g_stats.size()) {
+        g_stats.push_back(ProfileStat());
+        g_stats.back().name = name;
+    }
+    g_stat_index[name] = index;
+    return g_stats[index];
+}
+
+void WriteJsonString(FILE* file, const char* text) {
+    std::fputc('"', file);
+    for (const char* c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') std::fputc('\\', file);
+        if ((unsigned char)*c >= 0x20) std::fputc(*c, file);
+    }
+    std::fputc('"', file);
+}
+
+}  // namespace
+
+void EnableProfiling(bool enabled, bool capture_events) {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    if (enabled && capture_events && !g_capture) {
+        g_events.clear();
+        g_capture_start = ProfileNow();
+    }
+    g_capture = enabled && capture_events;
+    g_profiling_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+int64_t ProfileNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void RecordProfileEvent(const char* name, int64_t start_ns, int64_t end_ns) {
+    uint32_t thread = ThreadIndex();
+    double ms = (end_ns - start_ns) * 1e-6;
+
+    std::lock_guard<std::mutex> lock(g_mutex);
+    ProfileStat& stat = StatFor(name);
+    stat.average_ms = stat.calls == 0 ? ms : stat.average_ms + kAverageWeight * (ms - stat.average_ms);
+    stat.calls++;
+    stat.total_ms += ms;
+    stat.last_ms = ms;
+    if (ms > stat.max_ms) stat.max_ms = ms;
+
+    if (g_capture)
+        g_events.push_back(ProfileEvent{ name, start_ns, end_ns - start_ns, thread });
+}
+
+std::vector<ProfileStat> GetProfileStats() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_stats;
+}
+
+void ResetProfileStats() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    g_stats.clear();
+    g_stat_index.clear();
+}
+
+size_t CapturedEventCount() {
+    std::lock_guard<std::mutex> lock(g_mutex);
+    return g_events.size();
+}
+
+bool WriteChromeTrace(const std::string& path, std::string* error) {
+    std::vector<ProfileEvent> events;
+    int64_t origin;
+    {
+        std::lock_guard<std::mutex> lock(g_mutex);
+        events = g_events;
+        origin = g_capture_start;
+    }
+
+    FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        if (error) *error = "Cannot write " + path;
+        return false;
+    }
+
+    // Timestamps are microseconds since capture started
+    std::fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for (size_t i = 0; i < events.size(); i++) {
+        const ProfileEvent& e = events[i];
+        std::fprintf(file, "{\"name\":");
+        WriteJsonString(file, e.name);
+        std::fprintf(file, ",\"cat\":\"nbip\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%u}%s\n",
+            (e.start_ns - origin) * 1e-3, e.duration_ns * 1e-3, e.thread, i + 1 < events.size() ? "," : "");
+    }
+    std::fprintf(file, "]}\n");
+
+    bool ok = std::fclose(file) == 0;
+    if (!ok && error) *error = "Cannot write " + path;
+    return ok;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Scoped timers for the engine and the GUI.
+//
+// NBIP_PROFILE_SCOPE("name") times the rest of the enclosing block. While profiling is
+// off a scope costs one relaxed atomic load. While it is on, every finished scope
+// updates a per-name summary (for the live overlay) and, if event capture was requested,
+// is appended to an event list that WriteChromeTrace() saves. Names must outlive the
+// profiler: string literals or StageName().
+
+void EnableProfiling(bool enabled, bool capture_events = false);
+
+extern std::atomic<bool> g_profiling_enabled;
+inline bool ProfilingEnabled() { return g_profiling_enabled.load(std::memory_order_relaxed); }
+
+// Monotonic clock shared by every scope
+int64_t ProfileNow();
+
+void RecordProfileEvent(const char* name, int64_t start_ns, int64_t end_ns);
+
+class ProfileScope {
+public:
+    explicit ProfileScope(const char* name) : name_(ProfilingEnabled() ? name : nullptr) {
+        if (name_) start_ns_ = ProfileNow();
+    }
+    ~ProfileScope() {
+        if (name_) RecordProfileEvent(name_, start_ns_, ProfileNow());
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+private:
+    const char* name_;
+    int64_t start_ns_ = 0;
+};
+
+#define NBIP_PROFILE_CONCAT_(a, b) a##b
+#define NBIP_PROFILE_CONCAT(a, b) NBIP_PROFILE_CONCAT_(a, b)
+#define NBIP_PROFILE_SCOPE(name) ProfileScope NBIP_PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+
+// Timing summary of every scope with one name
+struct ProfileStat {
+    const char* name = nullptr;
+    uint64_t calls = 0;
+    double total_ms = 0.0;
+    double last_ms = 0.0;
+    double average_ms = 0.0;  // exponential moving average over roughly the last 20 calls
+    double max_ms = 0.0;
+};
+
+// Summaries in order of first appearance
+std::vector<ProfileStat> GetProfileStats();
+void ResetProfileStats();
+
+// Writes the captured events as a Chrome trace (chrome://tracing, Perfetto): one complete
+// ("X") event per scope, one row per thread
+bool WriteChromeTrace(const std::string& path, std::string* error = nullptr);
+size_t CapturedEventCount();
@@ -0,0 +1,214 @@
+#include "sobel.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NBIP_X86_SIMD 1
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define NBIP_TARGET(isa) __attribute__((target(isa)))
+#define NBIP_INLINE __attribute__((always_inline)) inline
+#elif defined(_MSC_VER)
+#define NBIP_TARGET(isa)
+#define NBIP_INLINE __forceinline
+#else
+#define NBIP_TARGET(isa)
+#define NBIP_INLINE inline
+#endif
+
+namespace {
+
+// Output rows per parallel task
+const int kBandRows = 32;
+
+// Separable Sobel taps (cv::getDerivKernels): Gx = deriv along x, smooth along y
+struct SobelTaps {
+    int size;
+    int smooth[7];
+    int deriv[7];
+};
+
+SobelTaps MakeTaps(int ksize) {
+    switch (ksize) {
+    case 1:  return { 3, { 0, 1, 0 }, { -1, 0, 1 } };
+    case 3:  return { 3, { 1, 2, 1 }, { -1, 0, 1 } };
+    case 5:  return { 5, { 1, 4, 6, 4, 1 }, { -1, -2, 0, 2, 1 } };
+    default: return { 7, { 1, 6, 15, 20, 15, 6, 1 }, { -1, -4, -5, 0, 5, 4, 1 } };
+    }
+}
+
+int BorderIndex(int i, int n, int border) {
+    if (border == cv::BORDER_REPLICATE)
+        return std::min(std::max(i, 0), n - 1);
+    if (n == 1)
+        return 0;
+    while (i < 0 || i >= n) {
+        if (i < 0) i = -i;
+        if (i >= n) i = 2 * n - 2 - i;
+    }
+    return i;
+}
+
+// Line buffers of one task
+struct SobelLines {
+    std::vector<int> vs, vd;  // vertical smooth / derivative, padded by the radius
+    std::vector<int> gx, gy;
+};
+
+struct RowOutputs {
+    uchar* magnitude;
+    short* dx;
+    short* dy;
+};
+
+// One output row. Every loop runs over contiguous ints with no data-dependent branches,
+// so the compiler vectorizes it for whatever ISA the caller is compiled for.
+template <int K>
+NBIP_INLINE void SobelRowT(const uchar* const* rows, int width, const int* column, const SobelTaps& t,
+                           SobelLines& lines, RowOutputs out, const SobelOptions& options) {
+    const int r = K / 2;
+    int* vs = lines.vs.data();
+    int* vd = lines.vd.data();
+    int* gx = lines.gx.data();
+    int* gy = lines.gy.data();
+
+    for (int x = 0; x < width; x++) {
+        int s = 0, d = 0;
+        for (int i = 0; i < K; i++) {
+            int v = rows[i][x];
+            s += t.smooth[i] * v;
+            d += t.deriv[i] * v;
+        }
+        vs[x + r] = s;
+        vd[x + r] = d;
+    }
+    // Border columns repeat the vertical sums of the columns they map to
+    for (int p = 0; p < r; p++) {
+        vs[p] = vs[column[p] + r];
+        vd[p] = vd[column[p] + r];
+        vs[width + r + p] = vs[column[width + r + p] + r];
+        vd[width + r + p] = vd[column[width + r + p] + r];
+    }
+
+    for (int x = 0; x < width; x++) {
+        int sx = 0, sy = 0;
+        for (int j = 0; j < K; j++) {
+            sx += t.deriv[j] * vs[x + j];
+            sy += t.smooth[j] * vd[x + j];
+        }
+        gx[x] = sx;
+        gy[x] = sy;
+    }
+
+    if (out.dx) {
+        for (int x = 0; x < width; x++)
+            out.dx[x] = (short)std::min(std::max(gx[x], -32768), 32767);
+    }
+    if (out.dy) {
+        for (int x = 0; x < width; x++)
+            out.dy[x] = (short)std::min(std::max(gy[x], -32768), 32767);
+    }
+    if (!out.magnitude)
+        return;
+
+    uchar* m = out.magnitude;
+    if (options.norm == GradientNorm::L1) {
+        // convertScaleAbs saturates to 8 bits; addWeighted rounds halves to even
+        for (int x = 0; x < width; x++) {
+            int a = std::min(std::abs(gx[x]), 255);
+            int b = std::min(std::abs(gy[x]), 255);
+            int sum = a + b;
+            int half = sum >> 1;
+            gx[x] = half + (sum & half & 1);
+        }
+    } else {
+        for (int x = 0; x < width; x++) {
+            float fx = (float)gx[x], fy = (float)gy[x];
+            gx[x] = std::min((int)(std::sqrt(fx * fx + fy * fy) + 0.5f), 255);
+        }
+    }
+    if (options.binary) {
+        const int threshold = options.threshold;
+        for (int x = 0; x < width; x++)
+            m[x] = gx[x] > threshold ? 255 : 0;
+    } else {
+        for (int x = 0; x < width; x++)
+            m[x] = (uchar)gx[x];
+    }
+}
+
+template <int K>
+void SobelRowDefault(const uchar* const* rows, int width, const int* column, const SobelTaps& t,
+                     SobelLines& lines, RowOutputs out, const SobelOptions& options) {
+    SobelRowT<K>(rows, width, column, t, lines, out, options);
+}
+
+#ifdef NBIP_X86_SIMD
+template <int K>
+NBIP_TARGET("avx2")
+void SobelRowAVX2(const uchar* const* rows, int width, const int* column, const SobelTaps& t,
+                  SobelLines& lines, RowOutputs out, const SobelOptions& options) {
+    SobelRowT<K>(rows, width, column, t, lines, out, options);
+}
+#endif
+
+using SobelRowFn = void (*)(const uchar* const*, int, const int*, const SobelTaps&, SobelLines&, RowOutputs,
+                            const SobelOptions&);
+
+template <int K>
+SobelRowFn SelectRow(SimdLevel level) {
+#ifdef NBIP_X86_SIMD
+    if (level == SimdLevel::AVX2)
+        return &SobelRowAVX2<K>;
+#else
+    (void)level;
+#endif
+    return &SobelRowDefault<K>;
+}
+
+}  // namespace
+
+void SobelMagnitude(const cv::Mat& gray, cv::Mat* magnitude, cv::Mat* dx, cv::Mat* dy,
+                    const SobelOptions& options, SimdLevel level) {
+    CV_Assert(gray.type() == CV_8UC1);
+    CV_Assert(options.ksize == 1 || options.ksize == 3 || options.ksize == 5 || options.ksize == 7);
+
+    const SobelTaps taps = MakeTaps(options.ksize);
+    const int radius = taps.size / 2;
+    const int width = gray.cols, height = gray.rows;
+
+    SobelRowFn row_fn = taps.size == 3 ? SelectRow<3>(level)
+                      : taps.size == 5 ? SelectRow<5>(level)
+                                       : SelectRow<7>(level);
+
+    std::vector<int> column(width + 2 * radius);
+    for (int p = 0; p < (int)column.size(); p++)
+        column[p] = BorderIndex(p - radius, width, options.border);
+
+    if (magnitude) magnitude->create(height, width, CV_8UC1);
+    if (dx) dx->create(height, width, CV_16SC1);
+    if (dy) dy->create(height, width, CV_16SC1);
+
+    const int bands = (height + kBandRows - 1) / kBandRows;
+    cv::parallel_for_(cv::Range(0, bands), [&](const cv::Range& range) {
+        SobelLines lines;
+        lines.vs.resize(width + 2 * radius);
+        lines.vd.resize(width + 2 * radius);
+        lines.gx.resize(width);
+        lines.gy.resize(width);
+        const uchar* rows[7];
+
+        int y_end = std::min(height, range.end * kBandRows);
+        for (int y = range.start * kBandRows; y < y_end; y++) {
+            for (int i = 0; i < taps.size; i++)
+                rows[i] = gray.ptr<uchar>(BorderIndex(y - radius + i, height, options.border));
+            RowOutputs out;
+            out.magnitude = magnitude ? magnitude->ptr<uchar>(y) : nullptr;
+            out.dx = dx ? dx->ptr<short>(y) : nullptr;
+            out.dy = dy ? dy->ptr<short>(y) : nullptr;
+            row_fn(rows, width, column.data(), taps, lines, out, options);
+        }
+    });
+}
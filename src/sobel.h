@@ -0,0 +1,31 @@
+#pragma once
+
+#include "pointwise.h"
+#include <opencv2/opencv.hpp>
+
+enum class GradientNorm {
+    L1,  // 0.5 * |Gx| + 0.5 * |Gy| on 8-bit absolute gradients, as the Sobel edge stage always did
+    L2   // sqrt(Gx^2 + Gy^2)
+};
+
+struct SobelOptions {
+    int ksize = 3;                        // aperture: 1, 3, 5 or 7 (1 is an unsmoothed [-1 0 1])
+    GradientNorm norm = GradientNorm::L1;
+    bool binary = false;                  // magnitude output becomes magnitude > threshold ? 255 : 0
+    int threshold = 0;
+    int border = cv::BORDER_REFLECT_101;  // or cv::BORDER_REPLICATE, which cv::Canny uses internally
+};
+
+// Gradients, magnitude and threshold of an 8-bit gray image in one sweep, parallel over
+// row bands. Each output row is built from the input rows under the aperture through
+// two line buffers, so no full-size temporaries are needed. Outputs that are null are
+// not computed:
+//
+//   magnitude  CV_8UC1: the norm of the gradient (or the thresholded map)
+//   dx, dy     CV_16SC1: what cv::Sobel writes for dx=1 and dy=1, ready for the
+//              cv::Canny overload that takes precomputed gradients
+//
+// The L1 magnitude and threshold match the old Sobel -> convertScaleAbs -> addWeighted
+// -> threshold chain bit for bit.
+void SobelMagnitude(const cv::Mat& gray, cv::Mat* magnitude, cv::Mat* dx, cv::Mat* dy,
+                    const SobelOptions& options, SimdLevel level = BestSimdLevel());
@@ -0,0 +1,249 @@
+#include "stream.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct StreamFrame {
+    size_t sequence = 0;      // position among the frames that were not dropped
+    size_t source_index = 0;  // position in the input
+    cv::Mat image;            // empty if processing failed
+};
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+int64_t ElapsedNs(Clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - since).count();
+}
+
+bool IsImagePattern(const std::string& path) {
+    return path.find('%') != std::string::npos;
+}
+
+// The pattern becomes a printf format: exactly one integer conversion (%d or %i, with
+// optional '0' flag and width) and otherwise only literal text and "%%"
+bool ValidFramePattern(const std::string& pattern) {
+    int conversions = 0;
+    for (size_t i = 0; i < pattern.size(); i++) {
+        if (pattern[i] != '%')
+            continue;
+        if (++i < pattern.size() && pattern[i] == '%')
+            continue;
+        while (i < pattern.size() && std::isdigit((unsigned char)pattern[i]))
+            i++;
+        if (i == pattern.size() || (pattern[i] != 'd' && pattern[i] != 'i'))
+            return false;
+        conversions++;
+    }
+    return conversions == 1;
+}
+
+// Only called with patterns ValidFramePattern accepted
+std::string FramePath(const std::string& pattern, size_t index) {
+    char path[4096];
+    std::snprintf(path, sizeof(path), pattern.c_str(), (int)index);
+    return path;
+}
+
+int DefaultFourcc(const std::string& path) {
+    std::string ext = fs::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    if (ext == ".mp4" || ext == ".m4v" || ext == ".mov")
+        return cv::VideoWriter::fourcc('m', 'p', '4', 'v');
+    return cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+}
+
+}  // namespace
+
+bool RunStream(const StreamOptions& options, StreamReport* report, std::string* error) {
+    StreamReport r;
+
+    cv::VideoCapture capture;
+    try {
+        capture.open(options.input);
+    } catch (const cv::Exception&) {
+    }
+    if (!capture.isOpened())
+        return Fail(error, "cannot open '" + options.input + "'");
+
+    int fourcc = 0;
+    if (options.fourcc.empty()) {
+        fourcc = DefaultFourcc(options.output);
+    } else if (options.fourcc.size() == 4) {
+        fourcc = cv::VideoWriter::fourcc(options.fourcc[0], options.fourcc[1], options.fourcc[2], options.fourcc[3]);
+    } else {
+        return Fail(error, "a fourcc has four characters: '" + options.fourcc + "'");
+    }
+
+    r.source_fps = capture.get(cv::CAP_PROP_FPS);
+    const double output_fps = options.fps > 0.0 ? options.fps : (r.source_fps > 0.0 ? r.source_fps : 25.0);
+    const double pace_fps = r.source_fps > 0.0 ? r.source_fps : output_fps;
+    const bool to_video = !options.output.empty() && !IsImagePattern(options.output);
+    if (!options.output.empty() && !to_video && !ValidFramePattern(options.output))
+        return Fail(error, "an output pattern needs exactly one integer conversion such as %06d: '" +
+                           options.output + "'");
+
+    const int hardware_threads = std::max(1, (int)std::thread::hardware_concurrency());
+    const int processors = options.process_threads > 0 ? options.process_threads : hardware_threads;
+
+    BoundedQueue<StreamFrame> decoded(options.queue_capacity);
+    BoundedQueue<StreamFrame> processed(options.queue_capacity);
+
+    std::atomic<size_t> read{0}, dropped{0}, written{0}, failed{0};
+    std::atomic<int64_t> decode_ns{0}, process_ns{0}, encode_ns{0};
+    std::atomic<int> processors_left{processors};
+    std::string encode_error;  // set by the encoder only, read after Wait()
+    std::atomic<bool> aborted{false};
+    std::vector<size_t> frames_per_second;
+
+    Clock::time_point start = Clock::now();
+    ThreadPool pool(1 + processors + 1);
+
+    // Reading is sequential by nature, so a single decoder
+    pool.Submit([&] {
+        size_t sequence = 0;
+        for (size_t index = 0;; index++) {
+            if (options.realtime) {
+                std::this_thread::sleep_until(start + std::chrono::duration_cast<Clock::duration>(
+                    std::chrono::duration<double>(index / pace_fps)));
+            }
+
+            Clock::time_point t0 = Clock::now();
+            StreamFrame frame;
+            bool ok = false;
+            try {
+                NBIP_PROFILE_SCOPE("Decode frame");
+                ok = capture.read(frame.image);
+            } catch (const cv::Exception&) {
+            }
+            decode_ns += ElapsedNs(t0);
+            if (!ok || frame.image.empty()) break;
+
+            read++;
+            frame.sequence = sequence;
+            frame.source_index = index;
+            if (options.realtime) {
+                if (!decoded.TryPush(frame)) {
+                    if (aborted) break;
+                    dropped++;
+                    continue;
+                }
+            } else if (!decoded.Push(frame)) {
+                break;
+            }
+            sequence++;
+        }
+        decoded.Close();
+    });
+
+    for (int i = 0; i < processors; i++) {
+        pool.Submit([&] {
+            Pipeline pipeline;
+            StreamFrame frame;
+            while (decoded.Pop(frame)) {
+                Clock::time_point t0 = Clock::now();
+                try {
+                    // Fresh output per frame (it is queued); intermediates are reused
+                    cv::Mat result;
+                    if (pipeline.Run(frame.image, result, options.params))
+                        frame.image = result;
+                    else
+                        frame.image.release();
+                } catch (const cv::Exception&) {
+                    frame.image.release();
+                }
+                process_ns += ElapsedNs(t0);
+
+                if (!processed.Push(frame)) break;
+            }
+            if (--processors_left == 0) processed.Close();
+        });
+    }
+
+    // Frames finish out of order across the processors; written back in sequence
+    pool.Submit([&] {
+        cv::VideoWriter writer;
+        std::map<size_t, StreamFrame> waiting;
+        size_t next = 0;
+        StreamFrame frame;
+        while (!aborted && processed.Pop(frame)) {
+            waiting[frame.sequence] = frame;
+            for (auto it = waiting.find(next); it != waiting.end(); it = waiting.find(++next)) {
+                cv::Mat image = it->second.image;
+                Clock::time_point t0 = Clock::now();
+                bool ok = !image.empty();
+                if (ok && to_video) {
+                    NBIP_PROFILE_SCOPE("Encode frame");
+                    if (!writer.isOpened()) {
+                        try {
+                            writer.open(options.output, fourcc, output_fps, image.size(), image.channels() != 1);
+                        } catch (const cv::Exception&) {
+                        }
+                        if (!writer.isOpened()) {
+                            encode_error = "cannot open '" + options.output + "' for writing";
+                            aborted = true;
+                            break;
+                        }
+                    }
+                    // Video codecs take 8-bit frames only
+                    ConvertDepth(image, image, CV_8U);
+                    writer.write(image);
+                } else if (ok && !options.output.empty()) {
+                    ok = WriteImage(FramePath(options.output, it->second.source_index), image, options.encoder);
+                }
+                encode_ns += ElapsedNs(t0);
+
+                if (ok) {
+                    written++;
+                    size_t second = (size_t)(ElapsedNs(start) / 1000000000);
+                    if (frames_per_second.size() <= second) frames_per_second.resize(second + 1, 0);
+                    frames_per_second[second]++;
+                } else {
+                    failed++;
+                }
+                waiting.erase(it);
+            }
+        }
+        // On error, unblock the stages upstream
+        decoded.Close();
+        processed.Close();
+        writer.release();
+    });
+
+    pool.Wait();
+
+    r.wall_seconds = ElapsedNs(start) * 1e-9;
+    r.read = read;
+    r.dropped = dropped;
+    r.written = written;
+    r.failed = failed;
+    r.decode = { 1, decode_ns * 1e-9 };
+    r.process = { processors, process_ns * 1e-9 };
+    r.encode = { 1, encode_ns * 1e-9 };
+    // The last second is partial
+    if (frames_per_second.size() > 1)
+        r.slowest_second_fps = (double)*std::min_element(frames_per_second.begin(), frames_per_second.end() - 1);
+    else
+        r.slowest_second_fps = r.FramesPerSecond();
+
+    if (report) *report = r;
+    if (!encode_error.empty())
+        return Fail(error, encode_error);
+    return true;
+}
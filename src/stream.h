@@ -0,0 +1,47 @@
+#pragma once
+
+#include "batch.h"
+#include "export_queue.h"
+#include "pipeline.h"
+#include <string>
+
+struct StreamOptions {
+    // Anything cv::VideoCapture opens: a video file or a numbered image sequence such
+    // as "frames/img_%04d.png"
+    std::string input;
+    // A video file (written with cv::VideoWriter, 8-bit), a printf-style image pattern
+    // such as "out/%06d.png" (one file per frame, numbered by input frame; exactly one
+    // %d, and "%%" for a literal percent sign), or empty to process and discard the frames
+    std::string output;
+    PipelineParams params;
+
+    std::string fourcc;          // video codec, e.g. "MJPG"; empty picks one from the extension
+    double fps = 0.0;            // output frame rate; 0 keeps the input's
+    int process_threads = 0;     // 0: one per hardware thread
+    size_t queue_capacity = 8;   // frames allowed to wait between two stages
+    // Read frames at the source frame rate, like a live camera, and drop the ones that
+    // arrive while the processing queue is full instead of waiting for it
+    bool realtime = false;
+    EncoderOptions encoder;      // image-pattern output
+};
+
+struct StreamReport {
+    size_t read = 0;
+    size_t dropped = 0;          // realtime mode only
+    size_t written = 0;
+    size_t failed = 0;
+    double source_fps = 0.0;     // as reported by the input (0 if unknown)
+    double wall_seconds = 0.0;
+    double slowest_second_fps = 0.0;  // frames written in the slowest whole second
+    BatchStageReport decode;
+    BatchStageReport process;
+    BatchStageReport encode;
+
+    double FramesPerSecond() const { return wall_seconds > 0.0 ? written / wall_seconds : 0.0; }
+};
+
+// Runs decode, the pipeline and encode as overlapped stages: one thread reads frames,
+// process_threads run the chain (frame N + 1 decodes while frame N is processed) and one
+// thread writes them back in order. Stages are connected by bounded queues, so memory
+// stays capped however long the input is.
+bool RunStream(const StreamOptions& options, StreamReport* report = nullptr, std::string* error = nullptr);
@@ -0,0 +1,408 @@
+#include "sweep.h"
+#include "blur.h"
+#include "pipeline_spec.h"
+#include "pixel_kernels.h"
+#include "preview.h"
+#include "profiler.h"
+#include "thread_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+double MsSince(Clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+struct SweepParameter {
+    const char* name;
+    Stage stage;
+    double min, max;
+    bool integer;
+    bool odd;
+    void (*set)(PipelineParams&, double);
+};
+
+// Enables the threshold stage with the method a swept value is read by
+void UseThreshold(PipelineParams& p, int method) {
+    p.threshold = true;
+    p.threshold_method = method;
+}
+
+const SweepParameter kParameters[] = {
+    { "brightness", Stage::BrightnessContrast, -255.0, 255.0, false, false,
+      [](PipelineParams& p, double v) { p.brightness = true; p.brightness_value = (float)v; } },
+    { "contrast", Stage::BrightnessContrast, 0.0, 10.0, false, false,
+      [](PipelineParams& p, double v) { p.contrast = true; p.contrast_value = (float)v; } },
+    { "blur", Stage::Blur, 1.0, kMaxBlurRadius, true, false,
+      [](PipelineParams& p, double v) { p.blur = true; p.blur_radius = (int)v; } },
+    { "value", Stage::Threshold, 0.0, 255.0, true, false,
+      [](PipelineParams& p, double v) { UseThreshold(p, 0); p.threshold_value = (int)v; } },
+    { "block", Stage::Threshold, 3.0, 255.0, true, true,
+      [](PipelineParams& p, double v) { UseThreshold(p, 1); p.block_size = (int)v; } },
+    { "constant", Stage::Threshold, -255.0, 255.0, true, false,
+      [](PipelineParams& p, double v) { UseThreshold(p, 1); p.constant = (int)v; } },
+    { "k", Stage::Threshold, -1.0, 1.0, false, false,
+      [](PipelineParams& p, double v) {
+          UseThreshold(p, 1);
+          if (p.adaptive_mode < static_cast<int>(AdaptiveMode::Sauvola))
+              p.adaptive_mode = static_cast<int>(AdaptiveMode::Sauvola);
+          p.adaptive_k = (float)v;
+      } },
+    { "low", Stage::EdgeDetection, 0.0, 1000.0, true, false,
+      [](PipelineParams& p, double v) { p.edge_detection = true; p.lower_threshold = (int)v; } },
+    { "high", Stage::EdgeDetection, 0.0, 1000.0, true, false,
+      [](PipelineParams& p, double v) { p.edge_detection = p.use_canny = true; p.upper_threshold = (int)v; } },
+    { "kernel", Stage::EdgeDetection, 1.0, 4.0, true, false,
+      [](PipelineParams& p, double v) { p.edge_detection = true; p.kernel_size = (int)v; } },
+};
+
+const SweepParameter* FindParameter(const std::string& name) {
+    for (const SweepParameter& parameter : kParameters) {
+        if (name == parameter.name)
+            return &parameter;
+    }
+    return nullptr;
+}
+
+int AxisStage(const SweepAxis& axis) {
+    return static_cast<int>(FindParameter(axis.name)->stage);
+}
+
+std::string FormatValue(double value) {
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+
+// `p` with every stage outside first..last-1 switched off
+PipelineParams StageRange(PipelineParams p, int first, int last) {
+    for (int i = 0; i < kStageCount; i++) {
+        if (i >= first && i < last) continue;
+        switch (static_cast<Stage>(i)) {
+        case Stage::Grayscale:          p.grayscale = false; break;
+        case Stage::BrightnessContrast: p.brightness = p.contrast = false; break;
+        case Stage::Blur:               p.blur = false; break;
+        case Stage::Threshold:          p.threshold = false; break;
+        default:                        p.edge_detection = false; break;
+        }
+    }
+    return p;
+}
+
+// Runs `params` (unscaled) on a source `scale` times the full image's size; shares
+// `input` when no stage is enabled
+cv::Mat RunStages(const cv::Mat& input, const PipelineParams& params, double scale) {
+    if (!params.AnyEnabled())
+        return input;
+    Pipeline pipeline;
+    cv::Mat output;
+    pipeline.Run(input, output, scale == 1.0 ? params : ScaleParamsForLevel(params, scale));
+    return output;
+}
+
+// Label band under every cell, and the gap around cells
+const int kLabelHeight = 20;
+const int kCellGap = 4;
+
+struct SheetLayout {
+    int columns = 0;
+    int rows = 0;
+    cv::Size cell;  // image plus label
+};
+
+SheetLayout MakeLayout(const SweepResult& result, const std::vector<SweepAxis>& axes, int cell_width, int columns) {
+    SheetLayout layout;
+    const int count = (int)result.variants.size();
+    // Failed variants have no image; any other one gives the cell shape
+    cv::Mat first;
+    for (const SweepVariant& variant : result.variants) {
+        if (!variant.image.empty()) {
+            first = variant.image;
+            break;
+        }
+    }
+    if (first.empty() || cell_width <= 0)
+        return layout;
+    if (axes.size() == 2)
+        columns = (int)axes[1].values.size();
+    else if (columns <= 0)
+        columns = (int)std::ceil(std::sqrt((double)count));
+    layout.columns = std::min(columns, count);
+    layout.rows = (count + layout.columns - 1) / layout.columns;
+    const int height = std::max(1, (int)std::lround((double)cell_width * first.rows / first.cols));
+    layout.cell = cv::Size(cell_width, height + kLabelHeight);
+    return layout;
+}
+
+cv::Rect CellRect(const SheetLayout& layout, int index) {
+    const int column = index % layout.columns, row = index / layout.columns;
+    return cv::Rect(kCellGap + column * (layout.cell.width + kCellGap),
+                    kCellGap + row * (layout.cell.height + kCellGap), layout.cell.width, layout.cell.height);
+}
+
+}  // namespace
+
+std::vector<std::string> SweepParameterNames() {
+    std::vector<std::string> names;
+    for (const SweepParameter& parameter : kParameters)
+        names.push_back(parameter.name);
+    return names;
+}
+
+bool MakeSweepAxis(const std::string& name, double first, double last, double step, SweepAxis& axis,
+                   std::string* error) {
+    const SweepParameter* parameter = FindParameter(name);
+    if (!parameter)
+        return Fail(error, "'" + name + "' cannot be swept");
+    if (!(step > 0.0))
+        return Fail(error, "sweep step of '" + name + "' must be positive");
+
+    const double span = std::abs(last - first);
+    const double count = std::floor(span / step + 1e-9) + 1;
+    if (count > kMaxSweepVariants)
+        return Fail(error, "sweep of '" + name + "' has more than " + std::to_string(kMaxSweepVariants) + " values");
+
+    SweepAxis result;
+    result.name = name;
+    for (int i = 0; i < (int)count; i++) {
+        double value = last >= first ? first + i * step : first - i * step;
+        if (parameter->integer) {
+            if (std::abs(value - std::round(value)) > 1e-9)
+                return Fail(error, "'" + name + "' only takes whole values");
+            value = std::round(value);
+        }
+        if (value < parameter->min || value > parameter->max || (parameter->odd && (int)value % 2 == 0))
+            return Fail(error, "invalid value " + FormatValue(value) + " for '" + name + "'");
+        result.values.push_back(value);
+    }
+    axis = result;
+    return true;
+}
+
+bool ParseSweepAxis(const std::string& text, SweepAxis& axis, std::string* error) {
+    const size_t eq = text.find('=');
+    if (eq == std::string::npos)
+        return Fail(error, "expected name=first:last[:step] in sweep '" + text + "'");
+
+    std::vector<double> numbers;
+    std::istringstream range(text.substr(eq + 1));
+    std::string part;
+    while (std::getline(range, part, ':')) {
+        try {
+            size_t used = 0;
+            numbers.push_back(std::stod(part, &used));
+            if (used != part.size())
+                return Fail(error, "invalid number '" + part + "' in sweep '" + text + "'");
+        } catch (...) {
+            return Fail(error, "invalid number '" + part + "' in sweep '" + text + "'");
+        }
+    }
+    if (numbers.size() < 2 || numbers.size() > 3)
+        return Fail(error, "expected name=first:last[:step] in sweep '" + text + "'");
+    return MakeSweepAxis(text.substr(0, eq), numbers[0], numbers[1], numbers.size() == 3 ? numbers[2] : 1.0,
+                         axis, error);
+}
+
+PipelineParams ApplySweepValue(const PipelineParams& params, const std::string& name, double value) {
+    PipelineParams result = params;
+    if (const SweepParameter* parameter = FindParameter(name))
+        parameter->set(result, value);
+    return result;
+}
+
+double SweepResult::UnsharedMs() const {
+    double total = 0.0;
+    for (const SweepVariant& variant : variants)
+        total += prefix_ms + variant.shared_ms + variant.ms;
+    return total;
+}
+
+SweepResult RunSweep(const cv::Mat& source, const PipelineParams& base, const std::vector<SweepAxis>& axes,
+                     const SweepOptions& options) {
+    NBIP_PROFILE_SCOPE("Sweep");
+    const Clock::time_point start = Clock::now();
+    SweepResult result;
+    if (source.empty() || axes.empty() || axes.size() > 2)
+        return result;
+    size_t count = 1;
+    for (const SweepAxis& axis : axes) {
+        if (!FindParameter(axis.name) || axis.values.empty())
+            return result;
+        count *= axis.values.size();
+    }
+    if (count > kMaxSweepVariants)
+        return result;
+
+    // Row-major: the last axis varies fastest
+    result.variants.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        SweepVariant& variant = result.variants[i];
+        variant.params = base;
+        variant.values.resize(axes.size());
+        size_t rest = i;
+        for (size_t a = axes.size(); a-- > 0;) {
+            variant.values[a] = axes[a].values[rest % axes[a].values.size()];
+            rest /= axes[a].values.size();
+            variant.params = ApplySweepValue(variant.params, axes[a].name, variant.values[a]);
+        }
+    }
+
+    // `outer` is the axis on the earlier stage. Stages before it are shared by every
+    // variant; those from it up to the other axis' stage by the variants of one outer value.
+    const size_t outer = axes.size() == 2 && AxisStage(axes[1]) < AxisStage(axes[0]) ? 1 : 0;
+    const int first_stage = AxisStage(axes[outer]);
+    const int split_stage = axes.size() == 2 ? AxisStage(axes[1 - outer]) : first_stage;
+    const size_t inner_count = axes.size() == 2 ? axes[1].values.size() : 1;
+    auto outer_index = [&](size_t i) { return outer == 0 ? i / inner_count : i % inner_count; };
+    result.shared_stages = first_stage;
+
+    Clock::time_point prefix_start = Clock::now();
+    const cv::Mat prefix = RunStages(source, StageRange(base, 0, first_stage), options.scale);
+    result.prefix_ms = MsSince(prefix_start);
+
+    const int threads = options.threads > 0 ? options.threads : (int)std::max(1u, std::thread::hardware_concurrency());
+    ThreadPool pool(threads);
+
+    // Intermediates of each outer value, from a variant that has it
+    std::vector<cv::Mat> middle(split_stage > first_stage ? axes[outer].values.size() : 0);
+    std::vector<double> middle_ms(middle.size(), 0.0);
+    std::vector<std::string> middle_errors(middle.size());
+    for (size_t i = 0; i < count; i++) {
+        const size_t o = outer_index(i);
+        if (o >= middle.size() || (outer == 0 ? i % inner_count : i / inner_count) != 0)
+            continue;
+        pool.Submit([&, i, o] {
+            NBIP_PROFILE_SCOPE("Sweep shared");
+            Clock::time_point t = Clock::now();
+            try {
+                middle[o] = RunStages(prefix, StageRange(result.variants[i].params, first_stage, split_stage),
+                                      options.scale);
+            } catch (const std::exception& e) {
+                middle_errors[o] = e.what();
+            }
+            middle_ms[o] = MsSince(t);
+        });
+    }
+    pool.Wait();
+
+    for (size_t i = 0; i < count; i++) {
+        pool.Submit([&, i] {
+            NBIP_PROFILE_SCOPE("Sweep variant");
+            SweepVariant& variant = result.variants[i];
+            const size_t o = outer_index(i);
+            const cv::Mat& input = middle.empty() ? prefix : middle[o];
+            if (!middle.empty()) {
+                variant.shared_ms = middle_ms[o];
+                if (!middle_errors[o].empty()) {
+                    variant.error = middle_errors[o];
+                    return;
+                }
+            }
+
+            // One variant failing (out of memory, say) leaves the others intact
+            try {
+                Clock::time_point t = Clock::now();
+                cv::Mat image = RunStages(input, StageRange(variant.params, split_stage, kStageCount), options.scale);
+                variant.ms = MsSince(t);
+
+                if (options.consume)
+                    options.consume(i, image);
+                if (options.thumbnail_width > 0 && image.cols > options.thumbnail_width) {
+                    const int height = std::max(1, (int)std::lround((double)options.thumbnail_width * image.rows / image.cols));
+                    cv::resize(image, variant.image, cv::Size(options.thumbnail_width, height), 0, 0, cv::INTER_AREA);
+                } else {
+                    variant.image = image;
+                }
+            } catch (const std::exception& e) {
+                variant.image.release();
+                variant.error = e.what();
+            }
+        });
+    }
+    pool.Wait();
+
+    result.wall_seconds = MsSince(start) / 1000.0;
+    return result;
+}
+
+std::string SweepLabel(const std::vector<SweepAxis>& axes, const SweepVariant& variant) {
+    std::string label;
+    for (size_t a = 0; a < axes.size() && a < variant.values.size(); a++) {
+        if (!label.empty()) label += ' ';
+        label += axes[a].name + "=" + FormatValue(variant.values[a]);
+    }
+    return label;
+}
+
+cv::Mat ContactSheet(const SweepResult& result, const std::vector<SweepAxis>& axes, int cell_width, int columns) {
+    const SheetLayout layout = MakeLayout(result, axes, cell_width, columns);
+    if (layout.columns == 0)
+        return cv::Mat();
+
+    cv::Mat sheet(kCellGap + layout.rows * (layout.cell.height + kCellGap),
+                  kCellGap + layout.columns * (layout.cell.width + kCellGap), CV_8UC3, cv::Scalar(32, 32, 32));
+    for (int i = 0; i < (int)result.variants.size(); i++) {
+        const SweepVariant& variant = result.variants[i];
+        const cv::Rect cell = CellRect(layout, i);
+        if (!variant.image.empty()) {
+            cv::Mat image;
+            ConvertDepth(variant.image, image, CV_8U);
+            if (image.channels() == 1)
+                cv::cvtColor(image, image, cv::COLOR_GRAY2BGR);
+
+            cv::Mat target = sheet(cv::Rect(cell.x, cell.y, cell.width, cell.height - kLabelHeight));
+            cv::resize(image, target, target.size(), 0, 0, cv::INTER_AREA);
+        }
+        const std::string label = variant.error.empty() ? SweepLabel(axes, variant) : SweepLabel(axes, variant) + " failed";
+        cv::putText(sheet, label, cv::Point(cell.x + 4, cell.br().y - 6),
+                    cv::FONT_HERSHEY_SIMPLEX, 0.4, cv::Scalar(230, 230, 230), 1, cv::LINE_AA);
+    }
+    return sheet;
+}
+
+int ContactSheetCell(const SweepResult& result, const std::vector<SweepAxis>& axes, int cell_width,
+                     cv::Point pt, int columns) {
+    const SheetLayout layout = MakeLayout(result, axes, cell_width, columns);
+    if (layout.columns == 0 || pt.x < kCellGap || pt.y < kCellGap)
+        return -1;
+    const int column = (pt.x - kCellGap) / (layout.cell.width + kCellGap);
+    const int row = (pt.y - kCellGap) / (layout.cell.height + kCellGap);
+    const int index = row * layout.columns + column;
+    if (column >= layout.columns || index >= (int)result.variants.size() || !CellRect(layout, index).contains(pt))
+        return -1;
+    return index;
+}
+
+bool WriteSweepCsv(const std::string& path, const SweepResult& result, const std::vector<SweepAxis>& axes,
+                   std::string* error) {
+    std::ofstream out(path);
+    if (!out)
+        return Fail(error, "cannot write " + path);
+
+    out << "variant";
+    for (const SweepAxis& axis : axes)
+        out << ',' << axis.name;
+    out << ",ms,shared_ms,pipeline\n";
+    for (size_t i = 0; i < result.variants.size(); i++) {
+        const SweepVariant& variant = result.variants[i];
+        out << i;
+        for (double value : variant.values)
+            out << ',' << value;
+        out << ',' << variant.ms << ',' << variant.shared_ms << ",\"" << FormatPipelineSpec(variant.params) << "\"\n";
+    }
+    if (!out)
+        return Fail(error, "cannot write " + path);
+    return true;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "pipeline.h"
+#include <functional>
+#include <string>
+#include <vector>
+
+// Largest number of combinations one sweep evaluates
+const size_t kMaxSweepVariants = 256;
+
+// One swept parameter: a numeric pipeline spec token (see pipeline_spec.h) and the
+// values it takes. Setting a value also enables its stage, and the method that reads it
+// where the stage has several: value selects the binary threshold, block and constant
+// the adaptive one (k also switches Gaussian and mean to Sauvola), and high Canny.
+struct SweepAxis {
+    std::string name;
+    std::vector<double> values;
+};
+
+// Spec tokens that can be swept: brightness, contrast, blur, value, block, constant, k,
+// low, high, kernel
+std::vector<std::string> SweepParameterNames();
+
+// Values first, first + step, ... up to last (counting down if last < first). Fails for
+// unknown names, values outside the parameter's range and non-integer values of integer
+// parameters.
+bool MakeSweepAxis(const std::string& name, double first, double last, double step, SweepAxis& axis,
+                   std::string* error = nullptr);
+
+// "name=first:last[:step]", e.g. "value=60:200:20" (step 1 if omitted)
+bool ParseSweepAxis(const std::string& text, SweepAxis& axis, std::string* error = nullptr);
+
+// `params` with the axis parameter set to `value`
+PipelineParams ApplySweepValue(const PipelineParams& params, const std::string& name, double value);
+
+struct SweepOptions {
+    int threads = 0;           // 0: one per hardware thread
+    double scale = 1.0;        // source size over the full image's (see ScaleParamsForLevel)
+    int thumbnail_width = 0;   // >0: keep results downscaled to this width, 0: full size
+
+    // Called from a worker with every full-size result as soon as it is ready
+    std::function<void(size_t index, const cv::Mat& image)> consume;
+};
+
+struct SweepVariant {
+    PipelineParams params;      // unscaled
+    std::vector<double> values; // one per axis, in the axes' order
+    cv::Mat image;              // result or its thumbnail
+    double ms = 0.0;            // stages of this variant alone
+    double shared_ms = 0.0;     // intermediate shared with the variants of the same outer value
+    std::string error;          // set if this variant failed; `image` is then empty
+};
+
+struct SweepResult {
+    std::vector<SweepVariant> variants;  // row-major: the last axis varies fastest
+    int shared_stages = 0;     // stages computed once for every variant
+    double prefix_ms = 0.0;
+    double wall_seconds = 0.0;
+
+    // Time the variants would have taken run one by one from the source
+    double UnsharedMs() const;
+};
+
+// Evaluates `base` with every combination of one or two axes on `source`.
+//
+// The stages before the first one an axis affects are computed once and every variant
+// starts from their output. With two axes on different stages, the stages between the
+// two are computed once per value of the earlier one. The remaining tails run in
+// parallel on a thread pool, one Pipeline per task. A variant whose evaluation throws is
+// marked with its error and the others still complete.
+SweepResult RunSweep(const cv::Mat& source, const PipelineParams& base, const std::vector<SweepAxis>& axes,
+                     const SweepOptions& options = SweepOptions());
+
+// "value=120" or "blur=3 value=120"
+std::string SweepLabel(const std::vector<SweepAxis>& axes, const SweepVariant& variant);
+
+// 8-bit BGR grid of the variants' images with their labels beneath: one row per value of
+// the first axis with two axes, otherwise `columns` wide (0: about square)
+cv::Mat ContactSheet(const SweepResult& result, const std::vector<SweepAxis>& axes, int cell_width,
+                     int columns = 0);
+
+// Cell of the contact sheet at pixel `pt`, or -1 between cells
+int ContactSheetCell(const SweepResult& result, const std::vector<SweepAxis>& axes, int cell_width,
+                     cv::Point pt, int columns = 0);
+
+// One line per variant: index, the axis values, ms, shared ms and the pipeline spec
+bool WriteSweepCsv(const std::string& path, const SweepResult& result, const std::vector<SweepAxis>& axes,
+                   std::string* error = nullptr);
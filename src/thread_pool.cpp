@@ -0,0 +1,97 @@
+#include "thread_pool.h"
+
+namespace {
+
+// Pool and deque index of the calling worker thread, if it is one
+thread_local const ThreadPool* t_pool = nullptr;
+thread_local int t_index = -1;
+
+}  // namespace
+
+ThreadPool::ThreadPool(int threads) {
+    if (threads < 1) threads = 1;
+    for (int i = 0; i < threads; i++)
+        queues_.push_back(std::make_unique<WorkQueue>());
+    for (int i = 0; i < threads; i++)
+        workers_.emplace_back([this, i] { WorkerLoop(i); });
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    task_ready_.notify_all();
+    for (std::thread& worker : workers_)
+        worker.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_++;
+        queued_++;
+    }
+    int index = t_pool == this ? t_index : (int)(next_queue_++ % queues_.size());
+    {
+        std::lock_guard<std::mutex> lock(queues_[index]->mutex);
+        queues_[index]->tasks.push_back(std::move(task));
+    }
+    task_ready_.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_.wait(lock, [&] { return pending_ == 0; });
+}
+
+bool ThreadPool::TryPop(int index, std::function<void()>& task) {
+    // Own deque first, newest task
+    {
+        WorkQueue& own = *queues_[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    // Then the oldest task of another worker
+    int n = (int)queues_.size();
+    for (int k = 1; k < n; k++) {
+        WorkQueue& victim = *queues_[(index + k) % n];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            steals_.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::WorkerLoop(int index) {
+    t_pool = this;
+    t_index = index;
+
+    for (;;) {
+        std::function<void()> task;
+        if (!TryPop(index, task)) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_ready_.wait(lock, [&] { return stopping_ || queued_ > 0; });
+            if (stopping_ && queued_ == 0) return;  // stopping and drained
+            continue;
+        }
+        queued_--;
+
+        task();
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_--;
+            if (pending_ == 0)
+                idle_.notify_all();
+        }
+    }
+}
@@ -0,0 +1,440 @@
+#include "tiled.h"
+#include "export_queue.h"
+#include "pixel_kernels.h"
+#include "profiler.h"
+#include <algorithm>
+#include <cctype>
+#include <cfloat>
+#include <filesystem>
+#include <fstream>
+
+namespace {
+
+// Bytes per pixel of one strip that can be alive at once while `p` runs on input of
+// `depth`. Every buffer the chain carries is taken as BGR: the strip read, one scratch
+// buffer per stage (the pipeline keeps them between strips) and the result. On top come
+// the workspaces of the enabled stages, sized from what they allocate.
+size_t StripBytesPerPixel(const PipelineParams& p, int depth) {
+    const size_t sample = CV_ELEM_SIZE1(depth);
+    const size_t wide = 3 * sample;
+    const size_t narrow = depth == CV_8U ? 0 : 1;  // 8-bit copies of 16-bit and float data
+
+    size_t bytes = (kStageCount + 2) * wide;
+    if (p.blur)
+        bytes += wide;  // the separable pass's intermediate image
+    if (p.threshold) {
+        bytes += sample + wide + 2 * narrow;  // gray, mask, 8-bit gray and mask
+        if (p.threshold_method == 1)
+            bytes += p.adaptive_mode == 0 ? 4 : 8;  // float local mean, or the CV_32S tables
+        if (p.threshold_method == 2)
+            bytes += wide;  // the main pass runs the threshold between two pipelines
+    }
+    if (p.edge_detection) {
+        bytes += sample + narrow + 1 + 1;  // gray, 8-bit gray, pre-blurred, edge map
+        bytes += 2 * 2;                    // CV_16S gradients
+        if (p.use_canny)
+            bytes += 1 + sizeof(void*);    // Canny's edge map and its worst-case hysteresis stack
+        bytes += p.overlay_edges ? 2 * wide : wide;  // widened input and overlay, or the widened map
+    }
+    return bytes;
+}
+
+bool Fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+std::string LowerExtension(const std::string& path) {
+    std::string ext = std::filesystem::path(path).extension().string();
+    std::transform(ext.begin(), ext.end(), ext.begin(), [](unsigned char c) { return (char)std::tolower(c); });
+    return ext;
+}
+
+bool IsPnm(const std::string& path) {
+    std::string ext = LowerExtension(path);
+    return ext == ".pgm" || ext == ".ppm" || ext == ".pnm";
+}
+
+// PNM stores 16-bit samples big-endian
+void SwapSampleBytes(cv::Mat& rows) {
+    for (int y = 0; y < rows.rows; y++) {
+        ushort* p = rows.ptr<ushort>(y);
+        for (int x = 0; x < rows.cols * rows.channels(); x++)
+            p[x] = (ushort)((p[x] >> 8) | (p[x] << 8));
+    }
+}
+
+bool LittleEndian() {
+    const ushort one = 1;
+    return *(const uchar*)&one == 1;
+}
+
+// Binary PGM (P5) / PPM (P6) with 8- or 16-bit samples, read by seeking to the wanted rows
+class PnmTileReader : public TileReader {
+public:
+    bool Open(const std::string& path, std::string* error) {
+        file_.open(path, std::ios::binary);
+        if (!file_)
+            return Fail(error, "cannot open '" + path + "'");
+
+        std::string magic = Token();
+        int width = std::atoi(Token().c_str());
+        int height = std::atoi(Token().c_str());
+        int maxval = std::atoi(Token().c_str());
+        file_.get();  // single whitespace before the raster
+
+        if ((magic != "P5" && magic != "P6") || width <= 0 || height <= 0 || maxval <= 0 || maxval > 65535 || !file_)
+            return Fail(error, "'" + path + "' is not a binary PGM/PPM file");
+
+        // Samples are taken as they are, without stretching maxval to the depth's range
+        size_ = cv::Size(width, height);
+        type_ = CV_MAKETYPE(maxval > 255 ? CV_16U : CV_8U, magic == "P5" ? 1 : 3);
+        data_offset_ = file_.tellg();
+        return true;
+    }
+
+    cv::Size Size() const override { return size_; }
+    int Type() const override { return type_; }
+    bool Streaming() const override { return true; }
+
+    bool ReadRows(int y, int count, cv::Mat& rows) override {
+        size_t row_bytes = (size_t)size_.width * CV_ELEM_SIZE(type_);
+        rows.create(count, size_.width, type_);
+        file_.clear();
+        file_.seekg(data_offset_ + (std::streamoff)(row_bytes * y));
+        for (int i = 0; i < count; i++) {
+            if (!file_.read((char*)rows.ptr(i), (std::streamsize)row_bytes))
+                return false;
+        }
+        if (CV_MAT_DEPTH(type_) == CV_16U && LittleEndian())
+            SwapSampleBytes(rows);
+        // PPM stores RGB
+        if (CV_MAT_CN(type_) == 3)
+            cv::cvtColor(rows, rows, cv::COLOR_RGB2BGR);
+        return true;
+    }
+
+private:
+    // Next header token, skipping whitespace and '#' comments
+    std::string Token() {
+        std::string token;
+        int c = file_.get();
+        while (c != EOF) {
+            if (c == '#') {
+                while (c != EOF && c != '\n') c = file_.get();
+            } else if (!std::isspace(c)) {
+                break;
+            }
+            c = file_.get();
+        }
+        while (c != EOF && !std::isspace(c)) {
+            token += (char)c;
+            c = file_.get();
+        }
+        if (c != EOF) file_.unget();
+        return token;
+    }
+
+    std::ifstream file_;
+    cv::Size size_;
+    int type_ = CV_8UC1;
+    std::streamoff data_offset_ = 0;
+};
+
+// Fallback for formats OpenCV can only decode as a whole
+class WholeImageTileReader : public TileReader {
+public:
+    bool Open(const std::string& path, std::string* error) {
+        image_ = ReadNativeImage(path);
+        if (image_.empty())
+            return Fail(error, "cannot read '" + path + "'");
+        return true;
+    }
+
+    cv::Size Size() const override { return cv::Size(image_.cols, image_.rows); }
+    int Type() const override { return image_.type(); }
+    bool Streaming() const override { return false; }
+
+    bool ReadRows(int y, int count, cv::Mat& rows) override {
+        rows = image_.rowRange(y, y + count);
+        return true;
+    }
+
+private:
+    cv::Mat image_;
+};
+
+// 8-bit rows are written as 8-bit samples, 16-bit and float ones as 16-bit
+class PnmTileWriter : public TileWriter {
+public:
+    bool Open(const std::string& path, cv::Size size, int type, std::string* error) {
+        file_.open(path, std::ios::binary | std::ios::trunc);
+        if (!file_)
+            return Fail(error, "cannot create '" + path + "'");
+        depth_ = CV_MAT_DEPTH(type) == CV_8U ? CV_8U : CV_16U;
+        file_ << (CV_MAT_CN(type) == 1 ? "P5" : "P6") << "\n" << size.width << " " << size.height << "\n"
+              << (depth_ == CV_8U ? 255 : 65535) << "\n";
+        return (bool)file_;
+    }
+
+    bool Streaming() const override { return true; }
+
+    bool WriteRows(const cv::Mat& rows) override {
+        ConvertDepth(rows, samples_, depth_);
+        if (samples_.channels() == 3) {
+            cv::cvtColor(samples_, rgb_, cv::COLOR_BGR2RGB);
+        } else {
+            samples_.copyTo(rgb_);
+        }
+        if (depth_ == CV_16U && LittleEndian())
+            SwapSampleBytes(rgb_);
+        size_t row_bytes = (size_t)rgb_.cols * rgb_.elemSize();
+        for (int y = 0; y < rgb_.rows; y++)
+            file_.write((const char*)rgb_.ptr(y), (std::streamsize)row_bytes);
+        return (bool)file_;
+    }
+
+    bool Finish() override {
+        file_.flush();
+        return (bool)file_;
+    }
+
+private:
+    std::ofstream file_;
+    cv::Mat samples_;
+    cv::Mat rgb_;
+    int depth_ = CV_8U;
+};
+
+class WholeImageTileWriter : public TileWriter {
+public:
+    WholeImageTileWriter(const std::string& path, cv::Size size, int type)
+        : path_(path), image_(size, type) {}
+
+    bool Streaming() const override { return false; }
+
+    bool WriteRows(const cv::Mat& rows) override {
+        if (next_row_ + rows.rows > image_.rows)
+            return false;
+        cv::Mat target = image_.rowRange(next_row_, next_row_ + rows.rows);
+        rows.copyTo(target);
+        next_row_ += rows.rows;
+        return true;
+    }
+
+    // Converts to the nearest depth the format stores
+    bool Finish() override {
+        return WriteImage(path_, image_, EncoderOptions());
+    }
+
+private:
+    std::string path_;
+    cv::Mat image_;
+    int next_row_ = 0;
+};
+
+// Row range of a strip: `core` rows are kept, `read` rows are processed
+struct Strip {
+    int core_begin, core_end;
+    int read_begin, read_end;
+};
+
+Strip MakeStrip(int y, int strip_rows, int halo, int height) {
+    Strip s;
+    s.core_begin = y;
+    s.core_end = std::min(height, y + strip_rows);
+    s.read_begin = std::max(0, s.core_begin - halo);
+    s.read_end = std::min(height, s.core_end + halo);
+    return s;
+}
+
+}  // namespace
+
+int OtsuThresholdFromHistogram(const double histogram[256]) {
+    double total = 0.0;
+    for (int i = 0; i < 256; i++)
+        total += histogram[i];
+    if (total <= 0.0)
+        return 0;
+
+    double scale = 1.0 / total;
+    double mu = 0.0;
+    for (int i = 0; i < 256; i++)
+        mu += i * histogram[i];
+    mu *= scale;
+
+    double mu1 = 0.0, q1 = 0.0;
+    double max_sigma = 0.0;
+    int max_value = 0;
+    for (int i = 0; i < 256; i++) {
+        double p_i = histogram[i] * scale;
+        mu1 *= q1;
+        q1 += p_i;
+        double q2 = 1.0 - q1;
+
+        if (std::min(q1, q2) < FLT_EPSILON || std::max(q1, q2) > 1.0 - FLT_EPSILON)
+            continue;
+
+        mu1 = (mu1 + i * p_i) / q1;
+        double mu2 = (mu - q1 * mu1) / q2;
+        double sigma = q1 * q2 * (mu1 - mu2) * (mu1 - mu2);
+        if (sigma > max_sigma) {
+            max_sigma = sigma;
+            max_value = i;
+        }
+    }
+    return max_value;
+}
+
+std::unique_ptr<TileReader> OpenTileReader(const std::string& path, std::string* error) {
+    if (IsPnm(path)) {
+        auto reader = std::make_unique<PnmTileReader>();
+        if (reader->Open(path, error))
+            return reader;
+        return nullptr;
+    }
+    auto reader = std::make_unique<WholeImageTileReader>();
+    if (reader->Open(path, error))
+        return reader;
+    return nullptr;
+}
+
+std::unique_ptr<TileWriter> CreateTileWriter(const std::string& path, cv::Size size, int type, std::string* error) {
+    if (IsPnm(path)) {
+        auto writer = std::make_unique<PnmTileWriter>();
+        if (writer->Open(path, size, type, error))
+            return writer;
+        return nullptr;
+    }
+    return std::make_unique<WholeImageTileWriter>(path, size, type);
+}
+
+bool RunTiled(const std::string& input, const std::string& output, const PipelineParams& params,
+              const TiledOptions& options, TiledReport* report, std::string* error) {
+    std::unique_ptr<TileReader> reader = OpenTileReader(input, error);
+    if (!reader)
+        return false;
+
+    const cv::Size size = reader->Size();
+    const int input_channels = CV_MAT_CN(reader->Type());
+    TiledReport r;
+    r.image_size = size;
+
+    Pipeline pipeline;
+    cv::Mat strip, result;
+
+    const int depth = CV_MAT_DEPTH(reader->Type());
+    const size_t row_bytes = (size_t)size.width * StripBytesPerPixel(params, depth);
+    auto strip_rows_for = [&](int halo) {
+        int64 budget_rows = (int64)(options.memory_limit / row_bytes);
+        return (int)std::max<int64>(1, std::min<int64>(size.height, budget_rows - 2 * halo));
+    };
+
+    // One output row plus the halo is the smallest strip; refuse rather than exceed the
+    // limit. The Otsu pre-pass stops before the threshold, so it never needs more.
+    const size_t min_bytes = (size_t)(1 + 2 * PipelineHalo(params)) * row_bytes;
+    if (min_bytes > options.memory_limit) {
+        return Fail(error, "memory limit of " + std::to_string(options.memory_limit >> 20) +
+                               " MB is below the " + std::to_string((min_bytes + (1 << 20) - 1) >> 20) +
+                               " MB a single strip of '" + input + "' needs");
+    }
+
+    // Otsu splits the chain at the threshold: the stages before it, the threshold at the
+    // level the pre-pass found, and the edge stage
+    const bool otsu = params.threshold && params.threshold_method == 2;
+    PipelineParams prefix = params;
+    prefix.threshold = false;
+    prefix.edge_detection = false;
+    PipelineParams suffix;
+    suffix.edge_detection = params.edge_detection;
+    suffix.use_canny = params.use_canny;
+    suffix.lower_threshold = params.lower_threshold;
+    suffix.upper_threshold = params.upper_threshold;
+    suffix.kernel_size = params.kernel_size;
+    suffix.overlay_edges = params.overlay_edges;
+    suffix.edge_norm = params.edge_norm;
+
+    // Otsu pre-pass: histogram of the threshold stage's gray input, strip by strip
+    if (otsu) {
+        const int prefix_halo = PipelineHalo(prefix);
+        const int prefix_rows = strip_rows_for(prefix_halo);
+
+        double histogram[256] = {};
+        cv::Mat gray;
+        for (int y = 0; y < size.height; y += prefix_rows) {
+            Strip s = MakeStrip(y, prefix_rows, prefix_halo, size.height);
+            if (!reader->ReadRows(s.read_begin, s.read_end - s.read_begin, strip))
+                return Fail(error, "read error in '" + input + "'");
+            pipeline.Run(strip, result, prefix);
+
+            cv::Mat core = result.rowRange(s.core_begin - s.read_begin, s.core_end - s.read_begin);
+            if (core.channels() == 3)
+                cv::cvtColor(core, gray, cv::COLOR_BGR2GRAY);
+            else
+                gray = core;
+            // Otsu runs on an 8-bit copy at any depth, as in the threshold stage
+            ConvertDepth(gray, gray, CV_8U);
+            for (int row = 0; row < gray.rows; row++) {
+                const uchar* p = gray.ptr(row);
+                for (int x = 0; x < gray.cols; x++)
+                    histogram[p[x]]++;
+            }
+        }
+
+        r.otsu_prepass = true;
+        r.otsu_threshold = OtsuThresholdFromHistogram(histogram);
+    }
+
+    r.halo = PipelineHalo(params);
+    r.strip_rows = strip_rows_for(r.halo);
+    r.estimated_peak_bytes = (size_t)(r.strip_rows + 2 * r.halo) * row_bytes;
+
+    int output_type = CV_MAKETYPE(depth, PipelineOutputChannels(params, input_channels));
+    std::unique_ptr<TileWriter> writer = CreateTileWriter(output, size, output_type, error);
+    if (!writer)
+        return false;
+    r.streaming = reader->Streaming() && writer->Streaming();
+
+    Pipeline edge_pipeline;
+    cv::Mat gray, mask;
+    for (int y = 0; y < size.height; y += r.strip_rows) {
+        Strip s = MakeStrip(y, r.strip_rows, r.halo, size.height);
+        {
+            NBIP_PROFILE_SCOPE("Read strip");
+            if (!reader->ReadRows(s.read_begin, s.read_end - s.read_begin, strip))
+                return Fail(error, "read error in '" + input + "'");
+        }
+        if (!otsu) {
+            pipeline.Run(strip, result, params);
+        } else {
+            pipeline.Run(strip, result, prefix);
+            if (result.channels() == 3)
+                cv::cvtColor(result, gray, cv::COLOR_BGR2GRAY);
+            else
+                gray = result;
+            // The whole-image stage thresholds an 8-bit copy, so a pixel passes where it
+            // rounds to above the level; in the strip's own depth that is half an 8-bit
+            // step higher (257 t + 128.5 for 16-bit)
+            cv::threshold(gray, mask, (r.otsu_threshold + 0.5) * DepthScale(depth), DepthMax(depth),
+                          cv::THRESH_BINARY);
+            if (result.channels() == 3)
+                cv::cvtColor(mask, mask, cv::COLOR_GRAY2BGR);
+            if (suffix.edge_detection)
+                edge_pipeline.Run(mask, result, suffix);
+            else
+                result = mask;
+        }
+
+        cv::Mat core = result.rowRange(s.core_begin - s.read_begin, s.core_end - s.read_begin);
+        NBIP_PROFILE_SCOPE("Write strip");
+        if (!writer->WriteRows(core))
+            return Fail(error, "write error in '" + output + "'");
+        r.strips++;
+    }
+
+    if (!writer->Finish())
+        return Fail(error, "cannot finish '" + output + "'");
+
+    if (report) *report = r;
+    return true;
+}
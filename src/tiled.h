@@ -0,0 +1,71 @@
+#pragma once
+
+#include "pipeline.h"
+#include <memory>
+#include <string>
+
+// Otsu's threshold for a 256-bin histogram, computed exactly like cv::threshold's
+// THRESH_OTSU so a tiled pre-pass picks the same value as a whole-image run
+int OtsuThresholdFromHistogram(const double histogram[256]);
+
+// Source of image rows. Binary PGM/PPM files (8- or 16-bit) are read row by row
+// without loading the whole image; other formats fall back to decoding the whole file
+// in its own depth (ReadNativeImage).
+class TileReader {
+public:
+    virtual ~TileReader() = default;
+    virtual cv::Size Size() const = 0;
+    virtual int Type() const = 0;
+    // Reads rows [y, y + count) into `rows` (1 or 3 channels, BGR order, 8-bit, 16-bit or float)
+    virtual bool ReadRows(int y, int count, cv::Mat& rows) = 0;
+    // False if the reader had to hold the whole image in memory
+    virtual bool Streaming() const = 0;
+};
+
+// Sink for image rows, written strictly top to bottom. Binary PGM/PPM output is
+// streamed to disk (16-bit for 16-bit and float rows); other formats are assembled in
+// memory and written with WriteImage, in the nearest depth the format stores.
+class TileWriter {
+public:
+    virtual ~TileWriter() = default;
+    virtual bool WriteRows(const cv::Mat& rows) = 0;
+    virtual bool Finish() = 0;
+    virtual bool Streaming() const = 0;
+};
+
+std::unique_ptr<TileReader> OpenTileReader(const std::string& path, std::string* error = nullptr);
+std::unique_ptr<TileWriter> CreateTileWriter(const std::string& path, cv::Size size, int type,
+                                             std::string* error = nullptr);
+
+struct TiledOptions {
+    // Bytes of pixel data alive at once: strips, stage buffers and stage workspaces
+    size_t memory_limit = size_t(512) << 20;
+};
+
+struct TiledReport {
+    cv::Size image_size;
+    int halo = 0;
+    int strip_rows = 0;        // output rows per strip
+    int strips = 0;
+    size_t estimated_peak_bytes = 0;
+    bool streaming = true;     // false if input or output had to be held whole
+    bool otsu_prepass = false;
+    int otsu_threshold = 0;
+};
+
+// Streams `input` through the chain in full-width strips and writes `output` strip by
+// strip. Each strip is read with the halo its neighbourhood stages need (blur kernel,
+// adaptive threshold block, Sobel/Canny aperture), processed, and only its core rows are
+// written, so results match a whole-image run. The strip height follows from
+// `memory_limit`; it fails if even a one-row strip and its halo would not fit.
+//
+// Otsu needs the histogram of the whole thresholded input: a pre-pass runs the stages
+// before the threshold strip by strip and accumulates the histogram of their 8-bit gray
+// copy. The main pass thresholds at the resulting level in the strip's own depth, where
+// a pixel passes exactly when its 8-bit copy would, as in a whole-image run.
+//
+// Canny's hysteresis can follow an edge arbitrarily far; an extra margin keeps seams
+// invisible in practice, but tiled Canny output is not guaranteed bit-identical. Neither is
+// a recursive Gaussian blur (large radii): its response is cut at the halo.
+bool RunTiled(const std::string& input, const std::string& output, const PipelineParams& params,
+              const TiledOptions& options, TiledReport* report = nullptr, std::string* error = nullptr);
@@ -0,0 +1,184 @@
+#include "viewport.h"
+#include "histogram.h"
+#include "profiler.h"
+#include "tiled.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Coarsest level ever used; a 1:4096 view of any real image
+const int kMaxViewportLevel = 12;
+
+// Otsu's histogram is taken from the pyramid level covering this size
+const cv::Size kOtsuSampleSize(1024, 1024);
+
+// Source pixels shown in place of a tile that isn't computed yet
+void FillFromSource(const cv::Mat& source, cv::Mat target) {
+    if (source.channels() == target.channels())
+        source.copyTo(target);
+    else if (target.channels() == 1)
+        cv::cvtColor(source, target, cv::COLOR_BGR2GRAY);
+    else
+        cv::cvtColor(source, target, cv::COLOR_GRAY2BGR);
+}
+
+}  // namespace
+
+int ViewportLevel(double zoom) {
+    if (zoom >= 1.0 || zoom <= 0.0)
+        return 0;
+    return std::min(kMaxViewportLevel, (int)std::floor(std::log2(1.0 / zoom)));
+}
+
+ViewportEvaluator::ViewportEvaluator(size_t cache_bytes) : max_bytes_(cache_bytes) {}
+
+void ViewportEvaluator::SetSource(const cv::Mat& image) {
+    pyramid_.SetSource(image);
+    lru_.clear();
+    index_.clear();
+    bytes_ = 0;
+    has_otsu_ = false;
+    display_.release();
+    pending_ = 0;
+}
+
+bool ViewportEvaluator::Lookup(const TileKey& key, cv::Mat& image) {
+    auto found = index_.find(key);
+    if (found == index_.end())
+        return false;
+    lru_.splice(lru_.begin(), lru_, found->second);
+    image = found->second->image;
+    return true;
+}
+
+void ViewportEvaluator::Store(const TileKey& key, const cv::Mat& image) {
+    size_t bytes = image.total() * image.elemSize();
+    if (bytes > max_bytes_) return;
+
+    lru_.push_front(Tile{ key, image, bytes });
+    index_[key] = lru_.begin();
+    bytes_ += bytes;
+    while (bytes_ > max_bytes_) {
+        Tile& oldest = lru_.back();
+        bytes_ -= oldest.bytes;
+        index_.erase(oldest.key);
+        lru_.pop_back();
+        stats_.evictions++;
+    }
+}
+
+cv::Mat ViewportEvaluator::ComputeTile(const cv::Mat& level_image, const cv::Rect& tile, const PipelineParams& params) {
+    NBIP_PROFILE_SCOPE("Viewport tile");
+    // Neighbourhood stages are symmetric: the halo applies to columns as well as rows
+    const int halo = PipelineHalo(params);
+    cv::Rect read(tile.x - halo, tile.y - halo, tile.width + 2 * halo, tile.height + 2 * halo);
+    read &= cv::Rect(0, 0, level_image.cols, level_image.rows);
+
+    cv::Mat result;
+    pipeline_.Run(level_image(read), result, params);
+    return result(tile - read.tl()).clone();
+}
+
+PipelineParams ViewportEvaluator::ResolveOtsu(const PipelineParams& params) {
+    if (!params.threshold || params.threshold_method != 2)
+        return params;
+
+    PipelineParams prefix = params;
+    prefix.threshold = false;
+    prefix.edge_detection = false;
+    uint64_t key = HashParams(prefix);
+    if (!has_otsu_ || key != otsu_key_) {
+        const cv::Mat& sample = pyramid_.Level(pyramid_.LevelFor(kOtsuSampleSize));
+        cv::Mat gray;
+        pipeline_.Run(sample, gray, ScaleParamsForLevel(prefix, (double)sample.cols / pyramid_.Level(0).cols));
+
+        Histogram histogram;
+        ComputeHistogram(gray, histogram);
+        double bins[256];
+        for (int v = 0; v < 256; v++)
+            bins[v] = (double)histogram.luma[v];
+        otsu_threshold_ = OtsuThresholdFromHistogram(bins);
+        otsu_key_ = key;
+        has_otsu_ = true;
+    }
+
+    PipelineParams resolved = params;
+    resolved.threshold_method = 0;
+    resolved.threshold_value = otsu_threshold_;
+    return resolved;
+}
+
+bool ViewportEvaluator::Update(const PipelineParams& params, const cv::Rect& region, double zoom, double budget_ms) {
+    if (pyramid_.LevelCount() == 0)
+        return false;
+
+    const int level = ViewportLevel(zoom);
+    const cv::Mat& image = pyramid_.Level(level);
+    const double scale = (double)image.cols / pyramid_.Level(0).cols;
+
+    // Whole level pixels covering the region
+    cv::Rect rect(cv::Point((int)std::floor(region.x * scale), (int)std::floor(region.y * scale)),
+                  cv::Point((int)std::ceil(region.br().x * scale), (int)std::ceil(region.br().y * scale)));
+    rect &= cv::Rect(0, 0, image.cols, image.rows);
+    if (rect.empty())
+        return false;
+
+    const PipelineParams level_params = ScaleParamsForLevel(ResolveOtsu(params), scale);
+    const uint64_t key = HashParams(level_params);
+    const bool moved = display_.empty() || key != display_key_ || level != level_ || rect != level_region_;
+    if (!moved && pending_ == 0)
+        return false;
+
+    // A fresh buffer: the presenter tells changes apart by the buffer it was given
+    const int type = CV_MAKETYPE(image.depth(), PipelineOutputChannels(level_params, image.channels()));
+    cv::Mat display(rect.size(), type);
+
+    const Clock::time_point start = Clock::now();
+    bool computed = false;
+    int pending = 0;
+    for (int ty = rect.y / kViewportTileSize; ty <= (rect.br().y - 1) / kViewportTileSize; ty++) {
+        for (int tx = rect.x / kViewportTileSize; tx <= (rect.br().x - 1) / kViewportTileSize; tx++) {
+            cv::Rect tile(tx * kViewportTileSize, ty * kViewportTileSize, kViewportTileSize, kViewportTileSize);
+            tile &= cv::Rect(0, 0, image.cols, image.rows);
+            const cv::Rect visible = tile & rect;
+            cv::Mat target = display(visible - rect.tl());
+
+            const TileKey tile_key{ key, level, tx, ty };
+            cv::Mat pixels;
+            if (Lookup(tile_key, pixels)) {
+                stats_.tiles_reused++;
+            } else {
+                double elapsed_ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+                if (computed && elapsed_ms > budget_ms) {
+                    FillFromSource(image(visible), target);
+                    pending++;
+                    continue;
+                }
+                pixels = ComputeTile(image, tile, level_params);
+                Store(tile_key, pixels);
+                stats_.tiles_computed++;
+                computed = true;
+            }
+            pixels(visible - tile.tl()).copyTo(target);
+        }
+    }
+
+    display_ = display;
+    display_key_ = key;
+    level_ = level;
+    level_scale_ = scale;
+    level_region_ = rect;
+    pending_ = pending;
+    return true;
+}
+
+ViewportStats ViewportEvaluator::Stats() const {
+    ViewportStats stats = stats_;
+    stats.cached_tiles = lru_.size();
+    stats.cached_bytes = bytes_;
+    return stats;
+}
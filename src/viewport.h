@@ -0,0 +1,105 @@
+#pragma once
+
+#include "preview.h"
+#include <cstdint>
+#include <list>
+#include <map>
+#include <tuple>
+
+const size_t kDefaultViewportCacheBytes = size_t(256) << 20;
+
+// Side of a cached tile, in pixels of its pyramid level
+const int kViewportTileSize = 256;
+
+struct ViewportStats {
+    uint64_t tiles_computed = 0;
+    uint64_t tiles_reused = 0;
+    uint64_t evictions = 0;
+    size_t cached_tiles = 0;
+    size_t cached_bytes = 0;
+};
+
+// Pyramid level a view at `zoom` (screen pixels per full-resolution pixel) is evaluated
+// at: the coarsest one that still has a pixel for every screen pixel, 0 from 1:1 up
+int ViewportLevel(double zoom);
+
+// Evaluates the chain for the visible part of a zoomed view only.
+//
+// The pyramid level matching the zoom is split into fixed tiles. A visible tile is
+// computed from its own pixels plus the halo every enabled stage needs (blur radius,
+// adaptive block, Sobel/Canny aperture), so at level 0 it matches the whole-image result,
+// except with Canny (see below). Coarser levels scale the neighbourhood sizes like
+// ProgressivePreview's proxies. Tiles
+// are cached by level, position and parameters (least recently used out past the byte
+// budget), so panning back, or returning to earlier settings, recomputes nothing.
+//
+// Otsu's threshold comes from a small level of the whole image, since one tile's
+// histogram is not the image's. Canny's hysteresis is global: it gets the same extra
+// margin as tiled runs (see RunTiled), but edges connected to a weak chain beyond that
+// margin can still come out differently, so Canny tiles are approximate at any level.
+// So are tiles of a recursive Gaussian blur (large radii), whose response is cut at the
+// halo (see BlurHalo).
+class ViewportEvaluator {
+public:
+    explicit ViewportEvaluator(size_t cache_bytes = kDefaultViewportCacheBytes);
+
+    // Drops every cached tile
+    void SetSource(const cv::Mat& image);
+
+    // Brings the view of `region` (full-resolution pixels) at `zoom` up to date. Missing
+    // tiles are computed until `budget_ms` has passed (at least one per call); the rest
+    // show the unprocessed source until a later call. Returns true if Display() changed.
+    bool Update(const PipelineParams& params, const cv::Rect& region, double zoom, double budget_ms = 25.0);
+
+    // The region at the resolution of Level(). A new buffer whenever it changes.
+    const cv::Mat& Display() const { return display_; }
+    int Level() const { return level_; }
+    // Level pixels per full-resolution pixel, and the level pixels Display() covers
+    double LevelScale() const { return level_scale_; }
+    cv::Rect LevelRegion() const { return level_region_; }
+    // Visible tiles still showing the source
+    int Pending() const { return pending_; }
+
+    ViewportStats Stats() const;
+
+private:
+    struct TileKey {
+        uint64_t params;
+        int level, x, y;
+        bool operator<(const TileKey& o) const {
+            return std::tie(params, level, y, x) < std::tie(o.params, o.level, o.y, o.x);
+        }
+    };
+
+    struct Tile {
+        TileKey key;
+        cv::Mat image;
+        size_t bytes;
+    };
+
+    bool Lookup(const TileKey& key, cv::Mat& image);
+    void Store(const TileKey& key, const cv::Mat& image);
+    cv::Mat ComputeTile(const cv::Mat& level_image, const cv::Rect& tile, const PipelineParams& params);
+    PipelineParams ResolveOtsu(const PipelineParams& params);
+
+    size_t max_bytes_;
+    ImagePyramid pyramid_;
+    Pipeline pipeline_;  // tiles run one at a time and reuse its scratch buffers
+
+    std::list<Tile> lru_;  // most recently used first
+    std::map<TileKey, std::list<Tile>::iterator> index_;
+    size_t bytes_ = 0;
+    ViewportStats stats_;
+
+    // Otsu's threshold for the stages before the threshold, as hashed in otsu_key_
+    bool has_otsu_ = false;
+    uint64_t otsu_key_ = 0;
+    int otsu_threshold_ = 0;
+
+    cv::Mat display_;
+    uint64_t display_key_ = 0;
+    int level_ = 0;
+    double level_scale_ = 1.0;
+    cv::Rect level_region_;
+    int pending_ = 0;
+};